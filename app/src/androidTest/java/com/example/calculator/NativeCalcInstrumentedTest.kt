@@ -2,10 +2,13 @@ package com.example.calculator
 
 import androidx.test.ext.junit.runners.AndroidJUnit4
 import androidx.test.platform.app.InstrumentationRegistry
+import org.junit.Assert.assertArrayEquals
 import org.junit.Assert.assertEquals
+import org.junit.Assert.assertTrue
 import org.junit.Assert.fail
 import org.junit.Test
 import org.junit.runner.RunWith
+import java.io.File
 
 @RunWith(AndroidJUnit4::class)
 class NativeCalcInstrumentedTest {
@@ -49,5 +52,496 @@ class NativeCalcInstrumentedTest {
             // expected
         }
     }
-}
 
+    @Test
+    fun testSessionChainsAnsAndVariables() {
+        val session = Native.createSession()
+        try {
+            assertEquals("Result: 12", Native.evaluateInSession(session, "3*4"))
+            Native.storeVariable(session, "A")
+            assertEquals("Result: 13", Native.evaluateInSession(session, "Ans+1"))
+            assertEquals("Result: 25", Native.evaluateInSession(session, "A+Ans"))
+            Native.memoryAdd(session, false)
+            assertEquals("25", Native.recallVariable(session, "M"))
+        } finally {
+            Native.destroySession(session)
+        }
+    }
+
+    @Test
+    fun testScientificNotationLiterals() {
+        assertEquals("Result: 0.0025", Native.parseExpression("2.5e-3"))
+        assertEquals("Result: 2000", Native.parseExpression("1E+3*2"))
+        assertEquals("Result: 6.02e23", Native.parseExpression("6.02e23"))
+        assertEquals("Result: 3", Native.parseExpression("1.5e300*2e-300"))
+        // An exponent needs at least one digit
+        assertEquals("Error: Invalid number: 1e", Native.parseExpression("1e"))
+        assertEquals("Error: Invalid number: 1e+", Native.parseExpression("1e+"))
+        assertEquals("Error: Invalid number: 1e5.5", Native.parseExpression("1e5.5"))
+    }
+
+    @Test
+    fun testUnknownVariableIsAnError() {
+        assertEquals("Error: Unknown variable: foo", Native.parseExpression("foo+1"))
+    }
+
+    @Test
+    fun testExactModeKeepsFractions() {
+        val session = Native.createSession()
+        try {
+            Native.setExactMode(session, true)
+            assertEquals("Result: 1/3", Native.evaluateInSession(session, "1/3"))
+            assertEquals("Result: 1", Native.evaluateInSession(session, "Ans*3"))
+            assertEquals("Result: 7/12", Native.evaluateInSession(session, "1/3+1/4"))
+        } finally {
+            Native.destroySession(session)
+        }
+    }
+
+    @Test
+    fun testNonIntegerPowersAndLogs() {
+        assertEquals("Result: 1.41421356237309504880168872421", Native.parseExpression("2^0.5"))
+        assertEquals("Result: 1.08933674416168773873009472195", Native.parseExpression("2^0.12345"))
+        assertEquals("Result: 2.30258509299404568401799145468", Native.parseExpression("ln(10)"))
+        assertEquals("Result: 3", Native.parseExpression("log(1000)"))
+    }
+
+    @Test
+    fun testRootsAtWorkingPrecision() {
+        // Perfect powers come back exact
+        assertEquals("Result: 12", Native.parseExpression("sqrt(144)"))
+        assertEquals("Result: 12345678901234567890",
+            Native.parseExpression("sqrt(152415787532388367501905199875019052100)"))
+        assertEquals("Result: 10", Native.parseExpression("1000^(1/3)"))
+        assertEquals("Result: 2", Native.parseExpression("32^0.2"))
+        assertEquals("Result: 0.01", Native.parseExpression("sqrt(0.0001)"))
+        // Irrational roots are correctly rounded to 30 digits
+        assertEquals("Result: 2.82842712474619009760337744842", Native.parseExpression("sqrt(8)"))
+        assertEquals("Result: 1.25992104989487316476721060728", Native.parseExpression("2^(1/3)"))
+        assertEquals("Result: 1.10408951367381233764950538762", Native.parseExpression("2^(1/7)"))
+        // Odd roots of negatives are real; even ones are principal complex roots
+        assertEquals("Result: -3", Native.parseExpression("(0-27)^(1/3)"))
+        assertEquals("Result: 2i", Native.parseExpression("sqrt(0-4)"))
+        assertEquals("Result: 1.41421356237309504880168872421+1.41421356237309504880168872421i",
+            Native.parseExpression("(0-16)^(1/4)"))
+        // Zero has no negative powers and there is no 0th root
+        assertEquals("Error: 0 to negative power is undefined", Native.parseExpression("0^(0-1)"))
+        assertEquals("Error: 0 to negative power is undefined", Native.parseExpression("0^(0-0.5)"))
+        assertEquals("Error: Division by zero", Native.parseExpression("8^(1/0)"))
+    }
+
+    @Test
+    fun testComplexFunctions() {
+        assertEquals("Result: -1125899906842624", Native.parseExpression("(1+i)^100"))
+        assertEquals("Result: 2+i", Native.parseExpression("sqrt(3+4*i)"))
+        assertEquals("Result: -1", Native.parseExpression("exp(i*pi)"))
+        assertEquals("Result: 3.14159265358979323846264338328i", Native.parseExpression("ln(0-1)"))
+    }
+
+    @Test
+    fun testAsyncEvaluationPreemptsStaleWork() {
+        val session = Native.createSession()
+        try {
+            // 100000 square roots at 30 digits: well over a second of work
+            val staleStates = ArrayList<Int>()
+            val staleListener = object : EvaluationListener {
+                override fun onProgress(task: Long, percent: Int) {}
+                override fun onComplete(task: Long, state: Int, result: String) {
+                    synchronized(staleStates) { staleStates.add(state) }
+                }
+            }
+            val stale = Native.submitEvaluation(session, "Σ(X^0.5,X,1,100000)", staleListener)
+            while (Native.evaluationState(stale) == Native.EVALUATION_PENDING) Thread.sleep(1)
+            assertEquals(Native.EVALUATION_RUNNING, Native.evaluationState(stale))
+
+            val fresh = Native.submitEvaluation(session, "6*7", null)
+            assertEquals("Result: 42", Native.awaitEvaluation(fresh, 10000))
+            assertEquals("", Native.awaitEvaluation(stale, 10000))
+            assertEquals(Native.EVALUATION_CANCELLED, Native.evaluationState(stale))
+            synchronized(staleStates) { assertEquals(listOf(Native.EVALUATION_CANCELLED), staleStates) }
+            assertEquals(100, Native.evaluationProgress(fresh))
+            Native.releaseEvaluation(stale)
+            Native.releaseEvaluation(fresh)
+        } finally {
+            Native.destroySession(session)
+        }
+    }
+
+    @Test
+    fun testProgressiveEvaluationRefinesAns() {
+        val session = Native.createSession()
+        try {
+            val fast = Native.submitProgressiveEvaluation(session, "sqrt(2)", 12, null)
+            assertEquals("Result: 1.41421356237", Native.awaitEvaluation(fast, 10000))
+            val refined = Native.submitRefinement(session, 30, null)
+            assertEquals("Result: 1.41421356237309504880168872421", Native.awaitEvaluation(refined, 10000))
+            Native.releaseEvaluation(fast)
+            Native.releaseEvaluation(refined)
+            // Integer digits beyond the 12 computed are not padded with zeros
+            val large = Native.submitProgressiveEvaluation(session, "(1+i)^100", 12, null)
+            assertEquals("Result: -1.12589990684e15", Native.awaitEvaluation(large, 10000))
+            val exact = Native.submitRefinement(session, 30, null)
+            assertEquals("Result: -1125899906842624", Native.awaitEvaluation(exact, 10000))
+            Native.releaseEvaluation(large)
+            Native.releaseEvaluation(exact)
+        } finally {
+            Native.destroySession(session)
+        }
+    }
+
+    @Test
+    fun testRepeatedEvaluationReusesCompiledProgram() {
+        val session = Native.createSession()
+        try {
+            Native.evaluateInSession(session, "3")
+            Native.storeVariable(session, "X")
+            assertEquals("Result: 10.5", Native.evaluateInSession(session, "X^2+X/2"))
+            Native.evaluateInSession(session, "4")
+            Native.storeVariable(session, "X")
+            assertEquals("Result: 18", Native.evaluateInSession(session, "X^2+X/2"))
+            assertEquals("Result: 0.25", Native.evaluateInSession(session, "sin(pi/6)*sin(pi/6)"))
+        } finally {
+            Native.destroySession(session)
+        }
+    }
+
+    @Test
+    fun testRepeatedPrimitivesHitTheCache() {
+        Native.clearCache()
+        assertEquals("Result: 1.08933674416168773873009472195", Native.parseExpression("2^0.12345"))
+        assertEquals("Result: 1.08933674416168773873009472195", Native.parseExpression("2^0.12345"))
+        val statistics = Native.cacheStatistics()
+        assertTrue(statistics[0] >= 1)
+        assertTrue(statistics[3] >= 1)
+    }
+
+    @Test
+    fun testCancellingDecimalsGiveZero() {
+        assertEquals("Result: 0", Native.parseExpression("0.5-0.5"))
+        assertEquals("Result: 0", Native.parseExpression("0.000*5"))
+        assertEquals("Result: -2.25", Native.parseExpression("1.5*(0-1.5)"))
+    }
+
+    @Test
+    fun testSnapshotRestoresSessionValues() {
+        val path = InstrumentationRegistry.getInstrumentation().targetContext.cacheDir.absolutePath + "/test.snapshot"
+        val saved = Native.createSession()
+        try {
+            Native.evaluateInSession(saved, "7")
+            Native.storeVariable(saved, "A")
+            Native.evaluateInSession(saved, "A*log(2)")
+            // Compiled but failed: not saved with the programs
+            assertEquals("Error: Division by zero", Native.evaluateInSession(saved, "A/0"))
+            assertTrue(Native.saveSnapshot(saved, path))
+        } finally {
+            Native.destroySession(saved)
+        }
+        val restored = Native.createSession()
+        try {
+            assertTrue(Native.loadSnapshot(restored, path))
+            assertEquals("7", Native.recallVariable(restored, "A"))
+            assertEquals("Result: 14", Native.evaluateInSession(restored, "A*2"))
+            assertEquals("Result: 2.107209969647868366496172263068", Native.evaluateInSession(restored, "A*log(2)"))
+            assertEquals("Error: Division by zero", Native.evaluateInSession(restored, "A/0"))
+            assertTrue(!Native.loadSnapshot(restored, "$path.missing"))
+        } finally {
+            Native.destroySession(restored)
+        }
+    }
+
+    @Test
+    fun testComplexProductsAreExact() {
+        assertEquals("Result: 13-0.375i", Native.parseExpression("(1.5+2*i)*(3-4.25*i)"))
+        assertEquals("Result: -0.2+0.4i", Native.parseExpression("(1+2*i)/(3-4*i)"))
+        assertEquals("Result: 5.25+5i", Native.parseExpression("(2.5+i)^2"))
+    }
+
+    @Test
+    fun testLargeIndependentSubtreesAgree() {
+        // Both products have over 20000 digits and take milliseconds each; on
+        // multi-core devices they are evaluated on different threads
+        val before = Native.parallelEvaluations()
+        assertEquals("Result: 123", Native.parseExpression("(123^5000*321^4000)/(321^4000*123^4999)"))
+        assertEquals("Result: 0", Native.parseExpression("(123^5000*321^4000)-(321^4000*123^4999*123)"))
+        val forked = Native.parallelEvaluations() - before
+        if (Runtime.getRuntime().availableProcessors() > 1) assertEquals(2L, forked) else assertEquals(0L, forked)
+    }
+
+    @Test
+    fun testTransformSizedPowersAgree() {
+        // 3^16000 has over 7600 digits: the last squarings go through the
+        // number-theoretic transform, on both sides differently
+        assertEquals("Result: 0", Native.parseExpression("(3^1000)^16-(9^1000)^8"))
+    }
+
+    @Test
+    fun testLargeIntegerExponents() {
+        assertEquals("Result: 22015.4560485521986457014565817", Native.parseExpression("1.0001^100000"))
+        assertEquals("Result: 9.04981730636080030139640266771e3010299", Native.parseExpression("2^10000000"))
+        assertEquals("Result: 0.0009765625", Native.parseExpression("2^(0-10)"))
+        assertEquals("Result: 23.909", Native.parseExpression("23.9090^1"))
+        // Powers of decimals keep the working precision, not the noise of
+        // the base's last digit
+        assertEquals("Result: 2", Native.parseExpression("sqrt(2)^2"))
+        assertEquals("Result: 2.82842712474619009760337744842", Native.parseExpression("sqrt(2)^3"))
+        assertEquals("Result: 4.32194237515066200915728819889", Native.parseExpression("1.05^30"))
+        // Real quotients of 477000-digit powers divide directly, without
+        // squaring the divisor; exact when they terminate, otherwise rounded
+        assertEquals("Result: 5.56263209915712886588211486263e-477122", Native.parseExpression("1/3^1000000"))
+        assertEquals("Result: 0.333333333333333333333333333333", Native.parseExpression("1/3"))
+        assertEquals("Result: 0.0390625", Native.parseExpression("5/128"))
+        assertEquals("Result: 3", Native.parseExpression("3^1000000/3^999999"))
+        assertEquals("Result: 5.56263209915712886588211486263e-477122", Native.parseExpression("3^(0-1000000)"))
+    }
+
+    @Test
+    fun testDisplayFormats() {
+        val session = Native.createSession()
+        try {
+            Native.setDisplayFormat(session, Native.DISPLAY_NORM1, 0)
+            assertEquals("Result: 1.2676506e30", Native.evaluateInSession(session, "2^100"))
+            assertEquals("Result: 0.25", Native.evaluateInSession(session, "1/4"))
+            assertEquals("Result: 5e-3", Native.evaluateInSession(session, "1/200"))
+            Native.setDisplayFormat(session, Native.DISPLAY_NORM2, 0)
+            assertEquals("Result: 0.005", Native.evaluateInSession(session, "1/200"))
+            Native.setDisplayFormat(session, Native.DISPLAY_FIX, 2)
+            assertEquals("Result: 100.00", Native.evaluateInSession(session, "99.995"))
+            Native.setDisplayFormat(session, Native.DISPLAY_SCI, 5)
+            assertEquals("Result: 1.2340e3", Native.evaluateInSession(session, "1234"))
+            Native.setDisplayFormat(session, Native.DISPLAY_ENG, 0)
+            assertEquals("Result: 500e-3", Native.evaluateInSession(session, "1/2"))
+            // Exact fractions stay fractions while they fit the display
+            Native.setExactMode(session, true)
+            Native.setDisplayFormat(session, Native.DISPLAY_NORM1, 0)
+            assertEquals("Result: 16/63", Native.evaluateInSession(session, "1/7+1/9"))
+            try {
+                Native.setDisplayFormat(session, Native.DISPLAY_FIX, 10)
+                fail("Fix 10 accepted")
+            } catch (e: IllegalArgumentException) {
+                // Expected
+            }
+        } finally {
+            Native.destroySession(session)
+        }
+    }
+
+    @Test
+    fun testIntegerFunctions() {
+        assertEquals("Result: 120", Native.parseExpression("10nCr3"))
+        assertEquals("Result: 720", Native.parseExpression("10nPr3"))
+        assertEquals("Result: 64", Native.parseExpression("2^3!"))
+        assertEquals("Result: 6", Native.parseExpression("gcd(12,18)"))
+        assertEquals("Result: 36", Native.parseExpression("lcm(12,18)"))
+        assertEquals("Result: 999000", Native.parseExpression("1000!/998!"))
+        assertTrue(Native.parseExpression("3.5!").startsWith("Error:"))
+    }
+
+    @Test
+    fun testSumsAndProducts() {
+        // Closed form and binary splitting: a million terms in milliseconds
+        assertEquals("Result: 333333833333500000", Native.parseExpression("sum(X^2,X,1,1000000)"))
+        assertEquals("Result: 2.71828182845904523536028747135", Native.parseExpression("Σ(1/X!,X,0,1000000)"))
+        assertEquals("Result: 2432902008176640000", Native.parseExpression("prod(X,X,1,20)"))
+        assertTrue(Native.parseExpression("sum(X,X,5,1)").startsWith("Error:"))
+        // Term by term: every term at the working precision plus guard
+        // digits, whether or not its neighbours are exact, then rounded
+        assertEquals("Result: 0.813969634073166187818855918116", Native.parseExpression("Σ(sin(X),X,1,1000)"))
+        assertEquals("Result: 37.2385281385281385281385281385", Native.parseExpression("Σ(abs(12/X),X,1,12)"))
+        assertEquals("Result: 14.3927267228657236313811274932", Native.parseExpression("Σ(1/X,X,1,1000000)"))
+        assertEquals("Result: 11", Native.parseExpression("prod(1+1/X,X,1,10)"))
+        val session = Native.createSession()
+        try {
+            Native.evaluateInSession(session, "3")
+            Native.storeVariable(session, "A")
+            assertEquals("Result: 165", Native.evaluateInSession(session, "sum(A*X,X,1,10)"))
+        } finally {
+            Native.destroySession(session)
+        }
+    }
+
+    @Test
+    fun testHistoryEditRecalculatesDependents() {
+        val session = Native.createSession()
+        try {
+            Native.evaluateInSession(session, "2+3")
+            Native.storeVariable(session, "A")
+            Native.evaluateInSession(session, "7")
+            Native.evaluateInSession(session, "A*10")
+            assertEquals("Ans→A", Native.historyExpression(session, 1))
+            // Only the entries reading the edited one through A change
+            assertTrue(intArrayOf(0, 1, 3).contentEquals(Native.editHistory(session, 0, "1+3")))
+            assertEquals("40", Native.historyResult(session, 3))
+            assertEquals("4", Native.recallVariable(session, "A"))
+            assertEquals("40", Native.recallVariable(session, "Ans"))
+            try {
+                Native.editHistory(session, 0, "1/0")
+                fail("Failed edit accepted")
+            } catch (e: ArithmeticException) {
+                // Expected, and nothing changed
+            }
+            assertEquals("1+3", Native.historyExpression(session, 0))
+            assertEquals(4, Native.historySize(session))
+        } finally {
+            Native.destroySession(session)
+        }
+    }
+
+    @Test
+    fun testResourceBudgetStopsRunawayEvaluations() {
+        val session = Native.createSession()
+        val unbudgeted = Native.createSession()
+        try {
+            // Towers are rounded, not stopped, under the default budget
+            assertEquals("Result: 4.28124773175747048036987115931e369693099", Native.evaluateInSession(unbudgeted, "9^9^9"))
+            // Results another session left in the shared cache are charged too
+            assertTrue(Native.evaluateInSession(unbudgeted, "2^10000").startsWith("Result: 1995063116880758"))
+            assertTrue(Native.evaluateInSession(unbudgeted, "1000!").startsWith("Result: 4023872600770937"))
+            Native.setResourceBudget(session, 1000, 0, 0)
+            assertTrue(Native.evaluateInSession(session, "2^10000").startsWith("Error: Digit budget exceeded"))
+            assertTrue(Native.evaluateInSession(session, "1000!").startsWith("Error: Digit budget exceeded"))
+            assertEquals("Result: 7", Native.evaluateInSession(session, "7"))
+            Native.setResourceBudget(session, 0, 0, 100)
+            val task = Native.submitEvaluation(session, "sum(sin(X),X,1,10000000)", null)
+            assertTrue(Native.awaitEvaluation(task, 10000)!!.startsWith("Error: Time budget exceeded"))
+            assertEquals(Native.EVALUATION_OVER_BUDGET, Native.evaluationState(task))
+            Native.releaseEvaluation(task)
+            // The session is untouched by the aborted evaluation
+            assertEquals("7", Native.recallVariable(session, "Ans"))
+        } finally {
+            Native.destroySession(unbudgeted)
+            Native.destroySession(session)
+        }
+    }
+
+    @Test
+    fun testTrigonometryReducesHugeArgumentsAndAngleUnits() {
+        val session = Native.createSession()
+        try {
+            assertEquals("Result: -0.852200849767188801772705893753", Native.evaluateInSession(session, "sin(10^22)"))
+            assertEquals("Result: -0.789672493429310082710289539917", Native.evaluateInSession(session, "sin(10^50)"))
+            Native.setAngleUnit(session, Native.ANGLE_DEGREES)
+            assertEquals("Result: 0.5", Native.evaluateInSession(session, "sin(30)"))
+            assertEquals("Result: 0", Native.evaluateInSession(session, "cos(90)"))
+            assertEquals("Result: 0.5", Native.evaluateInSession(session, "sin(36*10^49+30)"))
+            assertTrue(Native.evaluateInSession(session, "tan(90)").startsWith("Error:"))
+            assertEquals("Result: 30", Native.evaluateInSession(session, "asin(0.5)"))
+            Native.setAngleUnit(session, Native.ANGLE_GRADIANS)
+            assertEquals("Result: 1", Native.evaluateInSession(session, "sin(100)"))
+            // Same argument, different unit: the cached radian result is not reused
+            Native.setAngleUnit(session, Native.ANGLE_RADIANS)
+            assertEquals("Result: -0.988031624092861789987748907294", Native.evaluateInSession(session, "sin(30)"))
+        } finally {
+            Native.destroySession(session)
+        }
+    }
+
+    @Test
+    fun testTabulateSweepsXWithoutTouchingSlots() {
+        val session = Native.createSession()
+        try {
+            Native.evaluateInSession(session, "7")
+            Native.evaluateInSession(session, "3")
+            Native.storeVariable(session, "A")
+            // Compiled to machine code
+            val squares = Native.tabulate(session, "X^2+A", 0.0, 0.5, 5)
+            assertArrayEquals(doubleArrayOf(3.0, 3.25, 4.0, 5.25, 7.0), squares, 1e-12)
+            val reciprocals = Native.tabulate(session, "1/X", -1.0, 1.0, 3)
+            assertTrue(reciprocals[1].isNaN())
+            // Odd roots of negative bases, as the decimal engine takes them
+            assertArrayEquals(doubleArrayOf(-2.0, 1.0), Native.tabulate(session, "X^(1/3)", -8.0, 9.0, 2), 1e-12)
+            assertArrayEquals(doubleArrayOf(-2.0, 1.0), Native.tabulate(session, "X^0.2", -32.0, 33.0, 2), 1e-12)
+            assertArrayEquals(doubleArrayOf(4.0, 0.0), Native.tabulate(session, "X^(2/3)", -8.0, 8.0, 2), 1e-12)
+            assertTrue(Native.tabulate(session, "X^0.5", -4.0, 1.0, 1)[0].isNaN())
+            Native.setAngleUnit(session, Native.ANGLE_DEGREES)
+            assertArrayEquals(doubleArrayOf(0.0, 0.5, 1.0, 0.5, 0.0),
+                Native.tabulate(session, "sin(X)", 0.0, 30.0, 7).sliceArray(listOf(0, 1, 3, 5, 6)), 1e-15)
+            // No double form: evaluated decimally
+            assertArrayEquals(doubleArrayOf(1.0, 1.0, 2.0, 6.0), Native.tabulate(session, "X!", 0.0, 1.0, 4), 0.0)
+            assertEquals("Result: 3", Native.evaluateInSession(session, "Ans"))
+            assertEquals("0", Native.recallVariable(session, "X"))
+        } finally {
+            Native.destroySession(session)
+        }
+    }
+
+    @Test
+    fun testStoDShowsRecurringDecimals() {
+        val session = Native.createSession()
+        try {
+            Native.setExactMode(session, true)
+            Native.setDisplayFormat(session, Native.DISPLAY_NORM1, 0)
+            assertEquals("Result: 1/7", Native.evaluateInSession(session, "1/7"))
+            assertEquals("Result: 0.1\u03054\u03052\u03058\u03055\u03057\u0305",
+                Native.displayAnswer(session, Native.ANSWER_RECURRING))
+            assertEquals("Result: 0.1428571429", Native.displayAnswer(session, Native.ANSWER_DECIMAL))
+            Native.evaluateInSession(session, "7/12")
+            assertEquals("Result: 0.583\u0305", Native.displayAnswer(session, Native.ANSWER_RECURRING))
+            // Terminating decimals and periods too long for the display have none
+            Native.evaluateInSession(session, "1/8")
+            assertEquals("", Native.displayAnswer(session, Native.ANSWER_RECURRING))
+            Native.evaluateInSession(session, "1/97")
+            assertEquals("", Native.displayAnswer(session, Native.ANSWER_RECURRING))
+            assertEquals("Result: 1/97", Native.displayAnswer(session, Native.ANSWER_STANDARD))
+        } finally {
+            Native.destroySession(session)
+        }
+    }
+
+    @Test
+    fun testFactorAnswer() {
+        val session = Native.createSession()
+        try {
+            Native.evaluateInSession(session, "2^5*3^2*1000003")
+            assertEquals("Result: 2^5*3^2*1000003", Native.factorAnswer(session))
+            Native.evaluateInSession(session, "1/2")
+            assertTrue(Native.factorAnswer(session).startsWith("Error:"))
+        } finally {
+            Native.destroySession(session)
+        }
+    }
+
+    @Test
+    fun testFactorAnswerSplitsLargeSemiprimes() {
+        val session = Native.createSession()
+        try {
+            // Two 15-digit primes: out of rho's reach, found by ECM
+            Native.evaluateInSession(session, "905630240715784126864832981537")
+            assertEquals("Result: 838298935230947*1080318968156971", Native.factorAnswer(session))
+            // 2^128+1 is beyond 2^127, on three-word residues
+            Native.evaluateInSession(session, "2^128+1")
+            assertEquals("Result: 59649589127497217*5704689200685129054721", Native.factorAnswer(session))
+            // Factors close to the square root, and a square
+            Native.evaluateInSession(session, "18446744073709551533*18446744073709551557")
+            assertEquals("Result: 18446744073709551533*18446744073709551557", Native.factorAnswer(session))
+            Native.evaluateInSession(session, "10000000000000000051^2")
+            assertEquals("Result: 10000000000000000051^2", Native.factorAnswer(session))
+        } finally {
+            Native.destroySession(session)
+        }
+    }
+
+    @Test
+    fun testTraceCapturesEvaluations() {
+        val path = InstrumentationRegistry.getInstrumentation().targetContext.cacheDir.absolutePath + "/test.trace"
+        File(path).delete()
+        assertTrue(Native.startTrace(path))
+        val session = Native.createSession()
+        try {
+            Native.evaluateInSession(session, "2^64+1")
+            Native.factorAnswer(session)
+            assertEquals("Result: 6", Native.parseExpression("3!"))
+        } finally {
+            Native.destroySession(session)
+            Native.stopTrace()
+        }
+        val header = File(path).length()
+        assertTrue(header > 9)
+        // Appending keeps the existing records; anything else is refused
+        assertTrue(Native.startTrace(path))
+        Native.parseExpression("1+1")
+        Native.stopTrace()
+        assertTrue(File(path).length() > header)
+        File(path).writeText("not a trace")
+        assertTrue(!Native.startTrace(path))
+    }
+}
@@ -0,0 +1,176 @@
+#include "async_eval.h"
+#include "governor.h"
+#include <algorithm>
+#include <chrono>
+#include <android/log.h>
+
+#define LOG_TAG "CalculatorAsync"
+#define LOGD(...) __android_log_print(ANDROID_LOG_DEBUG, LOG_TAG, __VA_ARGS__)
+
+using namespace std;
+
+// Evaluations are mostly independent sessions or preempted retries, so a
+// couple of workers is enough; more would only compete with the UI thread
+static const size_t MAX_WORKERS = 4;
+
+EvaluationTask::EvaluationTask(CalcSession* session, EvaluationWork work)
+    : session(session), work(std::move(work)), currentState(EVALUATION_PENDING), completed(false) {}
+
+EvaluationState EvaluationTask::state() const {
+    lock_guard<mutex> guard(lock);
+    return currentState;
+}
+
+string EvaluationTask::result() const {
+    lock_guard<mutex> guard(lock);
+    return output;
+}
+
+bool EvaluationTask::wait(long timeoutMs) const {
+    unique_lock<mutex> guard(lock);
+    auto done = [this] { return completed; };
+    if (timeoutMs < 0) {
+        finished.wait(guard, done);
+        return true;
+    }
+    return finished.wait_for(guard, chrono::milliseconds(timeoutMs), done);
+}
+
+void EvaluationTask::run() {
+    {
+        lock_guard<mutex> guard(lock);
+        currentState = EVALUATION_RUNNING;
+    }
+    CancellationScope scope(&token);
+    try {
+        checkCancelled();
+        string value = work();
+        token.reportProgress(100);
+        finish(EVALUATION_DONE, "Result: " + value);
+    } catch (const CancelledError&) {
+        LOGD("Evaluation cancelled");
+        finish(EVALUATION_CANCELLED, "");
+    } catch (const BudgetExceededError& e) {
+        LOGD("Evaluation stopped: %s", e.what());
+        finish(EVALUATION_OVER_BUDGET, "Error: " + string(e.what()));
+    } catch (const exception& e) {
+        finish(EVALUATION_FAILED, "Error: " + string(e.what()));
+    }
+}
+
+void EvaluationTask::finish(EvaluationState finalState, string text) {
+    {
+        lock_guard<mutex> guard(lock);
+        currentState = finalState;
+        output = std::move(text);
+    }
+    // Waiters are released only after the callback, so nothing of the task
+    // runs once wait() has returned
+    if (onComplete) onComplete(*this);
+    {
+        lock_guard<mutex> guard(lock);
+        completed = true;
+    }
+    finished.notify_all();
+}
+
+EvaluationPool::EvaluationPool(size_t workerCount) : stopping(false) {
+    for (size_t i = 0; i < workerCount; i++) {
+        workers.emplace_back(&EvaluationPool::workerLoop, this);
+    }
+}
+
+EvaluationPool::~EvaluationPool() {
+    {
+        lock_guard<mutex> guard(lock);
+        stopping = true;
+        for (auto& task : active) task->cancel();
+    }
+    available.notify_all();
+    for (thread& worker : workers) worker.join();
+}
+
+shared_ptr<EvaluationTask> EvaluationPool::submit(CalcSession* session, const string& expression,
+                                                  function<void(int)> onProgress,
+                                                  EvaluationCallback onComplete) {
+    return submit(session, [session, expression] { return session->evaluateForDisplay(expression); },
+                  std::move(onProgress), std::move(onComplete));
+}
+
+shared_ptr<EvaluationTask> EvaluationPool::submit(CalcSession* session, EvaluationWork work,
+                                                  function<void(int)> onProgress,
+                                                  EvaluationCallback onComplete) {
+    auto task = make_shared<EvaluationTask>(session, std::move(work));
+    task->token.setProgressListener(std::move(onProgress));
+    task->onComplete = std::move(onComplete);
+    vector<shared_ptr<EvaluationTask>> dropped;
+    {
+        lock_guard<mutex> guard(lock);
+        // Older work on the same session is stale now
+        dropped = cancelLocked(session);
+        active.push_back(task);
+        queue.push_back(task);
+    }
+    available.notify_one();
+    for (auto& stale : dropped) stale->finish(EVALUATION_CANCELLED, "");
+    return task;
+}
+
+void EvaluationPool::cancelSession(CalcSession* session) {
+    vector<shared_ptr<EvaluationTask>> dropped;
+    vector<shared_ptr<EvaluationTask>> running;
+    {
+        lock_guard<mutex> guard(lock);
+        dropped = cancelLocked(session);
+        for (auto& task : active) {
+            if (task->session == session) running.push_back(task);
+        }
+    }
+    for (auto& stale : dropped) stale->finish(EVALUATION_CANCELLED, "");
+    for (auto& task : running) task->wait(-1);
+}
+
+// Caller holds the pool lock. Cancels the session's tasks and takes the ones
+// that have not started out of the queue; the caller finishes those after
+// unlocking, since completion callbacks may call back into the pool
+vector<shared_ptr<EvaluationTask>> EvaluationPool::cancelLocked(CalcSession* session) {
+    vector<shared_ptr<EvaluationTask>> dropped;
+    for (auto& task : active) {
+        if (task->session == session) task->cancel();
+    }
+    for (auto it = queue.begin(); it != queue.end();) {
+        if ((*it)->session == session) {
+            dropped.push_back(*it);
+            active.erase(find(active.begin(), active.end(), *it));
+            it = queue.erase(it);
+        } else {
+            ++it;
+        }
+    }
+    return dropped;
+}
+
+void EvaluationPool::workerLoop() {
+    for (;;) {
+        shared_ptr<EvaluationTask> task;
+        {
+            unique_lock<mutex> guard(lock);
+            available.wait(guard, [this] { return stopping || !queue.empty(); });
+            if (queue.empty()) return;
+            task = std::move(queue.front());
+            queue.pop_front();
+        }
+
+        // Cancelled tasks still go through run() so their waiters and
+        // callbacks see the final state
+        task->run();
+
+        lock_guard<mutex> guard(lock);
+        active.erase(find(active.begin(), active.end(), task));
+    }
+}
+
+EvaluationPool& evaluationPool() {
+    static EvaluationPool pool(max<size_t>(1, min<size_t>(MAX_WORKERS, thread::hardware_concurrency() / 2)));
+    return pool;
+}
@@ -0,0 +1,110 @@
+#pragma once
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "cancellation.h"
+#include "session.h"
+
+// Lifecycle of an asynchronous evaluation
+enum EvaluationState {
+    EVALUATION_PENDING,
+    EVALUATION_RUNNING,
+    EVALUATION_DONE,
+    EVALUATION_FAILED,
+    EVALUATION_CANCELLED,
+    EVALUATION_OVER_BUDGET  // Stopped by its ResourceBudget; the result says which
+};
+
+class EvaluationTask;
+
+// Called once the task has finished, failed or been cancelled: on the worker
+// thread that ran it, or - for a task still queued when a newer submission or
+// cancelSession() dropped it - on the thread that made that call, before it
+// returns
+using EvaluationCallback = std::function<void(EvaluationTask&)>;
+
+// Work run by a task: returns Ans as displayed, throws on errors
+using EvaluationWork = std::function<std::string()>;
+
+// Handle to one submitted evaluation; doubles as a pollable future
+class EvaluationTask {
+public:
+    EvaluationTask(CalcSession* session, EvaluationWork work);
+
+    EvaluationState state() const;
+    int progress() const { return token.progress(); }
+
+    // "Result: ..." or "Error: ..." in the same form as evaluateInSession;
+    // empty until the task has finished
+    std::string result() const;
+
+    // Block until the task has finished; false if the timeout ran out first.
+    // A negative timeout waits indefinitely
+    bool wait(long timeoutMs) const;
+
+    // Ask the task to stop; a running evaluation stops at its next
+    // cancellation check and leaves the session untouched
+    void cancel() { token.cancel(); }
+
+private:
+    friend class EvaluationPool;
+
+    void run();
+    void finish(EvaluationState finalState, std::string text);
+
+    CalcSession* const session;
+    const EvaluationWork work;
+    CancellationToken token;
+    EvaluationCallback onComplete;
+
+    mutable std::mutex lock;
+    mutable std::condition_variable finished;
+    EvaluationState currentState;
+    std::string output;
+    bool completed; // Final state set and callback returned
+};
+
+// Fixed set of worker threads evaluating session expressions off the caller's
+// thread. Submitting to a session cancels that session's older tasks, so a new
+// keystroke preempts stale work instead of queueing behind it
+class EvaluationPool {
+public:
+    explicit EvaluationPool(size_t workerCount);
+    ~EvaluationPool();
+
+    EvaluationPool(const EvaluationPool&) = delete;
+    EvaluationPool& operator=(const EvaluationPool&) = delete;
+
+    std::shared_ptr<EvaluationTask> submit(CalcSession* session, const std::string& expression,
+                                           std::function<void(int)> onProgress,
+                                           EvaluationCallback onComplete);
+
+    // Any other work on the session (progressive evaluation, refinement),
+    // with the same preemption rule
+    std::shared_ptr<EvaluationTask> submit(CalcSession* session, EvaluationWork work,
+                                           std::function<void(int)> onProgress,
+                                           EvaluationCallback onComplete);
+
+    // Cancel every task of the session and wait until none of them runs, so
+    // the session can be destroyed
+    void cancelSession(CalcSession* session);
+
+private:
+    void workerLoop();
+    std::vector<std::shared_ptr<EvaluationTask>> cancelLocked(CalcSession* session);
+
+    std::mutex lock;
+    std::condition_variable available;
+    std::deque<std::shared_ptr<EvaluationTask>> queue;
+    std::vector<std::shared_ptr<EvaluationTask>> active; // Queued or running
+    std::vector<std::thread> workers;
+    bool stopping;
+};
+
+// Process-wide pool sized to the device, created on first use
+EvaluationPool& evaluationPool();
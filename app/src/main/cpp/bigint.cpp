@@ -0,0 +1,703 @@
+#include "bigint.h"
+#include "governor.h"
+#include "ntt.h"
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include <string>
+#include <vector>
+using namespace std;
+
+typedef vector<uint32_t> Limbs;
+
+static const int KARATSUBA_THRESHOLD = 48; // Limbs; below this schoolbook wins
+static const size_t NTT_THRESHOLD = 400;    // Limbs; above this the transform wins
+
+// Limb storage a product of this many limbs holds at its peak: the result
+// plus Karatsuba's partial sums and products (the transforms charge their own)
+static size_t productBytes(size_t limbs) {
+    return 3 * limbs * sizeof(uint32_t);
+}
+
+BigInt::BigInt(long long value) : negative(value < 0) {
+    unsigned long long magnitude = negative ? 0ULL - (unsigned long long)value : (unsigned long long)value;
+    while (magnitude > 0) {
+        limbs.push_back((uint32_t)(magnitude % BASE));
+        magnitude /= BASE;
+    }
+}
+
+BigInt::BigInt(const string& digits) : negative(false) {
+    size_t start = 0;
+    if (!digits.empty() && (digits[0] == '-' || digits[0] == '+')) {
+        negative = digits[0] == '-';
+        start = 1;
+    }
+    if (start >= digits.length()) throw invalid_argument("Invalid integer: " + digits);
+
+    // Read 9-digit groups from the right
+    for (size_t end = digits.length(); end > start; ) {
+        size_t begin = end >= start + BASE_DIGITS ? end - BASE_DIGITS : start;
+        uint32_t limb = 0;
+        for (size_t i = begin; i < end; i++) {
+            if (digits[i] < '0' || digits[i] > '9') throw invalid_argument("Invalid integer: " + digits);
+            limb = limb * 10 + (digits[i] - '0');
+        }
+        limbs.push_back(limb);
+        end = begin;
+    }
+    trim();
+}
+
+void BigInt::trim() {
+    while (!limbs.empty() && limbs.back() == 0) limbs.pop_back();
+    if (limbs.empty()) negative = false;
+}
+
+size_t BigInt::digitCount() const {
+    if (limbs.empty()) return 1;
+    size_t count = (limbs.size() - 1) * BASE_DIGITS;
+    for (uint32_t top = limbs.back(); top > 0; top /= 10) count++;
+    return count;
+}
+
+string BigInt::toString() const {
+    if (limbs.empty()) return "0";
+
+    string result = negative ? "-" : "";
+    result += to_string(limbs.back());
+    for (size_t i = limbs.size() - 1; i-- > 0; ) {
+        string group = to_string(limbs[i]);
+        result.append(BASE_DIGITS - group.length(), '0');
+        result += group;
+    }
+    return result;
+}
+
+// Magnitude helpers on raw limb vectors
+
+static int compareLimbs(const Limbs& a, const Limbs& b) {
+    if (a.size() != b.size()) return a.size() < b.size() ? -1 : 1;
+    for (size_t i = a.size(); i-- > 0; ) {
+        if (a[i] != b[i]) return a[i] < b[i] ? -1 : 1;
+    }
+    return 0;
+}
+
+static void trimLimbs(Limbs& a) {
+    while (!a.empty() && a.back() == 0) a.pop_back();
+}
+
+static Limbs addLimbs(const Limbs& a, const Limbs& b) {
+    const Limbs& longer = a.size() >= b.size() ? a : b;
+    const Limbs& shorter = a.size() >= b.size() ? b : a;
+
+    Limbs result(longer.size() + 1);
+    uint32_t carry = 0;
+    for (size_t i = 0; i < longer.size(); i++) {
+        uint32_t sum = longer[i] + carry + (i < shorter.size() ? shorter[i] : 0);
+        carry = sum >= BigInt::BASE;
+        result[i] = carry ? sum - BigInt::BASE : sum;
+    }
+    result[longer.size()] = carry;
+    trimLimbs(result);
+    return result;
+}
+
+// a - b for |a| >= |b|
+static Limbs subtractLimbs(const Limbs& a, const Limbs& b) {
+    Limbs result(a.size());
+    int64_t borrow = 0;
+    for (size_t i = 0; i < a.size(); i++) {
+        int64_t diff = (int64_t)a[i] - borrow - (i < b.size() ? b[i] : 0);
+        borrow = diff < 0;
+        result[i] = (uint32_t)(borrow ? diff + BigInt::BASE : diff);
+    }
+    trimLimbs(result);
+    return result;
+}
+
+// In-place a += b at limb offset, a must be large enough to absorb the carry
+static void addInto(Limbs& a, const Limbs& b, size_t offset) {
+    uint32_t carry = 0;
+    size_t i = 0;
+    for (; i < b.size(); i++) {
+        uint32_t sum = a[offset + i] + b[i] + carry;
+        carry = sum >= BigInt::BASE;
+        a[offset + i] = carry ? sum - BigInt::BASE : sum;
+    }
+    for (size_t j = offset + i; carry; j++) {
+        uint32_t sum = a[j] + carry;
+        carry = sum >= BigInt::BASE;
+        a[j] = carry ? sum - BigInt::BASE : sum;
+    }
+}
+
+// In-place a -= b for a >= b
+static void subtractFrom(Limbs& a, const Limbs& b) {
+    int64_t borrow = 0;
+    for (size_t i = 0; i < a.size() && (i < b.size() || borrow); i++) {
+        int64_t diff = (int64_t)a[i] - borrow - (i < b.size() ? b[i] : 0);
+        borrow = diff < 0;
+        a[i] = (uint32_t)(borrow ? diff + BigInt::BASE : diff);
+    }
+    trimLimbs(a);
+}
+
+static Limbs multiplySchoolbook(const Limbs& a, const Limbs& b) {
+    if (a.empty() || b.empty()) return Limbs();
+
+    Limbs result(a.size() + b.size(), 0);
+    for (size_t i = 0; i < a.size(); i++) {
+        uint64_t carry = 0;
+        uint64_t ai = a[i];
+        if (ai == 0) continue;
+        for (size_t j = 0; j < b.size(); j++) {
+            uint64_t cur = result[i + j] + ai * b[j] + carry;
+            result[i + j] = (uint32_t)(cur % BigInt::BASE);
+            carry = cur / BigInt::BASE;
+        }
+        for (size_t k = i + b.size(); carry; k++) {
+            uint64_t cur = result[k] + carry;
+            result[k] = (uint32_t)(cur % BigInt::BASE);
+            carry = cur / BigInt::BASE;
+        }
+    }
+    trimLimbs(result);
+    return result;
+}
+
+static Limbs multiplyLimbs(const Limbs& a, const Limbs& b);
+
+// Karatsuba: three half-size products instead of four
+static Limbs multiplyKaratsuba(const Limbs& a, const Limbs& b) {
+    size_t half = max(a.size(), b.size()) / 2;
+
+    Limbs a0(a.begin(), a.begin() + min(half, a.size()));
+    Limbs a1(a.begin() + min(half, a.size()), a.end());
+    Limbs b0(b.begin(), b.begin() + min(half, b.size()));
+    Limbs b1(b.begin() + min(half, b.size()), b.end());
+    trimLimbs(a0);
+    trimLimbs(b0);
+
+    Limbs z0 = multiplyLimbs(a0, b0);
+    Limbs z2 = multiplyLimbs(a1, b1);
+    Limbs z1 = multiplyLimbs(addLimbs(a0, a1), addLimbs(b0, b1));
+    subtractFrom(z1, z0);
+    subtractFrom(z1, z2);
+
+    Limbs result(a.size() + b.size() + 1, 0);
+    addInto(result, z0, 0);
+    addInto(result, z1, half);
+    addInto(result, z2, 2 * half);
+    trimLimbs(result);
+    return result;
+}
+
+static Limbs multiplyLimbs(const Limbs& a, const Limbs& b) {
+    if (a.empty() || b.empty()) return Limbs();
+    if (min(a.size(), b.size()) < KARATSUBA_THRESHOLD) {
+        return multiplySchoolbook(a, b);
+    }
+    if (min(a.size(), b.size()) >= NTT_THRESHOLD && a.size() + b.size() <= NTT_MAX_LIMBS) {
+        Limbs result = multiplyNtt(a, b);
+        trimLimbs(result);
+        return result;
+    }
+    // Very unbalanced operands: split the long one into chunks of the short size
+    if (a.size() > 2 * b.size() || b.size() > 2 * a.size()) {
+        const Limbs& longer = a.size() > b.size() ? a : b;
+        const Limbs& shorter = a.size() > b.size() ? b : a;
+        Limbs result(a.size() + b.size() + 1, 0);
+        for (size_t offset = 0; offset < longer.size(); offset += shorter.size()) {
+            Limbs chunk(longer.begin() + offset, longer.begin() + min(offset + shorter.size(), longer.size()));
+            trimLimbs(chunk);
+            addInto(result, multiplyLimbs(chunk, shorter), offset);
+        }
+        trimLimbs(result);
+        return result;
+    }
+    return multiplyKaratsuba(a, b);
+}
+
+// Squares need only the products a[i] * a[j] with i <= j: the others are
+// the same products again, so each is computed once and doubled
+static Limbs squareSchoolbook(const Limbs& a) {
+    Limbs result(2 * a.size(), 0);
+    for (size_t i = 0; i < a.size(); i++) {
+        uint64_t ai = a[i];
+        if (ai == 0) continue;
+        uint64_t carry = 0;
+        for (size_t j = i + 1; j < a.size(); j++) {
+            uint64_t cur = result[i + j] + ai * a[j] + carry;
+            result[i + j] = (uint32_t)(cur % BigInt::BASE);
+            carry = cur / BigInt::BASE;
+        }
+        for (size_t k = i + a.size(); carry; k++) {
+            uint64_t cur = result[k] + carry;
+            result[k] = (uint32_t)(cur % BigInt::BASE);
+            carry = cur / BigInt::BASE;
+        }
+    }
+    // Double the cross products, then add the diagonal a[i]^2
+    uint64_t carry = 0;
+    for (size_t k = 0; k < result.size(); k++) {
+        uint64_t cur = 2 * (uint64_t)result[k] + carry;
+        if (k % 2 == 0) cur += (uint64_t)a[k / 2] * a[k / 2];
+        result[k] = (uint32_t)(cur % BigInt::BASE);
+        carry = cur / BigInt::BASE;
+    }
+    trimLimbs(result);
+    return result;
+}
+
+static Limbs squareLimbs(const Limbs& a);
+
+// Karatsuba for squares: a0^2, a1^2 and (a0 + a1)^2 are all squares again
+static Limbs squareKaratsuba(const Limbs& a) {
+    size_t half = a.size() / 2;
+    Limbs a0(a.begin(), a.begin() + half);
+    Limbs a1(a.begin() + half, a.end());
+    trimLimbs(a0);
+
+    Limbs z0 = squareLimbs(a0);
+    Limbs z2 = squareLimbs(a1);
+    Limbs z1 = squareLimbs(addLimbs(a0, a1));
+    subtractFrom(z1, z0);
+    subtractFrom(z1, z2);
+
+    Limbs result(2 * a.size() + 1, 0);
+    addInto(result, z0, 0);
+    addInto(result, z1, half);
+    addInto(result, z2, 2 * half);
+    trimLimbs(result);
+    return result;
+}
+
+static Limbs squareLimbs(const Limbs& a) {
+    if (a.empty()) return Limbs();
+    if (a.size() < KARATSUBA_THRESHOLD) return squareSchoolbook(a);
+    if (a.size() >= NTT_THRESHOLD && 2 * a.size() <= NTT_MAX_LIMBS) {
+        Limbs result = squareNtt(a);
+        trimLimbs(result);
+        return result;
+    }
+    return squareKaratsuba(a);
+}
+
+static Limbs multiplySmallLimbs(const Limbs& a, uint32_t factor) {
+    Limbs result(a.size() + 1);
+    uint64_t carry = 0;
+    for (size_t i = 0; i < a.size(); i++) {
+        uint64_t cur = (uint64_t)a[i] * factor + carry;
+        result[i] = (uint32_t)(cur % BigInt::BASE);
+        carry = cur / BigInt::BASE;
+    }
+    result[a.size()] = (uint32_t)carry;
+    trimLimbs(result);
+    return result;
+}
+
+// Divide in place by a single limb, returning the remainder
+static uint32_t divideSmallLimbs(Limbs& a, uint32_t divisor) {
+    uint64_t remainder = 0;
+    for (size_t i = a.size(); i-- > 0; ) {
+        uint64_t cur = a[i] + remainder * BigInt::BASE;
+        a[i] = (uint32_t)(cur / divisor);
+        remainder = cur % divisor;
+    }
+    trimLimbs(a);
+    return (uint32_t)remainder;
+}
+
+// Knuth algorithm D on base 10^9 limbs
+static void divModLimbs(const Limbs& a, const Limbs& b, Limbs& quotient, Limbs& remainder) {
+    if (b.empty()) throw domain_error("Division by zero");
+    if (compareLimbs(a, b) < 0) {
+        quotient.clear();
+        remainder = a;
+        return;
+    }
+    if (b.size() == 1) {
+        quotient = a;
+        uint32_t r = divideSmallLimbs(quotient, b[0]);
+        remainder.clear();
+        if (r) remainder.push_back(r);
+        return;
+    }
+
+    // Normalize so the top divisor limb is at least BASE/2
+    uint32_t scale = (uint32_t)(BigInt::BASE / ((uint64_t)b.back() + 1));
+    Limbs u = multiplySmallLimbs(a, scale);
+    Limbs v = multiplySmallLimbs(b, scale);
+    size_t n = v.size();
+    size_t m = a.size() - b.size();
+    u.resize(a.size() + 1, 0);
+
+    quotient.assign(m + 1, 0);
+    const uint64_t base = BigInt::BASE;
+    uint64_t vTop = v[n - 1];
+    uint64_t vNext = v[n - 2];
+
+    for (size_t j = m + 1; j-- > 0; ) {
+        uint64_t numerator = (uint64_t)u[j + n] * base + u[j + n - 1];
+        uint64_t qhat = numerator / vTop;
+        uint64_t rhat = numerator % vTop;
+        while (qhat >= base || qhat * vNext > rhat * base + u[j + n - 2]) {
+            qhat--;
+            rhat += vTop;
+            if (rhat >= base) break;
+        }
+
+        // Multiply and subtract qhat * v from u[j .. j+n]
+        int64_t borrow = 0;
+        uint64_t carry = 0;
+        for (size_t i = 0; i < n; i++) {
+            uint64_t product = qhat * v[i] + carry;
+            carry = product / base;
+            int64_t diff = (int64_t)u[i + j] - (int64_t)(product % base) - borrow;
+            borrow = diff < 0;
+            u[i + j] = (uint32_t)(borrow ? diff + (int64_t)base : diff);
+        }
+        int64_t diff = (int64_t)u[j + n] - (int64_t)carry - borrow;
+        borrow = diff < 0;
+        u[j + n] = (uint32_t)(borrow ? diff + (int64_t)base : diff);
+
+        // qhat was one too large: add the divisor back
+        if (borrow) {
+            qhat--;
+            uint32_t addCarry = 0;
+            for (size_t i = 0; i < n; i++) {
+                uint32_t sum = u[i + j] + v[i] + addCarry;
+                addCarry = sum >= base;
+                u[i + j] = addCarry ? sum - (uint32_t)base : sum;
+            }
+            u[j + n] = (uint32_t)((u[j + n] + addCarry) % base);
+        }
+        quotient[j] = (uint32_t)qhat;
+    }
+
+    trimLimbs(quotient);
+    u.resize(n);
+    trimLimbs(u);
+    divideSmallLimbs(u, scale);
+    remainder = u;
+}
+
+// Signed operations
+
+int compareMagnitude(const BigInt& a, const BigInt& b) {
+    return compareLimbs(a.limbs, b.limbs);
+}
+
+int compare(const BigInt& a, const BigInt& b) {
+    if (a.negative != b.negative) return a.negative ? -1 : 1;
+    int magnitude = compareLimbs(a.limbs, b.limbs);
+    return a.negative ? -magnitude : magnitude;
+}
+
+BigInt operator-(const BigInt& a) {
+    BigInt result = a;
+    if (!result.isZero()) result.negative = !result.negative;
+    return result;
+}
+
+BigInt operator+(const BigInt& a, const BigInt& b) {
+    BigInt result;
+    if (a.negative == b.negative) {
+        result.limbs = addLimbs(a.limbs, b.limbs);
+        result.negative = a.negative;
+    } else if (compareLimbs(a.limbs, b.limbs) >= 0) {
+        result.limbs = subtractLimbs(a.limbs, b.limbs);
+        result.negative = a.negative;
+    } else {
+        result.limbs = subtractLimbs(b.limbs, a.limbs);
+        result.negative = b.negative;
+    }
+    result.trim();
+    return result;
+}
+
+BigInt operator-(const BigInt& a, const BigInt& b) {
+    return a + (-b);
+}
+
+BigInt operator*(const BigInt& a, const BigInt& b) {
+    chargeDigits(a.digitCount() + b.digitCount());
+    MemoryCharge charge(productBytes(a.limbs.size() + b.limbs.size()));
+    BigInt result;
+    result.limbs = &a == &b ? squareLimbs(a.limbs) : multiplyLimbs(a.limbs, b.limbs);
+    result.negative = a.negative != b.negative;
+    result.trim();
+    return result;
+}
+
+void divMod(const BigInt& a, const BigInt& b, BigInt& quotient, BigInt& remainder) {
+    // Normalized copies of both operands and the quotient
+    MemoryCharge charge((2 * a.limbs.size() + b.limbs.size() + 1) * sizeof(uint32_t));
+    Limbs q, r;
+    divModLimbs(a.limbs, b.limbs, q, r);
+    quotient.limbs = std::move(q);
+    quotient.negative = a.negative != b.negative;
+    quotient.trim();
+    remainder.limbs = std::move(r);
+    remainder.negative = a.negative;
+    remainder.trim();
+}
+
+BigInt operator/(const BigInt& a, const BigInt& b) {
+    BigInt quotient, remainder;
+    divMod(a, b, quotient, remainder);
+    return quotient;
+}
+
+BigInt operator%(const BigInt& a, const BigInt& b) {
+    BigInt quotient, remainder;
+    divMod(a, b, quotient, remainder);
+    return remainder;
+}
+
+BigInt absValue(const BigInt& a) {
+    BigInt result = a;
+    result.negative = false;
+    return result;
+}
+
+BigInt shiftDecimal(const BigInt& a, size_t digits) {
+    if (a.isZero() || digits == 0) return a;
+    chargeDigits(a.digitCount() + digits);
+
+    BigInt result;
+    result.negative = a.negative;
+    result.limbs.assign(digits / BigInt::BASE_DIGITS, 0);
+    result.limbs.insert(result.limbs.end(), a.limbs.begin(), a.limbs.end());
+
+    uint32_t factor = 1;
+    for (size_t i = 0; i < digits % BigInt::BASE_DIGITS; i++) factor *= 10;
+    if (factor > 1) result.limbs = multiplySmallLimbs(result.limbs, factor);
+    result.trim();
+    return result;
+}
+
+BigInt shiftDecimalRight(const BigInt& a, size_t digits) {
+    if (digits == 0) return a;
+    if (digits >= a.digitCount()) return BigInt();
+
+    BigInt result;
+    result.negative = a.negative;
+    result.limbs.assign(a.limbs.begin() + digits / BigInt::BASE_DIGITS, a.limbs.end());
+
+    uint32_t divisor = 1;
+    for (size_t i = 0; i < digits % BigInt::BASE_DIGITS; i++) divisor *= 10;
+    if (divisor > 1) divideSmallLimbs(result.limbs, divisor);
+    result.trim();
+    return result;
+}
+
+size_t trailingZeroDigits(const BigInt& a) {
+    size_t count = 0;
+    size_t i = 0;
+    while (i < a.limbs.size() && a.limbs[i] == 0) {
+        count += BigInt::BASE_DIGITS;
+        i++;
+    }
+    if (i == a.limbs.size()) return 0;
+    for (uint32_t limb = a.limbs[i]; limb % 10 == 0; limb /= 10) count++;
+    return count;
+}
+
+BigInt square(const BigInt& a) {
+    chargeDigits(2 * a.digitCount());
+    MemoryCharge charge(productBytes(2 * a.limbs.size()));
+    BigInt result;
+    result.limbs = squareLimbs(a.limbs);
+    return result;
+}
+
+// Largest window tried; its table already holds 32 odd powers
+static const unsigned MAX_WINDOW_BITS = 6;
+
+vector<PowerWindow> powerWindows(unsigned long long exponent, unsigned& largestOdd) {
+    int bits = 64 - __builtin_clzll(exponent);
+    
+    // A window of k bits needs 2^(k-1) - 1 table products and then about one
+    // product per k + 1 exponent bits
+    unsigned window = 1;
+    double bestCost = bits / 2.0;
+    for (unsigned k = 2; k <= MAX_WINDOW_BITS; k++) {
+        double cost = (double)((1u << (k - 1)) - 1) + bits / (k + 1.0);
+        if (cost < bestCost) {
+            bestCost = cost;
+            window = k;
+        }
+    }
+    
+    vector<PowerWindow> steps;
+    largestOdd = 1;
+    unsigned pending = 0; // Squarings owed by zero bits before the next window
+    for (int bit = bits - 1; bit >= 0;) {
+        if (!((exponent >> bit) & 1)) {
+            pending++;
+            bit--;
+            continue;
+        }
+        // Widest window starting here that also ends in a set bit
+        int low = max(bit - (int)window + 1, 0);
+        while (!((exponent >> low) & 1)) low++;
+        unsigned odd = (unsigned)((exponent >> low) & ((1ULL << (bit - low + 1)) - 1));
+        unsigned squarings = steps.empty() ? 0 : pending + (unsigned)(bit - low + 1);
+        steps.push_back(PowerWindow{squarings, odd});
+        largestOdd = max(largestOdd, odd);
+        pending = 0;
+        bit = low - 1;
+    }
+    if (pending > 0) steps.push_back(PowerWindow{pending, 0});
+    return steps;
+}
+
+// Decimal digits of base^exponent, at most one too many
+static double powerDigits(const BigInt& base, unsigned long long exponent) {
+    double top = base.limbs.back();
+    if (base.limbs.size() > 1) top += base.limbs[base.limbs.size() - 2] / (double)BigInt::BASE;
+    return (log10(top) + (double)(base.limbs.size() - 1) * BigInt::BASE_DIGITS) * (double)exponent + 1;
+}
+
+BigInt power(const BigInt& base, unsigned long long exponent) {
+    if (exponent == 0) return BigInt(1);
+    // Refused before the first squaring rather than at the last one
+    if (!base.isZero()) chargeDigits((size_t)min(powerDigits(base, exponent), 1e18));
+    unsigned largestOdd;
+    vector<PowerWindow> steps = powerWindows(exponent, largestOdd);
+    
+    // oddPowers[i] = base^(2i + 1)
+    vector<BigInt> oddPowers(1, base);
+    if (largestOdd > 1) {
+        BigInt baseSquared = square(base);
+        while (2 * oddPowers.size() - 1 < largestOdd) oddPowers.push_back(oddPowers.back() * baseSquared);
+    }
+    BigInt result = oddPowers[steps[0].odd / 2];
+    for (size_t i = 1; i < steps.size(); i++) {
+        for (unsigned k = 0; k < steps[i].squarings; k++) result = square(result);
+        if (steps[i].odd != 0) result = result * oddPowers[steps[i].odd / 2];
+    }
+    return result;
+}
+
+// GCD
+
+static uint64_t toWord(const Limbs& a) {
+    uint64_t value = 0;
+    for (size_t i = a.size(); i-- > 0; ) value = value * BigInt::BASE + a[i];
+    return value;
+}
+
+static Limbs fromWord(uint64_t value) {
+    Limbs result;
+    while (value > 0) {
+        result.push_back((uint32_t)(value % BigInt::BASE));
+        value /= BigInt::BASE;
+    }
+    return result;
+}
+
+// Stein's binary GCD on machine words
+static uint64_t binaryGcd(uint64_t a, uint64_t b) {
+    if (a == 0) return b;
+    if (b == 0) return a;
+    int shift = __builtin_ctzll(a | b);
+    a >>= __builtin_ctzll(a);
+    while (b != 0) {
+        b >>= __builtin_ctzll(b);
+        if (a > b) swap(a, b);
+        b -= a;
+    }
+    return a << shift;
+}
+
+// x * p + y * q for signed cofactors whose combination is known to be non-negative
+static Limbs linearCombination(const Limbs& x, int64_t p, const Limbs& y, int64_t q) {
+    size_t length = max(x.size(), y.size());
+    Limbs result(length + 3, 0);
+    __int128 carry = 0;
+    for (size_t i = 0; i < length; i++) {
+        __int128 cur = carry;
+        if (i < x.size()) cur += (__int128)x[i] * p;
+        if (i < y.size()) cur += (__int128)y[i] * q;
+        // Floor division keeps every stored limb in [0, BASE)
+        __int128 limb = cur % BigInt::BASE;
+        carry = cur / BigInt::BASE;
+        if (limb < 0) {
+            limb += BigInt::BASE;
+            carry -= 1;
+        }
+        result[i] = (uint32_t)limb;
+    }
+    for (size_t i = length; carry > 0; i++) {
+        result[i] = (uint32_t)(carry % BigInt::BASE);
+        carry /= BigInt::BASE;
+    }
+    trimLimbs(result);
+    return result;
+}
+
+BigInt gcd(const BigInt& a, const BigInt& b) {
+    Limbs x = a.limbs, y = b.limbs;
+    if (compareLimbs(x, y) < 0) swap(x, y);
+
+    // Lehmer: simulate Euclid on the leading 18 digits and apply the
+    // accumulated cofactor matrix to the full numbers in one pass
+    while (y.size() > 2) {
+        size_t top = x.size() - 1;
+        if (top - (y.size() - 1) > 1) {
+            // Lengths differ too much for a shared leading window
+            Limbs q, r;
+            divModLimbs(x, y, q, r);
+            x.swap(y);
+            y.swap(r);
+            continue;
+        }
+
+        int64_t xHat = (int64_t)x[top] * BigInt::BASE + x[top - 1];
+        int64_t yHat = (top < y.size() ? (int64_t)y[top] * BigInt::BASE : 0) + y[top - 1];
+        int64_t A = 1, B = 0, C = 0, D = 1;
+
+        while (yHat + C != 0 && yHat + D != 0) {
+            int64_t q = (xHat + A) / (yHat + C);
+            int64_t qAlt = (xHat + B) / (yHat + D);
+            if (q != qAlt) break;
+            int64_t t = A - q * C; A = C; C = t;
+            t = B - q * D; B = D; D = t;
+            t = xHat - q * yHat; xHat = yHat; yHat = t;
+        }
+
+        if (B == 0) {
+            // No single-precision progress: take one full Euclidean step
+            Limbs q, r;
+            divModLimbs(x, y, q, r);
+            x.swap(y);
+            y.swap(r);
+        } else {
+            Limbs nextX = linearCombination(x, A, y, B);
+            Limbs nextY = linearCombination(x, C, y, D);
+            x.swap(nextX);
+            y.swap(nextY);
+        }
+    }
+
+    if (y.empty()) {
+        BigInt result;
+        result.limbs = x;
+        return result;
+    }
+
+    // One reduction brings both operands down to a machine word
+    {
+        Limbs q, r;
+        divModLimbs(x, y, q, r);
+        x.swap(y);
+        y.swap(r);
+    }
+    BigInt result;
+    result.limbs = fromWord(binaryGcd(toWord(x), toWord(y)));
+    return result;
+}
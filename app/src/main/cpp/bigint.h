@@ -0,0 +1,88 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Arbitrary precision integer stored as base 10^9 limbs, least significant first.
+// The decimal base keeps conversion to and from the string API linear.
+struct BigInt {
+    static const uint32_t BASE = 1000000000;
+    static const int BASE_DIGITS = 9;
+
+    std::vector<uint32_t> limbs; // Magnitude without leading zero limbs (empty for zero)
+    bool negative;
+
+    BigInt() : negative(false) {}
+    BigInt(long long value);
+
+    // Optional sign followed by decimal digits
+    explicit BigInt(const std::string& digits);
+
+    bool isZero() const { return limbs.empty(); }
+    bool isOdd() const { return !limbs.empty() && (limbs[0] & 1); }
+
+    // Number of decimal digits in the magnitude (1 for zero)
+    size_t digitCount() const;
+
+    std::string toString() const;
+
+    // Drop leading zero limbs and normalize the sign of zero
+    void trim();
+};
+
+int compareMagnitude(const BigInt& a, const BigInt& b);
+int compare(const BigInt& a, const BigInt& b);
+
+inline bool operator==(const BigInt& a, const BigInt& b) { return compare(a, b) == 0; }
+inline bool operator!=(const BigInt& a, const BigInt& b) { return compare(a, b) != 0; }
+inline bool operator<(const BigInt& a, const BigInt& b) { return compare(a, b) < 0; }
+inline bool operator>(const BigInt& a, const BigInt& b) { return compare(a, b) > 0; }
+inline bool operator<=(const BigInt& a, const BigInt& b) { return compare(a, b) <= 0; }
+inline bool operator>=(const BigInt& a, const BigInt& b) { return compare(a, b) >= 0; }
+
+BigInt operator-(const BigInt& a);
+BigInt operator+(const BigInt& a, const BigInt& b);
+BigInt operator-(const BigInt& a, const BigInt& b);
+// Schoolbook, Karatsuba or number-theoretic transform by operand size; x * x
+// of one object takes the squaring path
+BigInt operator*(const BigInt& a, const BigInt& b);
+BigInt operator/(const BigInt& a, const BigInt& b);
+BigInt operator%(const BigInt& a, const BigInt& b);
+
+// Truncating division: a = quotient * b + remainder, remainder has the sign of a
+void divMod(const BigInt& a, const BigInt& b, BigInt& quotient, BigInt& remainder);
+
+BigInt absValue(const BigInt& a);
+
+// Multiply by 10^digits (digits >= 0)
+BigInt shiftDecimal(const BigInt& a, size_t digits);
+
+// Divide by 10^digits, truncating toward zero
+BigInt shiftDecimalRight(const BigInt& a, size_t digits);
+
+// Number of trailing decimal zeros of a non-zero value (0 for zero)
+size_t trailingZeroDigits(const BigInt& a);
+
+// a * a with about half the work of a general product at every size
+BigInt square(const BigInt& a);
+
+// One step of a left-to-right sliding-window power: square the running
+// result `squarings` times, then multiply it by base^odd unless odd is 0
+struct PowerWindow {
+    unsigned squarings;
+    unsigned odd;
+};
+
+// Steps of base^exponent for exponent >= 1, most significant first. The
+// first step's odd power is the starting value. Windows are sized so the
+// table of odd powers up to largestOdd pays for itself: one squaring per
+// exponent bit, and about one product per window instead of per set bit
+std::vector<PowerWindow> powerWindows(unsigned long long exponent, unsigned& largestOdd);
+
+// Integer power by sliding windows. Each product is the growing result times
+// a small odd power of the base; the full-size work is all squarings
+BigInt power(const BigInt& base, unsigned long long exponent);
+
+// Greatest common divisor of the magnitudes: binary GCD while both operands fit
+// in a machine word, Lehmer's algorithm on the leading limbs above that
+BigInt gcd(const BigInt& a, const BigInt& b);
@@ -1,10 +1,37 @@
 #include "calc.h"
+#include "cancellation.h"
+#include "decimal_kernel.h"
+#include "memo_cache.h"
+#include "bigint.h"
 #include <stdexcept>
 #include <string>
 #include <algorithm>
+#include <climits>
+#include <cmath>
+#include <mutex>
 #include <vector>
 using namespace std;
 
+static thread_local size_t currentPrecision = DEFAULT_PRECISION;
+
+size_t workingPrecision() {
+    return currentPrecision;
+}
+
+void setWorkingPrecision(size_t digits) {
+    currentPrecision = max<size_t>(digits, 1);
+}
+
+static thread_local AngleUnit currentAngleUnit = ANGLE_RADIANS;
+
+AngleUnit angleUnit() {
+    return currentAngleUnit;
+}
+
+void setAngleUnit(AngleUnit unit) {
+    currentAngleUnit = unit;
+}
+
 // Legacy function for JNI compatibility (uses double precision)
 double calc(double a, char op, double b) {
     switch (op) {
@@ -19,254 +46,1118 @@ double calc(double a, char op, double b) {
     }
 }
 
-// Helper function to validate number string
+// Helper function to validate number string (optionally with an exponent part)
 bool isValidNumber(const string& str) {
     if (str.empty()) return false;
     
-    int start = 0;
+    size_t start = 0;
     if (str[0] == '-' || str[0] == '+') start = 1;
     if (start >= str.length()) return false;
     
     bool hasDecimal = false;
-    for (int i = start; i < str.length(); i++) {
+    bool hasDigit = false;
+    for (size_t i = start; i < str.length(); i++) {
         if (str[i] == '.') {
             if (hasDecimal) return false;
             hasDecimal = true;
+        } else if ((str[i] == 'e' || str[i] == 'E') && hasDigit) {
+            // Exponent: optional sign followed by at least one digit
+            size_t j = i + 1;
+            if (j < str.length() && (str[j] == '-' || str[j] == '+')) j++;
+            if (j >= str.length()) return false;
+            for (; j < str.length(); j++) {
+                if (str[j] < '0' || str[j] > '9') return false;
+            }
+            return true;
         } else if (str[i] < '0' || str[i] > '9') {
             return false;
+        } else {
+            hasDigit = true;
         }
     }
     return true;
 }
 
-// Remove leading zeros
-string removeLeadingZeros(const string& str) {
-    if (str.empty()) return "0";
-    
-    size_t start = 0;
-    if (str[0] == '-' || str[0] == '+') start = 1;
-    
-    while (start < str.length() && str[start] == '0') {
-        start++;
+bool isScientific(const string& number) {
+    return number.find_first_of("eE") != string::npos;
+}
+
+// Move trailing mantissa zeros into the exponent so only significant digits are kept
+static BigFloat normalizeFloat(BigFloat value) {
+    if (value.mantissa.isZero()) return BigFloat();
+    size_t zeros = trailingZeroDigits(value.mantissa);
+    if (zeros > 0) {
+        value.mantissa = shiftDecimalRight(value.mantissa, zeros);
+        value.exponent += zeros;
+    }
+    return value;
+}
+
+BigFloat parseBigFloat(const string& number) {
+    if (!isValidNumber(number)) throw invalid_argument("Invalid number: " + number);
+    
+    size_t expPos = number.find_first_of("eE");
+    string mantissaPart = number.substr(0, expPos);
+    long long exponent = 0;
+    if (expPos != string::npos) {
+        string exponentPart = number.substr(expPos + 1);
+        if (exponentPart.length() > 18) throw out_of_range("Exponent out of range: " + number);
+        exponent = stoll(exponentPart);
     }
     
-    if (start == str.length()) return "0";
+    size_t dot = mantissaPart.find('.');
+    if (dot != string::npos) {
+        exponent -= (long long)(mantissaPart.length() - dot - 1);
+        mantissaPart.erase(dot, 1);
+    }
+    if (mantissaPart.empty() || mantissaPart == "-" || mantissaPart == "+") mantissaPart += "0";
     
-    string result = str.substr(0, (str[0] == '-' || str[0] == '+') ? 1 : 0) + str.substr(start);
-    return result.empty() ? "0" : result;
+    return normalizeFloat(BigFloat(BigInt(mantissaPart), exponent));
 }
 
-// Remove trailing zeros from decimal
-string removeTrailingZeros(const string& str) {
-    if (str.find('.') == string::npos) return str;
-    
-    string result = str;
-    while (result.length() > 1 && result.back() == '0') {
-        result.pop_back();
+string formatBigFloat(const BigFloat& value) {
+    BigFloat normalized = normalizeFloat(value);
+    if (normalized.isZero()) return "0";
+    
+    string digits = absValue(normalized.mantissa).toString();
+    string sign = normalized.mantissa.negative ? "-" : "";
+    long long count = (long long)digits.length();
+    long long exponent = normalized.exponent;
+    long long pointPos = count + exponent; // Digits before the decimal point
+    
+    if (exponent >= 0 && exponent <= SCIENTIFIC_ZERO_LIMIT) {
+        return sign + digits + string((size_t)exponent, '0');
     }
-    if (result.back() == '.') {
-        result.pop_back();
+    if (exponent < 0 && pointPos > 0) {
+        return sign + digits.substr(0, (size_t)pointPos) + "." + digits.substr((size_t)pointPos);
     }
+    if (exponent < 0 && -pointPos <= SCIENTIFIC_ZERO_LIMIT) {
+        return sign + "0." + string((size_t)-pointPos, '0') + digits;
+    }
+    return formatScientific(normalized);
+}
+
+string formatScientific(const BigFloat& value) {
+    BigFloat normalized = normalizeFloat(value);
+    if (normalized.isZero()) return "0";
+    
+    // One digit before the point
+    string digits = absValue(normalized.mantissa).toString();
+    string result = (normalized.mantissa.negative ? "-" : "") + digits.substr(0, 1);
+    if (digits.length() > 1) result += "." + digits.substr(1);
+    return result + "e" + to_string((long long)digits.length() + normalized.exponent - 1);
+}
+
+static long long checkedExponent(long long a, long long b) {
+    long long result;
+    if (__builtin_add_overflow(a, b, &result)) throw overflow_error("Exponent overflow");
     return result;
 }
 
-// Compare absolute values (-1: a < b, 0: a == b, 1: a > b)
-int compareAbs(const string& a, const string& b) {
-    // Split into integer and decimal parts
-    size_t dotA = a.find('.');
-    size_t dotB = b.find('.');
-    
-    string intA = (dotA == string::npos) ? a : a.substr(0, dotA);
-    string intB = (dotB == string::npos) ? b : b.substr(0, dotB);
-    
-    string decA = (dotA == string::npos) ? "" : a.substr(dotA + 1);
-    string decB = (dotB == string::npos) ? "" : b.substr(dotB + 1);
-    
-    // Remove signs for comparison
-    if (!intA.empty() && (intA[0] == '-' || intA[0] == '+')) intA = intA.substr(1);
-    if (!intB.empty() && (intB[0] == '-' || intB[0] == '+')) intB = intB.substr(1);
-    
-    // Remove leading zeros
-    intA = removeLeadingZeros(intA);
-    intB = removeLeadingZeros(intB);
-    
-    // Compare integer parts by length first
-    if (intA.length() != intB.length()) {
-        return (intA.length() < intB.length()) ? -1 : 1;
+BigFloat add(const BigFloat& a, const BigFloat& b) {
+    if (a.isZero()) return b;
+    if (b.isZero()) return a;
+    
+    // Align to the smaller exponent; the sum is exact
+    long long exponent = min(a.exponent, b.exponent);
+    BigInt alignedA = shiftDecimal(a.mantissa, (size_t)(a.exponent - exponent));
+    BigInt alignedB = shiftDecimal(b.mantissa, (size_t)(b.exponent - exponent));
+    return normalizeFloat(BigFloat(alignedA + alignedB, exponent));
+}
+
+BigFloat subtract(const BigFloat& a, const BigFloat& b) {
+    return add(a, BigFloat(-b.mantissa, b.exponent));
+}
+
+BigFloat multiply(const BigFloat& a, const BigFloat& b) {
+    if (a.isZero() || b.isZero()) return BigFloat();
+    return normalizeFloat(BigFloat(a.mantissa * b.mantissa, checkedExponent(a.exponent, b.exponent)));
+}
+
+BigFloat sumOfProducts(initializer_list<FloatProductTerm> terms) {
+    // Products are summed at the smallest exponent among them; only the
+    // total has its trailing zeros stripped
+    long long exponent = 0;
+    bool first = true;
+    for (const FloatProductTerm& term : terms) {
+        const BigFloat& b = term.b == nullptr ? *term.a : *term.b;
+        if (term.a->isZero() || b.isZero()) continue;
+        long long productExponent = checkedExponent(term.a->exponent, b.exponent);
+        exponent = first ? productExponent : min(exponent, productExponent);
+        first = false;
     }
-    
-    // Same length, compare digit by digit
-    int intComp = intA.compare(intB);
-    if (intComp != 0) return (intComp < 0) ? -1 : 1;
-    
-    // Integer parts equal, compare decimal parts
-    int maxDecLen = max(decA.length(), decB.length());
-    decA.resize(maxDecLen, '0');
-    decB.resize(maxDecLen, '0');
-    
-    int decComp = decA.compare(decB);
-    return (decComp < 0) ? -1 : (decComp > 0) ? 1 : 0;
+    BigInt sum;
+    for (const FloatProductTerm& term : terms) {
+        const BigFloat& b = term.b == nullptr ? *term.a : *term.b;
+        if (term.a->isZero() || b.isZero()) continue;
+        BigInt product = term.a->mantissa * b.mantissa;
+        product = shiftDecimal(product, (size_t)(term.a->exponent + b.exponent - exponent));
+        sum = term.subtract ? sum - product : sum + product;
+    }
+    return normalizeFloat(BigFloat(sum, exponent));
 }
 
-// Add two positive numbers using pen-and-pencil method
-string addPositive(const string& a, const string& b) {
-    // Split into integer and decimal parts
-    size_t dotA = a.find('.');
-    size_t dotB = b.find('.');
-    
-    string intA = (dotA == string::npos) ? a : a.substr(0, dotA);
-    string intB = (dotB == string::npos) ? b : b.substr(0, dotB);
-    
-    string decA = (dotA == string::npos) ? "" : a.substr(dotA + 1);
-    string decB = (dotB == string::npos) ? "" : b.substr(dotB + 1);
-    
-    // Pad decimal parts to same length
-    int maxDecLen = max(decA.length(), decB.length());
-    decA.resize(maxDecLen, '0');
-    decB.resize(maxDecLen, '0');
-    
-    string result = "";
-    int carry = 0;
-    
-    // Add decimal part from right to left
-    for (int i = maxDecLen - 1; i >= 0; i--) {
-        int sum = (decA[i] - '0') + (decB[i] - '0') + carry;
-        result = char(sum % 10 + '0') + result;
-        carry = sum / 10;
+BigFloat divide(const BigFloat& a, const BigFloat& b, size_t significantDigits) {
+    if (b.isZero()) throw domain_error("Division by zero");
+    if (a.isZero()) return BigFloat();
+    
+    // Scale the dividend so the integer quotient has at least the requested digits
+    long long lengthA = (long long)a.mantissa.digitCount();
+    long long lengthB = (long long)b.mantissa.digitCount();
+    long long shift = max(0LL, (long long)significantDigits - (lengthA - lengthB));
+    BigInt quotient = shiftDecimal(a.mantissa, (size_t)shift) / b.mantissa;
+    
+    // Truncate to the requested number of significant digits
+    long long exponent = checkedExponent(a.exponent, -b.exponent) - shift;
+    long long excess = (long long)quotient.digitCount() - (long long)significantDigits;
+    if (excess > 0) {
+        quotient = shiftDecimalRight(quotient, (size_t)excess);
+        exponent += excess;
     }
-    
-    if (maxDecLen > 0) {
-        result = "." + result;
+    return normalizeFloat(BigFloat(quotient, exponent));
+}
+
+BigFloat power(const BigFloat& base, unsigned long long exponent) {
+    if (exponent == 0) return BigFloat(BigInt(1));
+    long long scaled;
+    if (__builtin_mul_overflow(base.exponent, (long long)exponent, &scaled)) {
+        throw overflow_error("Exponent overflow");
     }
-    
-    // Add integer part from right to left
-    int i = intA.length() - 1;
-    int j = intB.length() - 1;
-    
-    string intResult = "";
-    while (i >= 0 || j >= 0 || carry > 0) {
-        int sum = carry;
-        if (i >= 0) sum += (intA[i--] - '0');
-        if (j >= 0) sum += (intB[j--] - '0');
-        
-        intResult = char(sum % 10 + '0') + intResult;
-        carry = sum / 10;
+    return normalizeFloat(BigFloat(power(base.mantissa, exponent), scaled));
+}
+
+BigFloat truncateToDigits(const BigFloat& value, size_t digits) {
+    size_t length = value.mantissa.digitCount();
+    if (value.isZero() || length <= digits) return value;
+    size_t excess = length - digits;
+    return normalizeFloat(BigFloat(shiftDecimalRight(value.mantissa, excess), value.exponent + (long long)excess));
+}
+
+BigFloat roundToDigits(const BigFloat& value, size_t digits) {
+    size_t length = value.mantissa.digitCount();
+    if (value.isZero() || length <= digits) return value;
+    size_t excess = length - digits;
+    
+    // Keep one extra digit to decide the rounding direction (half away from zero)
+    BigInt magnitude = shiftDecimalRight(absValue(value.mantissa), excess - 1);
+    bool roundUp = magnitude.limbs[0] % 10 >= 5;
+    magnitude = shiftDecimalRight(magnitude, 1);
+    if (roundUp) magnitude = magnitude + BigInt(1);
+    if (value.mantissa.negative) magnitude = -magnitude;
+    return normalizeFloat(BigFloat(magnitude, value.exponent + (long long)excess));
+}
+
+// Extra digits carried through iterations so rounding errors stay invisible
+static const size_t GUARD_DIGITS = 8;
+
+// Digits of x^(-1/n) trusted from the double-precision seed
+static const size_t SEED_DIGITS = 12;
+
+static BigFloat square(const BigFloat& x) {
+    if (x.isZero()) return BigFloat();
+    return normalizeFloat(BigFloat(square(x.mantissa), checkedExponent(x.exponent, x.exponent)));
+}
+
+// Sliding-window power with every intermediate truncated to a fixed working
+// precision, so no product ever grows past twice that many digits. Each
+// truncation errs by one unit in the last place and the power amplifies
+// that by up to the exponent: callers add its digit count as guard digits
+static BigFloat powerTruncated(const BigFloat& base, unsigned long long exponent, size_t digits) {
+    if (exponent == 0) return BigFloat(BigInt(1));
+    unsigned largestOdd;
+    vector<PowerWindow> steps = powerWindows(exponent, largestOdd);
+    
+    // oddPowers[i] = base^(2i + 1)
+    vector<BigFloat> oddPowers(1, truncateToDigits(base, digits));
+    if (largestOdd > 1) {
+        BigFloat baseSquared = truncateToDigits(square(oddPowers[0]), digits);
+        while (2 * oddPowers.size() - 1 < largestOdd) {
+            oddPowers.push_back(truncateToDigits(multiply(oddPowers.back(), baseSquared), digits));
+        }
     }
-    
-    result = intResult + result;
-    return removeTrailingZeros(removeLeadingZeros(result));
+    BigFloat result = oddPowers[steps[0].odd / 2];
+    for (size_t i = 1; i < steps.size(); i++) {
+        for (unsigned k = 0; k < steps[i].squarings; k++) {
+            checkCancelled();
+            result = truncateToDigits(square(result), digits);
+        }
+        if (steps[i].odd != 0) result = truncateToDigits(multiply(result, oddPowers[steps[i].odd / 2]), digits);
+    }
+    return result;
 }
 
-// Subtract two positive numbers (assumes a >= b)
-string subtractPositive(const string& a, const string& b) {
-    // Split into integer and decimal parts
-    size_t dotA = a.find('.');
-    size_t dotB = b.find('.');
+// x^(-1/n) to about SEED_DIGITS digits using doubles. The decimal exponent is
+// split off exactly first, so any magnitude of x is seeded accurately.
+static BigFloat seedInverseRoot(const BigFloat& x, unsigned long long n) {
+    // x = lead * 10^scale with the top 17 digits in lead
+    size_t length = x.mantissa.digitCount();
+    size_t dropped = length > 17 ? length - 17 : 0;
+    double lead = stod(shiftDecimalRight(absValue(x.mantissa), dropped).toString());
+    long long scale = x.exponent + (long long)dropped;
+    
+    // scale = n*q + r with 0 <= r < n, so x^(-1/n) = (lead*10^r)^(-1/n) * 10^(-q)
+    long long divisor = n > (unsigned long long)LLONG_MAX ? LLONG_MAX : (long long)n;
+    long long q = scale / divisor;
+    long long r = scale % divisor;
+    if (r < 0) {
+        r += divisor;
+        q -= 1;
+    }
+    double logRoot = -(log10(lead) + (double)r) / (double)n;
+    double whole = floor(logRoot);
+    double leading = pow(10.0, logRoot - whole); // In [1, 10)
     
-    string intA = (dotA == string::npos) ? a : a.substr(0, dotA);
-    string intB = (dotB == string::npos) ? b : b.substr(0, dotB);
+    BigInt mantissa((long long)llround(leading * 1e15));
+    return normalizeFloat(BigFloat(mantissa, (long long)whole - 15 - q));
+}
+
+BigFloat inverseNthRoot(const BigFloat& x, unsigned long long n, size_t digits) {
+    if (n == 0) throw domain_error("Cannot take 0th root");
+    if (x.isZero()) throw domain_error("Division by zero");
+    if (x.mantissa.negative) throw domain_error("Root of negative number");
+    return inverseNthRoot(x, n, digits, seedInverseRoot(x, n), SEED_DIGITS);
+}
+
+BigFloat inverseNthRoot(const BigFloat& x, unsigned long long n, size_t digits,
+                        const BigFloat& seed, size_t seedDigits) {
+    if (n == 0) throw domain_error("Cannot take 0th root");
+    if (x.isZero()) throw domain_error("Division by zero");
+    if (x.mantissa.negative) throw domain_error("Root of negative number");
+    
+    // Precision schedule: each Newton step roughly doubles the correct digits,
+    // so only the last step runs at the full target precision
+    vector<size_t> schedule;
+    for (size_t p = digits + GUARD_DIGITS; p > seedDigits; p = p / 2 + 1) {
+        schedule.push_back(p);
+    }
+    reverse(schedule.begin(), schedule.end());
+    
+    // y <- y + y * (1 - x * y^n) / n converges to x^(-1/n) without dividing by x
+    BigFloat y = seed;
+    BigFloat one(BigInt(1));
+    BigFloat divisor{BigInt((long long)min<unsigned long long>(n, LLONG_MAX))};
+    for (size_t p : schedule) {
+        checkCancelled();
+        size_t working = p + GUARD_DIGITS;
+        BigFloat xp = truncateToDigits(x, working);
+        BigFloat residual = subtract(one, truncateToDigits(multiply(xp, powerTruncated(y, n, working)), working));
+        BigFloat correction = truncateToDigits(multiply(y, residual), working);
+        if (n > 1) correction = divide(correction, divisor, working); // Small integer divisor
+        y = truncateToDigits(add(y, correction), working);
+    }
+    return roundToDigits(y, digits);
+}
+
+BigFloat nthRoot(const BigFloat& x, unsigned long long n, size_t digits) {
+    if (n == 0) throw domain_error("Cannot take 0th root");
+    if (x.isZero()) return BigFloat();
+    if (x.mantissa.negative) throw domain_error("Root of negative number");
+    if (n == 1) return roundToDigits(x, digits);
+    
+    // x^(1/n) = x * x^(-(n-1)/n) = x * y^(n-1)
+    size_t working = digits + GUARD_DIGITS;
+    BigFloat y = inverseNthRoot(x, n, working);
+    BigFloat result = multiply(truncateToDigits(x, working), powerTruncated(y, n - 1, working));
+    return roundToDigits(result, digits);
+}
+
+BigFloat squareRoot(const BigFloat& x, size_t digits) {
+    return nthRoot(x, 2, digits);
+}
+
+string squareRoot(const string& number) {
+    return memoize("sqrt", number, [&] {
+        if (!isValidNumber(number)) throw invalid_argument("Invalid input for square root");
+        BigFloat value = parseBigFloat(number);
+        if (value.mantissa.negative) throw domain_error("Square root of negative number is undefined in real numbers");
+        return formatBigFloat(squareRoot(value, workingPrecision()));
+    });
+}
+
+long long decimalMagnitude(const BigFloat& x) {
+    return x.exponent + (long long)x.mantissa.digitCount() - 1;
+}
+
+// Nearest double; only used for seeds and range estimates
+static double toDouble(const BigFloat& x) {
+    size_t length = x.mantissa.digitCount();
+    size_t dropped = length > 17 ? length - 17 : 0;
+    double lead = stod(shiftDecimalRight(x.mantissa, dropped).toString());
+    return lead * pow(10.0, (double)(x.exponent + (long long)dropped));
+}
+
+static BigFloat fromDouble(double value) {
+    if (value == 0.0) return BigFloat();
+    int scale = (int)floor(log10(fabs(value))) - 16;
+    return normalizeFloat(BigFloat(BigInt((long long)llround(value / pow(10.0, (double)scale))), scale));
+}
+
+// Highest-precision value of a constant computed so far; lower precisions are
+// served by rounding it, higher ones recompute and replace it
+struct ConstantCache {
+    const char* name;
+    mutex lock;
+    BigFloat value;
+    size_t digits = 0;
+    bool consultedSource = false;
+    
+    explicit ConstantCache(const char* name) : name(name) {}
+};
+
+static mutex constantSourceLock;
+static ConstantSource constantSource;
+
+void setConstantSource(ConstantSource source) {
+    lock_guard<mutex> guard(constantSourceLock);
+    constantSource = std::move(source);
+}
+
+// Caller holds the cache lock. Adopts a stored value the first time the
+// constant is used
+static void consultConstantSource(ConstantCache& cache) {
+    if (cache.consultedSource) return;
+    cache.consultedSource = true;
+    ConstantSource source;
+    {
+        lock_guard<mutex> guard(constantSourceLock);
+        source = constantSource;
+    }
+    CachedConstant stored;
+    if (source && source(cache.name, stored) && stored.digits > cache.digits) {
+        cache.value = stored.value;
+        cache.digits = stored.digits;
+    }
+}
+
+static BigFloat cachedConstant(ConstantCache& cache, size_t digits, BigFloat (*compute)(size_t)) {
+    {
+        lock_guard<mutex> guard(cache.lock);
+        consultConstantSource(cache);
+        if (cache.digits >= digits) return roundToDigits(cache.value, digits);
+    }
+    BigFloat value = compute(digits + GUARD_DIGITS);
+    lock_guard<mutex> guard(cache.lock);
+    if (digits + GUARD_DIGITS > cache.digits) {
+        cache.value = value;
+        cache.digits = digits + GUARD_DIGITS;
+    }
+    return roundToDigits(value, digits);
+}
+
+// atanh(1/m) = sum 1/((2k+1) m^(2k+1)), or atan(1/m) with alternating signs;
+// every step divides by small integers only
+static BigFloat reciprocalSeries(unsigned m, size_t digits, bool alternating) {
+    size_t working = digits + GUARD_DIGITS;
+    BigFloat power = divide(BigFloat(BigInt(1)), BigFloat(BigInt(m)), working);
+    BigFloat square(BigInt((long long)m * m));
+    BigFloat sum = power;
+    bool negative = false;
+    for (unsigned long long k = 3; ; k += 2) {
+        checkCancelled();
+        power = divide(power, square, working);
+        BigFloat term = divide(power, BigFloat(BigInt((long long)k)), working);
+        if (term.isZero() || decimalMagnitude(term) < -(long long)working) break;
+        negative = alternating && !negative;
+        sum = truncateToDigits(negative ? subtract(sum, term) : add(sum, term), working);
+    }
+    return sum;
+}
+
+static BigFloat atanhReciprocal(unsigned m, size_t digits) {
+    return reciprocalSeries(m, digits, false);
+}
+
+// ln 2 = 2 atanh(1/3)
+static BigFloat computeLn2(size_t digits) {
+    return roundToDigits(multiply(BigFloat(BigInt(2)), atanhReciprocal(3, digits)), digits);
+}
+
+// ln 10 = 3 ln 2 + ln(5/4) = 6 atanh(1/3) + 2 atanh(1/9)
+static BigFloat computeLn10(size_t digits) {
+    BigFloat sum = add(multiply(BigFloat(BigInt(6)), atanhReciprocal(3, digits)),
+                       multiply(BigFloat(BigInt(2)), atanhReciprocal(9, digits)));
+    return roundToDigits(sum, digits);
+}
+
+// Machin: pi = 16 atan(1/5) - 4 atan(1/239)
+static BigFloat computePi(size_t digits) {
+    BigFloat sum = subtract(multiply(BigFloat(BigInt(16)), reciprocalSeries(5, digits, true)),
+                            multiply(BigFloat(BigInt(4)), reciprocalSeries(239, digits, true)));
+    return roundToDigits(sum, digits);
+}
+
+static ConstantCache ln2Cache("ln2");
+static ConstantCache ln10Cache("ln10");
+static ConstantCache piCache("pi");
+static ConstantCache twoOverPiCache("2/pi");
+
+vector<CachedConstant> cachedConstants() {
+    vector<CachedConstant> constants;
+    for (ConstantCache* cache : {&ln2Cache, &ln10Cache, &piCache, &twoOverPiCache}) {
+        lock_guard<mutex> guard(cache->lock);
+        // Stored values not used in this run are kept too
+        consultConstantSource(*cache);
+        if (cache->digits > 0) constants.push_back(CachedConstant{cache->name, cache->digits, cache->value});
+    }
+    return constants;
+}
+
+BigFloat constantLn2(size_t digits) {
+    return cachedConstant(ln2Cache, digits, computeLn2);
+}
+
+BigFloat constantLn10(size_t digits) {
+    return cachedConstant(ln10Cache, digits, computeLn10);
+}
+
+BigFloat constantPi(size_t digits) {
+    return cachedConstant(piCache, digits, computePi);
+}
+
+static BigFloat computeTwoOverPi(size_t digits) {
+    return divide(BigFloat(BigInt(2)), constantPi(digits + GUARD_DIGITS), digits);
+}
+
+// Digits of 2/pi for argument reduction. The table only ever grows, by at
+// least doubling, so a run of larger and larger arguments recomputes it a
+// few times rather than once per argument
+static BigFloat constantTwoOverPi(size_t digits) {
+    size_t held;
+    {
+        lock_guard<mutex> guard(twoOverPiCache.lock);
+        consultConstantSource(twoOverPiCache);
+        held = twoOverPiCache.digits;
+    }
+    size_t requested = digits;
+    if (held < digits) requested = max(digits, 2 * held);
+    return roundToDigits(cachedConstant(twoOverPiCache, requested, computeTwoOverPi), digits);
+}
+
+// Taylor series of exp for small |t|; terms shrink fast enough to stop early
+static BigFloat exponentialSeries(const BigFloat& t, size_t digits) {
+    BigFloat sum(BigInt(1));
+    BigFloat term(BigInt(1));
+    for (long long n = 1; ; n++) {
+        checkCancelled();
+        term = divide(truncateToDigits(multiply(term, t), digits), BigFloat(BigInt(n)), digits);
+        if (term.isZero() || decimalMagnitude(term) < -(long long)digits - 1) break;
+        sum = truncateToDigits(add(sum, term), digits);
+    }
+    return sum;
+}
+
+BigFloat exponential(const BigFloat& x, size_t digits) {
+    if (x.isZero()) return BigFloat(BigInt(1));
+    
+    long long magnitude = decimalMagnitude(x);
+    if (magnitude > 17) throw overflow_error("exp argument too large");
+    
+    // exp(x) = 10^k * exp(x - k ln 10): the power of ten is only an exponent shift
+    long long k = magnitude < 0 ? 0 : llround(toDouble(x) / 2.302585092994046);
+    size_t kDigits = k == 0 ? 0 : (size_t)BigInt(k).digitCount();
+    size_t working = digits + GUARD_DIGITS + kDigits;
+    BigFloat reduced = truncateToDigits(x, working + (size_t)max(0LL, magnitude + 1));
+    if (k != 0) {
+        reduced = subtract(reduced, multiply(BigFloat(BigInt(k)), constantLn10(working + kDigits)));
+        reduced = truncateToDigits(reduced, working + 2);
+    }
     
-    string decA = (dotA == string::npos) ? "" : a.substr(dotA + 1);
-    string decB = (dotB == string::npos) ? "" : b.substr(dotB + 1);
+    // Halve the argument s times (exactly: t = r * 5^s / 10^s), sum the short
+    // series, then square s times; s ~ sqrt(digits) balances both phases
+    size_t halvings = (size_t)sqrt((double)working) + 1;
+    size_t squaringDigits = working + halvings / 3 + 1;
+    BigFloat t = multiply(reduced, power(BigFloat(BigInt(5)), halvings));
+    t.exponent -= (long long)halvings;
+    BigFloat result = exponentialSeries(truncateToDigits(t, squaringDigits), squaringDigits);
+    for (size_t i = 0; i < halvings; i++) {
+        checkCancelled();
+        result = truncateToDigits(multiply(result, result), squaringDigits);
+    }
     
-    // Pad decimal parts
-    int maxDecLen = max(decA.length(), decB.length());
-    decA.resize(maxDecLen, '0');
-    decB.resize(maxDecLen, '0');
+    result.exponent += k;
+    return roundToDigits(result, digits);
+}
+
+// ln f for f near 1 by Newton's iteration y <- y + f*exp(-y) - 1, which needs
+// no division and doubles the correct digits per step
+static BigFloat logNearOne(const BigFloat& f, size_t digits) {
+    BigFloat one(BigInt(1));
+    BigFloat difference = subtract(f, one);
+    if (difference.isZero()) return BigFloat();
+    
+    // ln f ~ f - 1, so digits lost to cancellation are the leading zeros of f - 1
+    long long cancellation = max(0LL, -decimalMagnitude(difference));
+    BigFloat y;
+    if (cancellation > 8) {
+        // ln(1+d) = d - d^2/2 + ... is already accurate to ~2*cancellation digits
+        BigFloat halfSquare = multiply(multiply(difference, difference), BigFloat(BigInt(5), -1));
+        y = truncateToDigits(subtract(difference, halfSquare), 2 * (size_t)cancellation);
+        if ((size_t)cancellation * 2 >= digits + GUARD_DIGITS) return roundToDigits(y, digits);
+    } else {
+        y = fromDouble(log(toDouble(f)));
+    }
     
-    // Pad integer parts
-    int maxIntLen = max(intA.length(), intB.length());
-    intA = string(maxIntLen - intA.length(), '0') + intA;
-    intB = string(maxIntLen - intB.length(), '0') + intB;
+    vector<size_t> schedule;
+    for (size_t p = digits + GUARD_DIGITS; p > SEED_DIGITS; p = p / 2 + 1) {
+        schedule.push_back(p);
+    }
+    reverse(schedule.begin(), schedule.end());
+    
+    for (size_t p : schedule) {
+        checkCancelled();
+        size_t working = p + GUARD_DIGITS + (size_t)cancellation;
+        BigFloat scaled = multiply(truncateToDigits(f, working), exponential(BigFloat(-y.mantissa, y.exponent), working));
+        y = add(y, subtract(truncateToDigits(scaled, working), one));
+        y = truncateToDigits(y, working);
+    }
+    return roundToDigits(y, digits);
+}
+
+BigFloat naturalLog(const BigFloat& x, size_t digits) {
+    if (x.isZero() || x.mantissa.negative) throw domain_error("Logarithm of non-positive number");
+    
+    // x = f * 10^e with f in [1/sqrt(10), sqrt(10)): ln x = ln f + e ln 10
+    long long e = decimalMagnitude(x);
+    BigFloat f(x.mantissa, x.exponent - e);
+    if (toDouble(f) >= 3.1622776601683795) {
+        f.exponent -= 1;
+        e += 1;
+    }
     
-    string fullA = intA + decA;
-    string fullB = intB + decB;
+    if (e == 0) return logNearOne(f, digits);
+    size_t eDigits = (size_t)BigInt(e).digitCount();
+    size_t working = digits + GUARD_DIGITS;
+    BigFloat result = add(logNearOne(f, working),
+                          multiply(BigFloat(BigInt(e)), constantLn10(working + eDigits)));
+    return roundToDigits(result, digits);
+}
+
+// Largest denominator q for which x^(p/q) is taken as a root and a power
+static const long long SMALL_DENOMINATOR_LIMIT = 1000;
+
+// Recognise y as p/q with a small q: either exactly, or - for decimals as long
+// as a quotient - as the small fraction whose truncation or rounding y is
+// (0.333333333333333 -> 1/3, 0.666666666666666666666666666667 -> 2/3)
+static bool smallRational(const BigFloat& y, long long& p, long long& q) {
+    if (y.exponent >= 0) return false;
+    
+    BigInt magnitude = absValue(y.mantissa);
+    BigInt scale = shiftDecimal(BigInt(1), (size_t)-y.exponent);
+    BigInt divisor = gcd(magnitude, scale);
+    BigInt numerator = magnitude / divisor;
+    BigInt denominator = scale / divisor;
+    BigInt limit(SMALL_DENOMINATOR_LIMIT);
+    
+    if (denominator <= limit) {
+        if (numerator.digitCount() > 15) return false;
+        p = stoll(numerator.toString());
+        q = stoll(denominator.toString());
+    } else if (-y.exponent >= DIVISION_DECIMAL_PLACES) {
+        // Continued-fraction convergents of |y|; accept the first p/q with
+        // |y| <= p/q < |y| + 10^exponent, one that truncates to |y|, or with
+        // |p/q - |y|| <= 10^exponent / 2, one that rounds to it
+        BigInt a = numerator, b = denominator;
+        BigInt pPrev(1), pCur, qPrev(0), qCur(1);
+        pCur = a / b;
+        BigInt remainder = a % b;
+        bool found = false;
+        while (qCur <= limit) {
+            BigInt gap = pCur * scale - magnitude * qCur;
+            if (gap.negative ? -(gap + gap) <= qCur : gap < qCur) {
+                found = true;
+                break;
+            }
+            if (remainder.isZero()) break;
+            a = b;
+            b = remainder;
+            BigInt term = a / b;
+            remainder = a % b;
+            BigInt pNext = term * pCur + pPrev;
+            BigInt qNext = term * qCur + qPrev;
+            pPrev = pCur; pCur = pNext;
+            qPrev = qCur; qCur = qNext;
+        }
+        if (!found || pCur.digitCount() > 15) return false;
+        p = stoll(pCur.toString());
+        q = stoll(qCur.toString());
+    } else {
+        return false;
+    }
+    if (y.mantissa.negative) p = -p;
+    return true;
+}
+
+BigFloat power(const BigFloat& base, const BigFloat& exponent, size_t digits) {
+    BigFloat one(BigInt(1));
+    if (exponent.isZero()) return one;
+    if (base.isZero()) {
+        if (exponent.mantissa.negative) throw domain_error("0 to negative power is undefined");
+        return BigFloat();
+    }
     
-    string result = "";
-    int borrow = 0;
+    long long p = 0, q = 1;
+    bool integral = exponent.exponent >= 0 && decimalMagnitude(exponent) < 18;
+    if (integral) {
+        p = stoll(shiftDecimal(exponent.mantissa, (size_t)exponent.exponent).toString());
+    }
     
-    // Subtract from right to left
-    for (int i = fullA.length() - 1; i >= 0; i--) {
-        int diff = (fullA[i] - '0') - (fullB[i] - '0') - borrow;
-        if (diff < 0) {
-            diff += 10;
-            borrow = 1;
-        } else {
-            borrow = 0;
+    // Exact short-cuts: integer powers and small-denominator rationals are a
+    // root followed by a power, with guard digits for the power's error growth
+    if (integral || smallRational(exponent, p, q)) {
+        bool negativeBase = base.mantissa.negative;
+        if (negativeBase && q % 2 == 0) {
+            throw domain_error("Even root of negative number is undefined in real numbers");
         }
-        result = char(diff + '0') + result;
+        unsigned long long magnitudeP = p < 0 ? 0ULL - (unsigned long long)p : (unsigned long long)p;
+        size_t working = digits + GUARD_DIGITS + (size_t)BigInt((long long)magnitudeP).digitCount();
+        BigFloat absBase = base;
+        absBase.mantissa.negative = false;
+        BigFloat root = q == 1 ? absBase : nthRoot(absBase, (unsigned long long)q, working);
+        BigFloat result = powerTruncated(root, magnitudeP, working);
+        if (p < 0) result = divide(one, result, working);
+        if (negativeBase && magnitudeP % 2 == 1) result.mantissa = -result.mantissa;
+        return roundToDigits(result, digits);
     }
     
-    // Insert decimal point
-    if (maxDecLen > 0) {
-        result = result.substr(0, result.length() - maxDecLen) + "." + result.substr(result.length() - maxDecLen);
+    if (base.mantissa.negative) {
+        throw domain_error("Negative base with irrational exponent has no real value");
     }
     
-    return removeTrailingZeros(removeLeadingZeros(result));
+    // General case: x^y = exp(y ln x). y ln x needs as many extra digits as its
+    // integer part has, so estimate that first and refine ln x only if needed
+    size_t working = digits + GUARD_DIGITS;
+    BigFloat logBase = naturalLog(base, working);
+    BigFloat argument = multiply(truncateToDigits(exponent, working), logBase);
+    long long magnitude = argument.isZero() ? 0 : decimalMagnitude(argument);
+    if (magnitude > 0) {
+        working += (size_t)magnitude + 1;
+        logBase = naturalLog(base, working);
+        argument = multiply(truncateToDigits(exponent, working), logBase);
+    }
+    return exponential(truncateToDigits(argument, working), digits);
 }
 
-// Multiply using pen-and-pencil long multiplication
-string multiplyPositive(const string& a, const string& b) {
-    if (a == "0" || b == "0") return "0";
-    
-    // Remove decimal points and count decimal places
-    string numA = a, numB = b;
-    int decPlacesA = 0, decPlacesB = 0;
-    
-    size_t dotA = numA.find('.');
-    if (dotA != string::npos) {
-        decPlacesA = numA.length() - dotA - 1;
-        numA.erase(dotA, 1);
+string exponential(const string& number) {
+    return memoize("exp", number, [&] {
+        if (!isValidNumber(number)) throw invalid_argument("Invalid input for exp");
+        return formatBigFloat(exponential(parseBigFloat(number), workingPrecision()));
+    });
+}
+
+string naturalLog(const string& number) {
+    return memoize("ln", number, [&] {
+        if (!isValidNumber(number)) throw invalid_argument("Invalid input for ln");
+        return formatBigFloat(naturalLog(parseBigFloat(number), workingPrecision()));
+    });
+}
+
+static string commonLogUncached(const string& number) {
+    if (!isValidNumber(number)) throw invalid_argument("Invalid input for log");
+    size_t working = workingPrecision() + GUARD_DIGITS;
+    BigFloat value = parseBigFloat(number);
+    
+    // Exact powers of ten have integer logarithms
+    if (!value.mantissa.negative && value.mantissa == BigInt(1)) {
+        return to_string(value.exponent);
     }
-    
-    size_t dotB = numB.find('.');
-    if (dotB != string::npos) {
-        decPlacesB = numB.length() - dotB - 1;
-        numB.erase(dotB, 1);
+    BigFloat result = divide(naturalLog(value, working), constantLn10(working), working);
+    return formatBigFloat(roundToDigits(result, workingPrecision()));
+}
+
+string commonLog(const string& number) {
+    return memoize("log", number, [&] { return commonLogUncached(number); });
+}
+
+// Arguments whose integer part has more digits than this are rejected by the
+// trigonometric functions instead of reducing against that many digits of 2/pi
+static const long long MAX_TRIG_ARGUMENT_MAGNITUDE = 100000;
+
+// sin t and 1 - cos t for |t| <= pi/4: the argument is halved s times, both
+// series are summed, then sin 2t = 2 sin t (1 - v) and v' = 2 sin^2 t undo the
+// halvings. Keeping 1 - cos t instead of cos t avoids cancellation near zero
+static void sineVersine(const BigFloat& t, size_t digits, BigFloat& sine, BigFloat& versine) {
+    size_t halvings = (size_t)sqrt((double)digits) / 2 + 1;
+    size_t working = digits + halvings / 3 + 2;
+    BigFloat small = multiply(t, power(BigFloat(BigInt(5)), halvings));
+    small.exponent -= (long long)halvings;
+    small = truncateToDigits(small, working);
+    BigFloat square = truncateToDigits(multiply(small, small), working);
+    
+    sine = small;
+    versine = truncateToDigits(multiply(square, BigFloat(BigInt(5), -1)), working);
+    BigFloat sineTerm = small, versineTerm = versine;
+    for (long long n = 1; ; n++) {
+        checkCancelled();
+        sineTerm = divide(truncateToDigits(multiply(sineTerm, square), working),
+                          BigFloat(BigInt(-(2 * n) * (2 * n + 1))), working);
+        versineTerm = divide(truncateToDigits(multiply(versineTerm, square), working),
+                             BigFloat(BigInt(-(2 * n + 1) * (2 * n + 2))), working);
+        bool sineDone = sineTerm.isZero() || decimalMagnitude(sineTerm) < decimalMagnitude(sine) - (long long)working - 1;
+        if (!sineTerm.isZero()) sine = truncateToDigits(add(sine, sineTerm), working);
+        if (!versineTerm.isZero()) versine = truncateToDigits(add(versine, versineTerm), working);
+        if (sineDone) break;
     }
     
-    // Remove leading zeros
-    numA = removeLeadingZeros(numA);
-    numB = removeLeadingZeros(numB);
-    
-    // Multiply as integers
-    vector<int> result(numA.length() + numB.length(), 0);
+    BigFloat one(BigInt(1)), two(BigInt(2));
+    for (size_t i = 0; i < halvings; i++) {
+        checkCancelled();
+        BigFloat doubled = truncateToDigits(multiply(two, multiply(sine, subtract(one, versine))), working);
+        versine = truncateToDigits(multiply(two, multiply(sine, sine)), working);
+        sine = doubled;
+    }
+}
+
+// Round half away from zero to an integer
+static BigInt nearestInteger(const BigFloat& x) {
+    if (x.exponent >= 0) return shiftDecimal(x.mantissa, (size_t)x.exponent);
+    size_t places = (size_t)-x.exponent;
+    BigInt half = shiftDecimal(BigInt(5), places - 1);
+    BigInt magnitude = shiftDecimalRight(absValue(x.mantissa) + half, places);
+    return x.mantissa.negative ? -magnitude : magnitude;
+}
+
+// x 2/pi modulo 4, about `places` digits after the point. Payne-Hanek: with
+// x = M 10^e and 2/pi = T 10^q, every digit of T worth 100 or more in
+// M T 10^(e+q) contributes a multiple of 4, so only the digits of T from the
+// tens place down are multiplied by M. That product has the digits of M plus
+// `places` and a few more, however large e is
+static BigFloat quarterTurns(const BigFloat& x, long long magnitude, size_t places) {
+    size_t tableDigits = (size_t)max(0LL, magnitude) + places + 3;
+    BigFloat twoOverPi = constantTwoOverPi(tableDigits);
+    long long scale = x.exponent + twoOverPi.exponent;
+    BigInt kept = twoOverPi.mantissa;
+    size_t low = scale >= 2 ? 0 : (size_t)(2 - scale);
+    if (low < kept.digitCount()) kept = kept - shiftDecimal(shiftDecimalRight(kept, low), low);
+    return BigFloat(x.mantissa * kept, scale);
+}
+
+// sin and cos from a reduced angle |r| <= pi/4 (in radians) and the number
+// of quarter turns taken off
+static void sineCosineOfQuadrant(const BigFloat& reduced, long long quadrant, size_t digits,
+                                 BigFloat& sine, BigFloat& cosine) {
+    size_t working = digits + GUARD_DIGITS;
+    BigFloat s, c(BigInt(1));
+    if (!reduced.isZero()) {
+        BigFloat v;
+        sineVersine(reduced, working, s, v);
+        c = subtract(c, v);
+    }
+    switch (quadrant) {
+        case 0: sine = s; cosine = c; break;
+        case 1: sine = c; cosine = BigFloat(-s.mantissa, s.exponent); break;
+        case 2: sine = BigFloat(-s.mantissa, s.exponent); cosine = BigFloat(-c.mantissa, c.exponent); break;
+        default: sine = BigFloat(-c.mantissa, c.exponent); cosine = s; break;
+    }
+    sine = roundToDigits(sine, digits);
+    cosine = roundToDigits(cosine, digits);
+}
+
+// Quadrant of k quarter turns: k modulo 4, also for negative k
+static long long quadrantOf(const BigInt& k) {
+    long long quadrant = stoll((absValue(k) % BigInt(4)).toString());
+    if (k.negative && quadrant != 0) quadrant = 4 - quadrant;
+    return quadrant;
+}
+
+// x = k pi/2 + r with |r| <= pi/4. r is (x 2/pi - k) pi/2, so the fraction
+// of x 2/pi needs the digits of r plus whatever r lost to cancellation
+static void sineCosineRadians(const BigFloat& x, size_t digits, BigFloat& sine, BigFloat& cosine) {
+    long long magnitude = decimalMagnitude(x);
+    if (magnitude > MAX_TRIG_ARGUMENT_MAGNITUDE) throw overflow_error("Trigonometric argument too large");
+    size_t working = digits + GUARD_DIGITS;
+    if (magnitude < 0) {
+        sineCosineOfQuadrant(x, 0, digits, sine, cosine);
+        return;
+    }
     
-    // Multiply each digit
-    for (int i = numA.length() - 1; i >= 0; i--) {
-        for (int j = numB.length() - 1; j >= 0; j--) {
-            int mul = (numA[i] - '0') * (numB[j] - '0');
-            int pos1 = i + j;
-            int pos2 = i + j + 1;
-            
-            int sum = mul + result[pos2];
-            result[pos2] = sum % 10;
-            result[pos1] += sum / 10;
+    BigFloat fraction;
+    long long quadrant = 0;
+    long long cancellation = 0;
+    for (int pass = 0; pass < 2; pass++) {
+        BigFloat turns = quarterTurns(x, magnitude, working + (size_t)cancellation + 2);
+        BigInt k = nearestInteger(turns);
+        fraction = subtract(turns, BigFloat(k));
+        quadrant = quadrantOf(k);
+        long long lost = fraction.isZero() ? 0 : max(0LL, -decimalMagnitude(fraction));
+        if (lost <= cancellation) break;
+        cancellation = lost;
+    }
+    BigFloat halfPi = multiply(constantPi(working), BigFloat(BigInt(5), -1));
+    BigFloat reduced = truncateToDigits(multiply(truncateToDigits(fraction, working), halfPi), working);
+    sineCosineOfQuadrant(reduced, quadrant, digits, sine, cosine);
+}
+
+// Degrees or grads in a right angle
+static long long rightAngle(AngleUnit unit) {
+    return unit == ANGLE_DEGREES ? 90 : 100;
+}
+
+// x modulo m, exactly, in [0, m). A large power of ten in x costs a modular
+// power instead of the digits it stands for
+static BigFloat decimalModulo(const BigFloat& x, long long m) {
+    BigInt magnitude = absValue(x.mantissa);
+    BigInt remainder;
+    if (x.exponent >= 0) {
+        long long powerOfTen = 1 % m, base = 10 % m;
+        for (long long e = x.exponent; e > 0; e >>= 1) {
+            if (e & 1) powerOfTen = powerOfTen * base % m;
+            base = base * base % m;
         }
+        long long low = stoll((magnitude % BigInt(m)).toString());
+        remainder = BigInt(low * powerOfTen % m);
+        if (x.mantissa.negative && !remainder.isZero()) remainder = BigInt(m) - remainder;
+        return BigFloat(remainder);
     }
-    
-    // Convert result to string
-    string resultStr = "";
-    bool leadingZero = true;
-    for (int i = 0; i < result.size(); i++) {
-        if (result[i] != 0) leadingZero = false;
-        if (!leadingZero) resultStr += char(result[i] + '0');
+    BigInt modulus = shiftDecimal(BigInt(m), (size_t)-x.exponent);
+    remainder = magnitude % modulus;
+    if (x.mantissa.negative && !remainder.isZero()) remainder = modulus - remainder;
+    return BigFloat(remainder, x.exponent);
+}
+
+// Degrees and grads: a whole turn is taken off exactly, then the nearest
+// number of right angles, leaving |t| at most half a right angle. Exact
+// multiples of a right angle give exact 0 and 1
+static void sineCosineInUnit(const BigFloat& x, AngleUnit unit, size_t digits, BigFloat& sine, BigFloat& cosine) {
+    long long right = rightAngle(unit);
+    BigFloat turn = decimalModulo(x, 4 * right);
+    BigInt k = nearestInteger(divide(turn, BigFloat(BigInt(right)), (size_t)max(1LL, decimalMagnitude(turn)) + 4));
+    BigFloat t = subtract(turn, multiply(BigFloat(k), BigFloat(BigInt(right))));
+    size_t working = digits + GUARD_DIGITS;
+    BigFloat reduced;
+    if (!t.isZero()) {
+        // t pi / (2 right)
+        BigFloat perUnit = divide(constantPi(working), BigFloat(BigInt(2 * right)), working);
+        reduced = truncateToDigits(multiply(truncateToDigits(t, working), perUnit), working);
+    }
+    sineCosineOfQuadrant(reduced, quadrantOf(k), digits, sine, cosine);
+}
+
+void sineCosine(const BigFloat& x, size_t digits, BigFloat& sine, BigFloat& cosine, AngleUnit unit) {
+    if (x.isZero()) {
+        sine = BigFloat();
+        cosine = BigFloat(BigInt(1));
+        return;
+    }
+    if (unit == ANGLE_RADIANS) {
+        sineCosineRadians(x, digits, sine, cosine);
+    } else {
+        sineCosineInUnit(x, unit, digits, sine, cosine);
+    }
+}
+
+BigFloat sine(const BigFloat& x, size_t digits, AngleUnit unit) {
+    BigFloat s, c;
+    sineCosine(x, digits, s, c, unit);
+    return s;
+}
+
+BigFloat cosine(const BigFloat& x, size_t digits, AngleUnit unit) {
+    BigFloat s, c;
+    sineCosine(x, digits, s, c, unit);
+    return c;
+}
+
+BigFloat tangent(const BigFloat& x, size_t digits, AngleUnit unit) {
+    BigFloat s, c;
+    sineCosine(x, digits + GUARD_DIGITS, s, c, unit);
+    if (c.isZero()) throw domain_error("Tangent undefined at odd multiples of pi/2");
+    return divide(s, c, digits);
+}
+
+// An angle in radians converted to the unit. Degrees and grads are rounded
+// at the end only, so asin 0.5 comes out as 30 rather than 29.999...
+static BigFloat fromRadians(const BigFloat& radians, AngleUnit unit, size_t digits) {
+    if (unit == ANGLE_RADIANS || radians.isZero()) return roundToDigits(radians, digits);
+    size_t working = digits + GUARD_DIGITS;
+    BigFloat halfTurn(BigInt(2 * rightAngle(unit)));
+    return roundToDigits(divide(multiply(radians, halfTurn), constantPi(working), working), digits);
+}
+
+BigFloat arctangent(const BigFloat& x, size_t digits, AngleUnit unit) {
+    if (unit != ANGLE_RADIANS) return fromRadians(arctangent(x, digits + GUARD_DIGITS), unit, digits);
+    if (x.isZero()) return BigFloat();
+    if (x.mantissa.negative) {
+        BigFloat result = arctangent(BigFloat(-x.mantissa, x.exponent), digits);
+        return BigFloat(-result.mantissa, result.exponent);
     }
     
-    if (resultStr.empty()) resultStr = "0";
+    size_t working = digits + GUARD_DIGITS;
+    BigFloat one(BigInt(1));
+    int side = compare(x.exponent >= 0 ? shiftDecimal(x.mantissa, (size_t)x.exponent) : x.mantissa,
+                       x.exponent >= 0 ? BigInt(1) : shiftDecimal(BigInt(1), (size_t)-x.exponent));
+    if (side == 0) return roundToDigits(multiply(constantPi(working), BigFloat(BigInt(25), -2)), digits);
+    if (side > 0) {
+        // atan x = pi/2 - atan(1/x); the result is above pi/4, so no cancellation
+        BigFloat halfPi = multiply(constantPi(working), BigFloat(BigInt(5), -1));
+        BigFloat result = subtract(halfPi, arctangent(divide(one, x, working), working));
+        return roundToDigits(result, digits);
+    }
     
-    // Insert decimal point
-    int totalDecPlaces = decPlacesA + decPlacesB;
-    if (totalDecPlaces > 0) {
-        if (totalDecPlaces >= resultStr.length()) {
-            resultStr = "0." + string(totalDecPlaces - resultStr.length(), '0') + resultStr;
-        } else {
-            resultStr = resultStr.substr(0, resultStr.length() - totalDecPlaces) + "." + 
-                       resultStr.substr(resultStr.length() - totalDecPlaces);
-        }
+    // atan t = 2 atan(t / (1 + sqrt(1 + t^2))) until t is small enough for
+    // the alternating series to converge quickly
+    BigFloat t = truncateToDigits(x, working);
+    unsigned doublings = 0;
+    while (decimalMagnitude(t) > -3) {
+        checkCancelled();
+        BigFloat root = squareRoot(add(one, multiply(t, t)), working);
+        t = divide(t, add(one, root), working);
+        doublings++;
+    }
+    BigFloat square = truncateToDigits(multiply(t, t), working);
+    BigFloat power = t, sum = t;
+    for (long long k = 3; ; k += 2) {
+        checkCancelled();
+        power = truncateToDigits(multiply(power, square), working);
+        power.mantissa.negative = !power.mantissa.negative;
+        BigFloat term = divide(power, BigFloat(BigInt(k)), working);
+        if (term.isZero() || decimalMagnitude(term) < decimalMagnitude(sum) - (long long)working - 1) break;
+        sum = truncateToDigits(add(sum, term), working);
+    }
+    sum = multiply(sum, BigFloat(BigInt(1LL << doublings)));
+    return roundToDigits(sum, digits);
+}
+
+BigFloat arctangent2(const BigFloat& y, const BigFloat& x, size_t digits) {
+    size_t working = digits + GUARD_DIGITS;
+    if (x.isZero()) {
+        if (y.isZero()) throw domain_error("Argument of zero is undefined");
+        BigFloat halfPi = roundToDigits(multiply(constantPi(working), BigFloat(BigInt(5), -1)), digits);
+        if (y.mantissa.negative) halfPi.mantissa = -halfPi.mantissa;
+        return halfPi;
+    }
+    if (y.isZero()) {
+        return x.mantissa.negative ? constantPi(digits) : BigFloat();
     }
     
-    return removeTrailingZeros(removeLeadingZeros(resultStr));
+    BigFloat angle = arctangent(divide(y, x, working), working);
+    if (x.mantissa.negative) {
+        BigFloat pi = constantPi(working);
+        angle = y.mantissa.negative ? subtract(angle, pi) : add(angle, pi);
+    }
+    return roundToDigits(angle, digits);
+}
+
+// (1 - x)(1 + x) computed exactly, so arcsin and arccos near +-1 keep their digits
+static BigFloat oneMinusSquare(const BigFloat& x) {
+    BigFloat one(BigInt(1));
+    return multiply(subtract(one, x), add(one, x));
+}
+
+BigFloat arcsine(const BigFloat& x, size_t digits, AngleUnit unit) {
+    BigFloat rest = oneMinusSquare(x);
+    if (rest.mantissa.negative) throw domain_error("arcsin argument outside [-1, 1]");
+    size_t working = digits + GUARD_DIGITS;
+    return fromRadians(arctangent2(x, squareRoot(rest, working), working), unit, digits);
+}
+
+BigFloat arccosine(const BigFloat& x, size_t digits, AngleUnit unit) {
+    BigFloat rest = oneMinusSquare(x);
+    if (rest.mantissa.negative) throw domain_error("arccos argument outside [-1, 1]");
+    size_t working = digits + GUARD_DIGITS;
+    if (rest.isZero()) return x.mantissa.negative ? fromRadians(constantPi(working), unit, digits) : BigFloat();
+    return fromRadians(arctangent2(squareRoot(rest, working), x, working), unit, digits);
+}
+
+void hyperbolicSineCosine(const BigFloat& x, size_t digits, BigFloat& sinh, BigFloat& cosh) {
+    if (x.isZero()) {
+        sinh = BigFloat();
+        cosh = BigFloat(BigInt(1));
+        return;
+    }
+    // (e^x - e^-x)/2 cancels for small x; the lost digits are the leading zeros of x
+    long long cancellation = max(0LL, -decimalMagnitude(x));
+    size_t working = digits + GUARD_DIGITS + (size_t)cancellation;
+    BigFloat grow = exponential(x, working);
+    BigFloat shrink = divide(BigFloat(BigInt(1)), grow, working);
+    BigFloat half(BigInt(5), -1);
+    sinh = roundToDigits(multiply(subtract(grow, shrink), half), digits);
+    cosh = roundToDigits(multiply(add(grow, shrink), half), digits);
+}
+
+// Evaluates a trigonometric function of one argument on a number string at
+// the working precision and in the thread's angle unit, memoized under the
+// function's name (the memo key includes both)
+static string applyAngle(const string& number, const char* name,
+                         BigFloat (*function)(const BigFloat&, size_t, AngleUnit)) {
+    return memoize(name, number, [&] {
+        if (!isValidNumber(number)) throw invalid_argument(string("Invalid input for ") + name);
+        return formatBigFloat(function(parseBigFloat(number), workingPrecision(), angleUnit()));
+    });
+}
+
+string sine(const string& number) {
+    return applyAngle(number, "sin", sine);
+}
+
+string cosine(const string& number) {
+    return applyAngle(number, "cos", cosine);
+}
+
+string tangent(const string& number) {
+    return applyAngle(number, "tan", tangent);
+}
+
+string arcsine(const string& number) {
+    return applyAngle(number, "asin", arcsine);
+}
+
+string arccosine(const string& number) {
+    return applyAngle(number, "acos", arccosine);
+}
+
+string arctangent(const string& number) {
+    return applyAngle(number, "atan", arctangent);
+}
+
+static string hyperbolicFunctionUncached(const string& name, const string& number) {
+    if (!isValidNumber(number)) throw invalid_argument("Invalid input for " + name);
+    size_t digits = workingPrecision();
+    BigFloat sinh, cosh;
+    hyperbolicSineCosine(parseBigFloat(number), digits + GUARD_DIGITS, sinh, cosh);
+    if (name == "sinh") return formatBigFloat(roundToDigits(sinh, digits));
+    if (name == "cosh") return formatBigFloat(roundToDigits(cosh, digits));
+    if (name == "tanh") return formatBigFloat(divide(sinh, cosh, digits));
+    throw invalid_argument("Unknown hyperbolic function: " + name);
+}
+
+string hyperbolicFunction(const string& name, const string& number) {
+    return memoize("hyperbolic", name, number, [&] { return hyperbolicFunctionUncached(name, number); });
+}
+
+// Expand a scientific-notation operand to a plain decimal string for the
+// digit-string algorithms that do not handle exponents
+static string toPlainDecimal(const string& number) {
+    if (!isScientific(number)) return number;
+    
+    BigFloat value = parseBigFloat(number);
+    if (value.isZero()) return "0";
+    string digits = absValue(value.mantissa).toString();
+    string sign = value.mantissa.negative ? "-" : "";
+    if (value.exponent >= 0) return sign + digits + string((size_t)value.exponent, '0');
+    
+    long long pointPos = (long long)digits.length() + value.exponent;
+    if (pointPos > 0) return sign + digits.substr(0, (size_t)pointPos) + "." + digits.substr((size_t)pointPos);
+    return sign + "0." + string((size_t)-pointPos, '0') + digits;
+}
+
+// Scratch buffers of the string wrappers, reused by every call on the thread
+static thread_local DecimalBuffer kernelResult;
+static thread_local string kernelRemainder;
+
+static string formatKernelResult() {
+    string text;
+    formatDecimal(kernelResult, text);
+    return text;
+}
+
+// Runs a kernel on two validated plain decimal strings
+static string applyKernel(const string& operand1, const string& operand2,
+                          void (*kernel)(const DecimalView&, const DecimalView&, DecimalBuffer&)) {
+    DecimalView a, b;
+    parseDecimalView(operand1, a);
+    parseDecimalView(operand2, b);
+    kernel(a, b, kernelResult);
+    return formatKernelResult();
 }
 
 // Add function with sign handling
@@ -274,33 +1165,10 @@ string add(const string& operand1, const string& operand2) {
     if (!isValidNumber(operand1)) throw invalid_argument("Invalid first operand: " + operand1);
     if (!isValidNumber(operand2)) throw invalid_argument("Invalid second operand: " + operand2);
     
-    bool neg1 = operand1[0] == '-';
-    bool neg2 = operand2[0] == '-';
-    
-    string abs1 = neg1 ? operand1.substr(1) : operand1;
-    string abs2 = neg2 ? operand2.substr(1) : operand2;
-    
-    if (abs1[0] == '+') abs1 = abs1.substr(1);
-    if (abs2[0] == '+') abs2 = abs2.substr(1);
-    
-    string result;
-    
-    if (neg1 == neg2) {
-        // Same signs: add absolute values
-        result = addPositive(abs1, abs2);
-        if (neg1) result = "-" + result;
-    } else {
-        // Different signs: subtract absolute values
-        if (compareAbs(abs1, abs2) >= 0) {
-            result = subtractPositive(abs1, abs2);
-            if (neg1) result = "-" + result;
-        } else {
-            result = subtractPositive(abs2, abs1);
-            if (neg2) result = "-" + result;
-        }
+    if (isScientific(operand1) || isScientific(operand2)) {
+        return formatBigFloat(add(parseBigFloat(operand1), parseBigFloat(operand2)));
     }
-    
-    return result == "-0" ? "0" : result;
+    return applyKernel(operand1, operand2, addDecimal);
 }
 
 // Subtract function
@@ -308,15 +1176,10 @@ string subtract(const string& operand1, const string& operand2) {
     if (!isValidNumber(operand1)) throw invalid_argument("Invalid first operand: " + operand1);
     if (!isValidNumber(operand2)) throw invalid_argument("Invalid second operand: " + operand2);
     
-    // a - b = a + (-b)
-    string negOperand2 = operand2;
-    if (operand2[0] == '-') {
-        negOperand2 = operand2.substr(1);
-    } else {
-        negOperand2 = "-" + operand2;
+    if (isScientific(operand1) || isScientific(operand2)) {
+        return formatBigFloat(subtract(parseBigFloat(operand1), parseBigFloat(operand2)));
     }
-    
-    return add(operand1, negOperand2);
+    return applyKernel(operand1, operand2, subtractDecimal);
 }
 
 // Multiply function
@@ -324,61 +1187,81 @@ string multiply(const string& operand1, const string& operand2) {
     if (!isValidNumber(operand1)) throw invalid_argument("Invalid first operand: " + operand1);
     if (!isValidNumber(operand2)) throw invalid_argument("Invalid second operand: " + operand2);
     
-    bool neg1 = operand1[0] == '-';
-    bool neg2 = operand2[0] == '-';
-    
-    string abs1 = neg1 ? operand1.substr(1) : operand1;
-    string abs2 = neg2 ? operand2.substr(1) : operand2;
-    
-    if (abs1[0] == '+') abs1 = abs1.substr(1);
-    if (abs2[0] == '+') abs2 = abs2.substr(1);
-    
-    string result = multiplyPositive(abs1, abs2);
-    
-    if (result != "0" && (neg1 != neg2)) {
-        result = "-" + result;
+    if (isScientific(operand1) || isScientific(operand2)) {
+        return formatBigFloat(multiply(parseBigFloat(operand1), parseBigFloat(operand2)));
     }
-    
-    return result;
+    return applyKernel(operand1, operand2, multiplyDecimal);
 }
 
-// Long division helper - divides integer by integer, returns quotient and remainder
-pair<string, string> divideIntegers(const string& dividend, const string& divisor) {
-    if (divisor == "0") throw domain_error("Division by zero");
-    if (dividend == "0") return make_pair("0", "0");
-    
-    // If dividend is smaller than divisor, quotient is 0
-    if (compareAbs(dividend, divisor) < 0) {
-        return make_pair("0", dividend);
+static thread_local ProductAccumulator kernelProducts;
+
+string sumOfProducts(initializer_list<ProductTerm> terms) {
+    bool scientific = false;
+    for (const ProductTerm& term : terms) {
+        const string& b = term.b == nullptr ? *term.a : *term.b;
+        if (!isValidNumber(*term.a)) throw invalid_argument("Invalid first operand: " + *term.a);
+        if (!isValidNumber(b)) throw invalid_argument("Invalid second operand: " + b);
+        scientific = scientific || isScientific(*term.a) || isScientific(b);
     }
     
-    string quotient = "";
-    string remainder = "";
-    
-    // Process each digit of dividend from left to right (like long division)
-    for (int i = 0; i < dividend.length(); i++) {
-        // Bring down next digit
-        remainder += dividend[i];
-        remainder = removeLeadingZeros(remainder);
-        
-        // Find how many times divisor goes into current remainder
-        int count = 0;
-        while (compareAbs(remainder, divisor) >= 0) {
-            remainder = subtractPositive(remainder, divisor);
-            count++;
+    if (scientific) {
+        // Rare; the exact kernel covers plain decimals only
+        BigFloat sum;
+        for (const ProductTerm& term : terms) {
+            BigFloat a = parseBigFloat(*term.a);
+            BigFloat product = term.b == nullptr || term.b == term.a ? multiply(a, a) : multiply(a, parseBigFloat(*term.b));
+            sum = term.subtract ? subtract(sum, product) : add(sum, product);
         }
-        
-        quotient += char(count + '0');
+        return formatBigFloat(sum);
     }
     
-    quotient = removeLeadingZeros(quotient);
-    remainder = removeLeadingZeros(remainder);
+    for (const ProductTerm& term : terms) {
+        DecimalView a;
+        parseDecimalView(*term.a, a);
+        if (term.b == nullptr || term.b == term.a) {
+            kernelProducts.addSquare(a, term.subtract);
+        } else {
+            DecimalView b;
+            parseDecimalView(*term.b, b);
+            kernelProducts.addProduct(a, b, term.subtract);
+        }
+    }
+    kernelProducts.finish(kernelResult);
+    return formatKernelResult();
+}
+
+string dotProduct(const vector<string>& a, const vector<string>& b) {
+    if (a.size() != b.size()) throw invalid_argument("Vectors of different dimensions");
+    for (size_t k = 0; k < a.size(); k++) {
+        if (!isValidNumber(a[k])) throw invalid_argument("Invalid first operand: " + a[k]);
+        if (!isValidNumber(b[k])) throw invalid_argument("Invalid second operand: " + b[k]);
+    }
     
-    return make_pair(quotient, remainder);
+    string sum = "0";
+    for (size_t k = 0; k < a.size(); k++) {
+        if (isScientific(a[k]) || isScientific(b[k])) {
+            // Rare; the exact kernel covers plain decimals only
+            sum = add(sum, multiply(a[k], b[k]));
+            continue;
+        }
+        DecimalView x, y;
+        parseDecimalView(a[k], x);
+        parseDecimalView(b[k], y);
+        kernelProducts.addProduct(x, y);
+    }
+    kernelProducts.finish(kernelResult);
+    return add(sum, formatKernelResult());
+}
+
+// a / b rounded to the working precision, as other inexact results are:
+// 1/3^1000000 is 5.56263209915712886588211486263e-477122, not 0
+static string roundedQuotient(const BigFloat& a, const BigFloat& b) {
+    size_t digits = workingPrecision();
+    return formatBigFloat(roundToDigits(divide(a, b, digits + GUARD_DIGITS), digits));
 }
 
 // Division function using long division algorithm
-string divide(const string& operand1, const string& operand2) {
+static string divideUncached(const string& operand1, const string& operand2) {
     if (!isValidNumber(operand1)) throw invalid_argument("Invalid first operand: " + operand1);
     if (!isValidNumber(operand2)) throw invalid_argument("Invalid second operand: " + operand2);
     
@@ -390,346 +1273,186 @@ string divide(const string& operand1, const string& operand2) {
         return "0";
     }
     
-    // Handle signs
-    bool neg1 = operand1[0] == '-';
-    bool neg2 = operand2[0] == '-';
-    bool resultNegative = (neg1 != neg2);
-    
-    string abs1 = neg1 ? operand1.substr(1) : operand1;
-    string abs2 = neg2 ? operand2.substr(1) : operand2;
-    
-    if (abs1[0] == '+') abs1 = abs1.substr(1);
-    if (abs2[0] == '+') abs2 = abs2.substr(1);
-    
-    // Split into integer and decimal parts
-    size_t dot1 = abs1.find('.');
-    size_t dot2 = abs2.find('.');
-    
-    string int1 = (dot1 == string::npos) ? abs1 : abs1.substr(0, dot1);
-    string dec1 = (dot1 == string::npos) ? "" : abs1.substr(dot1 + 1);
-    
-    string int2 = (dot2 == string::npos) ? abs2 : abs2.substr(0, dot2);
-    string dec2 = (dot2 == string::npos) ? "" : abs2.substr(dot2 + 1);
-    
-    // Convert to integers by removing decimal points
-    // dividend = int1 + dec1, divisor = int2 + dec2
-    string dividend = int1 + dec1;
-    string divisor = int2 + dec2;
-    
-    // Calculate decimal shift needed
-    int decimalShift = dec2.length() - dec1.length();
-    
-    // If divisor has more decimal places, pad dividend with zeros
-    if (decimalShift > 0) {
-        dividend += string(decimalShift, '0');
-        decimalShift = 0;
-    }
-    
-    dividend = removeLeadingZeros(dividend);
-    divisor = removeLeadingZeros(divisor);
-    
-    // Perform integer division
-    pair<string, string> result = divideIntegers(dividend, divisor);
-    string quotient = result.first;
-    string remainder = result.second;
-    
-    // Handle decimal places in result
-    if (decimalShift < 0) {
-        int insertPos = quotient.length() + decimalShift;
-        if (insertPos <= 0) {
-            quotient = "0." + string(-insertPos, '0') + quotient;
-        } else if (insertPos < quotient.length()) {
-            quotient = quotient.substr(0, insertPos) + "." + quotient.substr(insertPos);
-        }
-    }
-    
-    // Add decimal precision if there's a remainder
-    if (remainder != "0" && quotient.find('.') == string::npos) {
-        quotient += ".";
+    if (isScientific(operand1) || isScientific(operand2)) {
+        return roundedQuotient(parseBigFloat(operand1), parseBigFloat(operand2));
     }
     
-    // Continue division for decimal places (up to 15 decimal places for precision)
-    int decimalPlaces = 0;
-    const int MAX_DECIMAL_PLACES = 15;
-    
-    while (remainder != "0" && decimalPlaces < MAX_DECIMAL_PLACES) {
-        remainder += "0"; // Multiply remainder by 10
-        remainder = removeLeadingZeros(remainder);
-        
-        int count = 0;
-        while (compareAbs(remainder, divisor) >= 0) {
-            remainder = subtractPositive(remainder, divisor);
-            count++;
-        }
-        
-        if (quotient.back() != '.') {
-            quotient += char(count + '0');
+    DecimalView a, b;
+    parseDecimalView(operand1, a);
+    parseDecimalView(operand2, b);
+    
+    // Fractional digits the dividend has beyond the divisor are kept, then
+    // DIVISION_DECIMAL_PLACES more. A quotient that ends within them is exact
+    size_t places = (a.fraction.size() > b.fraction.size() ? a.fraction.size() - b.fraction.size() : 0) +
+                    DIVISION_DECIMAL_PLACES;
+    divideDecimal(a, b, places, kernelResult, kernelRemainder);
+    if (kernelRemainder.empty()) return formatKernelResult();
+    return roundedQuotient(parseBigFloat(operand1), parseBigFloat(operand2));
+}
+
+string divide(const string& operand1, const string& operand2) {
+    return memoize("divide", operand1, operand2, [&] { return divideUncached(operand1, operand2); });
+}
+
+// Exact integer powers are kept while they have at most this many digits;
+// beyond that (2^10000000) they are rounded to the working precision
+static const size_t MAX_EXACT_POWER_DIGITS = 1000000;
+
+// Powers of non-integer bases are computed exactly up to this many
+// significant digits and then rounded to the working precision; beyond it
+// (1.0001^100000) every intermediate is truncated instead
+static const size_t MAX_EXACT_DECIMAL_POWER_DIGITS = 100;
+
+// Plain decimal text of an exact value, as the string kernels write it
+static string plainDecimal(const BigFloat& value) {
+    DecimalBuffer buffer;
+    if (!value.isZero()) {
+        buffer.digits = absValue(value.mantissa).toString();
+        if (value.exponent >= 0) {
+            buffer.digits.append((size_t)value.exponent, '0');
         } else {
-            quotient += char(count + '0');
+            buffer.scale = (size_t)-value.exponent;
+            if (buffer.digits.size() < buffer.scale) buffer.digits.insert(0, buffer.scale - buffer.digits.size(), '0');
         }
-        
-        decimalPlaces++;
+        buffer.negative = value.mantissa.negative;
     }
-    
-    // Clean up result
-    quotient = removeTrailingZeros(removeLeadingZeros(quotient));
-    
-    // Apply sign
-    if (resultNegative && quotient != "0") {
-        quotient = "-" + quotient;
-    }
-    
-    return quotient;
+    string text;
+    formatDecimal(buffer, text);
+    return text;
 }
 
-// Power function using repeated multiplication (pen-and-pencil method)
-string power(const string& base, const string& exponent) {
+// Kernel-style plain text unless the value needs scientific notation
+static string formatPower(const BigFloat& value) {
+    string text = formatBigFloat(value);
+    return isScientific(text) ? text : plainDecimal(value);
+}
+
+// Integer exponents of any size up to 18 digits. Powers of integers are
+// exact up to a million digits. Powers of other bases keep at most the
+// working precision, like the roots and quotients they usually come from:
+// sqrt(2)^2 is 2, not 2 plus the square of sqrt(2)'s rounding error. Larger
+// powers truncate every intermediate to the working precision plus guard
+// digits. Negative exponents take the reciprocal at the working precision
+static string powerUncached(const string& base, const string& exponent) {
     if (!isValidNumber(base)) throw invalid_argument("Invalid base: " + base);
     if (!isValidNumber(exponent)) throw invalid_argument("Invalid exponent: " + exponent);
     
+    // Exponents in scientific notation are ordinary integers or decimals
+    if (isScientific(exponent)) return power(base, toPlainDecimal(exponent));
+    
     // Handle special cases
     if (exponent == "0") return "1";
-    if (base == "0") return "0";
     if (base == "1") return "1";
-    if (exponent == "1") return base;
     
-    // Check if exponent is negative
-    bool negativeExponent = false;
-    string absExponent = exponent;
-    if (exponent[0] == '-') {
-        negativeExponent = true;
-        absExponent = exponent.substr(1);
-    }
+    bool negativeExponent = exponent[0] == '-';
+    string absExponent = negativeExponent || exponent[0] == '+' ? exponent.substr(1) : exponent;
     
     // Handle decimal exponents
     if (absExponent.find('.') != string::npos) {
         return powerDecimal(base, exponent);
     }
     
-    // Convert exponent to integer for repeated multiplication
-    if (absExponent.length() > 9) {  // Prevent very large exponents that would take too long
-        return "power(" + base + ", " + exponent + ") [exponent too large]";
-    }
-    
-    // Parse exponent as integer
-    long long exp = 0;
-    for (char c : absExponent) {
-        if (c < '0' || c > '9') {
-            throw invalid_argument("Invalid exponent format: " + exponent);
-        }
-        exp = exp * 10 + (c - '0');
-        if (exp > 1000) {  // Reasonable limit for performance
-            return "power(" + base + ", " + exponent + ") [exponent too large for computation]";
+    BigFloat value = parseBigFloat(base);
+    if (value.isZero()) {
+        if (negativeExponent && absExponent.find_first_not_of('0') != string::npos) {
+            throw domain_error("0 to negative power is undefined");
         }
+        return "0";
     }
     
-    // Handle base case
-    if (exp == 0) return "1";
-    if (exp == 1) return base;
-    
-    // Repeated multiplication (pen-and-pencil method)
-    string result = "1";
-    string currentBase = base;
-    
-    // Use exponentiation by squaring for efficiency
-    while (exp > 0) {
-        if (exp % 2 == 1) {
-            // If exponent is odd, multiply result by current base
-            result = multiply(result, currentBase);
-        }
-        // Square the base and halve the exponent
-        if (exp > 1) {
-            currentBase = multiply(currentBase, currentBase);
+    size_t firstDigit = absExponent.find_first_not_of('0');
+    if (firstDigit == string::npos) return "1";
+    if (absExponent.size() - firstDigit > 18) {
+        // Only +/-1 has a representable power this large
+        if (value.exponent != 0 || absValue(value.mantissa).toString() != "1") {
+            throw overflow_error("Exponent too large: " + exponent);
         }
-        exp /= 2;
+        bool odd = (absExponent.back() - '0') % 2 == 1;
+        return value.mantissa.negative && odd ? "-1" : "1";
     }
+    unsigned long long n = stoull(absExponent.substr(firstDigit));
     
-    // Handle negative exponent (result = 1/result)
     if (negativeExponent) {
-        result = divide("1", result);
+        return formatPower(power(value, BigFloat(BigInt("-" + absExponent.substr(firstDigit))), workingPrecision()));
     }
     
-    return result;
+    // Digits of the exact result: significant digits, and the plain form with
+    // its zeros. Both bounds are checked without overflowing
+    size_t significant = value.mantissa.digitCount();
+    size_t limit = value.exponent >= 0 ? MAX_EXACT_POWER_DIGITS : MAX_EXACT_DECIMAL_POWER_DIGITS;
+    if (n <= limit / significant) {
+        BigFloat result = power(value, n);
+        if (value.exponent < 0) return formatPower(roundToDigits(result, workingPrecision()));
+        long long magnitude = value.exponent;
+        unsigned long long plain = significant * n;
+        bool plainFits = magnitude == 0 || (unsigned long long)magnitude <= (MAX_EXACT_POWER_DIGITS - plain) / n;
+        // Scientific-notation bases stay in scientific notation
+        if (plainFits && !isScientific(base)) return plainDecimal(result);
+        return formatBigFloat(result);
+    }
+    
+    size_t digits = workingPrecision();
+    size_t working = digits + GUARD_DIGITS + to_string(n).size();
+    return formatPower(roundToDigits(powerTruncated(value, n, working), digits));
 }
 
-// Helper function to compute nth root using Newton's method (pen-and-pencil iterative approach)
-string nthRoot(const string& number, const string& root) {
+string power(const string& base, const string& exponent) {
+    return memoize("power", base, exponent, [&] { return powerUncached(base, exponent); });
+}
+
+// nth root of a decimal string at the working precision
+static string nthRootUncached(const string& number, const string& root) {
     if (!isValidNumber(number) || !isValidNumber(root)) {
         throw invalid_argument("Invalid input for nth root");
     }
     
+    BigFloat value = parseBigFloat(number);
+    BigFloat degree = parseBigFloat(root);
+    
     // Handle special cases
-    if (number == "0") return "0";
-    if (number == "1") return "1";
-    if (root == "1") return number;
-    if (root == "0") throw domain_error("Cannot take 0th root");
+    if (degree.isZero()) throw domain_error("Cannot take 0th root");
+    if (value.isZero()) return "0";
     
-    // For negative numbers, only odd roots are defined
-    bool negativeNumber = number[0] == '-';
-    string absNumber = negativeNumber ? number.substr(1) : number;
-    
-    // Check if root is even and number is negative
-    if (negativeNumber) {
-        // Parse root to check if it's even (simplified check for integer roots)
-        if (root.find('.') == string::npos) {
-            long long rootInt = 0;
-            for (char c : root) {
-                if (c >= '0' && c <= '9') {
-                    rootInt = rootInt * 10 + (c - '0');
-                    if (rootInt > 100) break; // Prevent overflow for check
-                }
-            }
-            if (rootInt % 2 == 0) {
-                throw domain_error("Even root of negative number is undefined in real numbers");
-            }
-        }
+    // Non-integer degrees are ordinary powers: x^(1/r)
+    if (degree.exponent < 0) {
+        return powerDecimal(number, divide("1", root));
     }
-    
-    // Newton's method: x_{n+1} = (1/n) * ((n-1)*x_n + a/x_n^(n-1))
-    // For nth root of a, we solve x^n = a
-    
-    // Initial guess: use the number itself divided by root as starting point
-    string x = divide(absNumber, root);
-    
-    // Ensure initial guess is reasonable
-    if (compareAbs(x, "0.001") < 0) x = "0.001";
-    if (compareAbs(x, "1000") > 0) x = "1000";
-    
-    string prev = "";
-    const int maxIterations = 50;
-    int iterations = 0;
-    
-    // Newton's method iterations
-    while (iterations < maxIterations) {
-        prev = x;
-        
-        try {
-            // Compute x^(n-1)
-            string rootMinus1 = subtract(root, "1");
-            string xPowerNMinus1 = power(x, rootMinus1);
-            
-            // Compute a / x^(n-1)
-            string dividend = divide(absNumber, xPowerNMinus1);
-            
-            // Compute (n-1)*x + a/x^(n-1)
-            string term1 = multiply(rootMinus1, x);
-            string numerator = add(term1, dividend);
-            
-            // Compute x = numerator / n
-            x = divide(numerator, root);
-            
-            // Check convergence
-            string diff = subtract(x, prev);
-            if (diff[0] == '-') diff = diff.substr(1); // abs(diff)
-            
-            // If difference is very small, we've converged
-            if (compareAbs(diff, "0.000000001") < 0) {
-                break;
-            }
-            
-        } catch (const exception& e) {
-            // If we encounter errors during iteration, return best guess
-            break;
-        }
-        
-        iterations++;
+    BigInt degreeInt = degree.exponent > 18 ? BigInt() : shiftDecimal(absValue(degree.mantissa), (size_t)degree.exponent);
+    if (degreeInt.isZero() || degreeInt.digitCount() > 18) {
+        throw domain_error("Root degree too large: " + root);
     }
+    unsigned long long n = stoull(degreeInt.toString());
     
-    // Apply sign for odd roots of negative numbers
-    if (negativeNumber) {
-        x = "-" + x;
+    // For negative numbers, only odd roots are defined
+    bool negativeNumber = value.mantissa.negative;
+    if (negativeNumber && n % 2 == 0) {
+        throw domain_error("Even root of negative number is undefined in real numbers");
     }
+    value.mantissa.negative = false;
+    
+    // A negative degree is the inverse root, which the engine computes directly
+    BigFloat result = degree.mantissa.negative
+        ? inverseNthRoot(value, n, workingPrecision())
+        : nthRoot(value, n, workingPrecision());
     
-    return x;
+    // Apply sign for odd roots of negative numbers
+    if (negativeNumber) result.mantissa = -result.mantissa;
+    return formatBigFloat(result);
+}
+
+string nthRoot(const string& number, const string& root) {
+    return memoize("nthRoot", number, root, [&] { return nthRootUncached(number, root); });
 }
 
-// Handle decimal exponents using a^(p/q) = (a^p)^(1/q) = qth_root(a^p)
+// Non-integer exponents: exp(y ln x) at the working precision, with exact
+// root short-cuts for small-denominator rationals such as 0.5 or 1/3
 string powerDecimal(const string& base, const string& exponent) {
-    if (!isValidNumber(base) || !isValidNumber(exponent)) {
-        throw invalid_argument("Invalid input for decimal power");
-    }
-    
-    // Handle special cases
-    if (base == "0") {
-        if (exponent[0] == '-') {
-            throw domain_error("0 to negative power is undefined");
-        }
-        return "0";
-    }
-    if (base == "1") return "1";
-    if (exponent == "0") return "1";
-    if (exponent == "1") return base;
-    
-    bool negativeExponent = exponent[0] == '-';
-    string absExponent = negativeExponent ? exponent.substr(1) : exponent;
-    
-    // Split decimal exponent into integer and fractional parts
-    size_t dotPos = absExponent.find('.');
-    string integerPart = absExponent.substr(0, dotPos);
-    string fractionalPart = absExponent.substr(dotPos + 1);
-    
-    if (integerPart.empty()) integerPart = "0";
-    
-    // Convert fractional part to a rational number (p/q)
-    // For example: 0.5 = 5/10 = 1/2, 0.25 = 25/100 = 1/4
-    
-    // Remove trailing zeros from fractional part
-    while (!fractionalPart.empty() && fractionalPart.back() == '0') {
-        fractionalPart.pop_back();
-    }
-    
-    if (fractionalPart.empty()) {
-        // Pure integer exponent
-        return negativeExponent ? divide("1", power(base, integerPart)) : power(base, integerPart);
-    }
-    
-    // Create fraction: fractionalPart / 10^(length of fractionalPart)
-    string denominator = "1";
-    for (size_t i = 0; i < fractionalPart.length(); i++) {
-        denominator = multiply(denominator, "10");
-    }
-    
-    // Simplify the fraction by finding GCD (simplified approach)
-    string numerator = fractionalPart;
-    
-    // Simple GCD reduction for common cases
-    while (numerator.length() > 1 && numerator.back() == '0' && denominator.length() > 1) {
-        numerator = numerator.substr(0, numerator.length() - 1);
-        denominator = denominator.substr(0, denominator.length() - 1);
-    }
-    
-    try {
-        string result;
-        
-        // If we have integer part, compute base^integerPart first
-        if (integerPart != "0") {
-            string integerResult = power(base, integerPart);
-            
-            // Then compute (base^integerPart)^(numerator/denominator)
-            // which is denominator_root(integerResult^numerator)
-            if (numerator != "0") {
-                string powered = power(integerResult, numerator);
-                result = nthRoot(powered, denominator);
-            } else {
-                result = integerResult;
-            }
-        } else {
-            // Pure fractional exponent: base^(numerator/denominator) = denominator_root(base^numerator)
-            string powered = power(base, numerator);
-            result = nthRoot(powered, denominator);
+    return memoize("powerDecimal", base, exponent, [&] {
+        if (!isValidNumber(base) || !isValidNumber(exponent)) {
+            throw invalid_argument("Invalid input for decimal power");
         }
-        
-        // Handle negative exponent
-        if (negativeExponent) {
-            result = divide("1", result);
-        }
-        
-        return result;
-        
-    } catch (const exception& e) {
-        // Fallback for complex decimal exponents
-        return "decimal_power(" + base + ", " + exponent + ") [approximation needed]";
-    }
+        return formatBigFloat(power(parseBigFloat(base), parseBigFloat(exponent), workingPrecision()));
+    });
 }
 
 // Generic operation function
@@ -1,8 +1,16 @@
 #pragma once
+#include <functional>
+#include <initializer_list>
 #include <string>
+#include <vector>
+#include "bigint.h"
 
 double calc(double a, char op, double b);
 
+// Fractional digits within which divide() keeps a terminating quotient exact;
+// any other quotient is rounded to the working precision
+const int DIVISION_DECIMAL_PLACES = 15;
+
 // String-based arithmetic functions
 std::string add(const std::string& operand1, const std::string& operand2);
 std::string subtract(const std::string& operand1, const std::string& operand2);
@@ -12,6 +20,198 @@ std::string power(const std::string& base, const std::string& exponent);
 std::string powerDecimal(const std::string& base, const std::string& exponent);
 std::string nthRoot(const std::string& number, const std::string& root);
 
+// One product of a sum of products, subtracted instead of added if flagged.
+// Pointing b at the same string as a (or leaving it null) squares a
+struct ProductTerm {
+    const std::string* a;
+    const std::string* b;
+    bool subtract;
+};
+
+// a1*b1 +/- a2*b2 +/- ... accumulated exactly and normalized once, without a
+// string per product: complex multiplication, |z|^2, dot products
+std::string sumOfProducts(std::initializer_list<ProductTerm> terms);
+
+// Sum of a[k] * b[k] over two vectors of equal length
+std::string dotProduct(const std::vector<std::string>& a, const std::vector<std::string>& b);
+
+// Big floating-point number: value = mantissa * 10^exponent. Only significant
+// digits are stored, so 1e300 costs one digit instead of 301
+struct BigFloat {
+    BigInt mantissa;
+    long long exponent;
+    
+    BigFloat() : exponent(0) {}
+    BigFloat(const BigInt& m, long long e = 0) : mantissa(m), exponent(e) {}
+    
+    bool isZero() const { return mantissa.isZero(); }
+};
+
+// Significant digits computed for results that cannot be exact (roots,
+// divisions in scientific notation) unless a PrecisionScope says otherwise
+const size_t DEFAULT_PRECISION = 30;
+
+// Working precision of the calling thread, so concurrent evaluations can use
+// different precisions
+size_t workingPrecision();
+void setWorkingPrecision(size_t digits);
+
+// Sets the working precision for the lifetime of the scope
+class PrecisionScope {
+public:
+    explicit PrecisionScope(size_t digits) : saved(workingPrecision()) { setWorkingPrecision(digits); }
+    ~PrecisionScope() { setWorkingPrecision(saved); }
+    PrecisionScope(const PrecisionScope&) = delete;
+    PrecisionScope& operator=(const PrecisionScope&) = delete;
+private:
+    size_t saved;
+};
+
+// Unit of the angles taken by the trigonometric functions and returned by
+// their inverses (SETUP Deg, Rad, Gra on the fx-991ES)
+enum AngleUnit {
+    ANGLE_DEGREES,
+    ANGLE_RADIANS,
+    ANGLE_GRADIANS
+};
+
+// Angle unit of the calling thread, radians unless an AngleUnitScope says
+// otherwise
+AngleUnit angleUnit();
+void setAngleUnit(AngleUnit unit);
+
+// Sets the angle unit for the lifetime of the scope
+class AngleUnitScope {
+public:
+    explicit AngleUnitScope(AngleUnit unit) : saved(angleUnit()) { setAngleUnit(unit); }
+    ~AngleUnitScope() { setAngleUnit(saved); }
+    AngleUnitScope(const AngleUnitScope&) = delete;
+    AngleUnitScope& operator=(const AngleUnitScope&) = delete;
+private:
+    AngleUnit saved;
+};
+
+// Results whose plain form would need more padding zeros than this are
+// written in scientific notation
+const int SCIENTIFIC_ZERO_LIMIT = 20;
+
+// Parse "-12.5", "1e-300" or "6.022E+23" without expanding the exponent
+BigFloat parseBigFloat(const std::string& number);
+
+// Plain decimal when short, "d.ddde[-]N" when the magnitude is extreme
+std::string formatBigFloat(const BigFloat& value);
+
+// "d.ddde[-]N" whatever the magnitude
+std::string formatScientific(const BigFloat& value);
+
+// True if the number string carries an exponent part
+bool isScientific(const std::string& number);
+
+BigFloat add(const BigFloat& a, const BigFloat& b);
+BigFloat subtract(const BigFloat& a, const BigFloat& b);
+BigFloat multiply(const BigFloat& a, const BigFloat& b);
+
+// Sum of products on big floats, exact, normalized once; b == nullptr or
+// b == a squares a
+struct FloatProductTerm {
+    const BigFloat* a;
+    const BigFloat* b;
+    bool subtract;
+};
+BigFloat sumOfProducts(std::initializer_list<FloatProductTerm> terms);
+BigFloat divide(const BigFloat& a, const BigFloat& b, size_t significantDigits);
+BigFloat power(const BigFloat& base, unsigned long long exponent);
+
+// Cut a value down to the given number of significant digits
+BigFloat truncateToDigits(const BigFloat& value, size_t digits);
+BigFloat roundToDigits(const BigFloat& value, size_t digits);
+
+// Roots of x >= 0 to the given number of significant digits, computed by a
+// division-free inverse-root Newton iteration that doubles its precision
+// every step starting from a double-precision seed
+BigFloat nthRoot(const BigFloat& x, unsigned long long n, size_t digits);
+BigFloat inverseNthRoot(const BigFloat& x, unsigned long long n, size_t digits);
+
+// Refines an earlier approximation of x^(-1/n) known to seedDigits digits;
+// only the Newton steps above seedDigits are run. n = 1 gives a reciprocal
+BigFloat inverseNthRoot(const BigFloat& x, unsigned long long n, size_t digits,
+                        const BigFloat& seed, size_t seedDigits);
+BigFloat squareRoot(const BigFloat& x, size_t digits);
+
+// Square root at the working precision
+std::string squareRoot(const std::string& number);
+
+// Natural logarithm constants, cached at the highest precision requested so far
+BigFloat constantLn2(size_t digits);
+BigFloat constantLn10(size_t digits);
+
+// Value of a cached constant ("ln2", "ln10", "pi") and the digits it holds
+struct CachedConstant {
+    std::string name;
+    size_t digits;
+    BigFloat value;
+};
+
+// Every constant computed so far, at its highest precision
+std::vector<CachedConstant> cachedConstants();
+
+// Where constants come from before they are computed (a snapshot of an earlier
+// run). Each constant asks the source once, the first time it is needed, and
+// keeps what it returns; only precisions beyond that are computed
+using ConstantSource = std::function<bool(const std::string& name, CachedConstant& constant)>;
+void setConstantSource(ConstantSource source);
+
+// exp and ln to the given number of significant digits; cost depends on the
+// precision, not on the size of the argument
+BigFloat exponential(const BigFloat& x, size_t digits);
+BigFloat naturalLog(const BigFloat& x, size_t digits);
+
+// x^y for any real y: integer and small-denominator rational exponents use
+// powers and roots, everything else exp(y ln x)
+BigFloat power(const BigFloat& base, const BigFloat& exponent, size_t digits);
+
+// exp, ln and log10 at the working precision
+std::string exponential(const std::string& number);
+std::string naturalLog(const std::string& number);
+std::string commonLog(const std::string& number);
+
+// Floor of log10|x| for non-zero x
+long long decimalMagnitude(const BigFloat& x);
+
+// pi by Machin's formula, cached like the logarithm constants
+BigFloat constantPi(size_t digits);
+
+// Trigonometric functions, in radians unless another unit is given. Radian
+// arguments are reduced modulo pi/2 by Payne-Hanek against cached digits of
+// 2/pi, so the cost follows the digits requested rather than the size of x.
+// Degrees and grads are reduced exactly modulo a right angle first: sin 180°
+// is exactly 0 and tan 90° is undefined
+void sineCosine(const BigFloat& x, size_t digits, BigFloat& sine, BigFloat& cosine,
+                AngleUnit unit = ANGLE_RADIANS);
+BigFloat sine(const BigFloat& x, size_t digits, AngleUnit unit = ANGLE_RADIANS);
+BigFloat cosine(const BigFloat& x, size_t digits, AngleUnit unit = ANGLE_RADIANS);
+BigFloat tangent(const BigFloat& x, size_t digits, AngleUnit unit = ANGLE_RADIANS);
+BigFloat arcsine(const BigFloat& x, size_t digits, AngleUnit unit = ANGLE_RADIANS);
+BigFloat arccosine(const BigFloat& x, size_t digits, AngleUnit unit = ANGLE_RADIANS);
+BigFloat arctangent(const BigFloat& x, size_t digits, AngleUnit unit = ANGLE_RADIANS);
+
+// Angle of the point (x, y) in (-pi, pi]
+BigFloat arctangent2(const BigFloat& y, const BigFloat& x, size_t digits);
+
+void hyperbolicSineCosine(const BigFloat& x, size_t digits, BigFloat& sinh, BigFloat& cosh);
+
+// Real trigonometric functions at the working precision, in the calling
+// thread's angle unit
+std::string sine(const std::string& number);
+std::string cosine(const std::string& number);
+std::string tangent(const std::string& number);
+std::string arcsine(const std::string& number);
+std::string arccosine(const std::string& number);
+std::string arctangent(const std::string& number);
+
+// sinh, cosh or tanh by name
+std::string hyperbolicFunction(const std::string& name, const std::string& number);
+
 // Generic operation function
 std::string operate(const std::string& operand1, char op, const std::string& operand2);
 
@@ -0,0 +1,37 @@
+#include "cancellation.h"
+#include "governor.h"
+
+static thread_local CancellationToken* activeToken = nullptr;
+
+void CancellationToken::reportProgress(int value) {
+    if (value < 0) value = 0;
+    if (value > 100) value = 100;
+    int previous = percent.exchange(value, std::memory_order_relaxed);
+    if (previous != value && progressListener) progressListener(value);
+}
+
+CancellationToken* currentCancellationToken() {
+    return activeToken;
+}
+
+CancellationScope::CancellationScope(CancellationToken* token) : saved(activeToken) {
+    activeToken = token;
+}
+
+CancellationScope::~CancellationScope() {
+    activeToken = saved;
+}
+
+void checkCancelled() {
+    CancellationToken* token = activeToken;
+    if (token == nullptr) return;
+    if (token->isCancelled()) throw CancelledError();
+    ResourceGovernor* governor = token->governor();
+    if (governor != nullptr) governor->checkTime();
+}
+
+void reportProgress(size_t done, size_t total) {
+    CancellationToken* token = activeToken;
+    if (token == nullptr || total == 0) return;
+    token->reportProgress((int)(done * 100 / total));
+}
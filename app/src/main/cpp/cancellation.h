@@ -0,0 +1,64 @@
+#pragma once
+#include <atomic>
+#include <functional>
+#include <stdexcept>
+#include <string>
+
+class ResourceGovernor;
+
+// Thrown from inside a computation whose token was cancelled; unwinds the
+// evaluation without touching Ans or any other session state
+class CancelledError : public std::runtime_error {
+public:
+    CancelledError() : std::runtime_error("Cancelled") {}
+};
+
+// Cooperative cancellation flag shared between whoever submitted a computation
+// and the thread running it. Also carries the computation's progress
+class CancellationToken {
+public:
+    void cancel() { cancelled.store(true, std::memory_order_relaxed); }
+    bool isCancelled() const { return cancelled.load(std::memory_order_relaxed); }
+
+    // Percent complete, 0-100
+    int progress() const { return percent.load(std::memory_order_relaxed); }
+
+    // Called on the computing thread whenever the percentage changes; set
+    // before the computation starts
+    void setProgressListener(std::function<void(int)> listener) { progressListener = std::move(listener); }
+
+    void reportProgress(int value);
+
+    // Budget of the computation, if it runs under a GovernorScope
+    ResourceGovernor* governor() const { return activeGovernor.load(std::memory_order_relaxed); }
+    void setGovernor(ResourceGovernor* governor) { activeGovernor.store(governor, std::memory_order_relaxed); }
+
+private:
+    std::atomic<bool> cancelled{false};
+    std::atomic<ResourceGovernor*> activeGovernor{nullptr};
+    std::atomic<int> percent{0};
+    std::function<void(int)> progressListener;
+};
+
+// Token of the computation running on the calling thread (nullptr if none)
+CancellationToken* currentCancellationToken();
+
+// Makes the token current for the lifetime of the scope
+class CancellationScope {
+public:
+    explicit CancellationScope(CancellationToken* token);
+    ~CancellationScope();
+    CancellationScope(const CancellationScope&) = delete;
+    CancellationScope& operator=(const CancellationScope&) = delete;
+private:
+    CancellationToken* saved;
+};
+
+// Throws CancelledError if the calling thread's computation was cancelled,
+// or BudgetExceededError once it has run out of time. Called once per
+// iteration of the long-running loops in the arithmetic engines; costs one
+// thread-local load when no token is installed
+void checkCancelled();
+
+// Reports done/total of the current computation to its token, if any
+void reportProgress(size_t done, size_t total);
@@ -0,0 +1,338 @@
+#include "complex_math.h"
+#include "cancellation.h"
+#include <stdexcept>
+#include <android/log.h>
+
+#define LOG_TAG "CalculatorComplex"
+#define LOGD(...) __android_log_print(ANDROID_LOG_DEBUG, LOG_TAG, __VA_ARGS__)
+
+using namespace std;
+
+// Extra digits carried through each function before the final rounding
+static const size_t GUARD_DIGITS = 8;
+
+// Largest integer exponent raised by repeated squaring in rectangular form;
+// bigger ones switch to polar form, where any power costs the same
+static const unsigned long long RECTANGULAR_POWER_LIMIT = 64;
+
+static BigFloat negated(const BigFloat& x) {
+    return BigFloat(-x.mantissa, x.exponent);
+}
+
+static BigFloat half(const BigFloat& x) {
+    return multiply(x, BigFloat(BigInt(5), -1));
+}
+
+static ComplexFloat truncate(const ComplexFloat& z, size_t digits) {
+    return ComplexFloat(truncateToDigits(z.real, digits), truncateToDigits(z.imaginary, digits));
+}
+
+// sin and cos of an angle, with values below the angle's own relative
+// precision taken as zero: e^(i pi) is -1, not -1 + 5.8e-76i
+static void sineCosineOfAngle(const BigFloat& angle, size_t digits, BigFloat& s, BigFloat& c) {
+    sineCosine(angle, digits + GUARD_DIGITS, s, c);
+    if (angle.isZero()) return;
+    long long noiseFloor = decimalMagnitude(angle) - (long long)(digits + GUARD_DIGITS / 2);
+    if (!s.isZero() && decimalMagnitude(s) < noiseFloor) s = BigFloat();
+    if (!c.isZero() && decimalMagnitude(c) < noiseFloor) c = BigFloat();
+}
+
+ComplexFloat toComplexFloat(const ComplexNumber& value) {
+    if (value.isReal()) return ComplexFloat(parseBigFloat(value.real));
+    return ComplexFloat(parseBigFloat(value.real), parseBigFloat(value.imaginary));
+}
+
+ComplexNumber toComplexNumber(const ComplexFloat& value, size_t digits) {
+    string realPart = formatBigFloat(roundToDigits(value.real, digits));
+    if (value.isReal()) return ComplexNumber(std::move(realPart));
+    return ComplexNumber(std::move(realPart), formatBigFloat(roundToDigits(value.imaginary, digits)));
+}
+
+ComplexFloat add(const ComplexFloat& a, const ComplexFloat& b) {
+    return ComplexFloat(add(a.real, b.real), add(a.imaginary, b.imaginary));
+}
+
+ComplexFloat subtract(const ComplexFloat& a, const ComplexFloat& b) {
+    return ComplexFloat(subtract(a.real, b.real), subtract(a.imaginary, b.imaginary));
+}
+
+ComplexFloat multiply(const ComplexFloat& a, const ComplexFloat& b) {
+    if (a.isReal() && b.isReal()) return ComplexFloat(multiply(a.real, b.real));
+    return ComplexFloat(sumOfProducts({{&a.real, &b.real, false}, {&a.imaginary, &b.imaginary, true}}),
+                        sumOfProducts({{&a.real, &b.imaginary, false}, {&a.imaginary, &b.real, false}}));
+}
+
+ComplexFloat divide(const ComplexFloat& a, const ComplexFloat& b, size_t digits) {
+    if (b.isZero()) throw domain_error("Division by zero");
+    if (b.isReal()) {
+        return ComplexFloat(divide(a.real, b.real, digits), divide(a.imaginary, b.real, digits));
+    }
+    // a / b = a * conj(b) / |b|^2
+    BigFloat denominator = sumOfProducts({{&b.real, nullptr, false}, {&b.imaginary, nullptr, false}});
+    ComplexFloat numerator = multiply(a, ComplexFloat(b.real, negated(b.imaginary)));
+    return ComplexFloat(divide(numerator.real, denominator, digits),
+                        divide(numerator.imaginary, denominator, digits));
+}
+
+BigFloat complexAbs(const ComplexFloat& z, size_t digits) {
+    if (z.isReal()) return roundToDigits(BigFloat(absValue(z.real.mantissa), z.real.exponent), digits);
+    if (z.real.isZero()) return roundToDigits(BigFloat(absValue(z.imaginary.mantissa), z.imaginary.exponent), digits);
+    return squareRoot(sumOfProducts({{&z.real, nullptr, false}, {&z.imaginary, nullptr, false}}), digits);
+}
+
+BigFloat complexArg(const ComplexFloat& z, size_t digits) {
+    return arctangent2(z.imaginary, z.real, digits);
+}
+
+PolarForm toPolar(const ComplexFloat& z, size_t digits) {
+    return PolarForm{complexAbs(z, digits), complexArg(z, digits)};
+}
+
+ComplexFloat fromPolar(const PolarForm& polar, size_t digits) {
+    BigFloat s, c;
+    sineCosineOfAngle(polar.argument, digits, s, c);
+    return ComplexFloat(roundToDigits(multiply(polar.modulus, c), digits),
+                        roundToDigits(multiply(polar.modulus, s), digits));
+}
+
+ComplexFloat complexSqrt(const ComplexFloat& z, size_t digits) {
+    if (z.isReal()) {
+        if (z.real.mantissa.negative) return ComplexFloat(BigFloat(), squareRoot(negated(z.real), digits));
+        return ComplexFloat(squareRoot(z.real, digits));
+    }
+
+    // t = sqrt((|z| + |a|) / 2) avoids the cancellation of |z| - |a|; the
+    // other part is b / 2t
+    size_t working = digits + GUARD_DIGITS;
+    BigFloat absReal(absValue(z.real.mantissa), z.real.exponent);
+    BigFloat t = squareRoot(half(add(complexAbs(z, working), absReal)), working);
+    BigFloat other = divide(z.imaginary, add(t, t), working);
+    if (!z.real.mantissa.negative) {
+        return ComplexFloat(roundToDigits(t, digits), roundToDigits(other, digits));
+    }
+    BigFloat absOther(absValue(other.mantissa), other.exponent);
+    return ComplexFloat(roundToDigits(absOther, digits),
+                        roundToDigits(z.imaginary.mantissa.negative ? negated(t) : t, digits));
+}
+
+ComplexFloat complexLog(const ComplexFloat& z, size_t digits) {
+    if (z.isZero()) throw domain_error("Logarithm of zero");
+
+    // ln|z| = ln(a^2 + b^2) / 2 on the exact sum of squares
+    size_t working = digits + GUARD_DIGITS;
+    BigFloat squares = sumOfProducts({{&z.real, nullptr, false}, {&z.imaginary, nullptr, false}});
+    BigFloat modulusLog = half(naturalLog(squares, working));
+    return ComplexFloat(roundToDigits(modulusLog, digits), complexArg(z, digits));
+}
+
+ComplexFloat complexExp(const ComplexFloat& z, size_t digits) {
+    size_t working = digits + GUARD_DIGITS;
+    BigFloat scale = exponential(z.real, working);
+    if (z.isReal()) return ComplexFloat(roundToDigits(scale, digits));
+    return fromPolar(PolarForm{scale, z.imaginary}, digits);
+}
+
+// Integer power by squaring; exact while the parts fit in the working digits
+static ComplexFloat powerBySquaring(const ComplexFloat& z, unsigned long long n, size_t working) {
+    ComplexFloat result(BigFloat(BigInt(1)));
+    ComplexFloat base = z;
+    while (n > 0) {
+        checkCancelled();
+        if (n & 1) result = truncate(multiply(result, base), working);
+        n >>= 1;
+        if (n > 0) base = truncate(multiply(base, base), working);
+    }
+    return result;
+}
+
+ComplexFloat complexPow(const ComplexFloat& z, const ComplexFloat& w, size_t digits) {
+    if (w.isZero()) return ComplexFloat(BigFloat(BigInt(1)));
+    if (z.isZero()) {
+        if (w.isReal() && !w.real.mantissa.negative) return ComplexFloat();
+        throw domain_error("0 to a negative or complex power is undefined");
+    }
+
+    size_t working = digits + GUARD_DIGITS;
+    if (w.isReal()) {
+        const BigFloat& y = w.real;
+        long long magnitude = decimalMagnitude(y);
+        bool integral = y.exponent >= 0 && magnitude < 18;
+        if (integral) {
+            long long n = stoll(shiftDecimal(y.mantissa, (size_t)y.exponent).toString());
+            unsigned long long count = n < 0 ? 0ULL - (unsigned long long)n : (unsigned long long)n;
+            if (count <= RECTANGULAR_POWER_LIMIT) {
+                ComplexFloat result = powerBySquaring(z, count, working + 2);
+                if (n < 0) result = divide(ComplexFloat(BigFloat(BigInt(1))), result, working);
+                return ComplexFloat(roundToDigits(result.real, digits), roundToDigits(result.imaginary, digits));
+            }
+        }
+
+        // De Moivre: |z|^y at angle y arg z. The angle needs as many extra
+        // digits as y has before the decimal point
+        size_t angleDigits = working + (size_t)max(0LL, magnitude + 1);
+        PolarForm polar = toPolar(z, angleDigits);
+        polar.modulus = power(polar.modulus, y, working);
+        polar.argument = truncateToDigits(multiply(y, polar.argument), angleDigits);
+        return fromPolar(polar, digits);
+    }
+
+    // exp(w ln z); a large w ln z needs extra digits in the logarithm
+    ComplexFloat logarithm = complexLog(z, working);
+    ComplexFloat exponent = multiply(w, logarithm);
+    long long size = max(exponent.real.isZero() ? 0 : decimalMagnitude(exponent.real),
+                         exponent.imaginary.isZero() ? 0 : decimalMagnitude(exponent.imaginary));
+    if (size > 0) {
+        working += (size_t)size + 1;
+        logarithm = complexLog(z, working);
+        exponent = multiply(w, logarithm);
+    }
+    return complexExp(truncate(exponent, working), digits);
+}
+
+// sin(a+bi) = sin a cosh b + i cos a sinh b
+ComplexFloat complexSin(const ComplexFloat& z, size_t digits) {
+    size_t working = digits + GUARD_DIGITS;
+    BigFloat s, c, sh, ch;
+    sineCosineOfAngle(z.real, digits, s, c);
+    hyperbolicSineCosine(z.imaginary, working, sh, ch);
+    return ComplexFloat(roundToDigits(multiply(s, ch), digits), roundToDigits(multiply(c, sh), digits));
+}
+
+// cos(a+bi) = cos a cosh b - i sin a sinh b
+ComplexFloat complexCos(const ComplexFloat& z, size_t digits) {
+    size_t working = digits + GUARD_DIGITS;
+    BigFloat s, c, sh, ch;
+    sineCosineOfAngle(z.real, digits, s, c);
+    hyperbolicSineCosine(z.imaginary, working, sh, ch);
+    return ComplexFloat(roundToDigits(multiply(c, ch), digits), roundToDigits(negated(multiply(s, sh)), digits));
+}
+
+// tan(a+bi) = (sin 2a + i sinh 2b) / (cos 2a + cosh 2b)
+ComplexFloat complexTan(const ComplexFloat& z, size_t digits) {
+    size_t working = digits + GUARD_DIGITS;
+    BigFloat two(BigInt(2));
+    BigFloat s, c, sh, ch;
+    sineCosineOfAngle(multiply(two, z.real), digits, s, c);
+    hyperbolicSineCosine(multiply(two, z.imaginary), working, sh, ch);
+    BigFloat denominator = add(c, ch);
+    if (denominator.isZero()) throw domain_error("Tangent undefined at odd multiples of pi/2");
+    return ComplexFloat(divide(s, denominator, digits), divide(sh, denominator, digits));
+}
+
+// sinh(a+bi) = sinh a cos b + i cosh a sin b
+ComplexFloat complexSinh(const ComplexFloat& z, size_t digits) {
+    size_t working = digits + GUARD_DIGITS;
+    BigFloat s, c, sh, ch;
+    sineCosineOfAngle(z.imaginary, digits, s, c);
+    hyperbolicSineCosine(z.real, working, sh, ch);
+    return ComplexFloat(roundToDigits(multiply(sh, c), digits), roundToDigits(multiply(ch, s), digits));
+}
+
+// cosh(a+bi) = cosh a cos b + i sinh a sin b
+ComplexFloat complexCosh(const ComplexFloat& z, size_t digits) {
+    size_t working = digits + GUARD_DIGITS;
+    BigFloat s, c, sh, ch;
+    sineCosineOfAngle(z.imaginary, digits, s, c);
+    hyperbolicSineCosine(z.real, working, sh, ch);
+    return ComplexFloat(roundToDigits(multiply(ch, c), digits), roundToDigits(multiply(sh, s), digits));
+}
+
+// tanh(a+bi) = (sinh 2a + i sin 2b) / (cosh 2a + cos 2b)
+ComplexFloat complexTanh(const ComplexFloat& z, size_t digits) {
+    size_t working = digits + GUARD_DIGITS;
+    BigFloat two(BigInt(2));
+    BigFloat s, c, sh, ch;
+    sineCosineOfAngle(multiply(two, z.imaginary), digits, s, c);
+    hyperbolicSineCosine(multiply(two, z.real), working, sh, ch);
+    BigFloat denominator = add(ch, c);
+    if (denominator.isZero()) throw domain_error("tanh undefined at odd multiples of i pi/2");
+    return ComplexFloat(divide(sh, denominator, digits), divide(s, denominator, digits));
+}
+
+// asin z = -i ln(iz + sqrt(1 - z^2)), evaluated in the right half-plane where
+// the sum does not cancel, using asin(-z) = -asin z
+ComplexFloat complexAsin(const ComplexFloat& z, size_t digits) {
+    bool mirrored = z.real.mantissa.negative || (z.real.isZero() && z.imaginary.mantissa.negative);
+    ComplexFloat x = mirrored ? ComplexFloat(negated(z.real), negated(z.imaginary)) : z;
+
+    size_t working = digits + GUARD_DIGITS;
+    ComplexFloat one(BigFloat(BigInt(1)));
+    ComplexFloat root = complexSqrt(subtract(one, multiply(x, x)), working);
+    ComplexFloat sum = add(ComplexFloat(negated(x.imaginary), x.real), root);
+    ComplexFloat logarithm = complexLog(sum, working);
+
+    // -i (u + vi) = v - ui
+    BigFloat realPart = logarithm.imaginary;
+    BigFloat imagPart = negated(logarithm.real);
+    if (mirrored) {
+        realPart = negated(realPart);
+        imagPart = negated(imagPart);
+    }
+    return ComplexFloat(roundToDigits(realPart, digits), roundToDigits(imagPart, digits));
+}
+
+// acos z = pi/2 - asin z
+ComplexFloat complexAcos(const ComplexFloat& z, size_t digits) {
+    size_t working = digits + GUARD_DIGITS;
+    ComplexFloat arcsine = complexAsin(z, working);
+    BigFloat halfPi = half(constantPi(working));
+    return ComplexFloat(roundToDigits(subtract(halfPi, arcsine.real), digits),
+                        roundToDigits(negated(arcsine.imaginary), digits));
+}
+
+// atan z = (i/2) (ln(1 - iz) - ln(1 + iz))
+ComplexFloat complexAtan(const ComplexFloat& z, size_t digits) {
+    size_t working = digits + GUARD_DIGITS;
+    ComplexFloat one(BigFloat(BigInt(1)));
+    ComplexFloat iz(negated(z.imaginary), z.real);
+    ComplexFloat difference = subtract(complexLog(subtract(one, iz), working), complexLog(add(one, iz), working));
+
+    // (i/2)(u + vi) = -v/2 + (u/2) i
+    return ComplexFloat(roundToDigits(half(negated(difference.imaginary)), digits),
+                        roundToDigits(half(difference.real), digits));
+}
+
+ComplexNumber applyComplexFunction(const string& name, const ComplexNumber& operand) {
+    LOGD("Complex function %s of %s", name.c_str(), operand.toString().c_str());
+
+    size_t digits = workingPrecision();
+    ComplexFloat z = toComplexFloat(operand);
+    ComplexFloat result;
+    if (name == "sqrt") {
+        result = complexSqrt(z, digits);
+    } else if (name == "ln") {
+        result = complexLog(z, digits);
+    } else if (name == "log" || name == "log10") {
+        size_t working = digits + GUARD_DIGITS;
+        ComplexFloat logarithm = complexLog(z, working);
+        result = divide(logarithm, ComplexFloat(constantLn10(working)), digits);
+    } else if (name == "exp") {
+        result = complexExp(z, digits);
+    } else if (name == "sin") {
+        result = complexSin(z, digits);
+    } else if (name == "cos") {
+        result = complexCos(z, digits);
+    } else if (name == "tan") {
+        result = complexTan(z, digits);
+    } else if (name == "asin") {
+        result = complexAsin(z, digits);
+    } else if (name == "acos") {
+        result = complexAcos(z, digits);
+    } else if (name == "atan") {
+        result = complexAtan(z, digits);
+    } else if (name == "sinh") {
+        result = complexSinh(z, digits);
+    } else if (name == "cosh") {
+        result = complexCosh(z, digits);
+    } else if (name == "tanh") {
+        result = complexTanh(z, digits);
+    } else {
+        throw invalid_argument(name + " not defined for complex numbers");
+    }
+    return toComplexNumber(result, digits);
+}
+
+ComplexNumber complexPower(const ComplexNumber& base, const ComplexNumber& exponent) {
+    size_t digits = workingPrecision();
+    return toComplexNumber(complexPow(toComplexFloat(base), toComplexFloat(exponent), digits), digits);
+}
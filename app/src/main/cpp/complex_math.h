@@ -0,0 +1,67 @@
+#pragma once
+#include <string>
+#include "calc.h"
+#include "complex_number.h"
+
+// Complex value in rectangular form with BigFloat parts; the working type of
+// the complex function engine
+struct ComplexFloat {
+    BigFloat real;
+    BigFloat imaginary;
+
+    ComplexFloat() {}
+    ComplexFloat(const BigFloat& r, const BigFloat& i = BigFloat()) : real(r), imaginary(i) {}
+
+    bool isReal() const { return imaginary.isZero(); }
+    bool isZero() const { return real.isZero() && imaginary.isZero(); }
+};
+
+// Modulus and argument (in (-pi, pi]); powers and roots are cheap in this form
+struct PolarForm {
+    BigFloat modulus;
+    BigFloat argument;
+};
+
+ComplexFloat toComplexFloat(const ComplexNumber& value);
+
+// Rounds both parts to the given significant digits
+ComplexNumber toComplexNumber(const ComplexFloat& value, size_t digits);
+
+PolarForm toPolar(const ComplexFloat& z, size_t digits);
+ComplexFloat fromPolar(const PolarForm& polar, size_t digits);
+
+ComplexFloat add(const ComplexFloat& a, const ComplexFloat& b);
+ComplexFloat subtract(const ComplexFloat& a, const ComplexFloat& b);
+ComplexFloat multiply(const ComplexFloat& a, const ComplexFloat& b);
+ComplexFloat divide(const ComplexFloat& a, const ComplexFloat& b, size_t digits);
+
+BigFloat complexAbs(const ComplexFloat& z, size_t digits);
+BigFloat complexArg(const ComplexFloat& z, size_t digits);
+
+// Principal branches, cut along the negative real axis
+ComplexFloat complexSqrt(const ComplexFloat& z, size_t digits);
+ComplexFloat complexLog(const ComplexFloat& z, size_t digits);
+ComplexFloat complexExp(const ComplexFloat& z, size_t digits);
+
+// z^w: small integer powers by squaring in rectangular form (exact for
+// Gaussian integers), larger and fractional real powers by De Moivre in polar
+// form, complex exponents as exp(w ln z)
+ComplexFloat complexPow(const ComplexFloat& z, const ComplexFloat& w, size_t digits);
+
+ComplexFloat complexSin(const ComplexFloat& z, size_t digits);
+ComplexFloat complexCos(const ComplexFloat& z, size_t digits);
+ComplexFloat complexTan(const ComplexFloat& z, size_t digits);
+ComplexFloat complexSinh(const ComplexFloat& z, size_t digits);
+ComplexFloat complexCosh(const ComplexFloat& z, size_t digits);
+ComplexFloat complexTanh(const ComplexFloat& z, size_t digits);
+ComplexFloat complexAsin(const ComplexFloat& z, size_t digits);
+ComplexFloat complexAcos(const ComplexFloat& z, size_t digits);
+ComplexFloat complexAtan(const ComplexFloat& z, size_t digits);
+
+// Named function (sqrt, ln, log, exp, sin ... tanh) of a complex operand at the
+// working precision; also used for real operands outside a real domain.
+// Complex angles are in radians whatever the thread's angle unit
+ComplexNumber applyComplexFunction(const std::string& name, const ComplexNumber& operand);
+
+// a^b at the working precision for complex operands or a negative real base
+ComplexNumber complexPower(const ComplexNumber& base, const ComplexNumber& exponent);
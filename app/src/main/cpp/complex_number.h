@@ -0,0 +1,67 @@
+#pragma once
+#include <string>
+#include <utility>
+
+// Memory-optimized Complex number structure
+struct ComplexNumber {
+    std::string real;
+    std::string imaginary;
+    
+    // Default constructor
+    ComplexNumber() : real("0"), imaginary("not initiated") {}
+    
+    // Single string constructor (real number)
+    ComplexNumber(const std::string& r) : real(r), imaginary("not initiated") {}
+    
+    // Two string constructor (complex number)
+    ComplexNumber(const std::string& r, const std::string& i) : real(r), imaginary(i) {}
+    
+    // Move constructors for efficiency
+    ComplexNumber(std::string&& r) : real(std::move(r)), imaginary("not initiated") {}
+    ComplexNumber(std::string&& r, std::string&& i) : real(std::move(r)), imaginary(std::move(i)) {}
+    
+    // Copy constructor (explicit)
+    ComplexNumber(const ComplexNumber& other) : real(other.real), imaginary(other.imaginary) {}
+    
+    // Move constructor
+    ComplexNumber(ComplexNumber&& other) noexcept 
+        : real(std::move(other.real)), imaginary(std::move(other.imaginary)) {}
+    
+    // Assignment operators
+    ComplexNumber& operator=(const ComplexNumber& other) {
+        if (this != &other) {
+            real = other.real;
+            imaginary = other.imaginary;
+        }
+        return *this;
+    }
+    
+    ComplexNumber& operator=(ComplexNumber&& other) noexcept {
+        if (this != &other) {
+            real = std::move(other.real);
+            imaginary = std::move(other.imaginary);
+        }
+        return *this;
+    }
+    
+    bool isReal() const {
+        return imaginary == "not initiated" || imaginary == "0";
+    }
+    
+    std::string toString() const {
+        if (isReal()) return real;
+        if (real == "0" && imaginary == "1") return "i";
+        if (real == "0" && imaginary == "-1") return "-i";
+        if (real == "0") return imaginary + "i";
+        if (imaginary == "0") return real;
+        
+        std::string sign = (imaginary[0] == '-') ? "" : "+";
+        if (imaginary == "1") {
+            return real + "+i";
+        } else if (imaginary == "-1") {
+            return real + "-i";
+        } else {
+            return real + sign + imaginary + "i";
+        }
+    }
+};
@@ -0,0 +1,446 @@
+#include "decimal_kernel.h"
+#include "bigint.h"
+#include "cancellation.h"
+#include "governor.h"
+#include <algorithm>
+#include <stdexcept>
+
+using namespace std;
+
+DecimalView DecimalBuffer::view() const {
+    DecimalView result;
+    string_view all(digits);
+    result.integer = all.substr(0, digits.size() - scale);
+    result.fraction = all.substr(digits.size() - scale);
+    result.negative = negative;
+    return result;
+}
+
+static bool allDigits(string_view text) {
+    for (char c : text) {
+        if (c < '0' || c > '9') return false;
+    }
+    return true;
+}
+
+bool parseDecimalView(string_view text, DecimalView& view) {
+    size_t start = 0;
+    bool negative = false;
+    if (!text.empty() && (text[0] == '-' || text[0] == '+')) {
+        negative = text[0] == '-';
+        start = 1;
+    }
+    size_t point = text.find('.', start);
+    string_view integer = point == string_view::npos ? text.substr(start) : text.substr(start, point - start);
+    string_view fraction = point == string_view::npos ? string_view() : text.substr(point + 1);
+    if (point == string_view::npos && integer.empty()) return false;
+    if (!allDigits(integer) || !allDigits(fraction)) return false;
+
+    view.integer = integer;
+    view.fraction = fraction;
+    view.negative = negative;
+    return true;
+}
+
+// Digit of |v| at the given power of ten, 0 outside the stored digits
+static inline int digitAt(const DecimalView& v, long power) {
+    if (power >= 0) {
+        return power < (long)v.integer.size() ? v.integer[v.integer.size() - 1 - power] - '0' : 0;
+    }
+    size_t index = (size_t)(-power - 1);
+    return index < v.fraction.size() ? v.fraction[index] - '0' : 0;
+}
+
+// Digit k of |v| read as one run without the point: integer, then fraction
+static inline int digitFromLeft(const DecimalView& v, size_t k) {
+    return (k < v.integer.size() ? v.integer[k] : v.fraction[k - v.integer.size()]) - '0';
+}
+
+static string_view withoutLeadingZeros(string_view digits) {
+    size_t first = 0;
+    while (first < digits.size() && digits[first] == '0') first++;
+    return digits.substr(first);
+}
+
+// Strip trailing fraction zeros and leading integer zeros in place
+static void normalize(DecimalBuffer& value) {
+    size_t end = value.digits.size();
+    while (value.scale > 0 && value.digits[end - 1] == '0') {
+        end--;
+        value.scale--;
+    }
+    value.digits.resize(end);
+
+    size_t integerLength = value.digits.size() - value.scale;
+    size_t zeros = 0;
+    while (zeros < integerLength && value.digits[zeros] == '0') zeros++;
+    value.digits.erase(0, zeros);
+    if (value.digits.empty()) value.negative = false;
+}
+
+int compareMagnitude(const DecimalView& a, const DecimalView& b) {
+    string_view integerA = withoutLeadingZeros(a.integer);
+    string_view integerB = withoutLeadingZeros(b.integer);
+    if (integerA.size() != integerB.size()) return integerA.size() < integerB.size() ? -1 : 1;
+    int order = integerA.compare(integerB);
+    if (order != 0) return order < 0 ? -1 : 1;
+
+    size_t length = max(a.fraction.size(), b.fraction.size());
+    for (size_t k = 0; k < length; k++) {
+        char digitA = k < a.fraction.size() ? a.fraction[k] : '0';
+        char digitB = k < b.fraction.size() ? b.fraction[k] : '0';
+        if (digitA != digitB) return digitA < digitB ? -1 : 1;
+    }
+    return 0;
+}
+
+// |a| + |b|, unnormalized
+static void addMagnitudes(const DecimalView& a, const DecimalView& b, DecimalBuffer& out) {
+    size_t scale = max(a.fraction.size(), b.fraction.size());
+    size_t integerLength = max(a.integer.size(), b.integer.size()) + 1;
+    out.digits.assign(integerLength + scale, '0');
+    out.scale = scale;
+
+    size_t index = out.digits.size();
+    int carry = 0;
+    for (long power = -(long)scale; power < (long)integerLength; power++) {
+        int sum = digitAt(a, power) + digitAt(b, power) + carry;
+        out.digits[--index] = char('0' + sum % 10);
+        carry = sum / 10;
+    }
+}
+
+// |a| - |b| for |a| >= |b|, unnormalized
+static void subtractMagnitudes(const DecimalView& a, const DecimalView& b, DecimalBuffer& out) {
+    size_t scale = max(a.fraction.size(), b.fraction.size());
+    size_t integerLength = max(a.integer.size(), b.integer.size());
+    out.digits.assign(integerLength + scale, '0');
+    out.scale = scale;
+
+    size_t index = out.digits.size();
+    int borrow = 0;
+    for (long power = -(long)scale; power < (long)integerLength; power++) {
+        int difference = digitAt(a, power) - digitAt(b, power) - borrow;
+        borrow = difference < 0 ? 1 : 0;
+        out.digits[--index] = char('0' + difference + 10 * borrow);
+    }
+}
+
+void addDecimal(const DecimalView& a, const DecimalView& b, DecimalBuffer& out) {
+    if (a.negative == b.negative) {
+        addMagnitudes(a, b, out);
+        out.negative = a.negative;
+    } else if (compareMagnitude(a, b) >= 0) {
+        subtractMagnitudes(a, b, out);
+        out.negative = a.negative;
+    } else {
+        subtractMagnitudes(b, a, out);
+        out.negative = b.negative;
+    }
+    normalize(out);
+}
+
+void subtractDecimal(const DecimalView& a, const DecimalView& b, DecimalBuffer& out) {
+    // a - b = a + (-b); only the sign flag of the view changes
+    DecimalView negated = b;
+    negated.negative = !b.negative;
+    addDecimal(a, negated, out);
+}
+
+// Operands this long (measured crossover) multiply faster as BigInt limbs,
+// nine digits per machine multiplication and Karatsuba or transforms beyond
+// that
+static const size_t LIMB_MULTIPLY_DIGITS = 12;
+
+// Digit run of |v| (integer then fraction) as a BigInt
+static BigInt toBigInt(const DecimalView& v) {
+    size_t length = v.integer.size() + v.fraction.size();
+    BigInt result;
+    for (size_t end = length; end > 0;) {
+        size_t begin = end >= (size_t)BigInt::BASE_DIGITS ? end - BigInt::BASE_DIGITS : 0;
+        uint32_t limb = 0;
+        for (size_t k = begin; k < end; k++) limb = limb * 10 + (uint32_t)digitFromLeft(v, k);
+        result.limbs.push_back(limb);
+        end = begin;
+    }
+    result.trim();
+    return result;
+}
+
+void multiplyDecimal(const DecimalView& a, const DecimalView& b, DecimalBuffer& out) {
+    size_t lengthA = a.integer.size() + a.fraction.size();
+    size_t lengthB = b.integer.size() + b.fraction.size();
+    chargeDigits(lengthA + lengthB);
+
+    if (min(lengthA, lengthB) >= LIMB_MULTIPLY_DIGITS) {
+        BigInt x = toBigInt(a);
+        bool same = a.integer.data() == b.integer.data() && a.integer.size() == b.integer.size() &&
+                    a.fraction.data() == b.fraction.data() && a.fraction.size() == b.fraction.size();
+        BigInt product = same ? square(x) : x * toBigInt(b);
+        out.digits = product.isZero() ? string() : product.toString();
+        out.scale = a.fraction.size() + b.fraction.size();
+        if (out.digits.size() < out.scale) out.digits.insert(0, out.scale - out.digits.size(), '0');
+        out.negative = a.negative != b.negative;
+        normalize(out);
+        return;
+    }
+
+    // Schoolbook long multiplication on digit values, written as characters
+    // at the end. Row i only carries into position i, which no earlier row
+    // has touched, so every cell stays below 100
+    MemoryCharge charge(lengthA + lengthB);
+    out.digits.assign(lengthA + lengthB, 0);
+    for (size_t i = lengthA; i-- > 0;) {
+        checkCancelled();
+        int digit = digitFromLeft(a, i);
+        if (digit == 0) continue;
+        int carry = 0;
+        for (size_t j = lengthB; j-- > 0;) {
+            int cell = out.digits[i + j + 1] + digit * digitFromLeft(b, j) + carry;
+            out.digits[i + j + 1] = char(cell % 10);
+            carry = cell / 10;
+        }
+        out.digits[i] = char(carry);
+    }
+    for (char& cell : out.digits) cell = char(cell + '0');
+
+    out.scale = a.fraction.size() + b.fraction.size();
+    out.negative = a.negative != b.negative;
+    normalize(out);
+}
+
+// Compare a remainder without leading zeros against the divisor digits of b
+// from position first on
+static int compareRemainder(const string& remainder, const DecimalView& b, size_t first, size_t length) {
+    if (remainder.size() != length) return remainder.size() < length ? -1 : 1;
+    for (size_t k = 0; k < length; k++) {
+        int digit = digitFromLeft(b, first + k);
+        if (remainder[k] - '0' != digit) return remainder[k] - '0' < digit ? -1 : 1;
+    }
+    return 0;
+}
+
+// remainder -= divisor in place, dropping the leading zeros it leaves
+static void subtractDivisor(string& remainder, const DecimalView& b, size_t first, size_t length) {
+    int borrow = 0;
+    size_t offset = remainder.size() - length;
+    for (size_t k = remainder.size(); k-- > 0;) {
+        int digit = k >= offset ? digitFromLeft(b, first + k - offset) : 0;
+        int difference = (remainder[k] - '0') - digit - borrow;
+        borrow = difference < 0 ? 1 : 0;
+        remainder[k] = char('0' + difference + 10 * borrow);
+    }
+    size_t zeros = 0;
+    while (zeros < remainder.size() && remainder[zeros] == '0') zeros++;
+    remainder.erase(0, zeros);
+}
+
+void divideDecimal(const DecimalView& a, const DecimalView& b, size_t decimalPlaces,
+                   DecimalBuffer& out, string& remainder) {
+    size_t lengthA = a.integer.size() + a.fraction.size();
+    size_t lengthB = b.integer.size() + b.fraction.size();
+    size_t first = 0;
+    while (first < lengthB && digitFromLeft(b, first) == 0) first++;
+    if (first == lengthB) throw domain_error("Division by zero");
+    size_t divisorLength = lengthB - first;
+
+    // With A and B the digit runs of |a| and |b|, |a| / |b| = A / B * 10^(fb - fa).
+    // The quotient to decimalPlaces is A * 10^shift / B: the digits of A
+    // followed by shift zeros, or without its last -shift digits
+    long shift = (long)b.fraction.size() - (long)a.fraction.size() + (long)decimalPlaces;
+    long dividendLength = (long)lengthA + shift;
+    if (dividendLength > 0) chargeDigits((size_t)dividendLength);
+    MemoryCharge charge((size_t)max(dividendLength, 0L) + divisorLength);
+
+    // Past the digits of A every later digit follows from the remainder
+    // alone: a zero remainder ends the quotient, and one seen before means
+    // the digits since then repeat. Remainders are compared against a single
+    // saved one, moved each time the distance to it reaches a doubling
+    // power (Brent's cycle detection), so a period of p digits is found
+    // within 2p digits of its start, in constant space
+    string saved;
+    long savedAt = -1, power = 1;
+    out.digits.clear();
+    remainder.clear();
+    for (long k = 0; k < dividendLength; k++) {
+        checkCancelled();
+        int next = k < (long)lengthA ? digitFromLeft(a, (size_t)k) : 0;
+        if (!remainder.empty() || next != 0) remainder.push_back(char('0' + next));
+        int count = 0;
+        while (compareRemainder(remainder, b, first, divisorLength) >= 0) {
+            subtractDivisor(remainder, b, first, divisorLength);
+            count++;
+        }
+        out.digits.push_back(char('0' + count));
+        if (k + 1 < (long)lengthA) continue;
+        if (remainder.empty()) {
+            out.digits.append((size_t)(dividendLength - k - 1), '0');
+            break;
+        }
+        if (savedAt >= 0 && remainder == saved) {
+            size_t period = (size_t)(k - savedAt);
+            while ((long)out.digits.size() < dividendLength) out.digits.push_back(out.digits[out.digits.size() - period]);
+            break;
+        }
+        if (savedAt < 0 || k - savedAt == power) {
+            if (savedAt >= 0) power *= 2;
+            saved = remainder;
+            savedAt = k;
+        }
+    }
+    if (out.digits.size() < decimalPlaces) out.digits.insert(0, decimalPlaces - out.digits.size(), '0');
+
+    out.scale = decimalPlaces;
+    out.negative = a.negative != b.negative;
+    normalize(out);
+}
+
+static const int64_t CHUNK_BASE = 10000;
+static const int CHUNK_DIGITS = 4;
+
+// Partial products (each below 10^8) a cell can take before it must carry
+static const uint64_t CARRY_INTERVAL = 90000000000ULL;
+
+// |v| as base-10^4 chunks, least significant first, with the fraction padded
+// to whole chunks. Returns the number of fractional chunks
+static size_t toChunks(const DecimalView& v, vector<uint32_t>& chunks) {
+    long fractionChunks = ((long)v.fraction.size() + CHUNK_DIGITS - 1) / CHUNK_DIGITS;
+    long totalChunks = fractionChunks + ((long)v.integer.size() + CHUNK_DIGITS - 1) / CHUNK_DIGITS;
+    chunks.clear();
+    for (long chunk = 0; chunk < totalChunks; chunk++) {
+        long lowest = (chunk - fractionChunks) * CHUNK_DIGITS;
+        uint32_t value = 0;
+        for (long power = lowest + CHUNK_DIGITS - 1; power >= lowest; power--) {
+            value = value * 10 + (uint32_t)digitAt(v, power);
+        }
+        chunks.push_back(value);
+    }
+    while (!chunks.empty() && chunks.back() == 0) chunks.pop_back();
+    return (size_t)fractionChunks;
+}
+
+// Grow the cells so a product with the given fractional chunks lines up, and
+// return the cell of its lowest chunk
+size_t ProductAccumulator::alignTo(size_t fractionChunks) {
+    if (fractionChunks > scaleChunks) {
+        cells.insert(cells.begin(), fractionChunks - scaleChunks, 0);
+        scaleChunks = fractionChunks;
+    }
+    return scaleChunks - fractionChunks;
+}
+
+// Carry every cell into [0, 10^4) except the top one, which keeps the sign
+void ProductAccumulator::propagateCarries() {
+    for (size_t k = 0; k + 1 < cells.size(); k++) {
+        int64_t carry = cells[k] / CHUNK_BASE;
+        if (cells[k] % CHUNK_BASE < 0) carry--;
+        cells[k] -= carry * CHUNK_BASE;
+        cells[k + 1] += carry;
+    }
+    while (!cells.empty() && (cells.back() >= CHUNK_BASE || cells.back() <= -CHUNK_BASE)) {
+        int64_t carry = cells.back() / CHUNK_BASE;
+        cells.back() -= carry * CHUNK_BASE;
+        cells.push_back(carry);
+    }
+    pending = 0;
+}
+
+void ProductAccumulator::addProduct(const DecimalView& a, const DecimalView& b, bool subtract) {
+    size_t fractionA = toChunks(a, chunksA);
+    size_t fractionB = toChunks(b, chunksB);
+    if (chunksA.empty() || chunksB.empty()) return;
+
+    uint64_t contributions = min(chunksA.size(), chunksB.size());
+    if (pending + contributions > CARRY_INTERVAL) propagateCarries();
+    pending += contributions;
+
+    size_t offset = alignTo(fractionA + fractionB);
+    if (cells.size() < offset + chunksA.size() + chunksB.size()) cells.resize(offset + chunksA.size() + chunksB.size(), 0);
+    bool negative = subtract != (a.negative != b.negative);
+    for (size_t i = 0; i < chunksA.size(); i++) {
+        checkCancelled();
+        int64_t chunk = negative ? -(int64_t)chunksA[i] : (int64_t)chunksA[i];
+        if (chunk == 0) continue;
+        int64_t* row = cells.data() + offset + i;
+        for (size_t j = 0; j < chunksB.size(); j++) row[j] += chunk * chunksB[j];
+    }
+}
+
+void ProductAccumulator::addSquare(const DecimalView& a, bool subtract) {
+    size_t fraction = toChunks(a, chunksA);
+    if (chunksA.empty()) return;
+
+    uint64_t contributions = chunksA.size();
+    if (pending + contributions > CARRY_INTERVAL) propagateCarries();
+    pending += contributions;
+
+    // Each cross product a_i * a_j appears twice in the square: computed once
+    // and doubled, next to the diagonal a_i^2
+    size_t offset = alignTo(2 * fraction);
+    if (cells.size() < offset + 2 * chunksA.size()) cells.resize(offset + 2 * chunksA.size(), 0);
+    int64_t sign = subtract ? -1 : 1;
+    for (size_t i = 0; i < chunksA.size(); i++) {
+        checkCancelled();
+        int64_t chunk = (int64_t)chunksA[i];
+        if (chunk == 0) continue;
+        int64_t* row = cells.data() + offset + i;
+        row[i] += sign * chunk * chunk;
+        int64_t doubled = 2 * sign * chunk;
+        for (size_t j = i + 1; j < chunksA.size(); j++) row[j] += doubled * chunksA[j];
+    }
+}
+
+void ProductAccumulator::finish(DecimalBuffer& out) {
+    propagateCarries();
+    while (!cells.empty() && cells.back() == 0) cells.pop_back();
+    out.negative = !cells.empty() && cells.back() < 0;
+    if (out.negative) {
+        // Lower cells are non-negative, so a negative top cell makes the sum
+        // negative; carrying its negation gives the magnitude
+        for (int64_t& cell : cells) cell = -cell;
+        propagateCarries();
+        while (!cells.empty() && cells.back() == 0) cells.pop_back();
+    }
+
+    out.digits.clear();
+    for (size_t k = cells.size(); k-- > 0;) {
+        int64_t cell = cells[k];
+        for (int64_t place = CHUNK_BASE / 10; place > 0; place /= 10) {
+            out.digits.push_back(char('0' + cell / place % 10));
+        }
+    }
+    out.scale = scaleChunks * CHUNK_DIGITS;
+    if (out.digits.size() < out.scale) out.digits.insert(0, out.scale - out.digits.size(), '0');
+    normalize(out);
+
+    cells.clear();
+    scaleChunks = 0;
+    pending = 0;
+}
+
+void assignDecimal(const DecimalView& value, DecimalBuffer& out) {
+    out.digits.assign(value.integer.data(), value.integer.size());
+    out.digits.append(value.fraction.data(), value.fraction.size());
+    out.scale = value.fraction.size();
+    out.negative = value.negative;
+    normalize(out);
+}
+
+void formatDecimal(const DecimalBuffer& value, string& text) {
+    if (value.isZero()) {
+        text.assign(1, '0');
+        return;
+    }
+    text.clear();
+    if (value.negative) text.push_back('-');
+    size_t integerLength = value.digits.size() - value.scale;
+    if (integerLength == 0) {
+        text.push_back('0');
+    } else {
+        text.append(value.digits, 0, integerLength);
+    }
+    if (value.scale > 0) {
+        text.push_back('.');
+        text.append(value.digits, integerLength, value.scale);
+    }
+}
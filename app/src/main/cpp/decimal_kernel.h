@@ -0,0 +1,81 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Allocation-free kernels behind the string arithmetic of calc.h. Operands are
+// views into the caller's storage, results go into caller-owned buffers, and
+// sign and scale travel as fields instead of characters, so negating an
+// operand or moving a decimal point never copies digits. A loop that reuses
+// its buffers stops allocating once they have grown to the working size.
+
+// Read-only decimal operand: +/- integer.fraction
+struct DecimalView {
+    std::string_view integer;   // Digits before the point; may be empty or have leading zeros
+    std::string_view fraction;  // Digits after the point; may have trailing zeros
+    bool negative = false;
+};
+
+// Kernel result: digits without sign or point, the last `scale` of them
+// fractional. Kernels leave it normalized: no leading integer zeros, no
+// trailing fraction zeros, and zero as empty digits with no sign
+struct DecimalBuffer {
+    std::string digits;
+    size_t scale = 0;
+    bool negative = false;
+
+    bool isZero() const { return digits.empty(); }
+
+    // Valid until the buffer is next written
+    DecimalView view() const;
+};
+
+// Splits "-12.50", "+3" or ".5" into a view of the text without copying;
+// false for anything else, including scientific notation
+bool parseDecimalView(std::string_view text, DecimalView& view);
+
+// Copy a view into a buffer, normalized
+void assignDecimal(const DecimalView& value, DecimalBuffer& out);
+
+// Compare |a| and |b|: -1, 0 or 1
+int compareMagnitude(const DecimalView& a, const DecimalView& b);
+
+// The output buffer must not be the storage of an operand view
+void addDecimal(const DecimalView& a, const DecimalView& b, DecimalBuffer& out);
+void subtractDecimal(const DecimalView& a, const DecimalView& b, DecimalBuffer& out);
+void multiplyDecimal(const DecimalView& a, const DecimalView& b, DecimalBuffer& out);
+
+// Exact sum of products (a1*b1 - a2*b2 + ...). Partial products go into wide
+// signed base-10^4 cells without carrying; carries, sign and zeros are
+// resolved once by finish(), so a sum of n products pays for one
+// normalization instead of n products and n - 1 additions. Squares take
+// about half the multiplications of a general product. Reusable: its
+// storage stays allocated between sums
+class ProductAccumulator {
+public:
+    void addProduct(const DecimalView& a, const DecimalView& b, bool subtract = false);
+    void addSquare(const DecimalView& a, bool subtract = false);
+
+    // Writes the normalized sum into out and starts a new, empty sum
+    void finish(DecimalBuffer& out);
+
+private:
+    size_t alignTo(size_t fractionChunks);
+    void propagateCarries();
+
+    std::vector<int64_t> cells;     // Least significant first
+    size_t scaleChunks = 0;         // Cells below the decimal point
+    uint64_t pending = 0;           // Partial products added since the last carry
+    std::vector<uint32_t> chunksA;  // Operand scratch
+    std::vector<uint32_t> chunksB;
+};
+
+// a / b truncated to the given number of fractional digits; remainder is
+// scratch space for the long division. Throws domain_error when b is zero
+void divideDecimal(const DecimalView& a, const DecimalView& b, size_t decimalPlaces,
+                   DecimalBuffer& out, std::string& remainder);
+
+// Writes the plain form used by the string API ("-12.5", "0.25", "0") into
+// text, replacing its contents
+void formatDecimal(const DecimalBuffer& value, std::string& text);
@@ -0,0 +1,164 @@
+#include "display_format.h"
+#include "calc.h"
+#include <stdexcept>
+#include <string>
+
+using namespace std;
+
+// Smallest magnitude Norm1 and Norm2 still show in plain notation
+static const long long NORM1_LOWEST_PLAIN = -2;
+static const long long NORM2_LOWEST_PLAIN = -9;
+
+// Plain notation up to this magnitude in every mode
+static const long long HIGHEST_PLAIN = (long long)DISPLAY_DIGITS - 1;
+
+DisplayFormat makeDisplayFormat(int mode, int digits) {
+    switch (mode) {
+        case DISPLAY_ALL:
+        case DISPLAY_NORM1:
+        case DISPLAY_NORM2:
+        case DISPLAY_ENG:
+            return DisplayFormat((DisplayMode)mode, 0);
+        case DISPLAY_FIX:
+            if (digits < 0 || digits > 9) throw invalid_argument("Fix takes 0 to 9 places");
+            return DisplayFormat(DISPLAY_FIX, digits);
+        case DISPLAY_SCI:
+            if (digits < 1 || digits > (int)DISPLAY_DIGITS) throw invalid_argument("Sci takes 1 to 10 digits");
+            return DisplayFormat(DISPLAY_SCI, digits);
+    }
+    throw invalid_argument("Unknown display mode: " + to_string(mode));
+}
+
+size_t displayPrecision(const DisplayFormat& format) {
+    return format.mode == DISPLAY_ALL ? 0 : DISPLAY_INTERNAL_DIGITS;
+}
+
+// Rounds to a multiple of 10^-places, half away from zero
+static BigFloat roundToPlaces(const BigFloat& value, long long places) {
+    if (value.isZero() || value.exponent >= -places) return value;
+    long long keep = decimalMagnitude(value) + 1 + places;
+    if (keep > 0) return roundToDigits(value, (size_t)keep);
+    if (keep < 0) return BigFloat();
+    // Only the first dropped digit is left to decide between 0 and one unit
+    BigInt lead = shiftDecimalRight(absValue(value.mantissa), value.mantissa.digitCount() - 1);
+    if (lead.limbs[0] < 5) return BigFloat();
+    return BigFloat(BigInt(value.mantissa.negative ? -1 : 1), -places);
+}
+
+// |value| as digits with exactly `places` decimals ("0.50", "12")
+static string plainText(const BigFloat& value, size_t places) {
+    string digits = value.isZero() ? "0" : absValue(value.mantissa).toString();
+    long long exponent = value.isZero() ? 0 : value.exponent;
+    if (exponent >= 0) {
+        digits.append((size_t)exponent, '0');
+        exponent = 0;
+    }
+    size_t fraction = (size_t)-exponent;
+    if (digits.size() <= fraction) digits.insert(0, fraction - digits.size() + 1, '0');
+    string integer = digits.substr(0, digits.size() - fraction);
+    string decimals = digits.substr(digits.size() - fraction);
+    decimals.resize(places, '0');
+    return places == 0 ? integer : integer + "." + decimals;
+}
+
+// |value| as "d.ddd" followed by "e" and its exponent, the mantissa padded to
+// `mantissaDigits` with `integerDigits` before the point (Eng needs up to 3)
+static string scientificText(const BigFloat& value, size_t mantissaDigits, size_t integerDigits, long long exponent) {
+    string digits = absValue(value.mantissa).toString();
+    if (digits.size() < mantissaDigits) digits.resize(mantissaDigits, '0');
+    if (digits.size() < integerDigits) digits.resize(integerDigits, '0');
+    string text = digits.substr(0, integerDigits);
+    if (digits.size() > integerDigits) text += "." + digits.substr(integerDigits);
+    return text + "e" + to_string(exponent);
+}
+
+static string formatValue(const BigFloat& value, const DisplayFormat& format) {
+    if (format.mode == DISPLAY_FIX) {
+        BigFloat rounded = roundToPlaces(value, format.digits);
+        if (rounded.isZero()) return plainText(BigFloat(), (size_t)format.digits);
+        long long magnitude = decimalMagnitude(rounded);
+        if (magnitude > HIGHEST_PLAIN) return formatValue(value, DisplayFormat(DISPLAY_NORM1));
+        // Places that would push the number past the display are dropped
+        long long places = format.digits;
+        if (magnitude >= 0 && magnitude + 1 + places > (long long)DISPLAY_DIGITS) {
+            places = (long long)DISPLAY_DIGITS - magnitude - 1;
+            rounded = roundToPlaces(value, places);
+        }
+        string sign = rounded.mantissa.negative ? "-" : "";
+        return sign + plainText(rounded, (size_t)places);
+    }
+
+    if (value.isZero()) {
+        return format.mode == DISPLAY_SCI ? scientificText(BigFloat(), (size_t)format.digits, 1, 0) : "0";
+    }
+    size_t digits = format.mode == DISPLAY_SCI ? (size_t)format.digits : DISPLAY_DIGITS;
+    BigFloat rounded = roundToDigits(value, digits);
+    long long magnitude = decimalMagnitude(rounded);
+    string sign = rounded.mantissa.negative ? "-" : "";
+
+    switch (format.mode) {
+        case DISPLAY_SCI:
+            return sign + scientificText(rounded, digits, 1, magnitude);
+        case DISPLAY_ENG: {
+            long long exponent = magnitude >= 0 ? magnitude - magnitude % 3 : magnitude - ((magnitude % 3) + 3) % 3;
+            return sign + scientificText(rounded, 0, (size_t)(magnitude - exponent + 1), exponent);
+        }
+        default: {
+            long long lowest = format.mode == DISPLAY_NORM2 ? NORM2_LOWEST_PLAIN : NORM1_LOWEST_PLAIN;
+            if (magnitude > HIGHEST_PLAIN || magnitude < lowest) {
+                return sign + scientificText(rounded, 0, 1, magnitude);
+            }
+            long long places = -rounded.exponent;
+            return sign + plainText(rounded, places > 0 ? (size_t)places : 0);
+        }
+    }
+}
+
+string formatNumber(const string& number, const DisplayFormat& format) {
+    if (format.mode == DISPLAY_ALL) return number;
+    return formatValue(parseBigFloat(number), format);
+}
+
+string formatComplex(const ComplexNumber& value, const DisplayFormat& format) {
+    if (format.mode == DISPLAY_ALL || value.isReal()) {
+        return format.mode == DISPLAY_ALL ? value.toString() : formatNumber(value.real, format);
+    }
+    // Zero parts are left out and unit imaginary parts written as i, as
+    // toString() does, judged on the rounded text
+    string real = formatNumber(value.real, format);
+    string imaginary = formatNumber(value.imaginary, format);
+    bool realZero = parseBigFloat(real).isZero();
+    if (parseBigFloat(imaginary).isZero()) return real;
+    if (imaginary == "1") imaginary.clear();
+    if (imaginary == "-1") imaginary = "-";
+    if (realZero) return imaginary + "i";
+    return real + (!imaginary.empty() && imaginary[0] == '-' ? "" : "+") + imaginary + "i";
+}
+
+string formatExact(const Rational& value, const DisplayFormat& format) {
+    if (format.mode == DISPLAY_ALL) return toFractionString(value);
+    size_t length = absValue(value.numerator).digitCount() + (value.isInteger() ? 0 : value.denominator.digitCount());
+    if (!value.isInteger() && length <= DISPLAY_DIGITS) return toFractionString(value);
+
+    // Two guard digits beyond the internal ones decide the rounding
+    BigFloat decimal = divide(BigFloat(value.numerator), BigFloat(value.denominator), DISPLAY_INTERNAL_DIGITS + 2);
+    return formatValue(decimal, format);
+}
+
+// Combining overline, UTF-8
+static const char* const OVERLINE = "\xCC\x85";
+
+string formatRecurring(const Rational& value) {
+    RepeatingDecimal expansion;
+    if (value.isInteger() || !findRepeatingDecimal(value, DISPLAY_DIGITS, expansion)) return "";
+    size_t integerDigits = expansion.integer.isZero() ? 0 : expansion.integer.digitCount();
+    if (expansion.period.empty() || integerDigits + expansion.prefix.size() + expansion.period.size() > DISPLAY_DIGITS) {
+        return "";
+    }
+    string text = (expansion.negative ? "-" : "") + expansion.integer.toString() + "." + expansion.prefix;
+    for (char digit : expansion.period) {
+        text += digit;
+        text += OVERLINE;
+    }
+    return text;
+}
@@ -0,0 +1,52 @@
+#pragma once
+#include <string>
+#include "complex_number.h"
+#include "rational.h"
+
+// Result display of the fx-991ES (SETUP Norm/Fix/Sci/Eng). The display shows
+// at most DISPLAY_DIGITS significant digits, so a formatted result never
+// needs more than DISPLAY_INTERNAL_DIGITS computed: like the calculator, 15
+// digits are carried and the visible 10 are rounded from them
+const size_t DISPLAY_DIGITS = 10;
+const size_t DISPLAY_INTERNAL_DIGITS = 15;
+
+enum DisplayMode {
+    DISPLAY_ALL,    // Every computed digit, unrounded (the engine's own text)
+    DISPLAY_NORM1,  // 10 digits, scientific below 0.01 and from 10^10 on
+    DISPLAY_NORM2,  // 10 digits, scientific below 10^-9 and from 10^10 on
+    DISPLAY_FIX,    // digits decimal places
+    DISPLAY_SCI,    // digits significant digits (1-10), always scientific
+    DISPLAY_ENG     // 10 digits, exponent a multiple of 3
+};
+
+struct DisplayFormat {
+    DisplayMode mode;
+    int digits;     // Fix: 0-9 places; Sci: 1-10 significant digits
+
+    DisplayFormat(DisplayMode m = DISPLAY_ALL, int d = 0) : mode(m), digits(d) {}
+};
+
+// Throws invalid_argument for digit counts the mode does not have
+DisplayFormat makeDisplayFormat(int mode, int digits);
+
+// Significant digits an evaluation must produce for this format; 0 for
+// DISPLAY_ALL, which shows whatever was computed
+size_t displayPrecision(const DisplayFormat& format);
+
+// A decimal string ("-12.5", ".25", "6.02e23") as the display shows it,
+// rounded half away from zero: "1.234567890e12", "0.25", "12.50" in Fix 2
+std::string formatNumber(const std::string& number, const DisplayFormat& format);
+
+// Both parts of a complex result formatted as above
+std::string formatComplex(const ComplexNumber& value, const DisplayFormat& format);
+
+// Exact results keep their fraction form while it fits on the display
+// (numerator and denominator digits together at most DISPLAY_DIGITS);
+// longer ones are shown as formatted decimals
+std::string formatExact(const Rational& value, const DisplayFormat& format);
+
+// S⇔D recurring-decimal form of an exact result with the repeating block
+// overlined (U+0305 after each digit: 0.1̅4̅2̅8̅5̅7̅), shown like the fx-991ES
+// when its digits fit on the display (DISPLAY_DIGITS, a zero integer part
+// not counted). Empty for integers, terminating decimals and longer periods
+std::string formatRecurring(const Rational& value);
@@ -0,0 +1,396 @@
+#include "double_program.h"
+#include "cancellation.h"
+#include "jit.h"
+#include "optimizer.h"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <android/log.h>
+
+#define LOG_TAG "CalculatorDouble"
+#define LOGD(...) __android_log_print(ANDROID_LOG_DEBUG, LOG_TAG, __VA_ARGS__)
+
+using namespace std;
+
+// Integer powers up to this are unrolled into multiplications
+static const long long MAX_UNROLLED_POWER = 64;
+
+// Inputs evaluated between cancellation checks
+static const size_t CHECK_INTERVAL = 4096;
+
+static const double PI = 3.14159265358979323846;
+
+// sin and cos of x in a unit with `right` to the right angle: a whole turn is
+// taken off exactly (fmod is exact), then the nearest right angle, so exact
+// multiples of a right angle give exact 0 and 1 as the decimal engine does
+static void unitSineCosine(double x, double right, double& sine, double& cosine) {
+    double turn = fmod(x, 4 * right);
+    double k = nearbyint(turn / right);
+    double t = turn - k * right;
+    double s = 0, c = 1;
+    if (t != 0) {
+        s = sin(t * (PI / (2 * right)));
+        c = cos(t * (PI / (2 * right)));
+    }
+    switch (((long long)k % 4 + 4) % 4) {
+        case 0: sine = s; cosine = c; break;
+        case 1: sine = c; cosine = -s; break;
+        case 2: sine = -s; cosine = -c; break;
+        default: sine = -c; cosine = s; break;
+    }
+    // No -0 from the quadrant signs: sin(180°) is 0
+    sine += 0.0;
+    cosine += 0.0;
+    if (std::isnan(t)) sine = cosine = NAN;
+}
+
+// The functions instructions call, by address
+static double radianSine(double x) { return sin(x); }
+static double radianCosine(double x) { return cos(x); }
+static double radianTangent(double x) { return tan(x); }
+static double degreeSine(double x) { double s, c; unitSineCosine(x, 90, s, c); return s; }
+static double degreeCosine(double x) { double s, c; unitSineCosine(x, 90, s, c); return c; }
+static double degreeTangent(double x) { double s, c; unitSineCosine(x, 90, s, c); return c == 0 ? NAN : s / c; }
+static double gradianSine(double x) { double s, c; unitSineCosine(x, 100, s, c); return s; }
+static double gradianCosine(double x) { double s, c; unitSineCosine(x, 100, s, c); return c; }
+static double gradianTangent(double x) { double s, c; unitSineCosine(x, 100, s, c); return c == 0 ? NAN : s / c; }
+static double arcSine(double x) { return asin(x); }
+static double arcCosine(double x) { return acos(x); }
+static double arcTangent(double x) { return atan(x); }
+static double hyperbolicSine(double x) { return sinh(x); }
+static double hyperbolicCosine(double x) { return cosh(x); }
+static double hyperbolicTangent(double x) { return tanh(x); }
+static double naturalExponential(double x) { return exp(x); }
+static double naturalLogarithm(double x) { return log(x); }
+static double commonLogarithm(double x) { return log10(x); }
+
+// Largest denominator q for which a negative base's x^(p/q) is taken as a
+// root and a power, as in the decimal engine
+static const long long SMALL_DENOMINATOR_LIMIT = 1000;
+
+// Recognise y as p/q with a small q, to within the rounding of y itself
+// (0.2 -> 1/5, the double nearest 1/3 -> 1/3), from its continued fraction
+static bool smallRational(double y, long long& p, long long& q) {
+    double magnitude = fabs(y), rest = magnitude;
+    long long pPrev = 1, pCur = (long long)floor(rest), qPrev = 0, qCur = 1;
+    while (qCur <= SMALL_DENOMINATOR_LIMIT) {
+        if (fabs((double)pCur / (double)qCur - magnitude) <= 2 * numeric_limits<double>::epsilon() * magnitude) {
+            p = y < 0 ? -pCur : pCur;
+            q = qCur;
+            return true;
+        }
+        double fraction = rest - floor(rest);
+        if (fraction == 0) break;
+        rest = 1 / fraction;
+        // A larger term would take the next denominator past the limit
+        if (rest > SMALL_DENOMINATOR_LIMIT + 1) break;
+        long long term = (long long)floor(rest);
+        long long pNext = term * pCur + pPrev, qNext = term * qCur + qPrev;
+        pPrev = pCur; pCur = pNext;
+        qPrev = qCur; qCur = qNext;
+    }
+    return false;
+}
+
+// pow() has no real value for a negative base and a non-integer exponent;
+// like the decimal engine, an odd root of the base is taken when the
+// exponent is a small fraction p/q with q odd
+static double realPower(double x, double y) {
+    long long p, q;
+    if (x < 0 && y != nearbyint(y) && std::isfinite(y) && fabs(y) < 1e15 && smallRational(y, p, q) && q % 2 == 1) {
+        double magnitude = pow(-x, y);
+        return p % 2 == 0 ? magnitude : -magnitude;
+    }
+    return pow(x, y);
+}
+
+static bool isBinary(DoubleOp op) {
+    return op != DOUBLE_SQRT && op != DOUBLE_ABS && op != DOUBLE_CALL;
+}
+
+double applyDouble(const DoubleInstruction& instruction, double left, double right) {
+    switch (instruction.op) {
+        case DOUBLE_ADD: return left + right;
+        case DOUBLE_SUBTRACT: return left - right;
+        case DOUBLE_MULTIPLY: return left * right;
+        case DOUBLE_DIVIDE: return left / right;
+        case DOUBLE_SQRT: return sqrt(left);
+        case DOUBLE_ABS: return fabs(left);
+        case DOUBLE_CALL: return instruction.unary(left);
+        case DOUBLE_CALL2: return instruction.binary(left, right);
+    }
+    return NAN;
+}
+
+// Lowers program nodes to instructions in SSA form, one value per
+// instruction (SOURCE_SLOT operands name instructions until slots are
+// allocated). Instructions of constant operands are computed on the spot
+class DoubleLowering {
+public:
+    DoubleLowering(int variable, const SlotTable* slots, AngleUnit unit)
+        : variable(variable), slots(slots), unit(unit) {}
+
+    DoubleCode code;
+
+    // False for anything without a double form
+    bool node(const ProgramNode& node, const vector<DoubleOperand>& values, DoubleOperand& value) {
+        switch (node.op) {
+            case OP_VALUE: return leaf(node.token, value);
+            case OP_ADD: value = emit(DOUBLE_ADD, values[node.left], values[node.right]); return true;
+            case OP_SUBTRACT: value = emit(DOUBLE_SUBTRACT, values[node.left], values[node.right]); return true;
+            case OP_MULTIPLY: value = emit(DOUBLE_MULTIPLY, values[node.left], values[node.right]); return true;
+            case OP_DIVIDE: value = emit(DOUBLE_DIVIDE, values[node.left], values[node.right]); return true;
+            case OP_SQUARE: value = emit(DOUBLE_MULTIPLY, values[node.left], values[node.left]); return true;
+            case OP_POWER: value = power(values[node.left], values[node.right]); return true;
+            case OP_FUNCTION:
+                if (node.token.series || node.right >= 0) return false;
+                return function(node.token.value, values[node.left], value);
+        }
+        return false;
+    }
+
+private:
+    DoubleOperand constant(double value) {
+        code.constants.push_back(value);
+        return DoubleOperand{SOURCE_CONSTANT, (int)code.constants.size() - 1};
+    }
+
+    DoubleOperand emit(DoubleOp op, DoubleOperand left, DoubleOperand right,
+                       double (*unary)(double) = nullptr, double (*binary)(double, double) = nullptr) {
+        DoubleInstruction instruction{op, (int)code.instructions.size(), left, isBinary(op) ? right : left, unary, binary};
+        if (left.source == SOURCE_CONSTANT && (!isBinary(op) || right.source == SOURCE_CONSTANT)) {
+            return constant(applyDouble(instruction, code.constants[left.index],
+                                        code.constants[instruction.right.index]));
+        }
+        code.instructions.push_back(instruction);
+        return DoubleOperand{SOURCE_SLOT, instruction.target};
+    }
+
+    DoubleOperand call(double (*function)(double), DoubleOperand operand) {
+        return emit(DOUBLE_CALL, operand, operand, function);
+    }
+
+    bool leaf(const Token& token, DoubleOperand& value) {
+        string text;
+        if (token.type == NUMBER) {
+            text = token.value;
+        } else if (token.slot == variable) {
+            value = DoubleOperand{SOURCE_INPUT, 0};
+            return true;
+        } else if (token.slot >= 0) {
+            if (slots == nullptr) {
+                value = constant(0);
+                return true;
+            }
+            if (!slots->values[token.slot].isReal()) return false;
+            text = slots->values[token.slot].real;
+        } else if (token.value == "pi") {
+            value = constant(PI);
+            return true;
+        } else if (token.value == "e") {
+            value = constant(2.71828182845904523536);
+            return true;
+        } else {
+            return false;
+        }
+        try {
+            double number = stod(text);
+            if (!std::isfinite(number)) return false;
+            value = constant(number);
+            return true;
+        } catch (const exception&) {
+            return false;
+        }
+    }
+
+    // Small integer powers by repeated squaring, like the decimal engine;
+    // anything else through realPower()
+    DoubleOperand power(DoubleOperand base, DoubleOperand exponent) {
+        if (exponent.source == SOURCE_CONSTANT) {
+            double n = code.constants[exponent.index];
+            if (n == nearbyint(n) && fabs(n) <= MAX_UNROLLED_POWER) {
+                long long remaining = (long long)fabs(n);
+                DoubleOperand result = constant(1), square = base;
+                bool first = true;
+                while (remaining > 0) {
+                    if (remaining & 1) {
+                        result = first ? square : emit(DOUBLE_MULTIPLY, result, square);
+                        first = false;
+                    }
+                    remaining >>= 1;
+                    if (remaining > 0) square = emit(DOUBLE_MULTIPLY, square, square);
+                }
+                return n < 0 ? emit(DOUBLE_DIVIDE, constant(1), result) : result;
+            }
+        }
+        return emit(DOUBLE_CALL2, base, exponent, nullptr, realPower);
+    }
+
+    // Radians to the unit, for inverse trigonometric results
+    DoubleOperand fromRadians(DoubleOperand radians) {
+        if (unit == ANGLE_RADIANS) return radians;
+        return emit(DOUBLE_MULTIPLY, radians, constant((unit == ANGLE_DEGREES ? 180 : 200) / PI));
+    }
+
+    bool function(const string& name, DoubleOperand x, DoubleOperand& value) {
+        bool degrees = unit == ANGLE_DEGREES, radians = unit == ANGLE_RADIANS;
+        if (name == "sqrt") value = emit(DOUBLE_SQRT, x, x);
+        else if (name == "abs") value = emit(DOUBLE_ABS, x, x);
+        else if (name == "inv") value = emit(DOUBLE_DIVIDE, constant(1), x);
+        else if (name == "exp") value = call(naturalExponential, x);
+        else if (name == "ln") value = call(naturalLogarithm, x);
+        else if (name == "log" || name == "log10") value = call(commonLogarithm, x);
+        else if (name == "sin") value = call(radians ? radianSine : degrees ? degreeSine : gradianSine, x);
+        else if (name == "cos") value = call(radians ? radianCosine : degrees ? degreeCosine : gradianCosine, x);
+        else if (name == "tan") value = call(radians ? radianTangent : degrees ? degreeTangent : gradianTangent, x);
+        else if (name == "asin") value = fromRadians(call(arcSine, x));
+        else if (name == "acos") value = fromRadians(call(arcCosine, x));
+        else if (name == "atan") value = fromRadians(call(arcTangent, x));
+        else if (name == "sinh") value = call(hyperbolicSine, x);
+        else if (name == "cosh") value = call(hyperbolicCosine, x);
+        else if (name == "tanh") value = call(hyperbolicTangent, x);
+        else return false;
+        return true;
+    }
+
+    const int variable;
+    const SlotTable* const slots;
+    const AngleUnit unit;
+};
+
+// Replaces SSA values by frame slots. A value's slot is given back at its
+// last reader, before that reader's own value takes one, so x*y can be
+// written over x
+static void allocateSlots(DoubleCode& code) {
+    size_t count = code.instructions.size();
+    vector<size_t> lastUse(count, 0);
+    for (size_t i = 0; i < count; i++) {
+        const DoubleInstruction& instruction = code.instructions[i];
+        if (instruction.left.source == SOURCE_SLOT) lastUse[instruction.left.index] = i;
+        if (isBinary(instruction.op) && instruction.right.source == SOURCE_SLOT) lastUse[instruction.right.index] = i;
+    }
+    if (code.result.source == SOURCE_SLOT) lastUse[code.result.index] = count;
+
+    vector<int> slotOf(count, -1);
+    vector<int> free;
+    int slots = 0;
+    for (size_t i = 0; i < count; i++) {
+        DoubleInstruction& instruction = code.instructions[i];
+        int left = instruction.left.source == SOURCE_SLOT ? instruction.left.index : -1;
+        int right = isBinary(instruction.op) && instruction.right.source == SOURCE_SLOT ? instruction.right.index : -1;
+        if (left >= 0 && lastUse[left] == i) free.push_back(slotOf[left]);
+        if (right >= 0 && right != left && lastUse[right] == i) free.push_back(slotOf[right]);
+        if (instruction.left.source == SOURCE_SLOT) instruction.left.index = slotOf[instruction.left.index];
+        if (instruction.right.source == SOURCE_SLOT) instruction.right.index = slotOf[instruction.right.index];
+        if (free.empty()) {
+            slotOf[i] = slots++;
+        } else {
+            slotOf[i] = free.back();
+            free.pop_back();
+        }
+        instruction.target = slotOf[i];
+    }
+    if (code.result.source == SOURCE_SLOT) code.result.index = slotOf[code.result.index];
+    code.slots = slots;
+}
+
+unique_ptr<DoubleProgram> DoubleProgram::lower(const CompiledProgram& program, int variable,
+                                               const SlotTable* slots, AngleUnit unit) {
+    const vector<ProgramNode>& nodes = program.nodes();
+    vector<bool> needed(nodes.size(), false);
+    needed[program.result()] = true;
+    for (int i = (int)nodes.size() - 1; i >= 0; i--) {
+        if (!needed[i]) continue;
+        if (nodes[i].left >= 0) needed[nodes[i].left] = true;
+        if (nodes[i].right >= 0) needed[nodes[i].right] = true;
+    }
+
+    DoubleLowering lowering(variable, slots, unit);
+    vector<DoubleOperand> values(nodes.size(), DoubleOperand{SOURCE_CONSTANT, -1});
+    for (size_t i = 0; i < nodes.size(); i++) {
+        if (!needed[i]) continue;
+        if (!lowering.node(nodes[i], values, values[i])) {
+            LOGD("No double form for node %d (%s)", (int)i, nodes[i].token.value.c_str());
+            return nullptr;
+        }
+    }
+    lowering.code.result = values[program.result()];
+    allocateSlots(lowering.code);
+    return unique_ptr<DoubleProgram>(new DoubleProgram(std::move(lowering.code)));
+}
+
+DoubleProgram::DoubleProgram(DoubleCode code) : lowered(std::move(code)) {
+    for (double value : lowered.constants) constantLanes.insert(constantLanes.end(), 8, value);
+    const int lanes[3] = {1, 4, 8};
+    for (int i = 0; i < 3; i++) {
+        kernels[i] = NativeKernel::compile(lowered, lanes[i]);
+        if (!kernels[i]) break;
+    }
+    // All or nothing: evaluate() picks variants by width only
+    if (!kernels[1] || !kernels[2]) {
+        for (auto& kernel : kernels) kernel.reset();
+    }
+    LOGD("%d instructions over %d slots, %s", (int)lowered.instructions.size(), lowered.slots,
+         isNative() ? "native" : "interpreted");
+}
+
+DoubleProgram::~DoubleProgram() = default;
+
+// Each instruction over all lanes at once: loops the compiler vectorizes,
+// with the dispatch paid once per LANES inputs
+template <int LANES>
+void DoubleProgram::interpret(const double* inputs, double* outputs, double* frame) const {
+    auto lanes = [&](const DoubleOperand& operand) -> const double* {
+        switch (operand.source) {
+            case SOURCE_SLOT: return frame + (size_t)operand.index * LANES;
+            case SOURCE_CONSTANT: return constantLanes.data() + (size_t)operand.index * 8;
+            case SOURCE_INPUT: break;
+        }
+        return inputs;
+    };
+    for (const DoubleInstruction& instruction : lowered.instructions) {
+        const double* a = lanes(instruction.left);
+        const double* b = lanes(instruction.right);
+        double* t = frame + (size_t)instruction.target * LANES;
+        switch (instruction.op) {
+            case DOUBLE_ADD: for (int i = 0; i < LANES; i++) t[i] = a[i] + b[i]; break;
+            case DOUBLE_SUBTRACT: for (int i = 0; i < LANES; i++) t[i] = a[i] - b[i]; break;
+            case DOUBLE_MULTIPLY: for (int i = 0; i < LANES; i++) t[i] = a[i] * b[i]; break;
+            case DOUBLE_DIVIDE: for (int i = 0; i < LANES; i++) t[i] = a[i] / b[i]; break;
+            case DOUBLE_SQRT: for (int i = 0; i < LANES; i++) t[i] = sqrt(a[i]); break;
+            case DOUBLE_ABS: for (int i = 0; i < LANES; i++) t[i] = fabs(a[i]); break;
+            case DOUBLE_CALL: for (int i = 0; i < LANES; i++) t[i] = instruction.unary(a[i]); break;
+            case DOUBLE_CALL2: for (int i = 0; i < LANES; i++) t[i] = instruction.binary(a[i], b[i]); break;
+        }
+    }
+    const double* result = lanes(lowered.result);
+    for (int i = 0; i < LANES; i++) outputs[i] = result[i];
+}
+
+template <int LANES>
+void DoubleProgram::evaluateLanes(size_t kernel, const double* inputs, double* outputs, double* frame) const {
+    if (kernels[kernel]) {
+        kernels[kernel]->run(inputs, outputs, frame);
+    } else {
+        interpret<LANES>(inputs, outputs, frame);
+    }
+}
+
+void DoubleProgram::evaluate(const double* inputs, double* outputs, size_t count) const {
+    vector<double> frame((size_t)max(lowered.slots, 1) * 8);
+    size_t i = 0;
+    for (; count - i >= 8; i += 8) {
+        if (i % CHECK_INTERVAL == 0) checkCancelled();
+        evaluateLanes<8>(2, inputs + i, outputs + i, frame.data());
+    }
+    if (count - i >= 4) {
+        evaluateLanes<4>(1, inputs + i, outputs + i, frame.data());
+        i += 4;
+    }
+    for (; i < count; i++) evaluateLanes<1>(0, inputs + i, outputs + i, frame.data());
+    for (i = 0; i < count; i++) {
+        if (!std::isfinite(outputs[i])) outputs[i] = NAN;
+    }
+}
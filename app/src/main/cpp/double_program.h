@@ -0,0 +1,91 @@
+#pragma once
+#include <memory>
+#include <vector>
+#include "calc.h"
+#include "session.h"
+
+class CompiledProgram;
+class NativeKernel;
+
+// Where an operand of a double instruction comes from
+enum DoubleSource {
+    SOURCE_SLOT,        // Frame slot holding an earlier instruction's value
+    SOURCE_CONSTANT,    // Entry of the constant pool
+    SOURCE_INPUT        // The swept variable
+};
+
+struct DoubleOperand {
+    DoubleSource source;
+    int index;          // Slot or constant; unused for the input
+};
+
+enum DoubleOp {
+    DOUBLE_ADD,
+    DOUBLE_SUBTRACT,
+    DOUBLE_MULTIPLY,
+    DOUBLE_DIVIDE,
+    DOUBLE_SQRT,
+    DOUBLE_ABS,
+    DOUBLE_CALL,        // unary(left): sin, ln, exp ...
+    DOUBLE_CALL2        // binary(left, right): pow
+};
+
+struct DoubleInstruction {
+    DoubleOp op;
+    int target;         // Frame slot written
+    DoubleOperand left;
+    DoubleOperand right;
+    double (*unary)(double);
+    double (*binary)(double, double);
+};
+
+// Straight-line double-precision code for one expression. Values live in
+// frame slots that are handed to a later value once their last reader has
+// run, so the frame is as small as the expression's widest point
+struct DoubleCode {
+    std::vector<DoubleInstruction> instructions;
+    std::vector<double> constants;
+    DoubleOperand result;
+    int slots = 0;
+};
+
+// Result of one instruction on scalar operands, as every backend computes it
+double applyDouble(const DoubleInstruction& instruction, double left, double right);
+
+// Double-precision form of a compiled expression as a function of one
+// session variable, for features that evaluate it at many points (TABLE,
+// plotting). Other variables are read once, when the program is lowered.
+// Runs as native code where a backend exists for the CPU (x86-64, AArch64),
+// in variants taking one, four and eight inputs per call, and through an
+// interpreter over the same code elsewhere. Immutable once lowered, so it
+// may be evaluated from several threads at once
+class DoubleProgram {
+public:
+    // Null when the expression has no double form: Σ and Π, integer
+    // functions, complex values or numbers out of double range. Angles are
+    // in the given unit
+    static std::unique_ptr<DoubleProgram> lower(const CompiledProgram& program, int variable,
+                                                const SlotTable* slots, AngleUnit unit);
+
+    ~DoubleProgram();
+
+    // f at each input. Undefined and overflowing values come out as NaN
+    void evaluate(const double* inputs, double* outputs, size_t count) const;
+
+    // Whether evaluate() runs machine code
+    bool isNative() const { return kernels[0] != nullptr; }
+
+    const DoubleCode& code() const { return lowered; }
+
+private:
+    explicit DoubleProgram(DoubleCode code);
+
+    template <int LANES>
+    void interpret(const double* inputs, double* outputs, double* frame) const;
+    template <int LANES>
+    void evaluateLanes(size_t kernel, const double* inputs, double* outputs, double* frame) const;
+
+    DoubleCode lowered;
+    std::vector<double> constantLanes;            // Each constant repeated for 8 lanes
+    std::unique_ptr<NativeKernel> kernels[3];     // 1, 4 and 8 inputs per call
+};
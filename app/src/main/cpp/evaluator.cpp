@@ -1,5 +1,12 @@
 #include "evaluator.h"
 #include "calc.h"
+#include "complex_math.h"
+#include "cancellation.h"
+#include "integer_functions.h"
+#include "optimizer.h"
+#include "parsing.h"
+#include "series.h"
+#include <algorithm>
 #include <string>
 #include <stack>
 #include <vector>
@@ -12,85 +19,11 @@
 
 using namespace std;
 
-// Token types (duplicated from parsing.cpp - could be moved to common header)
-enum TokenType {
-    NUMBER, OPERATOR, FUNCTION, LEFT_PAREN, RIGHT_PAREN, VARIABLE
-};
+// Largest integer exponent expanded exactly; bigger powers go to decimal
+static const long long MAX_EXACT_EXPONENT = 100000;
 
-// Token structure (duplicated from parsing.cpp)
-struct Token {
-    TokenType type;
-    string value;
-    int precedence;
-    bool rightAssociative;
-    
-    Token(TokenType t, const string& v, int p = 0, bool ra = false) 
-        : type(t), value(v), precedence(p), rightAssociative(ra) {}
-};
-
-// Memory-optimized Complex number structure
-struct ComplexNumber {
-    string real;
-    string imaginary;
-    
-    // Default constructor
-    ComplexNumber() : real("0"), imaginary("not initiated") {}
-    
-    // Single string constructor (real number)
-    ComplexNumber(const string& r) : real(r), imaginary("not initiated") {}
-    
-    // Two string constructor (complex number)
-    ComplexNumber(const string& r, const string& i) : real(r), imaginary(i) {}
-    
-    // Move constructors for efficiency
-    ComplexNumber(string&& r) : real(std::move(r)), imaginary("not initiated") {}
-    ComplexNumber(string&& r, string&& i) : real(std::move(r)), imaginary(std::move(i)) {}
-    
-    // Copy constructor (explicit)
-    ComplexNumber(const ComplexNumber& other) : real(other.real), imaginary(other.imaginary) {}
-    
-    // Move constructor
-    ComplexNumber(ComplexNumber&& other) noexcept 
-        : real(std::move(other.real)), imaginary(std::move(other.imaginary)) {}
-    
-    // Assignment operators
-    ComplexNumber& operator=(const ComplexNumber& other) {
-        if (this != &other) {
-            real = other.real;
-            imaginary = other.imaginary;
-        }
-        return *this;
-    }
-    
-    ComplexNumber& operator=(ComplexNumber&& other) noexcept {
-        if (this != &other) {
-            real = std::move(other.real);
-            imaginary = std::move(other.imaginary);
-        }
-        return *this;
-    }
-    
-    bool isReal() const {
-        return imaginary == "not initiated" || imaginary == "0";
-    }
-    
-    string toString() const {
-        if (isReal()) return real;
-        if (real == "0" && imaginary == "1") return "i";
-        if (real == "0" && imaginary == "-1") return "-i";
-        if (real == "0") return imaginary + "i";
-        if (imaginary == "0") return real;
-        
-        string sign = (imaginary[0] == '-') ? "" : "+";
-        if (imaginary == "1") {
-            return real + "+i";
-        } else if (imaginary == "-1") {
-            return real + "-i";
-        } else {
-            return real + sign + imaginary + "i";
-        }
-    }
-};
+// Imaginary part of a real operand; static so references to it stay valid
+static const string ZERO = "0";
 
 // Memory-optimized complex arithmetic functions using move semantics
 ComplexNumber addComplex(const ComplexNumber& a, const ComplexNumber& b) {
@@ -118,12 +51,13 @@ ComplexNumber subtractComplex(const ComplexNumber& a, const ComplexNumber& b) {
 ComplexNumber multiplyComplex(const ComplexNumber& a, const ComplexNumber& b) {
     // Use const references to avoid string copying
     const string& ar = a.real;
-    const string& ai = a.isReal() ? static_cast<const string&>("0") : a.imaginary;
+    const string& ai = a.isReal() ? ZERO : a.imaginary;
     const string& br = b.real;
-    const string& bi = b.isReal() ? static_cast<const string&>("0") : b.imaginary;
+    const string& bi = b.isReal() ? ZERO : b.imaginary;
     
-    string realPart = subtract(multiply(ar, br), multiply(ai, bi));
-    string imagPart = add(multiply(ar, bi), multiply(ai, br));
+    if (a.isReal() && b.isReal()) return ComplexNumber(multiply(ar, br));
+    string realPart = sumOfProducts({{&ar, &br, false}, {&ai, &bi, true}});
+    string imagPart = sumOfProducts({{&ar, &bi, false}, {&ai, &br, false}});
     
     if (imagPart == "0") {
         return ComplexNumber(std::move(realPart));
@@ -132,20 +66,26 @@ ComplexNumber multiplyComplex(const ComplexNumber& a, const ComplexNumber& b) {
 }
 
 ComplexNumber divideComplex(const ComplexNumber& a, const ComplexNumber& b) {
+    // Real quotients skip the conjugate form: a*b / b^2 is the same truncated
+    // quotient, but squaring a 477000-digit divisor (1/3^1000000) takes seconds
+    if (a.isReal() && b.isReal()) {
+        return ComplexNumber(divide(a.real, b.real));
+    }
+    
     // Use const references to avoid copying
     const string& ar = a.real;
-    const string& ai = a.isReal() ? static_cast<const string&>("0") : a.imaginary;
+    const string& ai = a.isReal() ? ZERO : a.imaginary;
     const string& br = b.real;
-    const string& bi = b.isReal() ? static_cast<const string&>("0") : b.imaginary;
+    const string& bi = b.isReal() ? ZERO : b.imaginary;
     
-    string denominator = add(multiply(br, br), multiply(bi, bi));
+    string denominator = sumOfProducts({{&br, nullptr, false}, {&bi, nullptr, false}});
     
     if (denominator == "0") {
         throw domain_error("Division by zero");
     }
     
-    string realNum = add(multiply(ar, br), multiply(ai, bi));
-    string imagNum = subtract(multiply(ai, br), multiply(ar, bi));
+    string realNum = sumOfProducts({{&ar, &br, false}, {&ai, &bi, false}});
+    string imagNum = sumOfProducts({{&ai, &br, false}, {&ar, &bi, true}});
     
     string realPart = divide(realNum, denominator);
     string imagPart = divide(imagNum, denominator);
@@ -156,6 +96,34 @@ ComplexNumber divideComplex(const ComplexNumber& a, const ComplexNumber& b) {
     return ComplexNumber(std::move(realPart), std::move(imagPart));
 }
 
+ComplexNumber powerComplex(const ComplexNumber& a, const ComplexNumber& b) {
+    if (a.isReal() && b.isReal()) {
+        try {
+            return ComplexNumber(power(a.real, b.real));
+        } catch (const domain_error&) {
+            // Negative base with an exponent that has no real value
+            if (a.real[0] != '-') throw;
+        }
+    }
+    return complexPower(a, b);
+}
+
+ComplexNumber squareComplex(const ComplexNumber& a) {
+    if (a.isReal()) {
+        // Squares of decimals are rounded as their other powers are
+        if (a.real.find('.') != string::npos) return ComplexNumber(power(a.real, "2"));
+        return ComplexNumber(multiply(a.real, a.real));
+    }
+    // (a+bi)^2 = a^2 - b^2 + 2abi
+    string realPart = sumOfProducts({{&a.real, nullptr, false}, {&a.imaginary, nullptr, true}});
+    string imagPart = sumOfProducts({{&a.real, &a.imaginary, false}, {&a.real, &a.imaginary, false}});
+    
+    if (imagPart == "0") {
+        return ComplexNumber(std::move(realPart));
+    }
+    return ComplexNumber(std::move(realPart), std::move(imagPart));
+}
+
 // Parse variable names to their values
 ComplexNumber parseVariable(const string& variableName) {
     if (variableName == "i" || variableName == "j") {
@@ -166,8 +134,31 @@ ComplexNumber parseVariable(const string& variableName) {
         return ComplexNumber("2.718281828459045235360287471352662497757247093699959574966967627724076630353");
     } else {
         LOGE("Unknown variable: %s", variableName.c_str());
-        return ComplexNumber("0"); // Default to 0 for unknown variables
+        throw invalid_argument("Unknown variable: " + variableName);
+    }
+}
+
+// Integer argument of x!, nPr, nCr, gcd and lcm
+static BigInt integerArgument(const ComplexNumber& value, const string& functionName) {
+    if (value.isReal()) {
+        Rational exact = parseRational(value.real);
+        if (exact.isInteger()) return exact.numerator;
     }
+    throw domain_error(functionName + " requires integer arguments");
+}
+
+static BigInt integerArgument(const Rational& value, const string& functionName) {
+    if (!value.isInteger()) throw domain_error(functionName + " requires integer arguments");
+    return value.numerator;
+}
+
+// The integer functions on either kind of argument
+static BigInt integerFunction(const string& functionName, const BigInt& a, const BigInt& b) {
+    if (functionName == "nPr") return permutations(a, b);
+    if (functionName == "nCr") return combinations(a, b);
+    if (functionName == "gcd") return gcd(a, b);
+    if (functionName == "lcm") return lcm(a, b);
+    throw invalid_argument("Unknown function: " + functionName);
 }
 
 // Apply mathematical functions
@@ -185,7 +176,7 @@ ComplexNumber applyFunction(const string& functionName, const ComplexNumber& ope
             // 1/(a+bi) = (a-bi)/(a²+b²)
             string a = operand.real;
             string b = operand.imaginary;
-            string denom = add(multiply(a, a), multiply(b, b));
+            string denom = sumOfProducts({{&a, nullptr, false}, {&b, nullptr, false}});
             
             if (denom == "0") {
                 throw domain_error("Cannot take inverse of zero");
@@ -207,54 +198,62 @@ ComplexNumber applyFunction(const string& functionName, const ComplexNumber& ope
             // For complex numbers, return magnitude
             string a = operand.real;
             string b = operand.imaginary;
-            string magnitude_squared = add(multiply(a, a), multiply(b, b));
-            // Note: For true sqrt, would need to implement square root algorithm
-            return ComplexNumber("sqrt(" + magnitude_squared + ")");
+            string magnitude_squared = sumOfProducts({{&a, nullptr, false}, {&b, nullptr, false}});
+            return ComplexNumber(squareRoot(magnitude_squared));
         }
     } else if (functionName == "sqrt") {
         if (operand.isReal()) {
-            // Simple placeholder - real implementation would use Newton's method
-            return ComplexNumber("sqrt(" + operand.real + ")");
-        } else {
-            // Complex square root is more involved
-            return ComplexNumber("complex_sqrt(" + operand.toString() + ")");
-        }
-    } else if (functionName == "ln") {
-        if (operand.isReal()) {
-            return ComplexNumber("ln(" + operand.real + ")");
+            if (operand.real[0] == '-') {
+                // sqrt(-x) = i*sqrt(x)
+                return ComplexNumber("0", squareRoot(operand.real.substr(1)));
+            }
+            return ComplexNumber(squareRoot(operand.real));
         } else {
-            return ComplexNumber("complex_ln(" + operand.toString() + ")");
+            return applyComplexFunction(functionName, operand);
         }
-    } else if (functionName == "log" || functionName == "log10") {
-        if (operand.isReal()) {
-            return ComplexNumber("log10(" + operand.real + ")");
+    } else if (functionName == "ln" || functionName == "log" || functionName == "log10") {
+        // Logarithms of negative reals are complex: ln|x| + i*pi
+        if (operand.isReal() && operand.real[0] != '-' && operand.real != "0") {
+            return ComplexNumber(functionName == "ln" ? naturalLog(operand.real) : commonLog(operand.real));
         } else {
-            return ComplexNumber("complex_log10(" + operand.toString() + ")");
+            return applyComplexFunction(functionName, operand);
         }
     } else if (functionName == "sin" || functionName == "cos" || functionName == "tan") {
         if (operand.isReal()) {
-            return ComplexNumber(functionName + "(" + operand.real + ")");
+            if (functionName == "sin") return ComplexNumber(sine(operand.real));
+            if (functionName == "cos") return ComplexNumber(cosine(operand.real));
+            return ComplexNumber(tangent(operand.real));
         } else {
-            return ComplexNumber("complex_" + functionName + "(" + operand.toString() + ")");
+            return applyComplexFunction(functionName, operand);
         }
     } else if (functionName == "asin" || functionName == "acos" || functionName == "atan") {
         if (operand.isReal()) {
-            return ComplexNumber(functionName + "(" + operand.real + ")");
+            if (functionName == "atan") return ComplexNumber(arctangent(operand.real));
+            try {
+                return ComplexNumber(functionName == "asin" ? arcsine(operand.real) : arccosine(operand.real));
+            } catch (const domain_error&) {
+                // Outside [-1, 1] the result is complex, an angle in radians
+                // only; in degrees and grads it is an error as on the fx-991ES
+                if (angleUnit() != ANGLE_RADIANS) throw;
+                return applyComplexFunction(functionName, operand);
+            }
         } else {
-            return ComplexNumber("complex_" + functionName + "(" + operand.toString() + ")");
+            return applyComplexFunction(functionName, operand);
         }
     } else if (functionName == "sinh" || functionName == "cosh" || functionName == "tanh") {
         if (operand.isReal()) {
-            return ComplexNumber(functionName + "(" + operand.real + ")");
+            return ComplexNumber(hyperbolicFunction(functionName, operand.real));
         } else {
-            return ComplexNumber("complex_" + functionName + "(" + operand.toString() + ")");
+            return applyComplexFunction(functionName, operand);
         }
     } else if (functionName == "exp") {
         if (operand.isReal()) {
-            return ComplexNumber("exp(" + operand.real + ")");
+            return ComplexNumber(exponential(operand.real));
         } else {
-            return ComplexNumber("complex_exp(" + operand.toString() + ")");
+            return applyComplexFunction(functionName, operand);
         }
+    } else if (functionName == "!") {
+        return ComplexNumber(factorial(integerArgument(operand, "x!")).toString());
     } else if (functionName == "floor" || functionName == "ceil") {
         if (operand.isReal()) {
             return ComplexNumber(functionName + "(" + operand.real + ")");
@@ -268,97 +267,120 @@ ComplexNumber applyFunction(const string& functionName, const ComplexNumber& ope
     }
 }
 
-// Main evaluation function - now uses references to avoid copying
-string evaluatePostfixExpression(const vector<Token>& postfixTokens) {
+ComplexNumber applyFunction(const string& functionName, const ComplexNumber& left, const ComplexNumber& right) {
+    LOGD("Applying function: %s to %s, %s", functionName.c_str(), left.toString().c_str(), right.toString().c_str());
+    return ComplexNumber(integerFunction(functionName, integerArgument(left, functionName),
+                                         integerArgument(right, functionName)).toString());
+}
+
+// Main evaluation function: runs the optimized program once
+ComplexNumber evaluatePostfix(const vector<Token>& postfixTokens, const SlotTable* slots) {
     try {
         LOGD("Starting evaluation of postfix expression with %d tokens", (int)postfixTokens.size());
-        
-        stack<ComplexNumber> evalStack;
-        
-        for (const Token& token : postfixTokens) {
-            LOGD("Processing token: type=%d, value=%s", token.type, token.value.c_str());
-            
-            switch (token.type) {
-                case NUMBER:
-                    evalStack.emplace(token.value); // Use emplace instead of push to avoid copy
-                    LOGD("Pushed number: %s", token.value.c_str());
-                    break;
-                    
-                case VARIABLE:
-                    {
-                        evalStack.emplace(parseVariable(token.value)); // Direct emplace
-                        LOGD("Pushed variable %s", token.value.c_str());
-                    }
-                    break;
-                    
-                case OPERATOR:
-                    if (evalStack.size() < 2) {
-                        throw invalid_argument("Invalid expression: not enough operands for operator " + token.value);
-                    }
+        return CompiledProgram(postfixTokens).evaluate(slots);
+    } catch (const exception& e) {
+        LOGE("Evaluation error: %s", e.what());
+        throw; // Re-throw to be caught by parseExpression
+    }
+}
+
+// Exact counterpart of evaluatePostfix: a stack machine over rationals
+Rational evaluatePostfixExact(const vector<Token>& postfixTokens, const SlotTable* slots) {
+    stack<Rational> evalStack;
+    
+    for (const Token& token : postfixTokens) {
+        checkCancelled();
+        switch (token.type) {
+            case NUMBER:
+                evalStack.push(parseRational(token.value));
+                break;
+                
+            case VARIABLE:
+                if (token.slot < 0) {
+                    // i, pi and e have no rational value
+                    throw InexactError("constant " + token.value);
+                }
+                if (slots == nullptr) {
+                    evalStack.push(Rational());
+                } else if (slots->hasExact[token.slot]) {
+                    evalStack.push(slots->exact[token.slot]);
+                } else {
+                    throw InexactError("variable " + token.value + " has no exact value");
+                }
+                break;
+                
+            case OPERATOR:
+                if (evalStack.size() < 2) {
+                    throw invalid_argument("Invalid expression: not enough operands for operator " + token.value);
+                }
+                
+                {
+                    Rational b = std::move(evalStack.top()); evalStack.pop();
+                    Rational a = std::move(evalStack.top()); evalStack.pop();
                     
-                    {
-                        ComplexNumber b = std::move(evalStack.top()); evalStack.pop(); // Use move semantics
-                        ComplexNumber a = std::move(evalStack.top()); evalStack.pop();
-                        
-                        LOGD("Applying operator %s", token.value.c_str());
-                        
-                        // Use references in operations to avoid copies
-                        if (token.value == "+") {
-                            evalStack.emplace(addComplex(a, b));
-                        } else if (token.value == "-") {
-                            evalStack.emplace(subtractComplex(a, b));
-                        } else if (token.value == "*") {
-                            evalStack.emplace(multiplyComplex(a, b));
-                        } else if (token.value == "/" || token.value == "÷") {
-                            evalStack.emplace(divideComplex(a, b));
-                        } else if (token.value == "^" || token.value == "**") {
-                            // Power operation using pen-and-pencil method
-                            if (a.isReal() && b.isReal()) {
-                                try {
-                                    string powerResult = power(a.real, b.real);
-                                    evalStack.emplace(powerResult);
-                                } catch (const exception& e) {
-                                    evalStack.emplace("Power Error: " + string(e.what()));
-                                }
-                            } else {
-                                // Complex power - placeholder for now
-                                evalStack.emplace("complex_pow(" + a.toString() + ", " + b.toString() + ")");
-                            }
-                        } else {
-                            throw invalid_argument("Unknown operator: " + token.value);
+                    if (token.value == "+") {
+                        evalStack.push(add(a, b));
+                    } else if (token.value == "-") {
+                        evalStack.push(subtract(a, b));
+                    } else if (token.value == "*") {
+                        evalStack.push(multiply(a, b));
+                    } else if (token.value == "/" || token.value == "÷") {
+                        evalStack.push(divide(a, b));
+                    } else if (token.value == "nPr" || token.value == "nCr") {
+                        evalStack.push(Rational(integerFunction(token.value, integerArgument(a, token.value),
+                                                                integerArgument(b, token.value))));
+                    } else if (token.value == "^" || token.value == "**") {
+                        // Integer exponents of a size we can expand and perfect roots stay exact
+                        if (b.numerator.limbs.size() == 1 && b.numerator.limbs[0] > MAX_EXACT_EXPONENT) {
+                            throw InexactError("exponent too large for exact result");
                         }
-                        
-                        LOGD("Operator result computed");
+                        evalStack.push(power(a, b));
+                    } else {
+                        throw invalid_argument("Unknown operator: " + token.value);
                     }
-                    break;
-                    
-                case FUNCTION:
-                    if (evalStack.empty()) {
-                        throw invalid_argument("Invalid expression: no operand for function " + token.value);
+                }
+                break;
+                
+            case FUNCTION:
+                if (evalStack.size() < (size_t)max(functionArity(token.value), 1)) {
+                    throw invalid_argument("Invalid expression: not enough operands for function " + token.value);
+                }
+                
+                if (token.series) {
+                    Rational last = std::move(evalStack.top()); evalStack.pop();
+                    Rational first = std::move(evalStack.top()); evalStack.pop();
+                    evalStack.push(evaluateSeriesExact(*token.series, first, last, slots));
+                } else if (functionArity(token.value) == 2) {
+                    Rational b = std::move(evalStack.top()); evalStack.pop();
+                    Rational a = std::move(evalStack.top()); evalStack.pop();
+                    evalStack.push(Rational(integerFunction(token.value, integerArgument(a, token.value),
+                                                            integerArgument(b, token.value))));
+                } else {
+                    Rational operand = std::move(evalStack.top()); evalStack.pop();
+                    if (token.value == "inv") {
+                        evalStack.push(divide(Rational(BigInt(1)), operand));
+                    } else if (token.value == "abs") {
+                        operand.numerator.negative = false;
+                        evalStack.push(operand);
+                    } else if (token.value == "!") {
+                        evalStack.push(Rational(factorial(integerArgument(operand, "x!"))));
+                    } else {
+                        throw InexactError("function " + token.value);
                     }
-                    
-                    {
-                        ComplexNumber operand = std::move(evalStack.top()); evalStack.pop(); // Use move
-                        evalStack.emplace(applyFunction(token.value, operand));
-                        LOGD("Function %s computed", token.value.c_str());
-                    }
-                    break;
-                    
-                default:
-                    LOGE("Unexpected token type in postfix expression: %d", token.type);
-                    throw invalid_argument("Unexpected token type in postfix expression");
-            }
-        }
-        
-        if (evalStack.size() != 1) {
-            throw invalid_argument("Invalid expression: final stack size is " + to_string(evalStack.size()) + ", expected 1");
+                }
+                break;
+                
+            default:
+                throw invalid_argument("Unexpected token type in postfix expression");
         }
-        
-        // Return result directly without copying
-        return evalStack.top().toString();
-        
-    } catch (const exception& e) {
-        LOGE("Evaluation error: %s", e.what());
-        throw; // Re-throw to be caught by parseExpression
     }
+    
+    if (evalStack.size() != 1) {
+        throw invalid_argument("Invalid expression: final stack size is " + to_string(evalStack.size()) + ", expected 1");
+    }
+    return std::move(evalStack.top());
+}
+
+string evaluatePostfixExpression(const vector<Token>& postfixTokens) {
+    return evaluatePostfix(postfixTokens, nullptr).toString();
 }
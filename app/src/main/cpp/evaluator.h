@@ -1,20 +1,39 @@
 #pragma once
 #include <string>
 #include <vector>
-
-// Forward declarations
-struct Token;
-struct ComplexNumber;
+#include "token.h"
+#include "complex_number.h"
+#include "rational.h"
+#include "session.h"
 
 // Main evaluation function - receives postfix tokens and returns result
 std::string evaluatePostfixExpression(const std::vector<Token>& postfixTokens);
 
+// Evaluates postfix tokens to a native value, reading slot-bound variables from
+// the given slot table (nullptr evaluates against cleared memory). The tokens
+// are compiled and optimized first; keep a CompiledProgram to evaluate the
+// same expression repeatedly
+ComplexNumber evaluatePostfix(const std::vector<Token>& postfixTokens, const SlotTable* slots);
+
+// Exact evaluation over rationals; throws InexactError for anything without an
+// exact rational result so the caller can fall back to evaluatePostfix
+Rational evaluatePostfixExact(const std::vector<Token>& postfixTokens, const SlotTable* slots);
+
 // Helper functions for complex number operations
 ComplexNumber addComplex(const ComplexNumber& a, const ComplexNumber& b);
 ComplexNumber subtractComplex(const ComplexNumber& a, const ComplexNumber& b);
 ComplexNumber multiplyComplex(const ComplexNumber& a, const ComplexNumber& b);
 ComplexNumber divideComplex(const ComplexNumber& a, const ComplexNumber& b);
 
+// x^y, falling back to the complex power where no real value exists
+ComplexNumber powerComplex(const ComplexNumber& a, const ComplexNumber& b);
+
+// x^2 with the multiplications a square needs: one for reals, two for complex
+ComplexNumber squareComplex(const ComplexNumber& a);
+
 // Mathematical functions
 ComplexNumber applyFunction(const std::string& functionName, const ComplexNumber& operand);
+
+// Two-argument functions: nPr, nCr, gcd and lcm
+ComplexNumber applyFunction(const std::string& functionName, const ComplexNumber& left, const ComplexNumber& right);
 ComplexNumber parseVariable(const std::string& variableName);
@@ -0,0 +1,90 @@
+#include "governor.h"
+#include <android/log.h>
+
+#define LOG_TAG "CalculatorGovernor"
+#define LOGD(...) __android_log_print(ANDROID_LOG_DEBUG, LOG_TAG, __VA_ARGS__)
+
+using namespace std;
+
+static string describe(BudgetResource resource, unsigned long long needed, unsigned long long limit) {
+    switch (resource) {
+        case BUDGET_DIGITS:
+            return "Digit budget exceeded: " + to_string(needed) + " digits, limit " + to_string(limit);
+        case BUDGET_MEMORY:
+            return "Memory budget exceeded: " + to_string((needed + 1023) >> 10) + " KB, limit " + to_string(limit >> 10) + " KB";
+        case BUDGET_TIME:
+            return "Time budget exceeded: limit " + to_string(limit) + " ms";
+    }
+    return "Budget exceeded";
+}
+
+BudgetExceededError::BudgetExceededError(BudgetResource resource, unsigned long long needed, unsigned long long limit)
+    : runtime_error(describe(resource, needed, limit)), exceeded(resource), amount(needed), allowed(limit) {}
+
+ResourceGovernor::ResourceGovernor(const ResourceBudget& budget)
+    : limits(budget), start(chrono::steady_clock::now()) {}
+
+void ResourceGovernor::checkDigits(size_t digits) const {
+    if (limits.digits > 0 && digits > limits.digits) {
+        LOGD("%zu digits requested, budget %zu", digits, limits.digits);
+        throw BudgetExceededError(BUDGET_DIGITS, digits, limits.digits);
+    }
+}
+
+void ResourceGovernor::acquire(size_t bytes) {
+    size_t total = live.fetch_add(bytes, memory_order_relaxed) + bytes;
+    if (limits.bytes > 0 && total > limits.bytes) {
+        live.fetch_sub(bytes, memory_order_relaxed);
+        LOGD("%zu bytes requested with %zu held, budget %zu", bytes, total - bytes, limits.bytes);
+        throw BudgetExceededError(BUDGET_MEMORY, total, limits.bytes);
+    }
+    size_t highest = peak.load(memory_order_relaxed);
+    while (total > highest && !peak.compare_exchange_weak(highest, total, memory_order_relaxed)) {}
+}
+
+void ResourceGovernor::checkTime() const {
+    if (limits.milliseconds <= 0) return;
+    auto elapsed = chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - start).count();
+    if (elapsed > limits.milliseconds) throw BudgetExceededError(BUDGET_TIME, elapsed, limits.milliseconds);
+}
+
+GovernorScope::GovernorScope(const ResourceBudget& budget) : governor(budget), attachedTo(nullptr) {
+    CancellationToken* token = currentCancellationToken();
+    if (token == nullptr) {
+        installed.emplace(&privateToken);
+        token = &privateToken;
+    }
+    if (token->governor() != nullptr) return;
+    token->setGovernor(&governor);
+    attachedTo = token;
+}
+
+GovernorScope::~GovernorScope() {
+    if (attachedTo) {
+        attachedTo->setGovernor(nullptr);
+        LOGD("Evaluation peaked at %zu kernel bytes", governor.peakBytes());
+    }
+}
+
+static ResourceGovernor* currentGovernor() {
+    CancellationToken* token = currentCancellationToken();
+    return token ? token->governor() : nullptr;
+}
+
+void chargeDigits(size_t digits) {
+    ResourceGovernor* governor = currentGovernor();
+    if (governor) governor->checkDigits(digits);
+}
+
+// Storage below this is left uncounted; the many small products would
+// only contend on the shared counter
+static const size_t MIN_CHARGED_BYTES = 4096;
+
+MemoryCharge::MemoryCharge(size_t bytes)
+    : governor(bytes >= MIN_CHARGED_BYTES ? currentGovernor() : nullptr), bytes(bytes) {
+    if (governor) governor->acquire(bytes);
+}
+
+MemoryCharge::~MemoryCharge() {
+    if (governor) governor->release(bytes);
+}
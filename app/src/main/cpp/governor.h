@@ -0,0 +1,107 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include "cancellation.h"
+
+// Limits of one evaluation; 0 leaves a resource unlimited
+struct ResourceBudget {
+    size_t digits;      // Longest number (integer or mantissa) any operation may produce
+    size_t bytes;       // Digit storage the arithmetic kernels may hold at once, all threads together
+    long milliseconds;  // Wall-clock time
+};
+
+// Room for every result the calculator can show (million-digit exact
+// powers, 100000!) while stopping runaway evaluations - products past
+// twenty million digits, a Σ still running after 30 s - before they
+// exhaust a phone. Towers such as 9^9^9 never reach it: powers beyond a
+// million digits are rounded to the working precision
+const ResourceBudget DEFAULT_BUDGET = {20000000, 256u << 20, 30000};
+
+enum BudgetResource {
+    BUDGET_DIGITS,
+    BUDGET_MEMORY,
+    BUDGET_TIME
+};
+
+// Thrown from inside the arithmetic when an evaluation goes over one of its
+// budgets. Like CancelledError it unwinds without touching session state
+class BudgetExceededError : public std::runtime_error {
+public:
+    BudgetExceededError(BudgetResource resource, unsigned long long needed, unsigned long long limit);
+
+    BudgetResource resource() const { return exceeded; }
+    unsigned long long needed() const { return amount; }  // Digits, bytes or milliseconds
+    unsigned long long limit() const { return allowed; }
+
+private:
+    BudgetResource exceeded;
+    unsigned long long amount;
+    unsigned long long allowed;
+};
+
+// Accounting of one evaluation against its budget, shared by every thread
+// working on it through the evaluation's CancellationToken
+class ResourceGovernor {
+public:
+    explicit ResourceGovernor(const ResourceBudget& budget);
+
+    const ResourceBudget& budget() const { return limits; }
+
+    void checkDigits(size_t digits) const;
+
+    // Bytes taken and given back by kernel scratch and results in flight;
+    // acquire() throws, counting nothing, if they do not fit
+    void acquire(size_t bytes);
+    void release(size_t bytes) { live.fetch_sub(bytes, std::memory_order_relaxed); }
+
+    void checkTime() const;
+
+    size_t peakBytes() const { return peak.load(std::memory_order_relaxed); }
+
+private:
+    ResourceBudget limits;
+    std::chrono::steady_clock::time_point start;
+    std::atomic<size_t> live{0};
+    std::atomic<size_t> peak{0};
+};
+
+// Puts the calling thread's evaluation under a governor for the lifetime of
+// the scope, attached to its cancellation token (a private one if none is
+// installed) so the time budget is checked wherever cancellation is. A
+// nested scope leaves the outer governor in charge
+class GovernorScope {
+public:
+    explicit GovernorScope(const ResourceBudget& budget);
+    ~GovernorScope();
+    GovernorScope(const GovernorScope&) = delete;
+    GovernorScope& operator=(const GovernorScope&) = delete;
+
+private:
+    ResourceGovernor governor;
+    CancellationToken privateToken;
+    std::optional<CancellationScope> installed;
+    CancellationToken* attachedTo;  // Null when nested
+};
+
+// Throws BudgetExceededError if the current evaluation may not produce a
+// number of this many digits. Called by the kernels before they compute
+// anything whose size they can predict
+void chargeDigits(size_t digits);
+
+// Holds kernel storage against the current evaluation's memory budget
+// while alive; nothing is counted outside a GovernorScope
+class MemoryCharge {
+public:
+    explicit MemoryCharge(size_t bytes);
+    ~MemoryCharge();
+    MemoryCharge(const MemoryCharge&) = delete;
+    MemoryCharge& operator=(const MemoryCharge&) = delete;
+
+private:
+    ResourceGovernor* governor;
+    size_t bytes;
+};
@@ -0,0 +1,220 @@
+#include "history.h"
+#include "calc.h"
+#include "cancellation.h"
+#include "complex_math.h"
+#include "evaluator.h"
+#include "governor.h"
+#include "optimizer.h"
+#include <stdexcept>
+#include <utility>
+#include <android/log.h>
+
+#define LOG_TAG "CalculatorHistory"
+#define LOGD(...) __android_log_print(ANDROID_LOG_DEBUG, LOG_TAG, __VA_ARGS__)
+
+using namespace std;
+
+// Decimal value of an exact result, as divide() writes the quotient: exact
+// when it terminates, otherwise rounded to the working precision
+static ComplexNumber decimalValue(const Rational& value) {
+    return ComplexNumber(divide(value.numerator.toString(), value.denominator.toString()));
+}
+
+// Copies a slot of the table into the entry's value
+static void takeValue(HistoryEntry& entry, const SlotTable& slots) {
+    entry.value = slots.values[entry.target];
+    entry.exact = slots.exact[entry.target];
+    entry.hasExact = slots.hasExact[entry.target];
+}
+
+// Sets a slot of the table to the value an entry wrote
+static void loadValue(SlotTable& slots, int slot, const HistoryEntry& entry) {
+    slots.values[slot] = entry.value;
+    slots.exact[slot] = entry.exact;
+    slots.hasExact[slot] = entry.hasExact;
+}
+
+bool evaluateHistoryExact(HistoryEntry& entry, SlotTable& slots) {
+    if (!entry.exactMode) return false;
+    try {
+        Rational exact = evaluatePostfixExact(entry.program->postfix(), &slots);
+        slots.assign(entry.target, decimalValue(exact), exact);
+        takeValue(entry, slots);
+        entry.exactResult = true;
+        return true;
+    } catch (const InexactError& e) {
+        LOGD("Exact evaluation not possible (%s), using decimal", e.what());
+        return false;
+    }
+}
+
+void runHistoryEntry(HistoryEntry& entry, SlotTable& slots) {
+    if (entry.operation == HISTORY_ASSIGN) {
+        loadValue(slots, entry.target, entry);
+        return;
+    }
+    entry.exactResult = false;
+    switch (entry.operation) {
+        case HISTORY_EVALUATE: {
+            PrecisionScope precision(entry.digits);
+            AngleUnitScope angles(entry.angleUnit);
+            if (evaluateHistoryExact(entry, slots)) return;
+            slots.assign(entry.target, entry.program->evaluate(&slots));
+            break;
+        }
+        case HISTORY_STORE:
+            slots.values[entry.target] = slots.values[SLOT_ANS];
+            slots.exact[entry.target] = slots.exact[SLOT_ANS];
+            slots.hasExact[entry.target] = slots.hasExact[SLOT_ANS];
+            break;
+        case HISTORY_MEMORY_ADD:
+        case HISTORY_MEMORY_SUBTRACT: {
+            bool subtracting = entry.operation == HISTORY_MEMORY_SUBTRACT;
+            if (slots.hasExact[SLOT_M] && slots.hasExact[SLOT_ANS]) {
+                Rational result = subtracting ? subtract(slots.exact[SLOT_M], slots.exact[SLOT_ANS])
+                                              : add(slots.exact[SLOT_M], slots.exact[SLOT_ANS]);
+                slots.assign(SLOT_M, decimalValue(result), result);
+            } else {
+                slots.assign(SLOT_M, subtracting ? subtractComplex(slots.values[SLOT_M], slots.values[SLOT_ANS])
+                                                 : addComplex(slots.values[SLOT_M], slots.values[SLOT_ANS]));
+            }
+            break;
+        }
+        case HISTORY_ASSIGN:
+            break;
+    }
+    takeValue(entry, slots);
+}
+
+string describeHistoryEntry(const HistoryEntry& entry) {
+    string target = variableSlotName(entry.target);
+    switch (entry.operation) {
+        case HISTORY_EVALUATE: return entry.expression;
+        case HISTORY_STORE: return "Ans→" + target;
+        case HISTORY_MEMORY_ADD: return "M+";
+        case HISTORY_MEMORY_SUBTRACT: return "M-";
+        case HISTORY_ASSIGN: return entry.value.toString() + "→" + target;
+    }
+    return string();
+}
+
+// Same value as far as readers and the display can tell
+static bool sameValue(const HistoryEntry& a, const HistoryEntry& b) {
+    return a.value.real == b.value.real && a.value.imaginary == b.value.imaginary &&
+           a.hasExact == b.hasExact && a.exactResult == b.exactResult &&
+           (!a.hasExact || (a.exact.numerator == b.exact.numerator && a.exact.denominator == b.exact.denominator));
+}
+
+void SessionHistory::reset(const SlotTable& slots) {
+    entries.clear();
+    base = slots;
+    for (uint64_t& writer : writers) writer = 0;
+}
+
+// Slots read by each kind of operation
+static void markInputs(const HistoryEntry& entry, bool reads[SLOT_COUNT]) {
+    switch (entry.operation) {
+        case HISTORY_EVALUATE: markProgramInputs(*entry.program, reads); break;
+        case HISTORY_STORE: reads[SLOT_ANS] = true; break;
+        case HISTORY_MEMORY_ADD:
+        case HISTORY_MEMORY_SUBTRACT: reads[SLOT_M] = reads[SLOT_ANS] = true; break;
+        case HISTORY_ASSIGN: break;
+    }
+}
+
+// Inputs of an entry whose slots were last written by the given entries
+static void captureInputs(HistoryEntry& entry, const uint64_t writers[SLOT_COUNT]) {
+    bool reads[SLOT_COUNT] = {};
+    markInputs(entry, reads);
+    entry.inputs.clear();
+    for (int slot = 0; slot < SLOT_COUNT; slot++) {
+        if (reads[slot]) entry.inputs.push_back(HistoryInput{slot, writers[slot]});
+    }
+}
+
+void SessionHistory::capture(HistoryEntry& entry) const {
+    entry.id = nextId;
+    captureInputs(entry, writers);
+}
+
+void SessionHistory::append(HistoryEntry entry) {
+    writers[entry.target] = entry.id;
+    nextId = entry.id + 1;
+    entries.push_back(std::move(entry));
+    if (entries.size() > CAPACITY) {
+        // Its readers read the same value from the base from now on
+        const HistoryEntry& oldest = entries.front();
+        loadValue(base, oldest.target, oldest);
+        if (writers[oldest.target] == oldest.id) writers[oldest.target] = 0;
+        entries.pop_front();
+    }
+}
+
+const HistoryEntry& SessionHistory::at(size_t index) const {
+    if (index >= entries.size()) throw out_of_range("No history entry " + to_string(index + 1));
+    return entries[index];
+}
+
+const HistoryEntry* SessionHistory::find(uint64_t id) const {
+    if (entries.empty() || id < entries.front().id || id > entries.back().id) return nullptr;
+    return &entries[id - entries.front().id];
+}
+
+HistoryEntry* SessionHistory::writer(int slot) {
+    return const_cast<HistoryEntry*>(find(writers[slot]));
+}
+
+vector<size_t> SessionHistory::edit(size_t index, const string& expression, shared_ptr<CompiledProgram> program,
+                                    SlotTable& slots) {
+    if (at(index).operation != HISTORY_EVALUATE) {
+        throw invalid_argument("Only calculations can be edited");
+    }
+
+    // The edited entry and everything after it are recalculated into copies,
+    // so a failure anywhere leaves the history as it was
+    vector<HistoryEntry> updated(entries.begin() + index, entries.end());
+    uint64_t firstId = updated.front().id;
+    uint64_t before[SLOT_COUNT] = {};
+    for (size_t i = 0; i < index; i++) before[entries[i].target] = entries[i].id;
+    updated[0].expression = expression;
+    updated[0].program = std::move(program);
+    captureInputs(updated[0], before);
+
+    vector<bool> changed(updated.size(), false);
+    vector<size_t> result;
+    for (size_t k = 0; k < updated.size(); k++) {
+        HistoryEntry& entry = updated[k];
+        bool stale = k == 0;
+        for (const HistoryInput& input : entry.inputs) {
+            if (input.producer >= firstId && changed[input.producer - firstId]) stale = true;
+        }
+        if (!stale) continue;
+
+        // Everything it reads, from the newest value of each producer
+        SlotTable table = base;
+        for (const HistoryInput& input : entry.inputs) {
+            const HistoryEntry* producer = input.producer >= firstId ? &updated[input.producer - firstId]
+                                                                     : find(input.producer);
+            if (producer) loadValue(table, input.slot, *producer);
+        }
+        try {
+            runHistoryEntry(entry, table);
+        } catch (const CancelledError&) {
+            throw;
+        } catch (const BudgetExceededError&) {
+            throw;
+        } catch (const exception& e) {
+            throw domain_error("Entry " + to_string(index + k + 1) + ": " + e.what());
+        }
+        if (sameValue(entry, entries[index + k])) continue;
+        changed[k] = true;
+        result.push_back(index + k);
+    }
+    LOGD("Edited entry %d: %d of %d entries changed", (int)index + 1, (int)result.size(), (int)updated.size());
+
+    for (size_t k = 0; k < updated.size(); k++) entries[index + k] = std::move(updated[k]);
+    for (int slot = 0; slot < SLOT_COUNT; slot++) {
+        if (writers[slot] >= firstId && changed[writers[slot] - firstId]) loadValue(slots, slot, *find(writers[slot]));
+    }
+    return result;
+}
@@ -0,0 +1,101 @@
+#pragma once
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <string>
+#include <vector>
+#include "calc.h"
+#include "complex_number.h"
+#include "rational.h"
+#include "session.h"
+
+class CompiledProgram;
+
+// Session operations kept in the history
+enum HistoryOperation {
+    HISTORY_EVALUATE,           // Expression into Ans
+    HISTORY_STORE,              // STO: Ans into a variable
+    HISTORY_MEMORY_ADD,         // M+
+    HISTORY_MEMORY_SUBTRACT,    // M-
+    HISTORY_ASSIGN              // Value set directly (CalcSession::set)
+};
+
+// A slot read by an entry and the entry that wrote it, 0 for the value the
+// slot had before the oldest entry kept
+struct HistoryInput {
+    int slot;
+    uint64_t producer;
+};
+
+// One recorded operation: what it read, from whom, and the value it wrote
+struct HistoryEntry {
+    uint64_t id = 0;
+    HistoryOperation operation = HISTORY_EVALUATE;
+    int target = SLOT_ANS;                      // Slot written
+    std::string expression;                     // HISTORY_EVALUATE only
+    std::shared_ptr<CompiledProgram> program;   // HISTORY_EVALUATE only
+    bool exactMode = false;                     // Settings it was evaluated with
+    size_t digits = 0;
+    AngleUnit angleUnit = ANGLE_RADIANS;
+    std::vector<HistoryInput> inputs;
+
+    ComplexNumber value;
+    Rational exact;
+    bool hasExact = false;
+    bool exactResult = false;   // Came out of exact evaluation, shown as a fraction
+};
+
+// Computes an entry's value from the slots it reads, under its own settings,
+// and writes it to its target slot. HISTORY_ASSIGN entries carry their value
+void runHistoryEntry(HistoryEntry& entry, SlotTable& slots);
+
+// Exact-mode evaluation of a HISTORY_EVALUATE entry, as runHistoryEntry tries
+// it first. False, with nothing written, if the result is not rational
+bool evaluateHistoryExact(HistoryEntry& entry, SlotTable& slots);
+
+// The entry as typed: the expression, "Ans→A", "M+", "5→X"
+std::string describeHistoryEntry(const HistoryEntry& entry);
+
+// Dependency graph of a session's calculations, spreadsheet style. Every
+// entry records which slots it read and which earlier entry wrote each of
+// them, so history order is a topological order of the graph. Editing an
+// entry re-evaluates it and then, walking forward, only the entries that
+// read a value which actually changed; everything else keeps its value.
+// Not thread-safe; the session serializes access
+class SessionHistory {
+public:
+    // Entries kept; the oldest ones are folded into the base slot values
+    static const size_t CAPACITY = 200;
+
+    // Forgets every entry; the given slots become the base values
+    void reset(const SlotTable& slots);
+
+    // Fills in the entry's id and inputs from the writers of the slots it
+    // reads, before it runs
+    void capture(HistoryEntry& entry) const;
+
+    // Appends a captured entry that has run
+    void append(HistoryEntry entry);
+
+    size_t size() const { return entries.size(); }
+    const HistoryEntry& at(size_t index) const;
+
+    // Latest entry to write a slot, nullptr if none is kept
+    HistoryEntry* writer(int slot);
+
+    // Replaces the expression of an evaluation entry and recalculates what
+    // depends on it, then writes the new values of the slots whose last
+    // writer changed to `slots`. Atomic: if any entry fails to evaluate,
+    // nothing changes and the error is rethrown naming the entry. Returns
+    // the indices of the entries whose value changed, in order
+    std::vector<size_t> edit(size_t index, const std::string& expression,
+                             std::shared_ptr<CompiledProgram> program, SlotTable& slots);
+
+private:
+    const HistoryEntry* find(uint64_t id) const;
+
+    std::deque<HistoryEntry> entries;
+    SlotTable base;                     // Slots as they were before the oldest entry
+    uint64_t nextId = 1;
+    uint64_t writers[SLOT_COUNT] = {};  // Last entry to write each slot, 0 for none
+};
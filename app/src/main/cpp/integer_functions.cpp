@@ -0,0 +1,978 @@
+#include "integer_functions.h"
+#include "cancellation.h"
+#include "governor.h"
+#include <algorithm>
+#include <cmath>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <type_traits>
+#include <android/log.h>
+
+#define LOG_TAG "CalculatorIntegers"
+#define LOGD(...) __android_log_print(ANDROID_LOG_DEBUG, LOG_TAG, __VA_ARGS__)
+
+using namespace std;
+
+typedef unsigned __int128 UInt128;
+
+// Binomials and permutations of n up to this are built from the primes up
+// to n (Legendre's formula); beyond it from the n - r + 1 .. n terms
+static const uint32_t LEGENDRE_LIMIT = uint32_t(1) << 22;
+
+// FACT divides out the primes below this before Pollard's rho
+static const uint32_t TRIAL_DIVISION_LIMIT = uint32_t(1) << 16;
+
+// Work one factorization may spend in total, in rho iterations (about two
+// modular products each) on residues below 2^127, about a second. Steps with
+// wider residues count as stepCost() iterations each
+static const uint64_t FACTOR_BUDGET = uint64_t(1) << 26;
+
+// Fermat steps tried on a part beyond 2^63 before rho: enough to split
+// n = p q at once when p and q agree in their leading half digits or so
+static const uint32_t FERMAT_STEPS = 4096;
+
+// Bit r is set when r is a square mod 64
+static const uint64_t SQUARES_MOD_64 = 0x202021202030213ULL;
+
+// Rho iterations spent on a part beyond 2^63 before handing it to ECM: rho
+// finds factors of up to 9 digits or so within them, ECM the larger ones
+static const uint64_t RHO_BEFORE_ECM = uint64_t(1) << 17;
+
+// ECM stage bounds by factor size: curves are run at the first bound until
+// the count given, then at the next. The tail repeats until the budget ends
+struct EcmLevel {
+    uint32_t b1;
+    uint32_t curves;
+};
+static const EcmLevel ECM_LEVELS[] = {{2000, 25}, {11000, 90}, {50000, 300}};
+
+// Second stage: primes up to ECM_B2_FACTOR * B1, met as mD +- j with
+// j coprime to ECM_STRIDE
+static const uint32_t ECM_B2_FACTOR = 50;
+static const uint32_t ECM_STRIDE = 210;
+
+// Rho steps between GCDs; the differences in between are multiplied up
+static const uint64_t RHO_BATCH = 128;
+
+// Miller-Rabin bases: the first 12 make the test deterministic below 2^64,
+// the first 13 below 3.3e24
+static const uint32_t WITNESSES[] = {2, 3, 5, 7, 11, 13, 17, 19, 23, 29, 31, 37, 41, 43, 47, 53, 59, 61, 67, 71};
+
+// Primes up to at least the given limit, by a sieve of Eratosthenes over the
+// odd numbers. One list is kept and grown on demand, as factorials and
+// binomials of similar size tend to follow each other
+static shared_ptr<const vector<uint32_t>> primesUpTo(uint32_t limit) {
+    static mutex lock;
+    static shared_ptr<const vector<uint32_t>> cached;
+    static uint32_t cachedLimit = 0;
+    lock_guard<mutex> guard(lock);
+    if (cached && cachedLimit >= limit) return cached;
+
+    limit = max(limit, TRIAL_DIVISION_LIMIT);
+    vector<uint8_t> composite(limit / 2 + 1, 0); // Entry i stands for 2i + 1
+    auto primes = make_shared<vector<uint32_t>>();
+    primes->push_back(2);
+    for (uint32_t i = 1; 2 * i + 1 <= limit; i++) {
+        if (composite[i]) continue;
+        uint32_t p = 2 * i + 1;
+        primes->push_back(p);
+        for (uint64_t multiple = (uint64_t)p * p; multiple <= limit; multiple += 2 * p) composite[multiple / 2] = 1;
+    }
+    LOGD("Sieved %d primes up to %u", (int)primes->size(), limit);
+    cached = primes;
+    cachedLimit = limit;
+    return cached;
+}
+
+static bool toWord(const BigInt& a, uint64_t& value) {
+    if (a.negative || a.limbs.size() > 2) return false;
+    value = 0;
+    for (size_t i = a.limbs.size(); i-- > 0;) value = value * BigInt::BASE + a.limbs[i];
+    return true;
+}
+
+static BigInt fromWord(uint64_t value) {
+    BigInt result;
+    for (; value > 0; value /= BigInt::BASE) result.limbs.push_back((uint32_t)(value % BigInt::BASE));
+    return result;
+}
+
+static double toDouble(const BigInt& a) {
+    if (a.digitCount() > 300) return HUGE_VAL;
+    return strtod(a.toString().c_str(), nullptr);
+}
+
+static double log10Factorial(double n) {
+    return lgamma(n + 1) / log(10.0);
+}
+
+static void checkResultDigits(double digits) {
+    if (digits > (double)MAX_INTEGER_RESULT_DIGITS) {
+        throw overflow_error("Result would have more than " + to_string(MAX_INTEGER_RESULT_DIGITS) + " digits");
+    }
+    chargeDigits((size_t)digits);
+}
+
+// Balanced product tree: both sides of every multiplication have about the
+// same size, so large products go to Karatsuba and the transforms
+static BigInt productTree(const vector<BigInt>& values, size_t begin, size_t end) {
+    if (end - begin == 1) return values[begin];
+    if (end - begin == 2) return values[begin] * values[begin + 1];
+    size_t middle = begin + (end - begin) / 2;
+    return productTree(values, begin, middle) * productTree(values, middle, end);
+}
+
+// Product of machine-word factors; runs of small ones are multiplied
+// together in a word first
+static BigInt product(const vector<uint64_t>& factors) {
+    vector<BigInt> words;
+    uint64_t word = 1;
+    for (uint64_t factor : factors) {
+        if (factor == 1) continue;
+        if (word > ((uint64_t)1 << 62) / factor) {
+            words.push_back(fromWord(word));
+            word = 1;
+        }
+        word *= factor;
+    }
+    if (word > 1 || words.empty()) words.push_back(fromWord(word));
+    checkCancelled();
+    return productTree(words, 0, words.size());
+}
+
+// Product of p^e over primes p with exponents e: the primes whose exponent
+// has bit k set are multiplied together, and those products are combined
+// with one squaring per bit, from the top bit down
+static BigInt primePowerProduct(const vector<uint32_t>& primes, const vector<uint32_t>& exponents) {
+    uint32_t highest = 0;
+    for (uint32_t exponent : exponents) highest = max(highest, exponent);
+    BigInt result(1);
+    for (int bit = 31; bit >= 0; bit--) {
+        if ((highest >> bit) == 0) continue;
+        vector<uint64_t> selected;
+        for (size_t i = 0; i < primes.size(); i++) {
+            if ((exponents[i] >> bit) & 1) selected.push_back(primes[i]);
+        }
+        result = square(result) * product(selected);
+    }
+    return result;
+}
+
+// Exponent of p in n! (Legendre's formula)
+static uint32_t factorialExponent(uint64_t n, uint64_t p) {
+    uint32_t exponent = 0;
+    for (uint64_t q = n / p; q > 0; q /= p) exponent += (uint32_t)q;
+    return exponent;
+}
+
+// Prime swing n! / ((n/2)!)^2: p appears once for every odd quotient n / p^i
+static BigInt swing(uint32_t n, const vector<uint32_t>& primes) {
+    vector<uint32_t> factors, exponents;
+    for (uint32_t p : primes) {
+        if (p > n) break;
+        uint32_t exponent = 0;
+        for (uint64_t q = n / p; q > 0; q /= p) exponent += (uint32_t)(q & 1);
+        if (exponent == 0) continue;
+        factors.push_back(p);
+        exponents.push_back(exponent);
+    }
+    return primePowerProduct(factors, exponents);
+}
+
+// n! = ((n/2)!)^2 * swing(n): half the factorial is one squaring, and the
+// swing has only primes up to n, most of them to the first power
+static BigInt swingFactorial(uint32_t n, const vector<uint32_t>& primes) {
+    if (n <= 20) {
+        uint64_t result = 1;
+        for (uint32_t i = 2; i <= n; i++) result *= i;
+        return fromWord(result);
+    }
+    checkCancelled();
+    return square(swingFactorial(n / 2, primes)) * swing(n, primes);
+}
+
+static void requireNonNegative(const BigInt& value, const char* function) {
+    if (value.negative) throw domain_error(string(function) + " requires non-negative integers");
+}
+
+BigInt factorial(const BigInt& n) {
+    requireNonNegative(n, "x!");
+    checkResultDigits(log10Factorial(toDouble(n)));
+    uint64_t value = 0;
+    toWord(n, value);
+    return swingFactorial((uint32_t)value, *primesUpTo((uint32_t)value));
+}
+
+// n! / (n - r)!, divided by r! as well for a binomial, from the exponent of
+// every prime in the quotient
+static BigInt legendreProduct(uint32_t n, uint32_t r, bool divideByR) {
+    shared_ptr<const vector<uint32_t>> primes = primesUpTo(n);
+    vector<uint32_t> factors, exponents;
+    for (uint32_t p : *primes) {
+        if (p > n) break;
+        uint32_t exponent = factorialExponent(n, p) - factorialExponent(n - r, p);
+        if (divideByR) exponent -= factorialExponent(r, p);
+        if (exponent == 0) continue;
+        factors.push_back(p);
+        exponents.push_back(exponent);
+    }
+    return primePowerProduct(factors, exponents);
+}
+
+// The terms n - r + 1 .. n of a permutation or binomial with a large n. For a
+// binomial, every prime of r! is divided out of the terms that are its
+// multiples before anything is multiplied, so no long division is needed
+static BigInt termProduct(const BigInt& n, uint64_t r, bool divideByR) {
+    uint64_t top = 0;
+    if (!toWord(n, top) || top >= ((uint64_t)1 << 63)) {
+        // Terms beyond machine words: multiply them out and divide once; the
+        // result's digit limit keeps r small here
+        vector<BigInt> terms;
+        for (uint64_t i = 0; i < r; i++) terms.push_back(n - BigInt((long long)i));
+        BigInt result = productTree(terms, 0, terms.size());
+        return divideByR ? result / factorial(BigInt((long long)r)) : result;
+    }
+
+    uint64_t first = top - r + 1;
+    vector<uint64_t> terms(r);
+    for (uint64_t i = 0; i < r; i++) terms[i] = first + i;
+    if (divideByR) {
+        shared_ptr<const vector<uint32_t>> primes = primesUpTo((uint32_t)r);
+        for (uint32_t p : *primes) {
+            if (p > r) break;
+            checkCancelled();
+            uint32_t remaining = factorialExponent(r, p);
+            for (uint64_t i = (p - first % p) % p; i < r && remaining > 0; i += p) {
+                while (remaining > 0 && terms[i] % p == 0) {
+                    terms[i] /= p;
+                    remaining--;
+                }
+            }
+        }
+    }
+    return product(terms);
+}
+
+BigInt permutations(const BigInt& n, const BigInt& r) {
+    requireNonNegative(n, "nPr");
+    requireNonNegative(r, "nPr");
+    if (r > n) throw domain_error("nPr requires r <= n");
+    double count = toDouble(r), size = toDouble(n);
+    // n^r bounds the result; the exact estimate only when that is too loose
+    if (count * log10(max(size, 1.0)) > (double)MAX_INTEGER_RESULT_DIGITS) {
+        checkResultDigits(log10Factorial(size) - log10Factorial(size - count));
+    }
+    uint64_t terms = 0;
+    toWord(r, terms);
+    if (terms == 0) return BigInt(1);
+    if (size <= LEGENDRE_LIMIT) return legendreProduct((uint32_t)size, (uint32_t)terms, false);
+    return termProduct(n, terms, false);
+}
+
+BigInt combinations(const BigInt& n, const BigInt& r) {
+    requireNonNegative(n, "nCr");
+    requireNonNegative(r, "nCr");
+    if (r > n) throw domain_error("nCr requires r <= n");
+    // C(n, r) = C(n, n - r)
+    BigInt smaller = min(r, n - r);
+    double count = toDouble(smaller), size = toDouble(n);
+    // (e n / k)^k bounds the result
+    if (count > 0 && count * log10(M_E * size / count) > (double)MAX_INTEGER_RESULT_DIGITS) {
+        checkResultDigits(log10Factorial(size) - log10Factorial(count) - log10Factorial(size - count));
+    }
+    uint64_t terms = 0;
+    toWord(smaller, terms);
+    if (terms == 0) return BigInt(1);
+    if (size <= LEGENDRE_LIMIT) return legendreProduct((uint32_t)size, (uint32_t)terms, true);
+    return termProduct(n, terms, true);
+}
+
+BigInt lcm(const BigInt& a, const BigInt& b) {
+    if (a.isZero() || b.isZero()) return BigInt(0);
+    return absValue(a) / gcd(a, b) * absValue(b);
+}
+
+// Montgomery arithmetic modulo an odd n < 2^63 with R = 2^64: a modular
+// product is one 64x64->128 multiplication and a reduction without division.
+// Values stay in Montgomery form (x R mod n) throughout, which changes
+// neither equality nor the GCD with n
+struct Montgomery64 {
+    typedef uint64_t Integer;
+    uint64_t modulus;
+    uint64_t negatedInverse;
+    uint64_t r2;    // R^2 mod n
+    uint64_t one;   // R mod n
+
+    explicit Montgomery64(uint64_t n) : modulus(n) {
+        uint64_t inverse = n; // Newton's iteration for n^-1 mod 2^64
+        for (int i = 0; i < 6; i++) inverse *= 2 - n * inverse;
+        negatedInverse = 0 - inverse;
+        one = (0 - n) % n;
+        r2 = (uint64_t)((UInt128)one * one % n);
+    }
+
+    uint64_t reduce(UInt128 t) const {
+        uint64_t m = (uint64_t)t * negatedInverse;
+        uint64_t u = (uint64_t)((t + (UInt128)m * modulus) >> 64);
+        return u >= modulus ? u - modulus : u;
+    }
+    uint64_t multiply(uint64_t a, uint64_t b) const { return reduce((UInt128)a * b); }
+    uint64_t add(uint64_t a, uint64_t b) const {
+        uint64_t s = a + b;
+        return s >= modulus ? s - modulus : s;
+    }
+    uint64_t subtract(uint64_t a, uint64_t b) const { return a >= b ? a - b : a + modulus - b; }
+    uint64_t fromInteger(uint64_t x) const { return multiply(x % modulus, r2); }
+    uint64_t stepCost() const { return 1; }
+};
+
+// The same with R = 2^128 for odd n < 2^127, on 256-bit intermediate products
+struct Montgomery128 {
+    typedef UInt128 Integer;
+    UInt128 modulus;
+    UInt128 negatedInverse;
+    UInt128 r2;
+    UInt128 one;
+
+    explicit Montgomery128(UInt128 n) : modulus(n) {
+        UInt128 inverse = n;
+        for (int i = 0; i < 7; i++) inverse *= 2 - n * inverse;
+        negatedInverse = 0 - inverse;
+        one = (0 - n) % n;
+        r2 = one;
+        for (int i = 0; i < 128; i++) {
+            r2 <<= 1; // n < 2^127, so doubling a residue cannot overflow
+            if (r2 >= n) r2 -= n;
+        }
+    }
+
+    static void multiplyWide(UInt128 a, UInt128 b, UInt128& high, UInt128& low) {
+        uint64_t a0 = (uint64_t)a, a1 = (uint64_t)(a >> 64);
+        uint64_t b0 = (uint64_t)b, b1 = (uint64_t)(b >> 64);
+        UInt128 p00 = (UInt128)a0 * b0, p01 = (UInt128)a0 * b1;
+        UInt128 p10 = (UInt128)a1 * b0, p11 = (UInt128)a1 * b1;
+        UInt128 middle = (p00 >> 64) + (uint64_t)p01 + (uint64_t)p10;
+        low = (middle << 64) | (uint64_t)p00;
+        high = p11 + (p01 >> 64) + (p10 >> 64) + (middle >> 64);
+    }
+
+    UInt128 reduce(UInt128 high, UInt128 low) const {
+        UInt128 m = low * negatedInverse;
+        UInt128 productHigh, productLow;
+        multiplyWide(m, modulus, productHigh, productLow);
+        // The low halves sum to 0 mod 2^128, carrying exactly when low != 0
+        UInt128 u = high + productHigh + (low != 0 ? 1 : 0);
+        return u >= modulus ? u - modulus : u;
+    }
+    UInt128 multiply(UInt128 a, UInt128 b) const {
+        UInt128 high, low;
+        multiplyWide(a, b, high, low);
+        return reduce(high, low);
+    }
+    UInt128 add(UInt128 a, UInt128 b) const {
+        UInt128 s = a + b;
+        return s >= modulus ? s - modulus : s;
+    }
+    UInt128 subtract(UInt128 a, UInt128 b) const { return a >= b ? a - b : a + modulus - b; }
+    UInt128 fromInteger(uint64_t x) const { return multiply((UInt128)x % modulus, r2); }
+    uint64_t stepCost() const { return 1; }
+};
+
+// Unsigned integer of N 64-bit words, least significant first, with just
+// the operations the modular arithmetic below needs
+template <size_t N>
+struct WideInteger {
+    uint64_t words[N];
+
+    WideInteger(uint64_t value = 0) {
+        words[0] = value;
+        for (size_t i = 1; i < N; i++) words[i] = 0;
+    }
+
+    bool operator==(const WideInteger& other) const {
+        for (size_t i = 0; i < N; i++) {
+            if (words[i] != other.words[i]) return false;
+        }
+        return true;
+    }
+    bool operator!=(const WideInteger& other) const { return !(*this == other); }
+
+    // Sums and differences modulo 2^(64N), returning the carry or borrow
+    static uint64_t add(const WideInteger& a, const WideInteger& b, WideInteger& sum) {
+        uint64_t carry = 0;
+        for (size_t i = 0; i < N; i++) {
+            uint64_t s = a.words[i] + carry;
+            carry = s < carry;
+            sum.words[i] = s + b.words[i];
+            carry += sum.words[i] < s;
+        }
+        return carry;
+    }
+    static uint64_t subtract(const WideInteger& a, const WideInteger& b, WideInteger& difference) {
+        uint64_t borrow = 0;
+        for (size_t i = 0; i < N; i++) {
+            uint64_t d = a.words[i] - borrow;
+            borrow = d > a.words[i];
+            difference.words[i] = d - b.words[i];
+            borrow += difference.words[i] > d;
+        }
+        return borrow;
+    }
+    WideInteger operator-(const WideInteger& other) const {
+        WideInteger difference;
+        subtract(*this, other, difference);
+        return difference;
+    }
+};
+
+// Montgomery arithmetic with R = 2^(64N) for odd n < 2^(64N - 1), one word
+// of the multiplier at a time (CIOS): N = 3 and 4 cover moduli up to 77
+// digits at a few times the cost of Montgomery128
+template <size_t N>
+struct MontgomeryWide {
+    typedef WideInteger<N> Integer;
+    Integer modulus;
+    uint64_t negatedInverse; // -n^-1 mod 2^64
+    Integer r2;
+    Integer one;
+
+    explicit MontgomeryWide(const Integer& n) : modulus(n) {
+        uint64_t inverse = n.words[0];
+        for (int i = 0; i < 6; i++) inverse *= 2 - n.words[0] * inverse;
+        negatedInverse = 0 - inverse;
+        // n < 2^(64N - 1), so doubling a residue cannot overflow
+        Integer r(1);
+        for (size_t i = 0; i < 128 * N; i++) {
+            r = add(r, r);
+            if (i + 1 == 64 * N) one = r;
+        }
+        r2 = r;
+    }
+
+    Integer multiply(const Integer& a, const Integer& b) const {
+        uint64_t t[N + 2] = {};
+        for (size_t i = 0; i < N; i++) {
+            uint64_t carry = 0;
+            for (size_t j = 0; j < N; j++) {
+                UInt128 s = (UInt128)a.words[j] * b.words[i] + t[j] + carry;
+                t[j] = (uint64_t)s;
+                carry = (uint64_t)(s >> 64);
+            }
+            UInt128 s = (UInt128)t[N] + carry;
+            t[N] = (uint64_t)s;
+            t[N + 1] = (uint64_t)(s >> 64);
+
+            // Add m n to make the lowest word zero, and shift it out
+            uint64_t m = t[0] * negatedInverse;
+            carry = (uint64_t)(((UInt128)m * modulus.words[0] + t[0]) >> 64);
+            for (size_t j = 1; j < N; j++) {
+                s = (UInt128)m * modulus.words[j] + t[j] + carry;
+                t[j - 1] = (uint64_t)s;
+                carry = (uint64_t)(s >> 64);
+            }
+            s = (UInt128)t[N] + carry;
+            t[N - 1] = (uint64_t)s;
+            t[N] = t[N + 1] + (uint64_t)(s >> 64);
+        }
+        // Below 2 n < 2^(64N), so t[N] is zero
+        Integer result, reduced;
+        for (size_t i = 0; i < N; i++) result.words[i] = t[i];
+        return Integer::subtract(result, modulus, reduced) ? result : reduced;
+    }
+    Integer add(const Integer& a, const Integer& b) const {
+        Integer s, reduced;
+        Integer::add(a, b, s);
+        return Integer::subtract(s, modulus, reduced) ? s : reduced;
+    }
+    Integer subtract(const Integer& a, const Integer& b) const {
+        Integer d;
+        if (Integer::subtract(a, b, d)) Integer::add(d, modulus, d);
+        return d;
+    }
+    Integer fromInteger(uint64_t x) const { return multiply(Integer(x), r2); }
+    uint64_t stepCost() const { return 2 * N - 2; }
+};
+
+// Plain BigInt residues for moduli beyond 2^255, some 40 times slower per
+// product than the Montgomery forms
+struct BigModulus {
+    typedef BigInt Integer;
+    BigInt modulus;
+    BigInt one;
+
+    explicit BigModulus(const BigInt& n) : modulus(n), one(1) {}
+
+    BigInt multiply(const BigInt& a, const BigInt& b) const { return a * b % modulus; }
+    BigInt add(const BigInt& a, const BigInt& b) const {
+        BigInt s = a + b;
+        return s >= modulus ? s - modulus : s;
+    }
+    BigInt subtract(const BigInt& a, const BigInt& b) const { return a >= b ? a - b : a + modulus - b; }
+    BigInt fromInteger(uint64_t x) const { return fromWord(x) % modulus; }
+    uint64_t stepCost() const { return 8 * modulus.limbs.size(); }
+};
+
+static bool isEven(uint64_t v) { return (v & 1) == 0; }
+static bool isEven(UInt128 v) { return (v & 1) == 0; }
+static bool isEven(const BigInt& v) { return !v.isOdd(); }
+template <size_t N>
+static bool isEven(const WideInteger<N>& v) { return (v.words[0] & 1) == 0; }
+
+static uint64_t half(uint64_t v) { return v >> 1; }
+static UInt128 half(UInt128 v) { return v >> 1; }
+static BigInt half(const BigInt& v) { return v / BigInt(2); }
+template <size_t N>
+static WideInteger<N> half(WideInteger<N> v) {
+    for (size_t i = 0; i < N; i++) v.words[i] = (v.words[i] >> 1) | (i + 1 < N ? v.words[i + 1] << 63 : 0);
+    return v;
+}
+
+template <class T>
+static T commonDivisor(T a, T b) {
+    while (b != 0) {
+        T t = a % b;
+        a = b;
+        b = t;
+    }
+    return a;
+}
+static BigInt commonDivisor(const BigInt& a, const BigInt& b) { return gcd(a, b); }
+
+static BigInt toBigInt(uint64_t v) { return fromWord(v); }
+static BigInt toBigInt(const BigInt& v) { return v; }
+static BigInt toBigInt(UInt128 v) {
+    BigInt result;
+    for (; v > 0; v /= BigInt::BASE) result.limbs.push_back((uint32_t)(v % BigInt::BASE));
+    return result;
+}
+template <size_t N>
+static BigInt toBigInt(const WideInteger<N>& v) {
+    BigInt result;
+    for (size_t i = N; i-- > 0;) result = result * BigInt("18446744073709551616") + toBigInt((UInt128)v.words[i]);
+    return result;
+}
+
+// False when a does not fit in N words
+template <size_t N>
+static bool toWide(const BigInt& a, WideInteger<N>& value) {
+    value = WideInteger<N>();
+    for (size_t i = a.limbs.size(); i-- > 0;) {
+        // value = value * BASE + limb, word by word
+        uint64_t carry = a.limbs[i];
+        for (size_t j = 0; j < N; j++) {
+            UInt128 s = (UInt128)value.words[j] * BigInt::BASE + carry;
+            value.words[j] = (uint64_t)s;
+            carry = (uint64_t)(s >> 64);
+        }
+        if (carry != 0) return false;
+    }
+    return true;
+}
+
+// Rho and ECM take a GCD once per batch or curve, so going through BigInt is cheap enough
+template <size_t N>
+static WideInteger<N> commonDivisor(const WideInteger<N>& a, const WideInteger<N>& b) {
+    WideInteger<N> result;
+    toWide(gcd(toBigInt(a), toBigInt(b)), result);
+    return result;
+}
+
+// Calls f with the cheapest modular arithmetic for an odd modulus n
+template <class F>
+static auto withModulus(const BigInt& n, F f) {
+    if (n.digitCount() <= 38) {
+        UInt128 value = 0;
+        for (size_t i = n.limbs.size(); i-- > 0;) value = value * BigInt::BASE + n.limbs[i];
+        if (value < ((UInt128)1 << 63)) return f(Montgomery64((uint64_t)value));
+        if (value < ((UInt128)1 << 127)) return f(Montgomery128(value));
+    }
+    WideInteger<3> value3;
+    if (toWide(n, value3) && value3.words[2] >> 63 == 0) return f(MontgomeryWide<3>(value3));
+    WideInteger<4> value4;
+    if (toWide(n, value4) && value4.words[3] >> 63 == 0) return f(MontgomeryWide<4>(value4));
+    return f(BigModulus(n));
+}
+
+template <class A>
+static typename A::Integer modularPower(const A& field, typename A::Integer base, typename A::Integer exponent) {
+    typename A::Integer result = field.one;
+    while (exponent != 0) {
+        if (!isEven(exponent)) result = field.multiply(result, base);
+        base = field.multiply(base, base);
+        exponent = half(exponent);
+    }
+    return result;
+}
+
+// Strong probable-prime test of an odd modulus to the given number of bases
+template <class A>
+static bool millerRabin(const A& field, int bases) {
+    typedef typename A::Integer Integer;
+    Integer d = field.modulus - Integer(1);
+    int s = 0;
+    while (isEven(d)) {
+        d = half(d);
+        s++;
+    }
+    Integer minusOne = field.subtract(Integer(0), field.one);
+    for (int i = 0; i < bases; i++) {
+        Integer x = modularPower(field, field.fromInteger(WITNESSES[i]), d);
+        if (x == field.one || x == minusOne) continue;
+        bool composite = true;
+        for (int j = 1; j < s && composite; j++) {
+            x = field.multiply(x, x);
+            if (x == minusOne) composite = false;
+        }
+        if (composite) return false;
+    }
+    return true;
+}
+
+bool isProbablePrime(const BigInt& n) {
+    if (n.negative || n < BigInt(2)) return false;
+    for (uint32_t p : WITNESSES) {
+        if (n == BigInt((long long)p)) return true;
+        if ((n % BigInt((long long)p)).isZero()) return false;
+    }
+    if (n < BigInt(73 * 73)) return true;
+
+    int bases = 20;
+    if (n.digitCount() <= 19 && n < BigInt("18446744073709551616")) {
+        bases = 12;
+    } else if (n < BigInt("3317044064679887385961981")) {
+        bases = 13;
+    }
+    return withModulus(n, [&](const auto& field) { return millerRabin(field, bases); });
+}
+
+// Brent's variant of Pollard's rho with x -> x^2 + c: the products of
+// differences are batched so a GCD is taken only every RHO_BATCH steps.
+// Returns a proper factor, or the modulus itself when this c failed or the
+// iteration budget ran out
+template <class A>
+static typename A::Integer brentRho(const A& field, uint64_t increment, uint64_t& budget) {
+    typedef typename A::Integer Integer;
+    const Integer& n = field.modulus;
+    Integer c = field.fromInteger(increment);
+    auto step = [&](const Integer& v) { return field.add(field.multiply(v, v), c); };
+
+    Integer y = field.fromInteger(2), x = y, saved = y, product = field.one, divisor = Integer(1);
+    for (uint64_t length = 1; divisor == Integer(1); length *= 2) {
+        if (budget < length * field.stepCost()) {
+            budget = 0;
+            return n;
+        }
+        budget -= length * field.stepCost();
+        x = y;
+        for (uint64_t i = 0; i < length; i++) y = step(y);
+        for (uint64_t k = 0; k < length && divisor == Integer(1); k += RHO_BATCH) {
+            checkCancelled();
+            uint64_t batch = min(RHO_BATCH, length - k);
+            if (budget < batch * field.stepCost()) {
+                budget = 0;
+                return n;
+            }
+            budget -= batch * field.stepCost();
+            saved = y;
+            for (uint64_t i = 0; i < batch; i++) {
+                y = step(y);
+                product = field.multiply(product, field.subtract(x, y));
+            }
+            divisor = commonDivisor(product, n);
+        }
+    }
+    if (divisor == n) {
+        // The batch that closed the cycle multiplied in a zero: retrace it
+        // one difference at a time
+        do {
+            saved = step(saved);
+            divisor = commonDivisor(field.subtract(x, saved), n);
+        } while (divisor == Integer(1));
+    }
+    return divisor;
+}
+
+// Point of a Montgomery curve B y^2 = x^3 + A x^2 + x as X:Z, y dropped
+template <class A>
+struct CurvePoint {
+    typename A::Integer x;
+    typename A::Integer z;
+};
+
+// Montgomery curve with a24 = (A + 2) / 4 kept as a24plus / c24, so setting
+// one up needs no modular inverse
+template <class A>
+struct MontgomeryCurve {
+    typedef typename A::Integer Integer;
+    const A& field;
+    Integer a24plus;
+    Integer c24;
+
+    CurvePoint<A> twice(const CurvePoint<A>& p) const {
+        Integer sum = field.add(p.x, p.z), difference = field.subtract(p.x, p.z);
+        sum = field.multiply(sum, sum);
+        difference = field.multiply(difference, difference);
+        Integer z = field.multiply(c24, difference);
+        Integer x = field.multiply(z, sum);
+        Integer product = field.subtract(sum, difference); // 4 X Z
+        z = field.multiply(field.add(z, field.multiply(a24plus, product)), product);
+        return CurvePoint<A>{x, z};
+    }
+
+    // p + q from p, q and p - q
+    CurvePoint<A> sum(const CurvePoint<A>& p, const CurvePoint<A>& q, const CurvePoint<A>& difference) const {
+        Integer u = field.multiply(field.subtract(p.x, p.z), field.add(q.x, q.z));
+        Integer v = field.multiply(field.add(p.x, p.z), field.subtract(q.x, q.z));
+        Integer plus = field.add(u, v), minus = field.subtract(u, v);
+        return CurvePoint<A>{field.multiply(difference.z, field.multiply(plus, plus)),
+                             field.multiply(difference.x, field.multiply(minus, minus))};
+    }
+
+    // k p for k >= 1 by the Montgomery ladder
+    CurvePoint<A> multiple(const CurvePoint<A>& p, uint64_t k) const {
+        if (k == 1) return p;
+        CurvePoint<A> low = p, high = twice(p);
+        int bit = 63;
+        while ((k >> bit) == 0) bit--;
+        while (bit-- > 0) {
+            if ((k >> bit) & 1) {
+                low = sum(high, low, p);
+                high = twice(high);
+            } else {
+                high = sum(low, high, p);
+                low = twice(low);
+            }
+        }
+        return low;
+    }
+};
+
+// Modular products of one ECM curve with the given first-stage bound,
+// roughly: a ladder step per bit of the primes, three per second-stage prime
+static uint64_t ecmCurveCost(uint32_t b1) {
+    return (uint64_t)b1 * 18 + (uint64_t)b1 * ECM_B2_FACTOR / 4;
+}
+
+// Lenstra's elliptic curve method, one curve: Suyama's curve for sigma, a
+// first stage multiplying the point by every prime power up to b1 and a
+// second stage looking for one more prime up to ECM_B2_FACTOR * b1. Returns
+// a proper factor, or the modulus itself when this curve failed
+template <class A>
+static typename A::Integer ecmCurve(const A& field, uint64_t sigma, uint32_t b1) {
+    typedef typename A::Integer Integer;
+    const Integer& n = field.modulus;
+    Integer s = field.fromInteger(sigma);
+    Integer u = field.subtract(field.multiply(s, s), field.fromInteger(5));
+    Integer v = field.add(field.add(s, s), field.add(s, s));
+    Integer u3 = field.multiply(field.multiply(u, u), u);
+    Integer v3 = field.multiply(field.multiply(v, v), v);
+    Integer vMinusU = field.subtract(v, u);
+    Integer threeUPlusV = field.add(field.add(field.add(u, u), u), v);
+    Integer sixteen = field.fromInteger(16);
+    MontgomeryCurve<A> curve{field,
+                             field.multiply(field.multiply(field.multiply(vMinusU, vMinusU), vMinusU), threeUPlusV),
+                             field.multiply(field.multiply(sixteen, u3), v)};
+    CurvePoint<A> point{u3, v3};
+
+    uint32_t b2 = b1 * ECM_B2_FACTOR;
+    shared_ptr<const vector<uint32_t>> primes = primesUpTo(b2);
+    size_t index = 0;
+    for (; index < primes->size() && (*primes)[index] <= b1; index++) {
+        if (index % 64 == 0) checkCancelled();
+        uint64_t p = (*primes)[index], power = p;
+        while (power * p <= b1) power *= p;
+        point = curve.multiple(point, power);
+    }
+    Integer divisor = commonDivisor(point.z, n);
+    if (divisor != Integer(1)) return divisor;
+
+    // x(m D Q) = x(j Q) when (m D +- j) Q vanishes mod a prime factor, for
+    // every second-stage prime m D +- j; differences are multiplied up
+    vector<CurvePoint<A>> small(ECM_STRIDE / 2 + 1);
+    CurvePoint<A> twiceQ = curve.twice(point);
+    small[1] = point;
+    small[3] = curve.sum(twiceQ, point, point);
+    for (uint32_t j = 5; j <= ECM_STRIDE / 2; j += 2) small[j] = curve.sum(small[j - 2], twiceQ, small[j - 4]);
+    CurvePoint<A> stride = curve.multiple(point, ECM_STRIDE);
+    uint32_t m = (b1 + ECM_STRIDE / 2) / ECM_STRIDE;
+    CurvePoint<A> previous = curve.multiple(point, (uint64_t)(m - 1) * ECM_STRIDE);
+    CurvePoint<A> current = curve.multiple(point, (uint64_t)m * ECM_STRIDE);
+    Integer product = field.one;
+    for (; index < primes->size() && (*primes)[index] <= b2; index++) {
+        if (index % 256 == 0) checkCancelled();
+        uint32_t q = (*primes)[index];
+        uint32_t nearest = (q + ECM_STRIDE / 2) / ECM_STRIDE;
+        while (m < nearest) {
+            CurvePoint<A> next = curve.sum(current, stride, previous);
+            previous = current;
+            current = next;
+            m++;
+        }
+        uint32_t j = q > m * ECM_STRIDE ? q - m * ECM_STRIDE : m * ECM_STRIDE - q;
+        const CurvePoint<A>& r = small[j];
+        product = field.multiply(product, field.subtract(field.multiply(current.x, r.z), field.multiply(r.x, current.z)));
+    }
+    divisor = commonDivisor(product, n);
+    return divisor == Integer(1) ? n : divisor;
+}
+
+// Divide in place by a small divisor, returning the remainder
+static uint32_t divideSmall(BigInt& a, uint32_t divisor) {
+    uint64_t remainder = 0;
+    for (size_t i = a.limbs.size(); i-- > 0;) {
+        uint64_t current = a.limbs[i] + remainder * BigInt::BASE;
+        a.limbs[i] = (uint32_t)(current / divisor);
+        remainder = current % divisor;
+    }
+    a.trim();
+    return (uint32_t)remainder;
+}
+
+static uint32_t remainderSmall(const BigInt& a, uint32_t divisor) {
+    uint64_t remainder = 0;
+    for (size_t i = a.limbs.size(); i-- > 0;) remainder = (a.limbs[i] + remainder * BigInt::BASE) % divisor;
+    return (uint32_t)remainder;
+}
+
+// Floor of the square root, by Newton's iteration from above
+static BigInt integerSquareRoot(const BigInt& n) {
+    BigInt x = power(BigInt(10), (n.digitCount() + 1) / 2);
+    while (true) {
+        BigInt next = x + n / x;
+        divideSmall(next, 2);
+        if (next >= x) return x;
+        x = std::move(next);
+    }
+}
+
+// Fermat's method: n = a^2 - b^2 = (a - b)(a + b) for a from the square
+// root up. Factors close to the square root, which rho and ECM take longest
+// on, are found in a few steps; squares of primes in the first. Returns n
+// when FERMAT_STEPS found nothing
+static BigInt fermatFactor(const BigInt& n) {
+    BigInt a = integerSquareRoot(n);
+    if (a * a == n) return a;
+    a = a + BigInt(1);
+    BigInt excess = a * a - n;
+    for (uint32_t step = 0; step < FERMAT_STEPS; step++) {
+        if (step % 256 == 0) checkCancelled();
+        if ((SQUARES_MOD_64 >> remainderSmall(excess, 64)) & 1) {
+            BigInt b = integerSquareRoot(excess);
+            if (b * b == excess) return a - b;
+        }
+        // (a + 1)^2 - a^2 = 2 a + 1
+        excess = excess + a + a + BigInt(1);
+        a = a + BigInt(1);
+    }
+    return n;
+}
+
+// A proper factor of an odd composite, or n itself if none was found within
+// the budget. Parts beyond 2^63 get a few Fermat steps for factors near the
+// square root and a short rho run for small ones, then curves of growing
+// bounds
+static BigInt findFactor(const BigInt& n, uint64_t& budget) {
+    if (n.digitCount() > 19) {
+        BigInt divisor = fermatFactor(n);
+        if (divisor != n) return divisor;
+    }
+    return withModulus(n, [&](const auto& field) {
+        typedef typename decay<decltype(field)>::type Field;
+        bool useEcm = !is_same<Field, Montgomery64>::value;
+        uint64_t rhoBudget = useEcm ? min(budget, RHO_BEFORE_ECM * field.stepCost()) : budget;
+        budget -= rhoBudget;
+        for (uint64_t increment = 1; rhoBudget > 0; increment++) {
+            auto divisor = brentRho(field, increment, rhoBudget);
+            if (divisor != field.modulus) {
+                budget += rhoBudget;
+                return toBigInt(divisor);
+            }
+        }
+
+        const size_t levels = sizeof(ECM_LEVELS) / sizeof(ECM_LEVELS[0]);
+        size_t level = 0;
+        for (uint64_t sigma = 6, curve = 1; useEcm; sigma++, curve++) {
+            if (curve > ECM_LEVELS[level].curves && level + 1 < levels) {
+                level++;
+                curve = 1;
+            }
+            uint32_t b1 = ECM_LEVELS[level].b1;
+            uint64_t cost = ecmCurveCost(b1) / 2 * field.stepCost();
+            if (budget < cost) break;
+            budget -= cost;
+            auto divisor = ecmCurve(field, sigma, b1);
+            if (divisor != field.modulus) {
+                LOGD("ECM found a factor on curve %d with B1 = %u", (int)curve, b1);
+                return toBigInt(divisor);
+            }
+        }
+        return n;
+    });
+}
+
+vector<PrimeFactor> factorize(const BigInt& n) {
+    if (n.negative || n.isZero()) throw domain_error("FACT requires a positive integer");
+    vector<PrimeFactor> factors;
+    BigInt rest = n;
+
+    shared_ptr<const vector<uint32_t>> primes = primesUpTo(TRIAL_DIVISION_LIMIT);
+    for (uint32_t p : *primes) {
+        if (p > TRIAL_DIVISION_LIMIT) break;
+        uint64_t small = 0;
+        if (toWord(rest, small) && small < (uint64_t)p * p) break;
+        if (remainderSmall(rest, p) != 0) continue;
+        unsigned exponent = 0;
+        BigInt quotient = rest;
+        while (divideSmall(quotient, p) == 0) {
+            rest = quotient;
+            exponent++;
+        }
+        factors.push_back(PrimeFactor{fromWord(p), exponent, true});
+    }
+
+    // What is left has no factor below the trial limit; split it with rho
+    // and ECM until every part is prime or out of budget
+    uint64_t budget = FACTOR_BUDGET;
+    vector<BigInt> pending;
+    if (rest > BigInt(1)) pending.push_back(rest);
+    while (!pending.empty()) {
+        BigInt part = std::move(pending.back());
+        pending.pop_back();
+        if (isProbablePrime(part)) {
+            factors.push_back(PrimeFactor{part, 1, true});
+            continue;
+        }
+        BigInt divisor = findFactor(part, budget);
+        if (divisor == part) {
+            LOGD("No factor of a %d-digit composite within the budget", (int)part.digitCount());
+            factors.push_back(PrimeFactor{part, 1, false});
+            continue;
+        }
+        pending.push_back(part / divisor);
+        pending.push_back(std::move(divisor));
+    }
+
+    // Rho finds factors in no particular order and may find one prime twice
+    sort(factors.begin(), factors.end(), [](const PrimeFactor& a, const PrimeFactor& b) { return a.factor < b.factor; });
+    vector<PrimeFactor> merged;
+    for (PrimeFactor& factor : factors) {
+        if (!merged.empty() && merged.back().factor == factor.factor) {
+            merged.back().exponent += factor.exponent;
+        } else {
+            merged.push_back(std::move(factor));
+        }
+    }
+    return merged;
+}
+
+string formatFactorization(const vector<PrimeFactor>& factors) {
+    if (factors.empty()) return "1";
+    string text;
+    for (const PrimeFactor& factor : factors) {
+        if (!text.empty()) text += '*';
+        text += factor.prime ? factor.factor.toString() : "(" + factor.factor.toString() + ")";
+        if (factor.exponent > 1) text += "^" + to_string(factor.exponent);
+    }
+    return text;
+}
@@ -0,0 +1,42 @@
+#pragma once
+#include <string>
+#include <vector>
+#include "bigint.h"
+
+// Integer functions of the calculator: x!, nPr, nCr, GCD, LCM and FACT.
+// Factorials and combinations are assembled from the prime factorization of
+// the result (prime swing, Legendre's formula) with balanced products, so
+// the multiplications are large and even and reach the fast BigInt tiers.
+// Arguments must be non-negative integers (domain_error otherwise); results
+// longer than MAX_INTEGER_RESULT_DIGITS are refused with overflow_error
+
+const size_t MAX_INTEGER_RESULT_DIGITS = 1000000;
+
+BigInt factorial(const BigInt& n);
+
+// n! / (n - r)! and n! / (r! (n - r)!), for 0 <= r <= n
+BigInt permutations(const BigInt& n, const BigInt& r);
+BigInt combinations(const BigInt& n, const BigInt& r);
+
+// Least common multiple of the magnitudes (gcd is in bigint.h)
+BigInt lcm(const BigInt& a, const BigInt& b);
+
+// Miller-Rabin with fixed bases: deterministic below 3.3e24, a probable
+// prime test above
+bool isProbablePrime(const BigInt& n);
+
+struct PrimeFactor {
+    BigInt factor;
+    unsigned exponent;
+    bool prime;     // False for a composite that could not be split in time
+};
+
+// Factorization of n >= 1 by increasing factor: trial division by small
+// primes, then Pollard-Brent rho on what is left, and for parts beyond 2^63
+// the elliptic curve method once rho has found their small factors. The
+// search has a budget of about a second, so a number with two huge prime
+// factors comes back with a composite part instead of running for hours
+std::vector<PrimeFactor> factorize(const BigInt& n);
+
+// FACT display form: "2^3*3*5", composite parts in parentheses
+std::string formatFactorization(const std::vector<PrimeFactor>& factors);
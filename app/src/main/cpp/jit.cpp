@@ -0,0 +1,309 @@
+#include "jit.h"
+#include <cstdint>
+#include <cstring>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <android/log.h>
+
+#define LOG_TAG "CalculatorJit"
+#define LOGD(...) __android_log_print(ANDROID_LOG_DEBUG, LOG_TAG, __VA_ARGS__)
+
+using namespace std;
+
+// Registers the kernel keeps its arguments in, callee-saved so they survive calls
+enum KernelBase { BASE_FRAME, BASE_POOL, BASE_INPUTS, BASE_OUTPUTS };
+
+#if defined(__x86_64__) && !defined(_WIN32)
+#define HAVE_KERNEL_BACKEND 1
+
+// System V x86-64 with SSE2. rbx: frame, r12: pool, r13: inputs, r14: outputs
+class KernelEmitter {
+public:
+    vector<uint8_t> bytes;
+
+    void prologue() {
+        // push rbx, r12, r13, r14; sub rsp, 8 (keeps calls 16-byte aligned);
+        // mov rbx, rdx; mov r12, rcx; mov r13, rdi; mov r14, rsi
+        emit({0x53, 0x41, 0x54, 0x41, 0x55, 0x41, 0x56, 0x48, 0x83, 0xEC, 0x08,
+              0x48, 0x89, 0xD3, 0x49, 0x89, 0xCC, 0x49, 0x89, 0xFD, 0x49, 0x89, 0xF6});
+    }
+
+    void epilogue() {
+        // add rsp, 8; pop r14, r13, r12, rbx; ret
+        emit({0x48, 0x83, 0xC4, 0x08, 0x41, 0x5E, 0x41, 0x5D, 0x41, 0x5C, 0x5B, 0xC3});
+    }
+
+    // movsd / movupd xmm, [base + displacement]
+    void load(int reg, KernelBase base, int32_t displacement, bool wide) {
+        memoryOperand(wide ? 0x66 : 0xF2, 0x10, reg, base, displacement);
+    }
+
+    void store(int reg, KernelBase base, int32_t displacement, bool wide) {
+        memoryOperand(wide ? 0x66 : 0xF2, 0x11, reg, base, displacement);
+    }
+
+    // destination = destination op source
+    void operate(DoubleOp op, int destination, int source, bool wide) {
+        uint8_t opcode = op == DOUBLE_ADD ? 0x58 : op == DOUBLE_MULTIPLY ? 0x59 : op == DOUBLE_SUBTRACT ? 0x5C : 0x5E;
+        registerOperand(wide ? 0x66 : 0xF2, opcode, destination, source);
+    }
+
+    void squareRoot(int reg, bool wide) {
+        registerOperand(wide ? 0x66 : 0xF2, 0x51, reg, reg);
+    }
+
+    // andpd with the sign mask, loaded into xmm15 (whole register either way)
+    void absolute(int reg, bool, int32_t maskDisplacement) {
+        load(MASK, BASE_POOL, maskDisplacement, true);
+        registerOperand(0x66, 0x54, reg, MASK);
+    }
+
+    // Arguments in xmm0 and xmm1, result in xmm0; every xmm is clobbered
+    void call(const void* function) {
+        // mov rax, imm64; call rax
+        emit({0x48, 0xB8});
+        uint64_t address = (uint64_t)(uintptr_t)function;
+        for (int i = 0; i < 8; i++) bytes.push_back((uint8_t)(address >> (8 * i)));
+        emit({0xFF, 0xD0});
+    }
+
+    bool fits() const { return true; }
+
+private:
+    static const int MASK = 15;
+
+    void emit(initializer_list<uint8_t> code) { bytes.insert(bytes.end(), code); }
+
+    static int number(KernelBase base) {
+        switch (base) {
+            case BASE_FRAME: return 3;
+            case BASE_POOL: return 12;
+            case BASE_INPUTS: return 13;
+            case BASE_OUTPUTS: break;
+        }
+        return 14;
+    }
+
+    void memoryOperand(uint8_t prefix, uint8_t opcode, int reg, KernelBase base, int32_t displacement) {
+        int rm = number(base);
+        bytes.push_back(prefix);
+        uint8_t rex = 0x40 | (reg >= 8 ? 4 : 0) | (rm >= 8 ? 1 : 0);
+        if (rex != 0x40) bytes.push_back(rex);
+        emit({0x0F, opcode, (uint8_t)(0x80 | (reg & 7) << 3 | (rm & 7))});   // mod 10: disp32
+        if ((rm & 7) == 4) bytes.push_back(0x24);                              // SIB for r12
+        for (int i = 0; i < 4; i++) bytes.push_back((uint8_t)((uint32_t)displacement >> (8 * i)));
+    }
+
+    void registerOperand(uint8_t prefix, uint8_t opcode, int destination, int source) {
+        bytes.push_back(prefix);
+        uint8_t rex = 0x40 | (destination >= 8 ? 4 : 0) | (source >= 8 ? 1 : 0);
+        if (rex != 0x40) bytes.push_back(rex);
+        emit({0x0F, opcode, (uint8_t)(0xC0 | (destination & 7) << 3 | (source & 7))});
+    }
+};
+
+#elif defined(__aarch64__)
+#define HAVE_KERNEL_BACKEND 1
+
+// AAPCS64 with NEON. x19: frame, x20: pool, x21: inputs, x22: outputs.
+// Only v0-v7 are used, which calls may clobber and need not be saved
+class KernelEmitter {
+public:
+    vector<uint8_t> bytes;
+
+    void prologue() {
+        emit(0xA9BD7BFD);   // stp x29, x30, [sp, #-48]!
+        emit(0x910003FD);   // mov x29, sp
+        emit(0xA90153F3);   // stp x19, x20, [sp, #16]
+        emit(0xA9025BF5);   // stp x21, x22, [sp, #32]
+        emit(0xAA0203F3);   // mov x19, x2
+        emit(0xAA0303F4);   // mov x20, x3
+        emit(0xAA0003F5);   // mov x21, x0
+        emit(0xAA0103F6);   // mov x22, x1
+    }
+
+    void epilogue() {
+        emit(0xA9425BF5);   // ldp x21, x22, [sp, #32]
+        emit(0xA94153F3);   // ldp x19, x20, [sp, #16]
+        emit(0xA8C37BFD);   // ldp x29, x30, [sp], #48
+        emit(0xD65F03C0);   // ret
+    }
+
+    // ldr d / ldr q with a scaled unsigned offset
+    void load(int reg, KernelBase base, int32_t displacement, bool wide) {
+        memoryOperand(wide ? 0x3DC00000 : 0xFD400000, reg, base, displacement, wide);
+    }
+
+    void store(int reg, KernelBase base, int32_t displacement, bool wide) {
+        memoryOperand(wide ? 0x3D800000 : 0xFD000000, reg, base, displacement, wide);
+    }
+
+    void operate(DoubleOp op, int destination, int source, bool wide) {
+        uint32_t opcode;
+        switch (op) {
+            case DOUBLE_ADD: opcode = wide ? 0x4E60D400 : 0x1E602800; break;
+            case DOUBLE_SUBTRACT: opcode = wide ? 0x4EE0D400 : 0x1E603800; break;
+            case DOUBLE_MULTIPLY: opcode = wide ? 0x6E60DC00 : 0x1E600800; break;
+            default: opcode = wide ? 0x6E60FC00 : 0x1E601800; break;
+        }
+        emit(opcode | source << 16 | destination << 5 | destination);
+    }
+
+    void squareRoot(int reg, bool wide) {
+        emit((wide ? 0x6EE1F800 : 0x1E61C000) | reg << 5 | reg);
+    }
+
+    void absolute(int reg, bool wide, int32_t) {
+        emit((wide ? 0x4EE0F800 : 0x1E60C000) | reg << 5 | reg);
+    }
+
+    // Arguments in d0 and d1, result in d0
+    void call(const void* function) {
+        uint64_t address = (uint64_t)(uintptr_t)function;
+        emit(0xD2800010 | (uint32_t)(address & 0xFFFF) << 5);                 // movz x16, #lo
+        for (uint32_t shift = 1; shift < 4; shift++) {
+            uint32_t part = (uint32_t)(address >> (16 * shift)) & 0xFFFF;
+            emit(0xF2800010 | shift << 21 | part << 5);                         // movk x16, #part, lsl #16*shift
+        }
+        emit(0xD63F0200);   // blr x16
+    }
+
+    bool fits() const { return !overflow; }
+
+private:
+    bool overflow = false;
+
+    void emit(uint32_t instruction) {
+        for (int i = 0; i < 4; i++) bytes.push_back((uint8_t)(instruction >> (8 * i)));
+    }
+
+    void memoryOperand(uint32_t opcode, int reg, KernelBase base, int32_t displacement, bool wide) {
+        int scale = wide ? 16 : 8;
+        if (displacement < 0 || displacement % scale != 0 || displacement / scale > 4095) {
+            overflow = true;
+            return;
+        }
+        emit(opcode | (uint32_t)(displacement / scale) << 10 | (uint32_t)(19 + base) << 5 | reg);
+    }
+};
+
+#endif
+
+#ifdef HAVE_KERNEL_BACKEND
+// Emits the kernel: each instruction over lanes/2 register pairs (one
+// scalar register for a single lane), operands loaded into v0-v3 and v4-v7
+static bool generate(const DoubleCode& code, int lanes, KernelEmitter& out) {
+    const bool wide = lanes > 1;
+    const int width = wide ? 2 : 1;             // Doubles per register
+    const int groups = lanes / width;           // Registers per value
+    const int32_t mask = (int32_t)code.constants.size() * 16;
+
+    // Register group `group` of an operand, or with `single` its lane `group`
+    auto load = [&](int reg, const DoubleOperand& operand, int group, bool single) {
+        int first = single ? group : group * width;
+        switch (operand.source) {
+            case SOURCE_SLOT:
+                out.load(reg, BASE_FRAME, (operand.index * lanes + first) * 8, wide && !single);
+                break;
+            case SOURCE_CONSTANT:
+                out.load(reg, BASE_POOL, operand.index * 16, wide && !single);
+                break;
+            case SOURCE_INPUT:
+                out.load(reg, BASE_INPUTS, first * 8, wide && !single);
+                break;
+        }
+    };
+
+    out.prologue();
+    int cached = -1;    // Frame slot whose value registers 0.. hold
+    for (const DoubleInstruction& instruction : code.instructions) {
+        if (instruction.op == DOUBLE_CALL || instruction.op == DOUBLE_CALL2) {
+            for (int lane = 0; lane < lanes; lane++) {
+                load(0, instruction.left, lane, true);
+                if (instruction.op == DOUBLE_CALL2) {
+                    load(1, instruction.right, lane, true);
+                    out.call((const void*)instruction.binary);
+                } else {
+                    out.call((const void*)instruction.unary);
+                }
+                out.store(0, BASE_FRAME, (instruction.target * lanes + lane) * 8, false);
+            }
+            cached = -1;
+            continue;
+        }
+        bool held = instruction.left.source == SOURCE_SLOT && instruction.left.index == cached;
+        for (int group = 0; group < groups; group++) {
+            if (!held) load(group, instruction.left, group, false);
+        }
+        switch (instruction.op) {
+            case DOUBLE_SQRT:
+                for (int group = 0; group < groups; group++) out.squareRoot(group, wide);
+                break;
+            case DOUBLE_ABS:
+                for (int group = 0; group < groups; group++) out.absolute(group, wide, mask);
+                break;
+            default:
+                for (int group = 0; group < groups; group++) {
+                    load(4 + group, instruction.right, group, false);
+                    out.operate(instruction.op, group, 4 + group, wide);
+                }
+                break;
+        }
+        for (int group = 0; group < groups; group++) {
+            out.store(group, BASE_FRAME, (instruction.target * lanes + group * width) * 8, wide);
+        }
+        cached = instruction.target;
+    }
+    bool held = code.result.source == SOURCE_SLOT && code.result.index == cached;
+    for (int group = 0; group < groups; group++) {
+        if (!held) load(group, code.result, group, false);
+        out.store(group, BASE_OUTPUTS, group * width * 8, wide);
+    }
+    out.epilogue();
+    return out.fits();
+}
+#endif
+
+unique_ptr<NativeKernel> NativeKernel::compile(const DoubleCode& code, int lanes) {
+#ifdef HAVE_KERNEL_BACKEND
+    KernelEmitter emitter;
+    if (!generate(code, lanes, emitter)) {
+        LOGD("Offsets out of range for %d lanes", lanes);
+        return nullptr;
+    }
+
+    vector<double> pool;
+    for (double value : code.constants) pool.insert(pool.end(), 2, value);
+    uint64_t magnitude = 0x7FFFFFFFFFFFFFFFull;
+    double mask;
+    memcpy(&mask, &magnitude, sizeof mask);
+    pool.insert(pool.end(), 2, mask);
+
+    long page = sysconf(_SC_PAGESIZE);
+    size_t size = (emitter.bytes.size() + page - 1) / page * page;
+    void* memory = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (memory == MAP_FAILED) {
+        LOGD("No memory for a %zu byte kernel", emitter.bytes.size());
+        return nullptr;
+    }
+    memcpy(memory, emitter.bytes.data(), emitter.bytes.size());
+    if (mprotect(memory, size, PROT_READ | PROT_EXEC) != 0) {
+        LOGD("Executable memory refused");
+        munmap(memory, size);
+        return nullptr;
+    }
+    __builtin___clear_cache((char*)memory, (char*)memory + emitter.bytes.size());
+    return unique_ptr<NativeKernel>(new NativeKernel(memory, size, std::move(pool)));
+#else
+    (void)code;
+    (void)lanes;
+    return nullptr;
+#endif
+}
+
+NativeKernel::NativeKernel(void* memory, size_t size, vector<double> pool)
+    : memory(memory), size(size), entry((Entry)memory), pool(std::move(pool)) {}
+
+NativeKernel::~NativeKernel() {
+    munmap(memory, size);
+}
@@ -0,0 +1,37 @@
+#pragma once
+#include <cstddef>
+#include <memory>
+#include <vector>
+#include "double_program.h"
+
+// DoubleCode compiled to machine code for a fixed number of inputs per
+// call (1, 4 or 8). Operations run over SSE2 or NEON registers, two lanes
+// to a register; calls go lane by lane. The value of the instruction just
+// run is kept in registers for the next one, so chains of arithmetic load
+// each operand once. The code lives in a private mapping that is writable
+// while it is emitted and only executable after
+class NativeKernel {
+public:
+    // Null where there is no backend for the CPU, when offsets do not fit
+    // the instruction encoding, or when the system refuses executable memory
+    static std::unique_ptr<NativeKernel> compile(const DoubleCode& code, int lanes);
+
+    ~NativeKernel();
+    NativeKernel(const NativeKernel&) = delete;
+    NativeKernel& operator=(const NativeKernel&) = delete;
+
+    // Frame: scratch of code.slots * lanes doubles
+    void run(const double* inputs, double* outputs, double* frame) const {
+        entry(inputs, outputs, frame, pool.data());
+    }
+
+private:
+    using Entry = void (*)(const double* inputs, double* outputs, double* frame, const double* pool);
+
+    NativeKernel(void* memory, size_t size, std::vector<double> pool);
+
+    void* memory;
+    size_t size;
+    Entry entry;
+    std::vector<double> pool;   // Each constant twice (one register's worth), then the sign mask
+};
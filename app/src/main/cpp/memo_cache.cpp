@@ -0,0 +1,150 @@
+#include "memo_cache.h"
+#include "calc.h"
+#include "governor.h"
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+
+using namespace std;
+
+// Room for a few thousand typical results; the cache is shared by the whole
+// process, so it stays small next to the app's heap
+static const size_t MEMO_CACHE_BYTES = 4 * 1024 * 1024;
+
+// Bookkeeping per entry on top of key and value: map nodes and iterators
+static const size_t ENTRY_OVERHEAD = 96;
+
+// Results larger than this share of a shard (exact powers with thousands of
+// digits) would evict everything else and are not cached
+static const size_t MAX_ENTRY_SHARE = 8;
+
+static size_t entrySize(const string& key, const string& value) {
+    return key.size() + value.size() + ENTRY_OVERHEAD;
+}
+
+// Digits of a cached number, exponent excluded
+static size_t digitCount(const string& value) {
+    size_t end = value.find_first_of("eE");
+    if (end == string::npos) end = value.size();
+    return (size_t)count_if(value.begin(), value.begin() + (long)end, [](char c) { return isdigit((unsigned char)c); });
+}
+
+MemoCache::MemoCache(size_t capacityBytes)
+    : shardCapacity(capacityBytes / SHARD_COUNT), hits(0), misses(0), evictions(0) {}
+
+MemoCache::Shard& MemoCache::shardFor(const string& key) {
+    return shards[hash<string>()(key) % SHARD_COUNT];
+}
+
+string MemoCache::getOrCompute(const string& key, const function<string()>& compute) {
+    Shard& shard = shardFor(key);
+    string cached;
+    bool hit = false;
+    {
+        lock_guard<mutex> guard(shard.lock);
+        auto found = shard.entries.find(key);
+        if (found != shard.entries.end()) {
+            // A hit restores the entry's full priority over the current age
+            Entry& entry = found->second;
+            shard.byPriority.erase(entry.priority);
+            entry.priority = shard.byPriority.emplace(shard.inflation + entry.cost, &found->first);
+            hits.fetch_add(1, memory_order_relaxed);
+            cached = entry.value;
+            hit = true;
+        }
+    }
+    if (hit) {
+        // Charged to the caller as if computed: the session that filled the
+        // entry may have had a larger digit budget
+        chargeDigits(digitCount(cached));
+        return cached;
+    }
+    misses.fetch_add(1, memory_order_relaxed);
+
+    auto start = chrono::steady_clock::now();
+    string value = compute();
+    double nanoseconds = (double)chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count();
+
+    size_t size = entrySize(key, value);
+    if (size <= shardCapacity / MAX_ENTRY_SHARE) {
+        lock_guard<mutex> guard(shard.lock);
+        insert(shard, key, value, nanoseconds / size);
+    }
+    return value;
+}
+
+// Caller holds the shard lock
+void MemoCache::insert(Shard& shard, const string& key, string value, double cost) {
+    // Another thread may have computed the same result meanwhile
+    if (shard.entries.count(key) != 0) return;
+
+    size_t size = entrySize(key, value);
+    while (shard.bytes + size > shardCapacity && !shard.byPriority.empty()) {
+        auto victim = shard.byPriority.begin();
+        shard.inflation = victim->first;
+        auto entry = shard.entries.find(*victim->second);
+        shard.bytes -= entrySize(entry->first, entry->second.value);
+        shard.byPriority.erase(victim);
+        shard.entries.erase(entry);
+        evictions.fetch_add(1, memory_order_relaxed);
+    }
+
+    auto inserted = shard.entries.emplace(key, Entry{std::move(value), cost, {}}).first;
+    inserted->second.priority = shard.byPriority.emplace(shard.inflation + cost, &inserted->first);
+    shard.bytes += size;
+}
+
+MemoStatistics MemoCache::statistics() const {
+    MemoStatistics result{hits.load(memory_order_relaxed), misses.load(memory_order_relaxed),
+                          evictions.load(memory_order_relaxed), 0, 0};
+    for (const Shard& shard : shards) {
+        lock_guard<mutex> guard(shard.lock);
+        result.entries += shard.entries.size();
+        result.bytes += shard.bytes;
+    }
+    return result;
+}
+
+void MemoCache::clear() {
+    for (Shard& shard : shards) {
+        lock_guard<mutex> guard(shard.lock);
+        shard.entries.clear();
+        shard.byPriority.clear();
+        shard.inflation = 0;
+        shard.bytes = 0;
+    }
+    hits.store(0, memory_order_relaxed);
+    misses.store(0, memory_order_relaxed);
+    evictions.store(0, memory_order_relaxed);
+}
+
+MemoCache& memoCache() {
+    static MemoCache cache(MEMO_CACHE_BYTES);
+    return cache;
+}
+
+// Operation, precision, angle unit and operands separated by a byte no
+// number contains
+static string memoKey(const char* operation, const string& operand1, const string* operand2) {
+    string key = operation;
+    key += '\0';
+    key += to_string(workingPrecision());
+    key += '\0';
+    key += to_string((int)angleUnit());
+    key += '\0';
+    key += operand1;
+    if (operand2 != nullptr) {
+        key += '\0';
+        key += *operand2;
+    }
+    return key;
+}
+
+string memoize(const char* operation, const string& operand, const function<string()>& compute) {
+    return memoCache().getOrCompute(memoKey(operation, operand, nullptr), compute);
+}
+
+string memoize(const char* operation, const string& operand1, const string& operand2,
+               const function<string()>& compute) {
+    return memoCache().getOrCompute(memoKey(operation, operand1, &operand2), compute);
+}
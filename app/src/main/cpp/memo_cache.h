@@ -0,0 +1,80 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+// Counters of a MemoCache since it was created or last cleared
+struct MemoStatistics {
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+    uint64_t entries;
+    uint64_t bytes;
+
+    double hitRate() const {
+        uint64_t lookups = hits + misses;
+        return lookups == 0 ? 0.0 : (double)hits / lookups;
+    }
+};
+
+// Bounded, thread-safe cache of primitive results keyed by operation and
+// operands. Keys are spread over independently locked shards so concurrent
+// evaluations rarely contend. Eviction is cost-aware (GreedyDual-Size): an
+// entry's priority is the time it took to compute per byte it occupies, aged
+// by the priority of the last victim, so a cheap quotient never pushes out a
+// root that took milliseconds to converge
+class MemoCache {
+public:
+    explicit MemoCache(size_t capacityBytes);
+
+    MemoCache(const MemoCache&) = delete;
+    MemoCache& operator=(const MemoCache&) = delete;
+
+    // Cached result for the key, or compute() stored under its measured cost.
+    // compute runs without any lock held; if it throws nothing is cached
+    std::string getOrCompute(const std::string& key, const std::function<std::string()>& compute);
+
+    MemoStatistics statistics() const;
+    void clear();
+
+private:
+    static const size_t SHARD_COUNT = 16;
+
+    struct Entry {
+        std::string value;
+        double cost;    // Nanoseconds per byte
+        std::multimap<double, const std::string*>::iterator priority;
+    };
+
+    struct Shard {
+        mutable std::mutex lock;
+        std::unordered_map<std::string, Entry> entries;
+        std::multimap<double, const std::string*> byPriority; // Lowest is evicted first
+        double inflation = 0;   // Priority of the last victim
+        size_t bytes = 0;
+    };
+
+    Shard& shardFor(const std::string& key);
+    void insert(Shard& shard, const std::string& key, std::string value, double cost);
+
+    const size_t shardCapacity;
+    Shard shards[SHARD_COUNT];
+    std::atomic<uint64_t> hits;
+    std::atomic<uint64_t> misses;
+    std::atomic<uint64_t> evictions;
+};
+
+// Process-wide cache shared by all sessions and evaluation threads
+MemoCache& memoCache();
+
+// Result of operation(operands) at the calling thread's working precision
+// and angle unit, from memoCache() when it was computed before. The
+// operands and those settings must determine the result completely
+std::string memoize(const char* operation, const std::string& operand,
+                    const std::function<std::string()>& compute);
+std::string memoize(const char* operation, const std::string& operand1, const std::string& operand2,
+                    const std::function<std::string()>& compute);
@@ -1,8 +1,23 @@
 #include <jni.h>
 #include <stdexcept>
 #include <string>
+#include <vector>
+#include "async_eval.h"
 #include "calc.h"
+#include "display_format.h"
+#include "memo_cache.h"
+#include "optimizer.h"
 #include "parsing.h"
+#include "session.h"
+#include "snapshot.h"
+#include "trace.h"
+
+static JavaVM* javaVm = nullptr;
+
+extern "C" JNIEXPORT jint JNICALL JNI_OnLoad(JavaVM* vm, void*) {
+    javaVm = vm;
+    return JNI_VERSION_1_6;
+}
 
 static void throwJava(JNIEnv* env, const char* clazz, const char* msg) {
     jclass ex = env->FindClass(clazz);
@@ -19,6 +34,59 @@ static void throwJava(JNIEnv* env, const char* clazz, const char* msg) {
     }
 }
 
+static std::string toStdString(JNIEnv* env, jstring value) {
+    const char* nativeString = env->GetStringUTFChars(value, 0);
+    std::string result(nativeString);
+    env->ReleaseStringUTFChars(value, nativeString);
+    return result;
+}
+
+static CalcSession* toSession(jlong handle) {
+    return reinterpret_cast<CalcSession*>(handle);
+}
+
+static std::shared_ptr<EvaluationTask>& toTask(jlong handle) {
+    return *reinterpret_cast<std::shared_ptr<EvaluationTask>*>(handle);
+}
+
+// Evaluation pool workers are attached to the VM the first time they call back
+// into Kotlin and detached when the worker thread exits
+struct AttachedThread {
+    JNIEnv* env = nullptr;
+    bool attached = false;
+    ~AttachedThread() {
+        if (attached) javaVm->DetachCurrentThread();
+    }
+};
+
+static JNIEnv* workerEnv() {
+    static thread_local AttachedThread thread;
+    if (thread.env == nullptr && javaVm != nullptr) {
+        if (javaVm->GetEnv(reinterpret_cast<void**>(&thread.env), JNI_VERSION_1_6) == JNI_EDETACHED) {
+            if (javaVm->AttachCurrentThread(&thread.env, nullptr) != JNI_OK) {
+                thread.env = nullptr;
+                return nullptr;
+            }
+            thread.attached = true;
+        }
+    }
+    return thread.env;
+}
+
+// Global reference to a Kotlin EvaluationListener plus its resolved methods
+struct ListenerRef {
+    jobject listener;
+    jmethodID onProgress;
+    jmethodID onComplete;
+};
+
+static int toSlot(JNIEnv* env, jstring name) {
+    std::string variable = toStdString(env, name);
+    int slot = resolveVariableSlot(variable);
+    if (slot < 0) throw std::invalid_argument("Unknown variable: " + variable);
+    return slot;
+}
+
 extern "C" JNIEXPORT jdouble JNICALL
 Java_com_example_calculator_Native_calc(JNIEnv* env, jclass, jdouble a, jchar op, jdouble b) {
     try {
@@ -59,3 +127,316 @@ Java_com_example_calculator_Native_parseExpression(JNIEnv* env, jclass, jstring
     }
 }
 
+
+extern "C" JNIEXPORT jlong JNICALL
+Java_com_example_calculator_Native_createSession(JNIEnv* env, jclass) {
+    try {
+        return reinterpret_cast<jlong>(new CalcSession());
+    } catch (...) {
+        throwJava(env, "java/lang/OutOfMemoryError", "cannot allocate session");
+        return 0;
+    }
+}
+
+extern "C" JNIEXPORT void JNICALL
+Java_com_example_calculator_Native_destroySession(JNIEnv*, jclass, jlong handle) {
+    // Background evaluations must not outlive their session
+    evaluationPool().cancelSession(toSession(handle));
+    delete toSession(handle);
+}
+
+extern "C" JNIEXPORT jstring JNICALL
+Java_com_example_calculator_Native_evaluateInSession(JNIEnv* env, jclass, jlong handle, jstring expression) {
+    // Same "Result: ..." / "Error: ..." contract as parseExpression, but Ans and
+    // variables stay native inside the session between calls
+    try {
+        std::string result = toSession(handle)->evaluateForDisplay(toStdString(env, expression));
+        return env->NewStringUTF(("Result: " + result).c_str());
+    } catch (const std::exception& e) {
+        return env->NewStringUTF((std::string("Error: ") + e.what()).c_str());
+    }
+}
+
+extern "C" JNIEXPORT void JNICALL
+Java_com_example_calculator_Native_setExactMode(JNIEnv*, jclass, jlong handle, jboolean enabled) {
+    toSession(handle)->setExactMode(enabled);
+}
+
+extern "C" JNIEXPORT void JNICALL
+Java_com_example_calculator_Native_setDisplayFormat(JNIEnv* env, jclass, jlong handle, jint mode, jint digits) {
+    try {
+        toSession(handle)->setDisplayFormat(makeDisplayFormat(mode, digits));
+    } catch (const std::invalid_argument& e) {
+        throwJava(env, "java/lang/IllegalArgumentException", e.what());
+    }
+}
+
+extern "C" JNIEXPORT void JNICALL
+Java_com_example_calculator_Native_setAngleUnit(JNIEnv* env, jclass, jlong handle, jint unit) {
+    if (unit < ANGLE_DEGREES || unit > ANGLE_GRADIANS) {
+        throwJava(env, "java/lang/IllegalArgumentException", ("Invalid angle unit: " + std::to_string(unit)).c_str());
+        return;
+    }
+    toSession(handle)->setAngleUnit((AngleUnit)unit);
+}
+
+extern "C" JNIEXPORT void JNICALL
+Java_com_example_calculator_Native_setResourceBudget(JNIEnv*, jclass, jlong handle, jlong digits, jlong bytes,
+                                                     jlong milliseconds) {
+    // Zero or negative leaves a resource unlimited
+    ResourceBudget budget = {digits > 0 ? (size_t)digits : 0, bytes > 0 ? (size_t)bytes : 0,
+                             milliseconds > 0 ? (long)milliseconds : 0};
+    toSession(handle)->setResourceBudget(budget);
+}
+
+extern "C" JNIEXPORT void JNICALL
+Java_com_example_calculator_Native_storeVariable(JNIEnv* env, jclass, jlong handle, jstring name) {
+    try {
+        toSession(handle)->store(toSlot(env, name));
+    } catch (const std::exception& e) {
+        throwJava(env, "java/lang/IllegalArgumentException", e.what());
+    }
+}
+
+extern "C" JNIEXPORT jstring JNICALL
+Java_com_example_calculator_Native_recallVariable(JNIEnv* env, jclass, jlong handle, jstring name) {
+    try {
+        return env->NewStringUTF(toSession(handle)->get(toSlot(env, name)).toString().c_str());
+    } catch (const std::exception& e) {
+        throwJava(env, "java/lang/IllegalArgumentException", e.what());
+        return nullptr;
+    }
+}
+
+extern "C" JNIEXPORT void JNICALL
+Java_com_example_calculator_Native_memoryAdd(JNIEnv* env, jclass, jlong handle, jboolean subtract) {
+    try {
+        if (subtract) {
+            toSession(handle)->memorySubtract();
+        } else {
+            toSession(handle)->memoryAdd();
+        }
+    } catch (const std::exception& e) {
+        throwJava(env, "java/lang/ArithmeticException", e.what());
+    }
+}
+
+extern "C" JNIEXPORT void JNICALL
+Java_com_example_calculator_Native_clearSession(JNIEnv*, jclass, jlong handle) {
+    toSession(handle)->clear();
+}
+
+extern "C" JNIEXPORT jstring JNICALL
+Java_com_example_calculator_Native_displayAnswer(JNIEnv* env, jclass, jlong handle, jint form) {
+    if (form < ANSWER_STANDARD || form > ANSWER_DECIMAL) {
+        throwJava(env, "java/lang/IllegalArgumentException", "Unknown answer form");
+        return nullptr;
+    }
+    std::string text = toSession(handle)->displayAnswer((AnswerForm)form);
+    return env->NewStringUTF(text.empty() ? "" : ("Result: " + text).c_str());
+}
+
+extern "C" JNIEXPORT jstring JNICALL
+Java_com_example_calculator_Native_factorAnswer(JNIEnv* env, jclass, jlong handle) {
+    try {
+        return env->NewStringUTF(("Result: " + toSession(handle)->factorAnswer()).c_str());
+    } catch (const std::exception& e) {
+        return env->NewStringUTF((std::string("Error: ") + e.what()).c_str());
+    }
+}
+
+extern "C" JNIEXPORT jdoubleArray JNICALL
+Java_com_example_calculator_Native_tabulate(JNIEnv* env, jclass, jlong handle, jstring expression,
+                                            jdouble start, jdouble step, jint count) {
+    try {
+        if (count < 0) throw std::invalid_argument("Negative row count");
+        std::vector<double> values = toSession(handle)->tabulate(toStdString(env, expression), start, step, (size_t)count);
+        jdoubleArray result = env->NewDoubleArray((jsize)values.size());
+        if (result != nullptr) env->SetDoubleArrayRegion(result, 0, (jsize)values.size(), values.data());
+        return result;
+    } catch (const std::exception& e) {
+        throwJava(env, "java/lang/IllegalArgumentException", e.what());
+        return nullptr;
+    }
+}
+
+extern "C" JNIEXPORT jint JNICALL
+Java_com_example_calculator_Native_historySize(JNIEnv*, jclass, jlong handle) {
+    return (jint)toSession(handle)->historySize();
+}
+
+extern "C" JNIEXPORT jstring JNICALL
+Java_com_example_calculator_Native_historyExpression(JNIEnv* env, jclass, jlong handle, jint index) {
+    try {
+        return env->NewStringUTF(toSession(handle)->historyExpression((size_t)index).c_str());
+    } catch (const std::exception& e) {
+        throwJava(env, "java/lang/IllegalArgumentException", e.what());
+        return nullptr;
+    }
+}
+
+extern "C" JNIEXPORT jstring JNICALL
+Java_com_example_calculator_Native_historyResult(JNIEnv* env, jclass, jlong handle, jint index) {
+    try {
+        return env->NewStringUTF(toSession(handle)->historyResult((size_t)index).c_str());
+    } catch (const std::exception& e) {
+        throwJava(env, "java/lang/IllegalArgumentException", e.what());
+        return nullptr;
+    }
+}
+
+extern "C" JNIEXPORT jintArray JNICALL
+Java_com_example_calculator_Native_editHistory(JNIEnv* env, jclass, jlong handle, jint index, jstring expression) {
+    // Indices of the entries whose result changed; a failed edit changes nothing
+    try {
+        std::vector<size_t> changed = toSession(handle)->editHistory((size_t)index, toStdString(env, expression));
+        std::vector<jint> indices(changed.begin(), changed.end());
+        jintArray result = env->NewIntArray((jsize)indices.size());
+        if (result != nullptr) env->SetIntArrayRegion(result, 0, (jsize)indices.size(), indices.data());
+        return result;
+    } catch (const std::domain_error& e) {
+        // An entry failed to evaluate
+        throwJava(env, "java/lang/ArithmeticException", e.what());
+        return nullptr;
+    } catch (const std::exception& e) {
+        throwJava(env, "java/lang/IllegalArgumentException", e.what());
+        return nullptr;
+    }
+}
+
+// Queues work on the evaluation pool. Progress and completion are reported to
+// the listener on a pool worker thread; the task handle is passed along so
+// Kotlin can tell stale results apart
+static jlong submitTask(JNIEnv* env, jlong handle, EvaluationWork work, jobject listener) {
+    auto* task = new std::shared_ptr<EvaluationTask>();
+    jlong taskHandle = reinterpret_cast<jlong>(task);
+    std::shared_ptr<ListenerRef> ref;
+    if (listener != nullptr) {
+        jclass listenerClass = env->GetObjectClass(listener);
+        ref = std::make_shared<ListenerRef>(ListenerRef{
+            env->NewGlobalRef(listener),
+            env->GetMethodID(listenerClass, "onProgress", "(JI)V"),
+            env->GetMethodID(listenerClass, "onComplete", "(JILjava/lang/String;)V")});
+        env->DeleteLocalRef(listenerClass);
+    }
+
+    std::function<void(int)> onProgress;
+    EvaluationCallback onComplete;
+    if (ref) {
+        onProgress = [ref, taskHandle](int percent) {
+            JNIEnv* worker = workerEnv();
+            if (worker == nullptr) return;
+            worker->CallVoidMethod(ref->listener, ref->onProgress, taskHandle, (jint)percent);
+            if (worker->ExceptionCheck()) worker->ExceptionClear();
+        };
+        onComplete = [ref, taskHandle](EvaluationTask& finished) {
+            JNIEnv* worker = workerEnv();
+            if (worker == nullptr) return;
+            jstring text = worker->NewStringUTF(finished.result().c_str());
+            worker->CallVoidMethod(ref->listener, ref->onComplete, taskHandle, (jint)finished.state(), text);
+            if (worker->ExceptionCheck()) worker->ExceptionClear();
+            worker->DeleteLocalRef(text);
+            worker->DeleteGlobalRef(ref->listener);
+        };
+    }
+
+    *task = evaluationPool().submit(toSession(handle), std::move(work), std::move(onProgress), std::move(onComplete));
+    return taskHandle;
+}
+
+extern "C" JNIEXPORT jlong JNICALL
+Java_com_example_calculator_Native_submitEvaluation(JNIEnv* env, jclass, jlong handle, jstring expression,
+                                                    jobject listener) {
+    CalcSession* session = toSession(handle);
+    std::string text = toStdString(env, expression);
+    return submitTask(env, handle, [session, text] { return session->evaluateForDisplay(text); }, listener);
+}
+
+extern "C" JNIEXPORT jlong JNICALL
+Java_com_example_calculator_Native_submitProgressiveEvaluation(JNIEnv* env, jclass, jlong handle, jstring expression,
+                                                               jint digits, jobject listener) {
+    CalcSession* session = toSession(handle);
+    std::string text = toStdString(env, expression);
+    size_t precision = (size_t)digits;
+    return submitTask(env, handle, [session, text, precision] {
+        return session->evaluateProgressive(text, precision);
+    }, listener);
+}
+
+extern "C" JNIEXPORT jlong JNICALL
+Java_com_example_calculator_Native_submitRefinement(JNIEnv* env, jclass, jlong handle, jint digits,
+                                                    jobject listener) {
+    CalcSession* session = toSession(handle);
+    size_t precision = (size_t)digits;
+    return submitTask(env, handle, [session, precision] { return session->refineAnswer(precision); }, listener);
+}
+
+extern "C" JNIEXPORT void JNICALL
+Java_com_example_calculator_Native_cancelEvaluation(JNIEnv*, jclass, jlong task) {
+    toTask(task)->cancel();
+}
+
+extern "C" JNIEXPORT jint JNICALL
+Java_com_example_calculator_Native_evaluationState(JNIEnv*, jclass, jlong task) {
+    return toTask(task)->state();
+}
+
+extern "C" JNIEXPORT jint JNICALL
+Java_com_example_calculator_Native_evaluationProgress(JNIEnv*, jclass, jlong task) {
+    return toTask(task)->progress();
+}
+
+extern "C" JNIEXPORT jstring JNICALL
+Java_com_example_calculator_Native_awaitEvaluation(JNIEnv* env, jclass, jlong task, jlong timeoutMs) {
+    // Pollable future: null while the task is still running
+    if (!toTask(task)->wait((long)timeoutMs)) return nullptr;
+    return env->NewStringUTF(toTask(task)->result().c_str());
+}
+
+extern "C" JNIEXPORT void JNICALL
+Java_com_example_calculator_Native_releaseEvaluation(JNIEnv*, jclass, jlong task) {
+    // The pool keeps its own reference while the task is queued or running
+    delete reinterpret_cast<std::shared_ptr<EvaluationTask>*>(task);
+}
+
+extern "C" JNIEXPORT jlongArray JNICALL
+Java_com_example_calculator_Native_cacheStatistics(JNIEnv* env, jclass) {
+    // hits, misses, evictions, entries, bytes
+    MemoStatistics statistics = memoCache().statistics();
+    jlong values[] = {(jlong)statistics.hits, (jlong)statistics.misses, (jlong)statistics.evictions,
+                      (jlong)statistics.entries, (jlong)statistics.bytes};
+    jlongArray result = env->NewLongArray(5);
+    if (result != nullptr) env->SetLongArrayRegion(result, 0, 5, values);
+    return result;
+}
+
+extern "C" JNIEXPORT void JNICALL
+Java_com_example_calculator_Native_clearCache(JNIEnv*, jclass) {
+    memoCache().clear();
+}
+
+extern "C" JNIEXPORT jlong JNICALL
+Java_com_example_calculator_Native_parallelEvaluations(JNIEnv*, jclass) {
+    return (jlong)parallelEvaluationCount();
+}
+
+extern "C" JNIEXPORT jboolean JNICALL
+Java_com_example_calculator_Native_saveSnapshot(JNIEnv* env, jclass, jlong handle, jstring path) {
+    return saveSnapshot(toStdString(env, path), *toSession(handle));
+}
+
+extern "C" JNIEXPORT jboolean JNICALL
+Java_com_example_calculator_Native_loadSnapshot(JNIEnv* env, jclass, jlong handle, jstring path) {
+    // A missing, outdated or damaged snapshot just means a cold start
+    return loadSnapshot(toStdString(env, path), *toSession(handle));
+}
+
+extern "C" JNIEXPORT jboolean JNICALL
+Java_com_example_calculator_Native_startTrace(JNIEnv* env, jclass, jstring path) {
+    return startTrace(toStdString(env, path));
+}
+
+extern "C" JNIEXPORT void JNICALL
+Java_com_example_calculator_Native_stopTrace(JNIEnv*, jclass) {
+    stopTrace();
+}
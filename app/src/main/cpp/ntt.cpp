@@ -0,0 +1,239 @@
+#include "ntt.h"
+#include "cancellation.h"
+#include "governor.h"
+#include "work_stealing.h"
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+
+using namespace std;
+
+// Products this long (in limbs) transform the three primes on separate cores
+static const size_t PARALLEL_NTT_LIMBS = size_t(1) << 14;
+
+static const uint32_t LIMB_BASE = 1000000000;
+
+// Arithmetic modulo a prime P < 2^30 in Montgomery form (x * 2^32 mod P).
+// Multiplication is one 32x32->64 product and a reduction without division,
+// and every loop over field elements is a plain array loop the compiler can
+// vectorize with NEON or SSE
+template <uint32_t P>
+struct PrimeField {
+    static constexpr uint32_t MODULUS = P;
+
+    static constexpr uint32_t inverse32() {
+        uint32_t inverse = P; // Newton's iteration for P^-1 mod 2^32
+        for (int i = 0; i < 5; i++) inverse *= 2 - P * inverse;
+        return inverse;
+    }
+    static constexpr uint32_t NEGATED_INVERSE = 0u - inverse32();
+    static constexpr uint32_t R2 = (uint32_t)((((uint64_t)1 << 32) % P) * (((uint64_t)1 << 32) % P) % P);
+
+    static inline uint32_t reduce(uint64_t t) {
+        uint32_t m = (uint32_t)t * NEGATED_INVERSE;
+        uint32_t u = (uint32_t)((t + (uint64_t)m * P) >> 32);
+        return u >= P ? u - P : u;
+    }
+    static inline uint32_t multiply(uint32_t a, uint32_t b) { return reduce((uint64_t)a * b); }
+    static inline uint32_t add(uint32_t a, uint32_t b) {
+        uint32_t s = a + b;
+        return s >= P ? s - P : s;
+    }
+    static inline uint32_t subtract(uint32_t a, uint32_t b) { return a >= b ? a - b : a + P - b; }
+
+    // Any value below 2^32 into Montgomery form, and back to [0, P)
+    static inline uint32_t toField(uint32_t x) { return multiply(x, R2); }
+    static inline uint32_t fromField(uint32_t x) { return reduce(x); }
+
+    static uint32_t power(uint32_t base, uint64_t exponent) {
+        uint32_t result = toField(1);
+        while (exponent > 0) {
+            if (exponent & 1) result = multiply(result, base);
+            base = multiply(base, base);
+            exponent >>= 1;
+        }
+        return result;
+    }
+};
+
+// 7 * 2^26 + 1, 5 * 2^25 + 1 and 119 * 2^23 + 1, all with primitive root 3.
+// Their product (about 7.9e25) bounds the convolution terms: at most 2^23
+// products of limbs below 10^9
+typedef PrimeField<469762049> Field1;
+typedef PrimeField<167772161> Field2;
+typedef PrimeField<998244353> Field3;
+static const uint32_t PRIMITIVE_ROOT = 3;
+
+// Twiddle factors by level: entries [len, 2 * len) hold w^j for j < len, w a
+// root of unity of order 2 * len. A table built for n serves every smaller
+// transform, so one table per prime is kept and grown on demand
+struct RootTable {
+    vector<uint32_t> forward;
+    vector<uint32_t> inverse;
+};
+
+template <class F>
+static shared_ptr<const RootTable> rootTable(size_t n) {
+    static mutex lock;
+    static shared_ptr<const RootTable> cached;
+    lock_guard<mutex> guard(lock);
+    if (cached && cached->forward.size() >= n) return cached;
+
+    auto table = make_shared<RootTable>();
+    table->forward.resize(n);
+    table->inverse.resize(n);
+    uint32_t generator = F::toField(PRIMITIVE_ROOT);
+    for (size_t len = 1; len < n; len <<= 1) {
+        uint32_t root = F::power(generator, (F::MODULUS - 1) / (2 * len));
+        uint32_t inverseRoot = F::power(root, F::MODULUS - 2);
+        uint32_t w = F::toField(1), iw = w;
+        for (size_t j = 0; j < len; j++) {
+            table->forward[len + j] = w;
+            table->inverse[len + j] = iw;
+            w = F::multiply(w, root);
+            iw = F::multiply(iw, inverseRoot);
+        }
+    }
+    cached = table;
+    return cached;
+}
+
+// Decimation in frequency, natural order in, bit-reversed order out. Each
+// level streams through contiguous halves, so no bit-reversal pass is needed
+template <class F>
+static void forwardTransform(uint32_t* a, size_t n, const uint32_t* roots) {
+    for (size_t len = n >> 1; len >= 1; len >>= 1) {
+        checkCancelled();
+        const uint32_t* w = roots + len;
+        for (size_t i = 0; i < n; i += 2 * len) {
+            uint32_t* x = a + i;
+            uint32_t* y = x + len;
+            for (size_t j = 0; j < len; j++) {
+                uint32_t u = x[j], v = y[j];
+                x[j] = F::add(u, v);
+                y[j] = F::multiply(F::subtract(u, v), w[j]);
+            }
+        }
+    }
+}
+
+// Decimation in time, bit-reversed order in, natural order out; the 1/n
+// factor is left to the caller
+template <class F>
+static void inverseTransform(uint32_t* a, size_t n, const uint32_t* roots) {
+    for (size_t len = 1; len < n; len <<= 1) {
+        checkCancelled();
+        const uint32_t* w = roots + len;
+        for (size_t i = 0; i < n; i += 2 * len) {
+            uint32_t* x = a + i;
+            uint32_t* y = x + len;
+            for (size_t j = 0; j < len; j++) {
+                uint32_t u = x[j], v = F::multiply(y[j], w[j]);
+                x[j] = F::add(u, v);
+                y[j] = F::subtract(u, v);
+            }
+        }
+    }
+}
+
+// Cyclic convolution of a and b (or a with itself) modulo one prime, as
+// plain residues in out
+template <class F>
+static void convolve(const vector<uint32_t>& a, const vector<uint32_t>* b, size_t n, vector<uint32_t>& out) {
+    shared_ptr<const RootTable> table = rootTable<F>(n);
+
+    out.assign(n, 0);
+    for (size_t i = 0; i < a.size(); i++) out[i] = F::toField(a[i]);
+    forwardTransform<F>(out.data(), n, table->forward.data());
+
+    // 1/n folded into the pointwise products
+    uint32_t scale = F::power(F::toField((uint32_t)n), F::MODULUS - 2);
+    if (b == nullptr) {
+        for (size_t i = 0; i < n; i++) out[i] = F::multiply(F::multiply(out[i], out[i]), scale);
+    } else {
+        vector<uint32_t> other(n, 0);
+        for (size_t i = 0; i < b->size(); i++) other[i] = F::toField((*b)[i]);
+        forwardTransform<F>(other.data(), n, table->forward.data());
+        for (size_t i = 0; i < n; i++) out[i] = F::multiply(F::multiply(out[i], other[i]), scale);
+    }
+
+    inverseTransform<F>(out.data(), n, table->inverse.data());
+    for (size_t i = 0; i < n; i++) out[i] = F::fromField(out[i]);
+}
+
+static uint64_t modularInverse(uint64_t value, uint64_t modulus) {
+    uint64_t result = 1;
+    value %= modulus;
+    for (uint64_t exponent = modulus - 2; exponent > 0; exponent >>= 1) {
+        if (exponent & 1) result = result * value % modulus;
+        value = value * value % modulus;
+    }
+    return result;
+}
+
+// Garner's reconstruction of each term from its three residues, carried into
+// base-10^9 limbs
+static vector<uint32_t> combine(const vector<uint32_t>& r1, const vector<uint32_t>& r2,
+                                const vector<uint32_t>& r3, size_t length) {
+    const uint64_t p1 = Field1::MODULUS, p2 = Field2::MODULUS, p3 = Field3::MODULUS;
+    const uint64_t inverse1mod2 = modularInverse(p1, p2);
+    const uint64_t inverse12mod3 = modularInverse(p1 * p2 % p3, p3);
+    const uint64_t p1mod3 = p1 % p3;
+
+    vector<uint32_t> result(length);
+    unsigned __int128 carry = 0;
+    for (size_t k = 0; k < length; k++) {
+        // x = a1 + p1 * a2 + p1 * p2 * a3 with each digit below its prime
+        uint64_t a1 = r1[k];
+        uint64_t a2 = (r2[k] + p2 - a1 % p2) % p2 * inverse1mod2 % p2;
+        uint64_t partial = (a1 + p1mod3 * a2) % p3;
+        uint64_t a3 = (r3[k] + p3 - partial) % p3 * inverse12mod3 % p3;
+        carry += a1 + (unsigned __int128)p1 * (a2 + p2 * a3);
+        result[k] = (uint32_t)(carry % LIMB_BASE);
+        carry /= LIMB_BASE;
+    }
+    return result;
+}
+
+static vector<uint32_t> convolveAll(const vector<uint32_t>& a, const vector<uint32_t>* b) {
+    size_t length = a.size() + (b != nullptr ? b->size() : a.size());
+    if (length > NTT_MAX_LIMBS) throw length_error("Product too long for the number-theoretic transform");
+    size_t n = 1;
+    while (n < length) n <<= 1;
+    // Three residue vectors, each with a second operand's transform
+    MemoryCharge charge((b != nullptr ? 6 : 3) * n * sizeof(uint32_t));
+
+    vector<uint32_t> r1, r2, r3;
+    WorkStealingPool& pool = workStealingPool();
+    if (length >= PARALLEL_NTT_LIMBS && pool.workerCount() > 0) {
+        // Three independent transforms; forked work keeps the caller's
+        // cancellation token
+        CancellationToken* token = currentCancellationToken();
+        TaskGroup group(pool);
+        group.spawn([&, token] {
+            CancellationScope scope(token);
+            convolve<Field2>(a, b, n, r2);
+        });
+        group.spawn([&, token] {
+            CancellationScope scope(token);
+            convolve<Field3>(a, b, n, r3);
+        });
+        convolve<Field1>(a, b, n, r1);
+        group.wait();
+    } else {
+        convolve<Field1>(a, b, n, r1);
+        convolve<Field2>(a, b, n, r2);
+        convolve<Field3>(a, b, n, r3);
+    }
+    return combine(r1, r2, r3, length);
+}
+
+vector<uint32_t> multiplyNtt(const vector<uint32_t>& a, const vector<uint32_t>& b) {
+    if (a.empty() || b.empty()) return vector<uint32_t>();
+    return convolveAll(a, &b);
+}
+
+vector<uint32_t> squareNtt(const vector<uint32_t>& a) {
+    if (a.empty()) return vector<uint32_t>();
+    return convolveAll(a, nullptr);
+}
@@ -0,0 +1,22 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Multiplication of base-10^9 limb vectors (least significant first, as in
+// BigInt) by number-theoretic transforms: the convolution is computed modulo
+// three primes of the form k * 2^m + 1 and put back together by the Chinese
+// remainder theorem, in O(n log n) instead of Karatsuba's O(n^1.58). Only
+// worth it for operands of thousands of limbs; BigInt's multiplication
+// dispatches here by size
+
+// Longest product, in limbs, the primes have roots of unity for (2^23 limbs,
+// about 75 million digits)
+const size_t NTT_MAX_LIMBS = size_t(1) << 23;
+
+// Exact product; a.size() + b.size() must not exceed NTT_MAX_LIMBS. The
+// result may have leading zero limbs
+std::vector<uint32_t> multiplyNtt(const std::vector<uint32_t>& a, const std::vector<uint32_t>& b);
+
+// a * a with one forward transform per prime instead of two
+std::vector<uint32_t> squareNtt(const std::vector<uint32_t>& a);
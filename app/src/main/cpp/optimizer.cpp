@@ -0,0 +1,500 @@
+#include "optimizer.h"
+#include "calc.h"
+#include "cancellation.h"
+#include "evaluator.h"
+#include "parsing.h"
+#include "rational.h"
+#include "series.h"
+#include "work_stealing.h"
+#include <algorithm>
+#include <atomic>
+#include <stdexcept>
+#include <unordered_map>
+#include <android/log.h>
+
+#define LOG_TAG "CalculatorOptimizer"
+#define LOGD(...) __android_log_print(ANDROID_LOG_DEBUG, LOG_TAG, __VA_ARGS__)
+
+using namespace std;
+
+// Division by a literal becomes a multiplication only when the reciprocal
+// terminates within this many fractional digits (x/2, x/8, x/1024, not x/3)
+static const int MAX_RECIPROCAL_PLACES = 40;
+
+// Estimated digit operations (about a nanosecond each) of a whole evaluation
+// below which it stays on the calling thread: forking costs tens of
+// microseconds, so only evaluations of a millisecond or more gain from it
+static const double PARALLEL_COST = 1e6;
+
+// A node that becomes ready while its thread has other work queued is
+// handed to the pool when it is estimated to cost at least this much
+static const double SPAWN_COST = 2e5;
+
+// Evaluations that forked, for parallelEvaluationCount()
+static atomic<uint64_t> parallelEvaluations(0);
+
+// Constants are parsed from 75-digit literals
+static const double CONSTANT_DIGITS = 75;
+
+static ProgramOp operatorOp(const string& op) {
+    if (op == "+") return OP_ADD;
+    if (op == "-") return OP_SUBTRACT;
+    if (op == "*") return OP_MULTIPLY;
+    if (op == "/" || op == "÷") return OP_DIVIDE;
+    if (op == "^" || op == "**") return OP_POWER;
+    throw invalid_argument("Unknown operator: " + op);
+}
+
+// Exact value of 1/value as a decimal literal, if it terminates
+static bool terminatingReciprocal(const Rational& value, string& reciprocal) {
+    Rational inverse = divide(Rational(BigInt(1)), value);
+    // 1/value terminates when its denominator is 2^a * 5^b, after max(a, b) places
+    BigInt rest = inverse.denominator;
+    int twos = 0, fives = 0;
+    while (!rest.isOdd()) {
+        rest = rest / BigInt(2);
+        twos++;
+    }
+    while ((rest % BigInt(5)).isZero()) {
+        rest = rest / BigInt(5);
+        fives++;
+    }
+    int places = max(twos, fives);
+    if (rest != BigInt(1) || places > MAX_RECIPROCAL_PLACES) return false;
+    reciprocal = toDecimalString(inverse, places);
+    return true;
+}
+
+// Builds the DAG bottom-up from postfix. Every node goes through intern(), so
+// a subexpression that occurs twice resolves to the node built the first time
+class ProgramBuilder {
+public:
+    vector<ProgramNode> nodes;
+
+    int leaf(const Token& token) {
+        return intern(OP_VALUE, token, -1, -1);
+    }
+
+    int unary(const Token& token, int operand) {
+        return intern(OP_FUNCTION, token, operand, -1);
+    }
+
+    int function(const Token& token, int left, int right) {
+        return intern(OP_FUNCTION, token, left, right);
+    }
+
+    int binary(const Token& token, int left, int right) {
+        // nPr and nCr are written as operators but evaluated as functions
+        if (token.value == "nPr" || token.value == "nCr") return function(Token(FUNCTION, token.value), left, right);
+        ProgramOp op = operatorOp(token.value);
+        Rational literal;
+        if (op == OP_POWER && literalValue(right, literal) && literal.isInteger() &&
+            literal.numerator == BigInt(2)) {
+            return intern(OP_SQUARE, token, left, -1);
+        }
+        if (op == OP_POWER && literalValue(right, literal) &&
+            literal.numerator == BigInt(1) && literal.denominator == BigInt(2)) {
+            return unary(Token(FUNCTION, "sqrt"), left);
+        }
+        string reciprocal;
+        if (op == OP_DIVIDE && literalValue(right, literal) && !literal.isZero() &&
+            terminatingReciprocal(literal, reciprocal)) {
+            return binary(Token(OPERATOR, "*", 2), left, leaf(Token(NUMBER, reciprocal)));
+        }
+        // Commutative operands in a fixed order, so a+b and b+a are shared
+        if ((op == OP_ADD || op == OP_MULTIPLY) && right < left) swap(left, right);
+        return intern(op, token, left, right);
+    }
+
+private:
+    int intern(ProgramOp op, const Token& token, int left, int right) {
+        string key = to_string(op) + ' ' + to_string(token.type) + ' ' + to_string(token.slot) + ' ' +
+                     to_string(left) + ' ' + to_string(right) + ' ' + token.value;
+        if (token.series) key += ' ' + token.series->source;
+        auto found = index.find(key);
+        if (found != index.end()) return found->second;
+
+        bool constant = op == OP_VALUE ? !(token.type == VARIABLE && token.slot >= 0)
+                                       : nodes[left].constant && (right < 0 || nodes[right].constant);
+        if (token.series) {
+            // A series body reading session variables changes with them
+            bool reads[SLOT_COUNT] = {};
+            markSeriesInputs(*token.series, reads);
+            constant = constant && find(begin(reads), end(reads), true) == end(reads);
+        }
+        nodes.push_back(ProgramNode{op, token, left, right, constant});
+        int node = (int)nodes.size() - 1;
+        index.emplace(std::move(key), node);
+        return node;
+    }
+
+    // Value of a numeric literal node
+    bool literalValue(int node, Rational& value) const {
+        const ProgramNode& candidate = nodes[node];
+        if (candidate.op != OP_VALUE || candidate.token.type != NUMBER) return false;
+        try {
+            value = parseRational(candidate.token.value);
+            return true;
+        } catch (const exception&) {
+            return false; // Malformed literal, left to the evaluator to report
+        }
+    }
+
+    unordered_map<string, int> index;
+};
+
+CompiledProgram::CompiledProgram(const vector<Token>& postfix)
+    : source(postfix), root(-1), foldedPrecision(0), foldedAngleUnit(ANGLE_RADIANS) {
+    ProgramBuilder builder;
+    vector<int> stack;
+    for (const Token& token : postfix) {
+        switch (token.type) {
+            case NUMBER:
+            case VARIABLE:
+                stack.push_back(builder.leaf(token));
+                break;
+
+            case OPERATOR: {
+                if (stack.size() < 2) {
+                    throw invalid_argument("Invalid expression: not enough operands for operator " + token.value);
+                }
+                int right = stack.back(); stack.pop_back();
+                int left = stack.back(); stack.pop_back();
+                stack.push_back(builder.binary(token, left, right));
+                break;
+            }
+
+            case FUNCTION: {
+                size_t arity = max(functionArity(token.value), 1);
+                if (stack.size() < arity) {
+                    throw invalid_argument("Invalid expression: not enough operands for function " + token.value);
+                }
+                if (arity == 2) {
+                    int right = stack.back(); stack.pop_back();
+                    int left = stack.back(); stack.pop_back();
+                    stack.push_back(builder.function(token, left, right));
+                } else {
+                    int operand = stack.back(); stack.pop_back();
+                    stack.push_back(builder.unary(token, operand));
+                }
+                break;
+            }
+
+            default:
+                throw invalid_argument("Unexpected token type in postfix expression");
+        }
+    }
+
+    if (stack.size() != 1) {
+        throw invalid_argument("Invalid expression: final stack size is " + to_string(stack.size()) + ", expected 1");
+    }
+
+    // Rewrites leave the literals they replaced behind; keep only the nodes
+    // the result depends on
+    vector<bool> reachable(builder.nodes.size(), false);
+    reachable[stack.back()] = true;
+    for (int i = (int)builder.nodes.size() - 1; i >= 0; i--) {
+        if (!reachable[i]) continue;
+        const ProgramNode& node = builder.nodes[i];
+        if (node.left >= 0) reachable[node.left] = true;
+        if (node.right >= 0) reachable[node.right] = true;
+    }
+    vector<int> renumbered(builder.nodes.size(), -1);
+    for (size_t i = 0; i < builder.nodes.size(); i++) {
+        if (!reachable[i]) continue;
+        ProgramNode node = builder.nodes[i];
+        if (node.left >= 0) node.left = renumbered[node.left];
+        if (node.right >= 0) node.right = renumbered[node.right];
+        renumbered[i] = (int)program.size();
+        program.push_back(std::move(node));
+    }
+    root = renumbered[stack.back()];
+    LOGD("Compiled %d postfix tokens into %d nodes", (int)postfix.size(), (int)program.size());
+}
+
+static ComplexNumber evaluateNode(const ProgramNode& node, const vector<ComplexNumber>& values,
+                                  const SlotTable* slots) {
+    switch (node.op) {
+        case OP_VALUE:
+            if (node.token.type == NUMBER) return ComplexNumber(node.token.value);
+            if (node.token.slot >= 0) {
+                // Session variables were bound to their slot by the compiler
+                return slots != nullptr ? slots->values[node.token.slot] : ComplexNumber("0");
+            }
+            return parseVariable(node.token.value);
+        case OP_ADD:
+            return addComplex(values[node.left], values[node.right]);
+        case OP_SUBTRACT:
+            return subtractComplex(values[node.left], values[node.right]);
+        case OP_MULTIPLY:
+            return multiplyComplex(values[node.left], values[node.right]);
+        case OP_DIVIDE:
+            return divideComplex(values[node.left], values[node.right]);
+        case OP_POWER:
+            return powerComplex(values[node.left], values[node.right]);
+        case OP_SQUARE:
+            return squareComplex(values[node.left]);
+        case OP_FUNCTION:
+            if (node.token.series) return evaluateSeries(*node.token.series, values[node.left], values[node.right], slots);
+            if (node.right >= 0) return applyFunction(node.token.value, values[node.left], values[node.right]);
+            return applyFunction(node.token.value, values[node.left]);
+    }
+    throw invalid_argument("Unexpected program node");
+}
+
+static double digitLength(const ComplexNumber& value) {
+    return (double)(value.real.size() + (value.isReal() ? 0 : value.imaginary.size()));
+}
+
+// Exponent of x^n when n is a small integer literal, otherwise 0
+static double literalExponent(const ProgramNode& node) {
+    if (node.op != OP_VALUE || node.token.type != NUMBER) return 0;
+    const string& text = node.token.value;
+    if (text.empty() || text.size() > 6 || text.find_first_not_of("0123456789") != string::npos) return 0;
+    return stod(text);
+}
+
+// Rough digit operations of every node to evaluate, from the digit lengths
+// its operands will have: enough to tell a 2000-digit product from a 10-digit
+// one, which is all scheduling needs. Complex parts count as more digits
+static vector<double> estimateCosts(const vector<ProgramNode>& program, const vector<bool>& needed,
+                                    const vector<bool>& isFolded, const vector<ComplexNumber>& folded,
+                                    const SlotTable* slots) {
+    double precision = (double)workingPrecision();
+    vector<double> lengths(program.size(), 1);
+    vector<double> costs(program.size(), 0);
+    for (size_t i = 0; i < program.size(); i++) {
+        if (!needed[i]) continue;
+        const ProgramNode& node = program[i];
+        if (isFolded[i]) {
+            lengths[i] = digitLength(folded[i]);
+            continue;
+        }
+        double a = node.left >= 0 ? lengths[node.left] : 0;
+        double b = node.right >= 0 ? lengths[node.right] : 0;
+        switch (node.op) {
+            case OP_VALUE:
+                if (node.token.type == NUMBER) lengths[i] = (double)node.token.value.size();
+                else if (node.token.slot >= 0 && slots != nullptr) lengths[i] = digitLength(slots->values[node.token.slot]);
+                else lengths[i] = CONSTANT_DIGITS;
+                break;
+            case OP_ADD:
+            case OP_SUBTRACT:
+                lengths[i] = max(a, b) + 1;
+                costs[i] = max(a, b);
+                break;
+            case OP_MULTIPLY:
+                lengths[i] = a + b;
+                costs[i] = a * b;
+                break;
+            case OP_SQUARE:
+                lengths[i] = 2 * a;
+                costs[i] = a * a / 2;
+                break;
+            case OP_DIVIDE:
+                lengths[i] = max(a, precision) + DIVISION_DECIMAL_PLACES;
+                costs[i] = lengths[i] * b;
+                break;
+            case OP_POWER: {
+                double exponent = literalExponent(program[node.right]);
+                if (exponent > 0) {
+                    // Dominated by the last squaring; an a-digit base has
+                    // about a - 1/2 digits of magnitude
+                    lengths[i] = max(1.0, a - 0.5) * exponent;
+                    costs[i] = lengths[i] * lengths[i] / 2;
+                } else {
+                    // exp(y ln x) at the working precision
+                    lengths[i] = precision;
+                    costs[i] = precision * precision * precision / 10 + a * precision;
+                }
+                break;
+            }
+            case OP_FUNCTION:
+                // Series at the working precision, about one term per digit
+                lengths[i] = precision;
+                costs[i] = precision * precision * precision / 10 + a * precision;
+                break;
+        }
+    }
+    return costs;
+}
+
+// Dataflow evaluation: a node runs as soon as its last operand is done, on
+// the thread that finished that operand. Expensive nodes that become ready
+// while the thread has other work are forked to the pool, so independent
+// subtrees proceed on different cores while cheap nodes never leave the
+// thread that produced their operands
+class ParallelEvaluation {
+public:
+    ParallelEvaluation(const vector<ProgramNode>& program, const vector<bool>& needed,
+                       const vector<double>& costs, const vector<bool>& isFolded,
+                       const vector<ComplexNumber>& folded, vector<ComplexNumber>& values,
+                       const SlotTable* slots)
+        : program(program), costs(costs), isFolded(isFolded), folded(folded), values(values),
+          slots(slots), remaining(program.size()), users(program.size()), total(0), completed(0),
+          failed(false), precision(workingPrecision()), unit(angleUnit()), token(currentCancellationToken()),
+          group(workStealingPool()) {
+        for (size_t i = 0; i < program.size(); i++) {
+            if (!needed[i]) continue;
+            total++;
+            int missing = 0;
+            const ProgramNode& node = program[i];
+            if (!isFolded[i] && node.left >= 0) {
+                users[node.left].push_back((int)i);
+                missing++;
+            }
+            if (!isFolded[i] && node.right >= 0 && node.right != node.left) {
+                users[node.right].push_back((int)i);
+                missing++;
+            }
+            remaining[i].store(missing, memory_order_relaxed);
+            if (missing == 0) ready.push_back((int)i);
+        }
+        reverse(ready.begin(), ready.end());
+    }
+
+    void run() {
+        try {
+            drain(std::move(ready), true);
+        } catch (...) {
+            // Forked tasks stop at their next node; the group waits for them
+            // before this object goes away
+            failed.store(true, memory_order_relaxed);
+            throw;
+        }
+        group.wait();
+    }
+
+private:
+    // Work is a stack of ready nodes, most recently readied on top
+    void drain(vector<int> work, bool onCaller) {
+        while (!work.empty() && !failed.load(memory_order_relaxed)) {
+            int i = work.back();
+            work.pop_back();
+            if (costs[i] >= SPAWN_COST && !work.empty()) {
+                fork(i);
+                continue;
+            }
+            checkCancelled();
+            // Progress listeners are only called on the evaluating thread
+            if (onCaller) reportProgress(completed.load(memory_order_relaxed), total);
+            values[i] = isFolded[i] ? folded[i] : evaluateNode(program[i], values, slots);
+            completed.fetch_add(1, memory_order_relaxed);
+            for (int user : users[i]) {
+                if (remaining[user].fetch_sub(1, memory_order_acq_rel) == 1) work.push_back(user);
+            }
+        }
+    }
+
+    void fork(int node) {
+        group.spawn([this, node] {
+            // Forked work runs under the caller's precision, angle unit and
+            // cancellation
+            PrecisionScope precisionScope(precision);
+            AngleUnitScope angleUnitScope(unit);
+            CancellationScope cancellationScope(token);
+            try {
+                drain(vector<int>{node}, false);
+            } catch (...) {
+                failed.store(true, memory_order_relaxed);
+                throw;
+            }
+        });
+    }
+
+    const vector<ProgramNode>& program;
+    const vector<double>& costs;
+    const vector<bool>& isFolded;
+    const vector<ComplexNumber>& folded;
+    vector<ComplexNumber>& values;
+    const SlotTable* slots;
+
+    vector<atomic<int>> remaining;  // Operands not yet evaluated
+    vector<vector<int>> users;      // Nodes waiting on each node
+    vector<int> ready;
+    size_t total;
+    atomic<size_t> completed;
+    atomic<bool> failed;
+
+    const size_t precision;
+    const AngleUnit unit;
+    CancellationToken* const token;
+    TaskGroup group;
+};
+
+void CompiledProgram::evaluateParallel(const vector<bool>& needed, const vector<double>& costs,
+                                       vector<ComplexNumber>& values, const SlotTable* slots) {
+    ParallelEvaluation(program, needed, costs, isFolded, folded, values, slots).run();
+}
+
+ComplexNumber CompiledProgram::evaluate(const SlotTable* slots) {
+    // Folded values are only valid at the precision and angle unit they
+    // were computed in
+    size_t precision = workingPrecision();
+    if (precision != foldedPrecision || angleUnit() != foldedAngleUnit) {
+        folded.assign(program.size(), ComplexNumber());
+        isFolded.assign(program.size(), false);
+        foldedPrecision = precision;
+        foldedAngleUnit = angleUnit();
+    }
+
+    // Operands of folded nodes are not needed again
+    vector<bool> needed(program.size(), false);
+    needed[root] = true;
+    for (int i = (int)program.size() - 1; i >= 0; i--) {
+        if (!needed[i] || isFolded[i]) continue;
+        if (program[i].left >= 0) needed[program[i].left] = true;
+        if (program[i].right >= 0) needed[program[i].right] = true;
+    }
+
+    vector<ComplexNumber> values(program.size());
+    if (workStealingPool().workerCount() > 0) {
+        vector<double> costs = estimateCosts(program, needed, isFolded, folded, slots);
+        double total = 0;
+        size_t expensive = 0;
+        for (double cost : costs) {
+            total += cost;
+            if (cost >= SPAWN_COST) expensive++;
+        }
+        // Forking pays off only with two expensive nodes that can overlap
+        if (total >= PARALLEL_COST && expensive >= 2) {
+            LOGD("Evaluating %d nodes in parallel, estimated cost %.3g", (int)program.size(), total);
+            parallelEvaluations++;
+            evaluateParallel(needed, costs, values, slots);
+            for (size_t i = 0; i < program.size(); i++) {
+                if (needed[i] && program[i].constant && !isFolded[i]) {
+                    folded[i] = values[i];
+                    isFolded[i] = true;
+                }
+            }
+            return std::move(values[root]);
+        }
+    }
+
+    for (size_t i = 0; i < program.size(); i++) {
+        checkCancelled();
+        reportProgress(i, program.size());
+        if (!needed[i]) continue;
+        if (isFolded[i]) {
+            values[i] = folded[i];
+            continue;
+        }
+        values[i] = evaluateNode(program[i], values, slots);
+        if (program[i].constant) {
+            folded[i] = values[i];
+            isFolded[i] = true;
+        }
+    }
+    return std::move(values[root]);
+}
+
+uint64_t parallelEvaluationCount() {
+    return parallelEvaluations.load();
+}
+
+void markProgramInputs(const CompiledProgram& program, bool reads[SLOT_COUNT]) {
+    for (const Token& token : program.postfix()) {
+        if (token.slot >= 0) reads[token.slot] = true;
+        if (token.series) markSeriesInputs(*token.series, reads);
+    }
+}
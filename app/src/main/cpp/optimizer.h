@@ -0,0 +1,71 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "calc.h"
+#include "complex_number.h"
+#include "session.h"
+#include "token.h"
+
+// Operation of a program node
+enum ProgramOp {
+    OP_VALUE,       // Number, constant or session variable
+    OP_ADD, OP_SUBTRACT, OP_MULTIPLY, OP_DIVIDE, OP_POWER,
+    OP_SQUARE,      // x^2 as x*x
+    OP_FUNCTION     // Function named by the token, of one or two operands
+};
+
+// One node of an expression DAG. Operands always come before the node that
+// uses them, so the node list is an evaluation order
+struct ProgramNode {
+    ProgramOp op;
+    Token token;    // Leaf value or function name; operator of binary nodes
+    int left;       // Operand node indices, -1 when unused
+    int right;
+    bool constant;  // Depends on no session variable
+};
+
+// Postfix program compiled into an expression DAG. Identical subexpressions
+// share one node (sin(pi/6)*sin(pi/6) computes the sine once) and cheap forms
+// replace general operations: x^2 squares, x^0.5 is sqrt and division by a
+// literal with a terminating reciprocal (x/2, x/8) multiplies instead.
+// Subtrees without session variables are folded: computed on the first
+// evaluation and reused by later ones at the same working precision, so the
+// program can be evaluated repeatedly against changing variables cheaply.
+// When the operands are large enough for independent subtrees to take
+// milliseconds each, an evaluation spreads them over workStealingPool().
+// Not thread-safe; the owner serializes evaluations
+class CompiledProgram {
+public:
+    // Throws invalid_argument for malformed programs, as evaluation would
+    explicit CompiledProgram(const std::vector<Token>& postfix);
+
+    // Decimal evaluation reading slot-bound variables from the given slot
+    // table (nullptr evaluates against cleared memory)
+    ComplexNumber evaluate(const SlotTable* slots);
+
+    // The program as compiled, for evaluators that need token order
+    const std::vector<Token>& postfix() const { return source; }
+
+    const std::vector<ProgramNode>& nodes() const { return program; }
+    int result() const { return root; }
+
+private:
+    void evaluateParallel(const std::vector<bool>& needed, const std::vector<double>& costs,
+                          std::vector<ComplexNumber>& values, const SlotTable* slots);
+
+    std::vector<Token> source;
+    std::vector<ProgramNode> program;
+    int root;
+
+    std::vector<ComplexNumber> folded;  // Values of constant nodes
+    std::vector<bool> isFolded;
+    size_t foldedPrecision;             // Working precision of the folded values
+    AngleUnit foldedAngleUnit;          // and the angle unit they were computed in
+};
+
+// Evaluations so far, process-wide, that were spread over workStealingPool()
+uint64_t parallelEvaluationCount();
+
+// Marks the session slots a program reads, including those read inside Σ and Π
+void markProgramInputs(const CompiledProgram& program, bool reads[SLOT_COUNT]);
@@ -1,5 +1,10 @@
 #include "parsing.h"
+#include "calc.h"
 #include "evaluator.h"
+#include "governor.h"
+#include "series.h"
+#include "session.h"
+#include "trace.h"
 #include <string>
 #include <iostream>
 #include <stack>
@@ -8,6 +13,7 @@
 #include <algorithm>
 #include <cmath>
 #include <map>
+#include <stdexcept>
 #include <android/log.h>
 
 #define LOG_TAG "CalculatorParser"
@@ -16,75 +22,104 @@
 
 using namespace std;
 
-// Complex number structure
-struct ComplexNumber {
-    string real;
-    string imaginary;
-    
-    ComplexNumber() : real("0"), imaginary("not initiated") {}
-    ComplexNumber(const string& r) : real(r), imaginary("not initiated") {}
-    ComplexNumber(const string& r, const string& i) : real(r), imaginary(i) {}
-    
-    bool isReal() const {
-        return imaginary == "not initiated" || imaginary == "0";
-    }
-    
-    string toString() const {
-        if (isReal()) return real;
-        if (real == "0") return imaginary + "i";
-        if (imaginary == "0") return real;
-        
-        string sign = (imaginary[0] == '-') ? "" : "+";
-        return real + sign + imaginary + "i";
-    }
-};
-
-// Token types
-enum TokenType {
-    NUMBER, OPERATOR, FUNCTION, LEFT_PAREN, RIGHT_PAREN, VARIABLE
-};
-
-// Token structure
-struct Token {
-    TokenType type;
-    string value;
-    int precedence;
-    bool rightAssociative;
-    
-    Token(TokenType t, const string& v, int p = 0, bool ra = false) 
-        : type(t), value(v), precedence(p), rightAssociative(ra) {}
-};
-
 // Operator precedence map
-map<string, pair<int, bool>> operatorMap = {
+static const map<string, pair<int, bool>> operatorMap = {
     {"+", {1, false}}, {"-", {1, false}},
     {"*", {2, false}}, {"/", {2, false}}, {"%", {2, false}},
+    {"nPr", {3, false}}, {"nCr", {3, false}}, // Permutations and combinations, as typed on the fx-991ES
     {"^", {4, true}},  {"**", {4, true}}  // Power has highest precedence and is right-associative
 };
 
 // Function map
-map<string, int> functionMap = {
+static const map<string, int> functionMap = {
     {"sin", 1}, {"cos", 1}, {"tan", 1},
     {"asin", 1}, {"acos", 1}, {"atan", 1},
     {"sinh", 1}, {"cosh", 1}, {"tanh", 1},
     {"log", 1}, {"ln", 1}, {"log10", 1},
     {"sqrt", 1}, {"abs", 1}, {"inv", 1},
-    {"exp", 1}, {"floor", 1}, {"ceil", 1}
+    {"exp", 1}, {"floor", 1}, {"ceil", 1},
+    {"!", 1},   // Postfix factorial
+    {"gcd", 2}, {"lcm", 2},
+    {"Σ", 2}, {"Π", 2}  // Bounds of a sum or product; the body travels with the token
 };
 
+int functionArity(const string& name) {
+    auto found = functionMap.find(name);
+    return found != functionMap.end() ? found->second : 0;
+}
+
 // Helper function to check if character is alphanumeric
 bool isAlphaNum(char c) {
     return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9');
 }
 
+vector<Token> tokenize(const string& expression);
+
+// Σ(body, X, a, b) and Π(...), typed with the symbol or as sum( and prod(.
+// The body is compiled on its own into the token's series; the bounds stay
+// in the expression as the function's two arguments. i is at the opening
+// parenthesis and is left on the closing one
+static void tokenizeSeries(const string& expression, size_t& i, bool product, vector<Token>& tokens) {
+    const char* name = product ? "Π" : "Σ";
+    while (i < expression.length() && isspace((unsigned char)expression[i])) i++;
+    if (i >= expression.length() || expression[i] != '(') {
+        throw invalid_argument(string(name) + " must be followed by (");
+    }
+    vector<string> arguments(1);
+    int depth = 0;
+    for (i++; i < expression.length(); i++) {
+        char c = expression[i];
+        if (c == '(') depth++;
+        if (c == ')' && depth-- == 0) break;
+        if (c == ',' && depth == 0) {
+            arguments.emplace_back();
+        } else {
+            arguments.back() += c;
+        }
+    }
+    if (i >= expression.length()) throw invalid_argument(string("Missing ) after ") + name + "(");
+    if (arguments.size() != 4) {
+        throw invalid_argument(string(name) + "( takes an expression, a variable and two bounds");
+    }
+
+    string variable;
+    for (char c : arguments[1]) {
+        if (!isspace((unsigned char)c)) variable += c;
+    }
+    int slot = resolveVariableSlot(variable);
+    if (slot < 0 || slot == SLOT_ANS) throw invalid_argument(string(name) + " cannot count with " + variable);
+
+    auto series = make_shared<Series>();
+    series->product = product;
+    series->variable = slot;
+    series->body = compileExpression(arguments[0]);
+    series->source = arguments[0] + "," + variable;
+    Token function(FUNCTION, name);
+    function.series = std::move(series);
+    tokens.push_back(std::move(function));
+    tokens.push_back(Token(LEFT_PAREN, "("));
+    for (Token& token : tokenize(arguments[2])) tokens.push_back(std::move(token));
+    tokens.push_back(Token(COMMA, ","));
+    for (Token& token : tokenize(arguments[3])) tokens.push_back(std::move(token));
+    tokens.push_back(Token(RIGHT_PAREN, ")"));
+}
+
 // Tokenize the input expression
 vector<Token> tokenize(const string& expression) {
     vector<Token> tokens;
     string current = "";
     
-    for (int i = 0; i < expression.length(); i++) {
+    for (size_t i = 0; i < expression.length(); i++) {
         char c = expression[i];
         
+        // Σ and Π are two bytes of UTF-8
+        if (expression.compare(i, 2, "Σ") == 0 || expression.compare(i, 2, "Π") == 0) {
+            bool product = expression.compare(i, 2, "Π") == 0;
+            i += 2;
+            tokenizeSeries(expression, i, product, tokens);
+            continue;
+        }
+        
         if (isspace(c)) {
             continue; // Skip whitespace
         }
@@ -95,11 +130,17 @@ vector<Token> tokenize(const string& expression) {
             while (i < expression.length() && 
                    (isdigit(expression[i]) || expression[i] == '.' || 
                     expression[i] == 'e' || expression[i] == 'E' ||
-                    (expression[i] == '-' && i > 0 && (expression[i-1] == 'e' || expression[i-1] == 'E')))) {
+                    ((expression[i] == '-' || expression[i] == '+') && i > 0 && (expression[i-1] == 'e' || expression[i-1] == 'E')))) {
                 current += expression[i];
                 i++;
             }
             i--; // Back up one since the loop will increment
+            
+            // Scientific literals are parsed once here into their compact
+            // mantissa/exponent form ("1.5E+300" -> "1.5e300", "2e3" -> "2000")
+            if (isScientific(current)) {
+                current = formatBigFloat(parseBigFloat(current));
+            }
             tokens.push_back(Token(NUMBER, current));
         }
         // Variables and functions
@@ -108,17 +149,31 @@ vector<Token> tokenize(const string& expression) {
             while (i < expression.length() && isAlphaNum(expression[i])) {
                 current += expression[i];
                 i++;
+                // Word operators end where they are spelled out: 10nCr3
+                if (operatorMap.count(current)) break;
             }
             i--; // Back up one
             
-            if (functionMap.find(current) != functionMap.end()) {
+            auto wordOperator = operatorMap.find(current);
+            if (current == "sum" || current == "prod") {
+                i++;
+                tokenizeSeries(expression, i, current == "prod", tokens);
+            } else if (wordOperator != operatorMap.end()) {
+                tokens.push_back(Token(OPERATOR, current, wordOperator->second.first, wordOperator->second.second));
+            } else if (functionMap.find(current) != functionMap.end()) {
                 tokens.push_back(Token(FUNCTION, current));
             } else if (current == "i" || current == "j") {
                 tokens.push_back(Token(VARIABLE, current)); // Imaginary unit
             } else if (current == "pi" || current == "e") {
                 tokens.push_back(Token(VARIABLE, current)); // Constants
             } else {
-                tokens.push_back(Token(VARIABLE, current)); // Other variables
+                // Session variables (A-F, X, Y, M, Ans) are bound to a fixed slot here
+                Token variable(VARIABLE, current);
+                variable.slot = resolveVariableSlot(current);
+                if (variable.slot < 0) {
+                    throw invalid_argument("Unknown variable: " + current);
+                }
+                tokens.push_back(variable);
             }
         }
         // Operators
@@ -132,11 +187,18 @@ vector<Token> tokenize(const string& expression) {
                 i++;
             }
             
-            if (operatorMap.find(op) != operatorMap.end()) {
-                auto opInfo = operatorMap[op];
-                tokens.push_back(Token(OPERATOR, op, opInfo.first, opInfo.second));
+            auto opInfo = operatorMap.find(op);
+            if (opInfo != operatorMap.end()) {
+                tokens.push_back(Token(OPERATOR, op, opInfo->second.first, opInfo->second.second));
             }
         }
+        // Postfix factorial
+        else if (c == '!') {
+            tokens.push_back(Token(FUNCTION, "!"));
+        }
+        else if (c == ',') {
+            tokens.push_back(Token(COMMA, ","));
+        }
         // Parentheses
         else if (c == '(') {
             tokens.push_back(Token(LEFT_PAREN, "("));
@@ -162,7 +224,20 @@ vector<Token> shuntingYard(const vector<Token>& tokens) {
                 break;
                 
             case FUNCTION:
-                operators.push(token);
+                // A postfix function applies to the operand just output
+                if (token.value == "!") {
+                    output.push_back(token);
+                } else {
+                    operators.push(token);
+                }
+                break;
+                
+            case COMMA:
+                // End of an argument: flush it up to the function's parenthesis
+                while (!operators.empty() && operators.top().type != LEFT_PAREN) {
+                    output.push_back(operators.top());
+                    operators.pop();
+                }
                 break;
                 
             case OPERATOR:
@@ -207,30 +282,44 @@ vector<Token> shuntingYard(const vector<Token>& tokens) {
     return output;
 }
 
+// Compile an infix expression into a postfix program with variables bound to slots
+vector<Token> compileExpression(const string& expression) {
+    // Tokenize the expression
+    vector<Token> tokens = tokenize(expression);
+    LOGD("Tokenization complete: %d tokens", (int)tokens.size());
+    
+    // Convert to postfix using Shunting Yard
+    vector<Token> postfix = shuntingYard(tokens);
+    LOGD("Shunting Yard complete: %d postfix tokens", (int)postfix.size());
+    
+    return postfix;
+}
+
 // Evaluation is now handled by evaluator.cpp
 
 std::string parseExpression(const std::string& expression) {
+    TraceEvent trace(TRACE_EXPRESSION, nullptr, expression);
     try {
         LOGD("C++ received expression: %s", expression.c_str());
         
-        // Tokenize the expression
-        vector<Token> tokens = tokenize(expression);
-        LOGD("Tokenization complete: %d tokens", (int)tokens.size());
-        
-        // Convert to postfix using Shunting Yard
-        vector<Token> postfix = shuntingYard(tokens);
-        LOGD("Shunting Yard complete: %d postfix tokens", (int)postfix.size());
+        vector<Token> postfix = compileExpression(expression);
+        trace.phase(PHASE_COMPILE);
         
         // Send postfix tokens to evaluator for computation
+        GovernorScope governor(DEFAULT_BUDGET);
         string result = evaluatePostfixExpression(postfix);
+        trace.phase(PHASE_EVALUATE);
         
         string output = "Result: " + result;
         LOGD("C++ final output: %s", output.c_str());
         
+        trace.finish(output);
         return output;
         
     } catch (const std::exception& e) {
         LOGE("Parsing error: %s", e.what());
-        return "Error: " + string(e.what());
+        string output = "Error: " + string(e.what());
+        trace.finish(output);
+        return output;
     }
 }
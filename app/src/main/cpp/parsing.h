@@ -1,4 +1,18 @@
 #pragma once
+#include <cstdint>
 #include <string>
+#include <vector>
+#include "token.h"
+
+// Version of the programs compileExpression produces. Bump it whenever a
+// change to tokenizing or postfix conversion gives an expression different
+// tokens, so programs saved by older builds are dropped instead of reused
+const uint32_t PARSER_VERSION = 1;
 
 std::string parseExpression(const std::string& expression);
+
+// Tokenize and convert to postfix, resolving session variables to slots
+std::vector<Token> compileExpression(const std::string& expression);
+
+// Number of arguments a function takes (0 for unknown names)
+int functionArity(const std::string& name);
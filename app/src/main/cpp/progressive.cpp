@@ -0,0 +1,235 @@
+#include "progressive.h"
+#include "cancellation.h"
+#include "evaluator.h"
+#include "series.h"
+#include <algorithm>
+#include <stdexcept>
+
+using namespace std;
+
+// Extra digits carried by every inexact node over the requested precision
+static const size_t GUARD_DIGITS = 8;
+
+// Integer powers of exact values stay exact while the result is at most this
+// many digits long
+static const size_t MAX_EXACT_POWER_DIGITS = 100000;
+
+static ComplexFloat truncated(const ComplexFloat& z, size_t digits) {
+    return ComplexFloat(truncateToDigits(z.real, digits), truncateToDigits(z.imaginary, digits));
+}
+
+static bool equal(const BigFloat& a, const BigFloat& b) {
+    return subtract(a, b).isZero();
+}
+
+ProgressiveResult::ProgressiveResult(shared_ptr<const CompiledProgram> program, const SlotTable* slots)
+    : program(std::move(program)), nodes(this->program->nodes().size()),
+      inputs(slots != nullptr ? new SlotTable(*slots) : nullptr), unit(angleUnit()), currentDigits(0) {
+    const vector<ProgramNode>& programNodes = this->program->nodes();
+    for (size_t i = 0; i < programNodes.size(); i++) {
+        const Token& token = programNodes[i].token;
+        if (programNodes[i].op == OP_VALUE && token.type == VARIABLE && token.slot >= 0) {
+            nodes[i].value = toComplexFloat(slots != nullptr ? slots->values[token.slot] : ComplexNumber("0"));
+            nodes[i].exact = true;
+            nodes[i].computed = true;
+        }
+    }
+}
+
+BigFloat ProgressiveResult::seededInverseRoot(Node& node, const BigFloat& x, unsigned long long n, size_t working) {
+    BigFloat y = node.seedDigits == 0 ? inverseNthRoot(x, n, working)
+                                      : inverseNthRoot(x, n, working, node.seed, node.seedDigits);
+    node.seed = y;
+    node.seedDigits = working - 2;
+    return y;
+}
+
+// numerator / denominator as numerator times a seeded reciprocal; exact when
+// both inputs are exact and the quotient terminates within the working digits
+static BigFloat quotient(const BigFloat& numerator, const BigFloat& denominator, const BigFloat& reciprocal,
+                         bool exactInputs, bool& exact, size_t working) {
+    BigFloat result = truncateToDigits(multiply(numerator, reciprocal), working);
+    if (denominator.mantissa.negative) result.mantissa = -result.mantissa;
+    exact = false;
+    if (exactInputs) {
+        BigFloat rounded = roundToDigits(result, working - GUARD_DIGITS);
+        if (equal(multiply(rounded, denominator), numerator)) {
+            exact = true;
+            return rounded;
+        }
+    }
+    return result;
+}
+
+// Numbers and the constants pi and e; slot values were captured by the
+// constructor
+void ProgressiveResult::evaluateValue(const Token& token, Node& node, size_t working) {
+    if (token.type == NUMBER) {
+        node.value = ComplexFloat(parseBigFloat(token.value));
+        node.exact = true;
+    } else if (token.value == "pi") {
+        node.value = ComplexFloat(constantPi(working));
+    } else if (token.value == "e") {
+        node.value = ComplexFloat(exponential(BigFloat(BigInt(1)), working));
+    } else {
+        node.value = toComplexFloat(parseVariable(token.value));
+        node.exact = true;
+    }
+}
+
+void ProgressiveResult::evaluateOperator(ProgramOp op, Node& node, const Node& a, const Node& b, size_t working) {
+    bool exactInputs = a.exact && b.exact;
+
+    if (op == OP_ADD || op == OP_SUBTRACT || op == OP_MULTIPLY || op == OP_SQUARE) {
+        ComplexFloat value = op == OP_ADD ? add(a.value, b.value)
+                           : op == OP_SUBTRACT ? subtract(a.value, b.value)
+                                               : multiply(a.value, b.value);
+        node.exact = exactInputs;
+        node.value = exactInputs ? value : truncated(value, working);
+    } else if (op == OP_DIVIDE) {
+        if (b.value.isZero()) throw domain_error("Division by zero");
+        if (!a.value.isReal() || !b.value.isReal()) {
+            node.value = divide(a.value, b.value, working);
+            node.exact = false;
+            return;
+        }
+        BigFloat divisor = b.value.real;
+        divisor.mantissa.negative = false;
+        BigFloat reciprocal = seededInverseRoot(node, divisor, 1, working);
+        node.value = ComplexFloat(quotient(a.value.real, b.value.real, reciprocal, exactInputs, node.exact, working));
+    } else if (op == OP_POWER) {
+        if (a.value.isReal() && b.value.isReal()) {
+            const BigFloat& base = a.value.real;
+            const BigFloat& exponent = b.value.real;
+            if (exactInputs && exponent.exponent >= 0 && !exponent.mantissa.negative && decimalMagnitude(exponent) < 9) {
+                unsigned long long n = stoull(shiftDecimal(exponent.mantissa, (size_t)exponent.exponent).toString());
+                if (n * base.mantissa.digitCount() <= MAX_EXACT_POWER_DIGITS) {
+                    node.value = ComplexFloat(power(base, n));
+                    node.exact = true;
+                    return;
+                }
+            }
+            node.exact = false;
+            try {
+                node.value = ComplexFloat(power(base, exponent, working));
+                return;
+            } catch (const domain_error&) {
+                // Negative base with an exponent that has no real value
+                if (!base.mantissa.negative) throw;
+            }
+        }
+        node.value = complexPow(a.value, b.value, working);
+        node.exact = false;
+    } else {
+        throw invalid_argument("Unexpected program node");
+    }
+}
+
+// Operand of an integer function with every digit it has: an exact 50-digit
+// integer must not be rounded to the working precision first
+static ComplexNumber integerOperand(const ComplexFloat& x, size_t working) {
+    return toComplexNumber(x, max(working, x.real.mantissa.digitCount()));
+}
+
+void ProgressiveResult::evaluateFunction(const Token& token, Node& node, const Node& operand, const Node* second,
+                                         size_t working) {
+    const string& name = token.value;
+    const ComplexFloat& x = operand.value;
+
+    if (token.series) {
+        // Sums and products are evaluated anew at each precision, against
+        // the slots as they were at construction
+        PrecisionScope scope(working);
+        node.value = toComplexFloat(evaluateSeries(*token.series, toComplexNumber(x, working),
+                                                   toComplexNumber(second->value, working), inputs.get()));
+        node.exact = false;
+    } else if (second != nullptr) {
+        // nPr, nCr, gcd and lcm: integers of exact integers, computed once
+        PrecisionScope scope(working);
+        node.value = toComplexFloat(applyFunction(name, integerOperand(x, working), integerOperand(second->value, working)));
+        node.exact = operand.exact && second->exact;
+    } else if (name == "!") {
+        PrecisionScope scope(working);
+        node.value = toComplexFloat(applyFunction(name, integerOperand(x, working)));
+        node.exact = operand.exact;
+    } else if (name == "sqrt" && x.isReal() && !x.real.mantissa.negative) {
+        if (x.real.isZero()) {
+            node.value = ComplexFloat();
+            node.exact = true;
+            return;
+        }
+        // sqrt x = x * x^(-1/2); perfect squares of exact values stay exact
+        BigFloat y = seededInverseRoot(node, x.real, 2, working);
+        BigFloat root = truncateToDigits(multiply(x.real, y), working);
+        node.exact = false;
+        if (operand.exact) {
+            BigFloat rounded = roundToDigits(root, working - GUARD_DIGITS);
+            if (equal(multiply(rounded, rounded), x.real)) {
+                root = rounded;
+                node.exact = true;
+            }
+        }
+        node.value = ComplexFloat(root);
+    } else if (name == "inv" && x.isReal()) {
+        if (x.real.isZero()) throw domain_error("Cannot take inverse of zero");
+        BigFloat divisor = x.real;
+        divisor.mantissa.negative = false;
+        BigFloat reciprocal = seededInverseRoot(node, divisor, 1, working);
+        node.value = ComplexFloat(quotient(BigFloat(BigInt(1)), x.real, reciprocal, operand.exact, node.exact, working));
+    } else if (name == "abs" && x.isReal()) {
+        node.value = ComplexFloat(BigFloat(absValue(x.real.mantissa), x.real.exponent));
+        node.exact = operand.exact;
+    } else {
+        // Everything else has no reusable state: recompute through the
+        // evaluator's own dispatch at the new precision
+        PrecisionScope scope(working);
+        node.value = toComplexFloat(applyFunction(name, toComplexNumber(x, working)));
+        node.exact = false;
+    }
+}
+
+// Rounded to the digits computed. When that drops digits of the integer part,
+// scientific notation, rather than zeros standing in for digits never shown:
+// (1+i)^100 at 12 digits is -1.12589990684e15, not -1125899906840000
+static string formatRounded(const BigFloat& value, size_t digits) {
+    BigFloat rounded = roundToDigits(value, digits);
+    bool dropped = value.mantissa.digitCount() > digits;
+    return dropped && rounded.exponent > 0 ? formatScientific(rounded) : formatBigFloat(rounded);
+}
+
+ComplexNumber ProgressiveResult::refine(size_t digits) {
+    digits = max(digits, currentDigits);
+    size_t working = digits + GUARD_DIGITS;
+    AngleUnitScope angleUnitScope(unit);
+
+    const vector<ProgramNode>& programNodes = program->nodes();
+    for (size_t i = 0; i < programNodes.size(); i++) {
+        checkCancelled();
+        reportProgress(i, programNodes.size());
+
+        const ProgramNode& programNode = programNodes[i];
+        Node& node = nodes[i];
+        if (node.computed && node.exact) continue;
+        switch (programNode.op) {
+            case OP_VALUE:
+                evaluateValue(programNode.token, node, working);
+                break;
+            case OP_FUNCTION:
+                evaluateFunction(programNode.token, node, nodes[programNode.left],
+                                 programNode.right >= 0 ? &nodes[programNode.right] : nullptr, working);
+                break;
+            case OP_SQUARE:
+                evaluateOperator(OP_SQUARE, node, nodes[programNode.left], nodes[programNode.left], working);
+                break;
+            default:
+                evaluateOperator(programNode.op, node, nodes[programNode.left], nodes[programNode.right], working);
+                break;
+        }
+        node.computed = true;
+    }
+
+    currentDigits = digits;
+    const ComplexFloat& value = nodes[program->result()].value;
+    if (value.isReal()) return ComplexNumber(formatRounded(value.real, digits));
+    return ComplexNumber(formatRounded(value.real, digits), formatRounded(value.imaginary, digits));
+}
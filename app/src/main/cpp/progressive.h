@@ -0,0 +1,47 @@
+#pragma once
+#include <memory>
+#include <vector>
+#include "complex_math.h"
+#include "optimizer.h"
+#include "session.h"
+
+// Significant digits of the first, fast answer of a progressive evaluation
+const size_t FAST_PRECISION = 12;
+
+// Anytime evaluation of a compiled expression. refine() returns the value to
+// a requested number of digits and can be called again later for more digits
+// without starting over: exact sub-results (integer arithmetic, terminating
+// divisions, perfect roots) are computed once, and square roots and
+// reciprocals restart their Newton iteration from the previous value, so
+// only the extra precision is paid for
+class ProgressiveResult {
+public:
+    // Slot-bound variables and the angle unit are read here, so later
+    // changes to the session do not affect refinements
+    ProgressiveResult(std::shared_ptr<const CompiledProgram> program, const SlotTable* slots);
+
+    ComplexNumber refine(size_t digits);
+
+    // Digits of the most precise value computed so far (0 before the first refine)
+    size_t digits() const { return currentDigits; }
+
+private:
+    struct Node {
+        ComplexFloat value;
+        bool computed = false;
+        bool exact = false;         // Independent of precision, never recomputed
+        BigFloat seed;              // Newton state: reciprocal or inverse root
+        size_t seedDigits = 0;
+    };
+
+    void evaluateValue(const Token& token, Node& node, size_t working);
+    void evaluateOperator(ProgramOp op, Node& node, const Node& a, const Node& b, size_t working);
+    void evaluateFunction(const Token& token, Node& node, const Node& operand, const Node* second, size_t working);
+    BigFloat seededInverseRoot(Node& node, const BigFloat& x, unsigned long long n, size_t working);
+
+    std::shared_ptr<const CompiledProgram> program;
+    std::vector<Node> nodes; // One per program node
+    std::unique_ptr<SlotTable> inputs; // Slots read by series bodies, null for cleared memory
+    AngleUnit unit;
+    size_t currentDigits;
+};
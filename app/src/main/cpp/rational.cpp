@@ -0,0 +1,256 @@
+#include "rational.h"
+#include "calc.h"
+#include "cancellation.h"
+#include <algorithm>
+#include <string>
+using namespace std;
+
+static const BigInt ONE(1);
+
+// Decimal exponents beyond this are not expanded into exact integers
+static const long long MAX_EXACT_DECIMAL_EXPONENT = 100000;
+
+Rational::Rational(const BigInt& n, const BigInt& d) {
+    if (d.isZero()) throw domain_error("Division by zero");
+
+    BigInt g = gcd(n, d);
+    if (g == ONE) {
+        numerator = n;
+        denominator = d;
+    } else {
+        numerator = n / g;
+        denominator = d / g;
+    }
+    if (denominator.negative) {
+        numerator = -numerator;
+        denominator = -denominator;
+    }
+}
+
+// Builds a rational from parts that are already coprime
+static Rational reduced(BigInt n, BigInt d) {
+    Rational result;
+    result.numerator = std::move(n);
+    result.denominator = std::move(d);
+    return result;
+}
+
+Rational parseRational(const string& decimal) {
+    BigFloat value = parseBigFloat(decimal);
+    
+    // Keep absurd exponents from expanding into gigantic integers
+    if (value.exponent > MAX_EXACT_DECIMAL_EXPONENT || value.exponent < -MAX_EXACT_DECIMAL_EXPONENT) {
+        throw InexactError("exponent too large for an exact value: " + decimal);
+    }
+    if (value.exponent >= 0) return Rational(shiftDecimal(value.mantissa, (size_t)value.exponent));
+    return Rational(value.mantissa, shiftDecimal(ONE, (size_t)-value.exponent));
+}
+
+// Henrici's method: GCDs are taken of the smaller factors rather than of the
+// full cross products, which keeps normalization cheap
+Rational add(const Rational& a, const Rational& b) {
+    if (a.isZero()) return b;
+    if (b.isZero()) return a;
+    if (a.isInteger() && b.isInteger()) return reduced(a.numerator + b.numerator, ONE);
+
+    BigInt g = gcd(a.denominator, b.denominator);
+    if (g == ONE) {
+        return reduced(a.numerator * b.denominator + b.numerator * a.denominator,
+                       a.denominator * b.denominator);
+    }
+
+    BigInt bOverG = b.denominator / g;
+    BigInt t = a.numerator * bOverG + b.numerator * (a.denominator / g);
+    if (t.isZero()) return Rational();
+
+    BigInt g2 = gcd(t, g);
+    if (g2 == ONE) return reduced(t, a.denominator * bOverG);
+    return reduced(t / g2, (a.denominator / g) * (b.denominator / g2));
+}
+
+Rational subtract(const Rational& a, const Rational& b) {
+    return add(a, reduced(-b.numerator, b.denominator));
+}
+
+Rational multiply(const Rational& a, const Rational& b) {
+    if (a.isZero() || b.isZero()) return Rational();
+
+    // Cross-cancel before multiplying so the products are already reduced
+    BigInt g1 = gcd(a.numerator, b.denominator);
+    BigInt g2 = gcd(b.numerator, a.denominator);
+    BigInt n1 = g1 == ONE ? a.numerator : a.numerator / g1;
+    BigInt d2 = g1 == ONE ? b.denominator : b.denominator / g1;
+    BigInt n2 = g2 == ONE ? b.numerator : b.numerator / g2;
+    BigInt d1 = g2 == ONE ? a.denominator : a.denominator / g2;
+    return reduced(n1 * n2, d1 * d2);
+}
+
+Rational divide(const Rational& a, const Rational& b) {
+    if (b.isZero()) throw domain_error("Division by zero");
+
+    Rational reciprocal = b.numerator.negative
+        ? reduced(-b.denominator, -b.numerator)
+        : reduced(b.denominator, b.numerator);
+    return multiply(a, reciprocal);
+}
+
+Rational power(const Rational& base, long long exponent) {
+    if (exponent == 0) return Rational(ONE);
+    if (base.isZero()) {
+        if (exponent < 0) throw domain_error("0 to negative power is undefined");
+        return Rational();
+    }
+
+    // Powers of coprime parts stay coprime, no GCD needed
+    unsigned long long magnitude = exponent < 0 ? 0ULL - (unsigned long long)exponent : (unsigned long long)exponent;
+    Rational result = reduced(power(base.numerator, magnitude), power(base.denominator, magnitude));
+    return exponent < 0 ? divide(Rational(ONE), result) : result;
+}
+
+// Largest root degree tried for an exact rational power
+static const long long MAX_EXACT_ROOT_DEGREE = 1000;
+
+// Exact q-th root of a non-negative integer, if it has one
+static bool exactIntegerRoot(const BigInt& value, unsigned long long q, BigInt& root) {
+    if (value.isZero() || value == ONE) {
+        root = value;
+        return true;
+    }
+    size_t rootDigits = value.digitCount() / q + 1;
+    BigFloat approximation = roundToDigits(nthRoot(BigFloat(value), q, rootDigits + 2), rootDigits);
+    if (approximation.exponent < 0) return false;
+    root = shiftDecimal(approximation.mantissa, (size_t)approximation.exponent);
+    return power(root, q) == value;
+}
+
+Rational power(const Rational& base, const Rational& exponent) {
+    if (exponent.isInteger()) {
+        if (exponent.numerator.limbs.size() > 1) throw InexactError("exponent too large for exact result");
+        long long p = exponent.numerator.isZero() ? 0 : exponent.numerator.limbs[0];
+        return power(base, exponent.numerator.negative ? -p : p);
+    }
+    if (exponent.denominator > BigInt(MAX_EXACT_ROOT_DEGREE) || exponent.numerator.limbs.size() > 1) {
+        throw InexactError("exponent denominator too large for exact root");
+    }
+
+    // p/q with q > 1: exact only when numerator and denominator are q-th powers
+    unsigned long long q = exponent.denominator.limbs[0];
+    long long p = exponent.numerator.limbs[0];
+    if (base.numerator.negative && q % 2 == 0) {
+        throw InexactError("even root of negative number");
+    }
+    BigInt numeratorRoot, denominatorRoot;
+    if (!exactIntegerRoot(absValue(base.numerator), q, numeratorRoot) ||
+        !exactIntegerRoot(base.denominator, q, denominatorRoot)) {
+        throw InexactError("irrational root");
+    }
+    if (base.numerator.negative) numeratorRoot = -numeratorRoot;
+    return power(Rational(numeratorRoot, denominatorRoot), exponent.numerator.negative ? -p : p);
+}
+
+string toFractionString(const Rational& value) {
+    if (value.isInteger()) return value.numerator.toString();
+    return value.numerator.toString() + "/" + value.denominator.toString();
+}
+
+// Denominators below this have remainders whose tenfold fits 64 bits
+static const unsigned long long MAX_WORD_DIVISOR = 1000000000000000000ULL;
+
+static unsigned long long toWord(const BigInt& value) {
+    unsigned long long word = 0;
+    for (size_t i = value.limbs.size(); i-- > 0;) word = word * BigInt::BASE + value.limbs[i];
+    return word;
+}
+
+static char nextDigit(unsigned long long& remainder, unsigned long long divisor) {
+    remainder *= 10;
+    char digit = char('0' + remainder / divisor);
+    remainder %= divisor;
+    return digit;
+}
+
+static char nextDigit(BigInt& remainder, const BigInt& divisor) {
+    checkCancelled();
+    BigInt quotient;
+    divMod(remainder * BigInt(10), divisor, quotient, remainder);
+    return char('0' + (quotient.isZero() ? 0 : quotient.limbs[0]));
+}
+
+static bool isZero(unsigned long long value) { return value == 0; }
+static bool isZero(const BigInt& value) { return value.isZero(); }
+
+// Times `factor` divides divisor, counting no further than limit
+static size_t factorCount(const BigInt& divisor, unsigned factor, size_t limit) {
+    BigInt rest = divisor, quotient, remainder;
+    size_t count = 0;
+    while (count <= limit) {
+        divMod(rest, BigInt((long long)factor), quotient, remainder);
+        if (!remainder.isZero()) break;
+        rest = quotient;
+        count++;
+    }
+    return count;
+}
+
+template <class Number>
+static bool expandRemainder(Number remainder, const Number& divisor, size_t start, size_t maxDigits,
+                            RepeatingDecimal& result) {
+    for (size_t i = 0; i < start; i++) result.prefix.push_back(nextDigit(remainder, divisor));
+    if (isZero(remainder)) return true;
+    const Number first = remainder;
+    do {
+        if (result.prefix.size() + result.period.size() >= maxDigits) return false;
+        result.period.push_back(nextDigit(remainder, divisor));
+    } while (remainder != first);
+    return true;
+}
+
+bool findRepeatingDecimal(const Rational& value, size_t maxDigits, RepeatingDecimal& result) {
+    BigInt remainder;
+    divMod(absValue(value.numerator), value.denominator, result.integer, remainder);
+    result.negative = value.numerator.negative;
+    result.prefix.clear();
+    result.period.clear();
+    size_t start = max(factorCount(value.denominator, 2, maxDigits), factorCount(value.denominator, 5, maxDigits));
+    if (start > maxDigits) return false;
+    if (value.denominator < BigInt((long long)MAX_WORD_DIVISOR)) {
+        return expandRemainder(toWord(remainder), toWord(value.denominator), start, maxDigits, result);
+    }
+    return expandRemainder(remainder, value.denominator, start, maxDigits, result);
+}
+
+string RepeatingDecimal::toDecimalString(size_t decimalPlaces) const {
+    string digits = prefix.substr(0, decimalPlaces);
+    while (digits.size() < decimalPlaces && !period.empty()) {
+        digits.append(period, 0, min(period.size(), decimalPlaces - digits.size()));
+    }
+    while (!digits.empty() && digits.back() == '0') digits.pop_back();
+    string text = integer.toString();
+    if (!digits.empty()) text += "." + digits;
+    if (negative && text != "0") text = "-" + text;
+    return text;
+}
+
+// Small denominators whose expansion repeats within the places are
+// expanded digit by digit; the rest take one long division
+string toDecimalString(const Rational& value, int decimalPlaces) {
+    RepeatingDecimal expansion;
+    if (decimalPlaces > 0 && value.denominator < BigInt((long long)MAX_WORD_DIVISOR) &&
+        findRepeatingDecimal(value, (size_t)decimalPlaces, expansion)) {
+        return expansion.toDecimalString((size_t)decimalPlaces);
+    }
+
+    BigInt quotient, remainder;
+    divMod(absValue(value.numerator), value.denominator, quotient, remainder);
+
+    string result = quotient.toString();
+    if (!remainder.isZero() && decimalPlaces > 0) {
+        BigInt fraction = shiftDecimal(remainder, decimalPlaces) / value.denominator;
+        string digits = fraction.toString();
+        digits.insert(0, decimalPlaces - digits.length(), '0');
+        while (!digits.empty() && digits.back() == '0') digits.pop_back();
+        if (!digits.empty()) result += "." + digits;
+    }
+    if (value.numerator.negative && result != "0") result = "-" + result;
+    return result;
+}
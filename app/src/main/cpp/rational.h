@@ -0,0 +1,66 @@
+#pragma once
+#include <stdexcept>
+#include <string>
+#include "bigint.h"
+
+// Thrown when an operation has no exact rational result (irrational powers,
+// transcendental functions, complex values); exact evaluation then falls back
+// to decimal arithmetic
+class InexactError : public std::runtime_error {
+public:
+    explicit InexactError(const std::string& what) : std::runtime_error(what) {}
+};
+
+// Exact rational number kept in lowest terms with a positive denominator
+struct Rational {
+    BigInt numerator;
+    BigInt denominator;
+
+    Rational() : numerator(0), denominator(1) {}
+    Rational(const BigInt& n) : numerator(n), denominator(1) {}
+
+    // Reduces to lowest terms
+    Rational(const BigInt& n, const BigInt& d);
+
+    bool isZero() const { return numerator.isZero(); }
+    bool isInteger() const { return denominator.limbs.size() == 1 && denominator.limbs[0] == 1; }
+};
+
+// Exact conversion of a decimal string such as "-12.375" or "1.5e-30"
+Rational parseRational(const std::string& decimal);
+
+// Arithmetic; results are always in lowest terms
+Rational add(const Rational& a, const Rational& b);
+Rational subtract(const Rational& a, const Rational& b);
+Rational multiply(const Rational& a, const Rational& b);
+Rational divide(const Rational& a, const Rational& b);
+Rational power(const Rational& base, long long exponent);
+
+// Rational exponent p/q; exact only when the q-th root of both numerator and
+// denominator is an integer (4^(1/2), (8/27)^(2/3)), InexactError otherwise
+Rational power(const Rational& base, const Rational& exponent);
+
+// "p/q", or just "p" for integers
+std::string toFractionString(const Rational& value);
+
+// Decimal expansion truncated to the given number of fractional digits
+std::string toDecimalString(const Rational& value, int decimalPlaces);
+
+// Exact decimal expansion of a rational: after the point come the prefix
+// digits once, then the period repeated forever (empty when the decimal
+// terminates). 1/6 is 0.1 then 6 repeated, 1/7 is 0. then 142857 repeated
+struct RepeatingDecimal {
+    bool negative = false;
+    BigInt integer;         // Integer part of the magnitude
+    std::string prefix;
+    std::string period;
+
+    // As toDecimalString(), with the digits taken from the period
+    std::string toDecimalString(size_t decimalPlaces) const;
+};
+
+// Long division that stops as soon as the remainder comes round again. The
+// period starts once the 2s and 5s of the denominator are used up, so only
+// that one remainder is compared. False when prefix and period together
+// would be longer than maxDigits
+bool findRepeatingDecimal(const Rational& value, size_t maxDigits, RepeatingDecimal& result);
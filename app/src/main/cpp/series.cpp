@@ -0,0 +1,794 @@
+#include "series.h"
+#include "calc.h"
+#include "cancellation.h"
+#include "complex_math.h"
+#include "evaluator.h"
+#include "integer_functions.h"
+#include "optimizer.h"
+#include "parsing.h"
+#include "work_stealing.h"
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include <android/log.h>
+
+#define LOG_TAG "CalculatorSeries"
+#define LOGD(...) __android_log_print(ANDROID_LOG_DEBUG, LOG_TAG, __VA_ARGS__)
+
+using namespace std;
+
+// Bounds have at most ten digits, as on the fx-991ES
+static const long long MAX_BOUND = 9999999999LL;
+
+// Terms one task evaluates and folds before its result joins the tree. Fixed,
+// so the grouping (and with it every rounding) is the same on any device
+static const long long CHUNK_TERMS = 2048;
+
+// Exact term-by-term sums of fractions grow too fast to go further
+static const long long MAX_EXACT_TERMS = 10000;
+
+// Exact powers of a constant body
+static const long long MAX_EXACT_EXPONENT = 100000;
+
+// Degree limit of the polynomials the analysis follows
+static const int MAX_DEGREE = 32;
+
+// Exponents of the loop variable's polynomials the analysis expands
+static const long long MAX_SHAPE_EXPONENT = 64;
+
+// Digits binary splitting may build in its products; beyond them the series
+// is evaluated term by term. Exact results are kept smaller, since reducing
+// the final fraction costs a quadratic GCD
+static const double MAX_SPLIT_DIGITS = 2e6;
+static const double MAX_EXACT_SPLIT_DIGITS = 2e4;
+
+// Binary splitting forks the left half of ranges at least this long
+static const long long PARALLEL_SPLIT_TERMS = 4096;
+
+// Extra digits carried by the splitting quotient and its cut-off
+static const size_t GUARD_DIGITS = 8;
+
+// Leading zero terms skipped to find a first term to scale the ratios by
+static const int MAX_LEADING_ZEROS = 8;
+
+static const char* seriesName(const Series& series) {
+    return series.product ? "Π" : "Σ";
+}
+
+static long long seriesBound(const Series& series, const Rational& value) {
+    if (!value.isInteger()) throw domain_error(string(seriesName(series)) + " bounds must be integers");
+    if (compareMagnitude(value.numerator, BigInt(MAX_BOUND)) > 0) {
+        throw domain_error(string(seriesName(series)) + " bounds must have at most ten digits");
+    }
+    return stoll(value.numerator.toString());
+}
+
+static long long seriesBound(const Series& series, const ComplexNumber& value) {
+    if (!value.isReal()) throw domain_error(string(seriesName(series)) + " bounds must be integers");
+    return seriesBound(series, parseRational(value.real));
+}
+
+void markSeriesInputs(const Series& series, bool reads[SLOT_COUNT]) {
+    bool own[SLOT_COUNT] = {};
+    for (const Token& token : series.body) {
+        if (token.slot >= 0) own[token.slot] = true;
+        if (token.series) markSeriesInputs(*token.series, own);
+    }
+    own[series.variable] = false;
+    for (int slot = 0; slot < SLOT_COUNT; slot++) {
+        if (own[slot]) reads[slot] = true;
+    }
+}
+
+// ---- Shape of the body -----------------------------------------------------
+
+// Coefficients of a polynomial in the loop variable k, lowest power first
+using Polynomial = vector<Rational>;
+
+static void trim(Polynomial& p) {
+    while (p.size() > 1 && p.back().isZero()) p.pop_back();
+}
+
+static int degree(const Polynomial& p) {
+    return (int)p.size() - 1;
+}
+
+static Polynomial add(const Polynomial& a, const Polynomial& b, bool negateB) {
+    Polynomial sum(max(a.size(), b.size()));
+    for (size_t i = 0; i < sum.size(); i++) {
+        Rational x = i < a.size() ? a[i] : Rational();
+        Rational y = i < b.size() ? b[i] : Rational();
+        sum[i] = negateB ? subtract(x, y) : add(x, y);
+    }
+    trim(sum);
+    return sum;
+}
+
+static Polynomial multiply(const Polynomial& a, const Polynomial& b) {
+    Polynomial product(a.size() + b.size() - 1);
+    for (size_t i = 0; i < a.size(); i++) {
+        if (a[i].isZero()) continue;
+        for (size_t j = 0; j < b.size(); j++) product[i + j] = add(product[i + j], multiply(a[i], b[j]));
+    }
+    trim(product);
+    return product;
+}
+
+static Polynomial power(const Polynomial& p, long long exponent) {
+    Polynomial result{Rational(BigInt(1))};
+    for (long long i = 0; i < exponent; i++) result = multiply(result, p);
+    return result;
+}
+
+// p(k + 1), by Taylor shift
+static Polynomial shifted(Polynomial p) {
+    int n = degree(p);
+    for (int i = 0; i < n; i++) {
+        for (int j = n - 1; j >= i; j--) p[j] = add(p[j], p[j + 1]);
+    }
+    return p;
+}
+
+// What the analysis knows of a subexpression as a function of the loop
+// variable k. Constants are polynomials of degree 0 with ratio 1; a known
+// polynomial p is hypergeometric with ratio p(k+1)/p(k)
+struct Shape {
+    bool varies = false;        // Depends on k
+    bool polynomial = true;     // Polynomial in k of at most `degree`
+    int degree = 0;
+    bool known = false;         // coefficients holds the exact polynomial
+    Polynomial coefficients;
+    bool hypergeometric = true; // t(k+1)/t(k) = up(k)/down(k)
+    Polynomial up{Rational(BigInt(1))};
+    Polynomial down{Rational(BigInt(1))};
+
+    bool isConstant(const Rational& value) const {
+        return known && !varies && coefficients.size() == 1 &&
+               subtract(coefficients[0], value).isZero();
+    }
+};
+
+static Shape constantShape(const Rational* value) {
+    Shape shape;
+    if (value != nullptr) {
+        shape.known = true;
+        shape.coefficients = Polynomial{*value};
+    }
+    return shape;
+}
+
+static Shape otherShape() {
+    Shape shape;
+    shape.varies = true;
+    shape.polynomial = false;
+    shape.hypergeometric = false;
+    return shape;
+}
+
+static Shape polynomialShape(const Polynomial& p) {
+    Shape shape;
+    shape.known = true;
+    shape.coefficients = p;
+    shape.degree = degree(p);
+    shape.varies = shape.degree > 0;
+    if (shape.varies) {
+        shape.up = shifted(p);
+        shape.down = p;
+    }
+    return shape;
+}
+
+static bool ratioFits(const Polynomial& up, const Polynomial& down) {
+    return degree(up) <= MAX_DEGREE && degree(down) <= MAX_DEGREE;
+}
+
+static Shape sumShape(const Shape& a, const Shape& b, bool difference) {
+    if (a.known && b.known) return polynomialShape(add(a.coefficients, b.coefficients, difference));
+    if (b.isConstant(Rational())) return a;
+    if (!a.varies && !b.varies) return constantShape(nullptr);
+    if (!a.polynomial || !b.polynomial) return otherShape();
+    // A polynomial with coefficients only known as decimals
+    Shape shape = otherShape();
+    shape.polynomial = true;
+    shape.degree = max(a.degree, b.degree);
+    return shape;
+}
+
+static Shape productShape(const Shape& a, const Shape& b, bool quotient) {
+    if (quotient && b.isConstant(Rational())) return otherShape(); // Left to the evaluator to report
+    if (a.known && b.known && (quotient ? !b.varies : a.degree + b.degree <= MAX_DEGREE)) {
+        if (!quotient) return polynomialShape(multiply(a.coefficients, b.coefficients));
+        Polynomial scaled = a.coefficients;
+        for (Rational& c : scaled) c = divide(c, b.coefficients[0]);
+        return polynomialShape(scaled);
+    }
+    Shape shape = otherShape();
+    shape.varies = a.varies || b.varies;
+    if (a.polynomial && b.polynomial && (!quotient || !b.varies) &&
+        (quotient ? a.degree : a.degree + b.degree) <= MAX_DEGREE) {
+        shape.polynomial = true;
+        shape.degree = quotient ? a.degree : a.degree + b.degree;
+    }
+    if (a.hypergeometric && b.hypergeometric) {
+        Polynomial up = multiply(a.up, quotient ? b.down : b.up);
+        Polynomial down = multiply(a.down, quotient ? b.up : b.down);
+        if (ratioFits(up, down)) {
+            shape.hypergeometric = true;
+            shape.up = std::move(up);
+            shape.down = std::move(down);
+        }
+    }
+    return shape;
+}
+
+static Shape powerShape(const Shape& a, const Shape& b) {
+    // Integer exponents: polynomials stay polynomials, ratios are powered
+    if (!b.varies && b.known && b.coefficients[0].isInteger() &&
+        compareMagnitude(b.coefficients[0].numerator, BigInt(MAX_SHAPE_EXPONENT)) <= 0) {
+        long long n = stoll(b.coefficients[0].numerator.toString());
+        if (a.known && (n >= 0 || !a.varies)) {
+            if (!a.varies) {
+                if (a.coefficients[0].isZero() && n < 0) return otherShape();
+                Rational value = power(a.coefficients[0], n);
+                return constantShape(&value);
+            }
+            if (a.degree * n <= MAX_DEGREE) return polynomialShape(power(a.coefficients, n));
+        }
+        Shape shape = otherShape();
+        shape.varies = a.varies;
+        if (a.polynomial && n >= 0 && a.degree * n <= MAX_DEGREE) {
+            shape.polynomial = true;
+            shape.degree = a.degree * (int)n;
+        }
+        long long m = n < 0 ? -n : n;
+        if (a.hypergeometric && (degree(a.up) * m <= MAX_DEGREE && degree(a.down) * m <= MAX_DEGREE)) {
+            shape.hypergeometric = true;
+            shape.up = power(n < 0 ? a.down : a.up, m);
+            shape.down = power(n < 0 ? a.up : a.down, m);
+        }
+        return shape;
+    }
+    // c^(s k + r) with a rational c and an integer step s: ratio c^s
+    if (!a.varies && a.known && !a.coefficients[0].isZero() && b.known && b.degree == 1 &&
+        b.coefficients[1].isInteger() &&
+        compareMagnitude(b.coefficients[1].numerator, BigInt(MAX_SHAPE_EXPONENT)) <= 0) {
+        Shape shape = otherShape();
+        shape.hypergeometric = true;
+        shape.up = Polynomial{power(a.coefficients[0], stoll(b.coefficients[1].numerator.toString()))};
+        shape.down = Polynomial{Rational(BigInt(1))};
+        return shape;
+    }
+    return a.varies || b.varies ? otherShape() : constantShape(nullptr);
+}
+
+// (s k + r)! for positive integer s: ratio (s k + r + 1) ... (s k + r + s)
+static Shape factorialShape(const Shape& a) {
+    if (!a.varies) return constantShape(nullptr);
+    if (!a.known || a.degree != 1 || !a.coefficients[0].isInteger() || !a.coefficients[1].isInteger() ||
+        a.coefficients[1].numerator.negative ||
+        compareMagnitude(a.coefficients[1].numerator, BigInt(MAX_DEGREE)) > 0) {
+        return otherShape();
+    }
+    Shape shape = otherShape();
+    long long step = stoll(a.coefficients[1].numerator.toString());
+    Polynomial up{Rational(BigInt(1))};
+    for (long long j = 1; j <= step; j++) {
+        up = multiply(up, Polynomial{add(a.coefficients[0], Rational(BigInt(j))), a.coefficients[1]});
+    }
+    shape.hypergeometric = true;
+    shape.up = std::move(up);
+    return shape;
+}
+
+// Operands that are opaque to the analysis: constant if none varies
+static Shape opaqueShape(const vector<Shape>& operands) {
+    for (const Shape& operand : operands) {
+        if (operand.varies) return otherShape();
+    }
+    return constantShape(nullptr);
+}
+
+static Shape analyze(const Series& series, const SlotTable& table) {
+    vector<Shape> stack;
+    for (const Token& token : series.body) {
+        if (token.type == NUMBER) {
+            try {
+                Rational value = parseRational(token.value);
+                stack.push_back(constantShape(&value));
+            } catch (const exception&) {
+                stack.push_back(constantShape(nullptr));
+            }
+            continue;
+        }
+        if (token.type == VARIABLE) {
+            if (token.slot == series.variable) {
+                stack.push_back(polynomialShape(Polynomial{Rational(), Rational(BigInt(1))}));
+            } else if (token.slot >= 0 && table.hasExact[token.slot]) {
+                stack.push_back(constantShape(&table.exact[token.slot]));
+            } else {
+                stack.push_back(constantShape(nullptr));
+            }
+            continue;
+        }
+
+        size_t arity = token.type == OPERATOR ? 2 : (size_t)max(functionArity(token.value), 1);
+        if (stack.size() < arity) return otherShape(); // Malformed; evaluation reports it
+        vector<Shape> operands(stack.end() - arity, stack.end());
+        stack.resize(stack.size() - arity);
+
+        const string& name = token.value;
+        if (token.series) {
+            bool reads[SLOT_COUNT] = {};
+            markSeriesInputs(*token.series, reads);
+            stack.push_back(reads[series.variable] ? otherShape() : opaqueShape(operands));
+        } else if (name == "+" || name == "-") {
+            stack.push_back(sumShape(operands[0], operands[1], name == "-"));
+        } else if (name == "*" || name == "/" || name == "÷") {
+            stack.push_back(productShape(operands[0], operands[1], name != "*"));
+        } else if (name == "^" || name == "**") {
+            stack.push_back(powerShape(operands[0], operands[1]));
+        } else if (name == "!") {
+            stack.push_back(factorialShape(operands[0]));
+        } else if (name == "inv") {
+            Rational one(BigInt(1));
+            stack.push_back(productShape(constantShape(&one), operands[0], true));
+        } else {
+            stack.push_back(opaqueShape(operands));
+        }
+    }
+    return stack.size() == 1 ? stack.back() : otherShape();
+}
+
+// ---- Terms -----------------------------------------------------------------
+
+// The session's slots, or cleared memory when there is no session
+static SlotTable bindings(const SlotTable* slots) {
+    if (slots != nullptr) return *slots;
+    SlotTable table;
+    for (int slot = 0; slot < SLOT_COUNT; slot++) table.assign(slot, ComplexNumber("0"), Rational());
+    return table;
+}
+
+static ComplexNumber decimalTerm(const Series& series, CompiledProgram& program, SlotTable& table, long long k) {
+    table.assign(series.variable, ComplexNumber(to_string(k)), Rational(BigInt(k)));
+    return program.evaluate(&table);
+}
+
+static Rational exactTerm(const Series& series, SlotTable& table, long long k) {
+    table.assign(series.variable, ComplexNumber(to_string(k)), Rational(BigInt(k)));
+    return evaluatePostfixExact(series.body, &table);
+}
+
+static bool isZero(const ComplexNumber& value) {
+    return value.isReal() && value.real.find_first_not_of("-.0") == string::npos;
+}
+
+static ComplexNumber addTerms(const ComplexNumber& a, const ComplexNumber& b) { return addComplex(a, b); }
+static Rational addTerms(const Rational& a, const Rational& b) { return add(a, b); }
+static ComplexNumber subtractTerms(const ComplexNumber& a, const ComplexNumber& b) { return subtractComplex(a, b); }
+static Rational subtractTerms(const Rational& a, const Rational& b) { return subtract(a, b); }
+static ComplexNumber multiplyTerms(const ComplexNumber& a, const ComplexNumber& b) { return multiplyComplex(a, b); }
+static Rational multiplyTerms(const Rational& a, const Rational& b) { return multiply(a, b); }
+static ComplexNumber multiplyTerms(const ComplexNumber& a, const BigInt& b) { return multiplyComplex(a, ComplexNumber(b.toString())); }
+static Rational multiplyTerms(const Rational& a, const BigInt& b) { return multiply(a, Rational(b)); }
+
+// Runs task(0) ... task(count - 1), spread over the pool when it has
+// workers; forked tasks keep the caller's precision and cancellation
+template <typename Task>
+static void forEachIndex(size_t count, const Task& task) {
+    WorkStealingPool& pool = workStealingPool();
+    if (count < 2 || pool.workerCount() == 0) {
+        for (size_t i = 0; i < count; i++) task(i);
+        return;
+    }
+    size_t precision = workingPrecision();
+    AngleUnit unit = angleUnit();
+    CancellationToken* token = currentCancellationToken();
+    TaskGroup group(pool);
+    for (size_t i = 1; i < count; i++) {
+        group.spawn([&task, i, precision, unit, token] {
+            PrecisionScope precisionScope(precision);
+            AngleUnitScope angleUnitScope(unit);
+            CancellationScope cancellationScope(token);
+            task(i);
+        });
+    }
+    task(0);
+    group.wait();
+}
+
+// Terms first..last folded chunk by chunk: fold(a, b) evaluates and combines
+// the terms a..b with state of its own, on whichever thread runs the chunk.
+// Chunk results are then combined pairwise, a level of the tree at a time
+template <typename Value, typename Fold, typename Combine>
+static Value reduceTerms(long long first, long long last, const Fold& fold, const Combine& combine) {
+    size_t chunks = (size_t)((last - first) / CHUNK_TERMS + 1);
+    vector<Value> partial(chunks);
+    forEachIndex(chunks, [&](size_t c) {
+        long long a = first + (long long)c * CHUNK_TERMS;
+        partial[c] = fold(a, min(last, a + CHUNK_TERMS - 1));
+    });
+    for (size_t width = 1; width < chunks; width *= 2) {
+        size_t pairs = (chunks - width + 2 * width - 1) / (2 * width);
+        forEachIndex(pairs, [&](size_t p) {
+            size_t i = p * 2 * width;
+            partial[i] = combine(partial[i], partial[i + width]);
+        });
+    }
+    return std::move(partial[0]);
+}
+
+// Values with a fractional part rounded to the given significant digits.
+// Partial sums of decimal terms keep their places, but a product of n of them
+// would carry n times as many; sums and products of integers stay exact
+static ComplexNumber roundedFraction(const ComplexNumber& value, size_t digits) {
+    bool fraction = value.real.find('.') != string::npos ||
+                    (!value.isReal() && value.imaginary.find('.') != string::npos);
+    if (!fraction || value.real.size() + (value.isReal() ? 0 : value.imaginary.size()) <= digits) return value;
+    ComplexFloat z = toComplexFloat(value);
+    if (max(z.real.mantissa.digitCount(), z.imaginary.mantissa.digitCount()) <= digits) return value;
+    return toComplexNumber(z, digits);
+}
+
+// A term at the working precision in effect, from its exact value while the
+// body has one (1/X, 12/X): that is quicker than the decimal quotients and
+// spares them the cache. Once a term has none (X^0.5 at 2), the rest go
+// straight to the decimal evaluation, which is as precise, only slower
+static ComplexNumber guardedTerm(const Series& series, CompiledProgram& program, SlotTable& table, long long k,
+                                 bool& tryExact) {
+    if (!tryExact) return decimalTerm(series, program, table, k);
+    Rational value;
+    try {
+        value = exactTerm(series, table, k);
+    } catch (const InexactError&) {
+        tryExact = false;
+        return decimalTerm(series, program, table, k);
+    }
+    if (value.isInteger()) return ComplexNumber(value.numerator.toString());
+    BigFloat quotient = divide(BigFloat(value.numerator), BigFloat(value.denominator), workingPrecision());
+    return ComplexNumber(formatBigFloat(quotient));
+}
+
+static ComplexNumber evaluateTerms(const Series& series, long long first, long long last, const SlotTable& table) {
+    if (last - first + 1 > MAX_SERIES_TERMS) {
+        throw overflow_error(string(seriesName(series)) + " of more than 10^7 terms without a closed form");
+    }
+    LOGD("%s over %lld terms, term by term", seriesName(series), last - first + 1);
+    size_t precision = workingPrecision();
+    size_t working = precision + GUARD_DIGITS;
+    auto combine = [&series, working](const ComplexNumber& a, const ComplexNumber& b) {
+        if (!series.product) return addTerms(a, b);
+        return roundedFraction(multiplyTerms(a, b), working);
+    };
+    ComplexNumber result;
+    {
+        // Every term - each quotient and function in it - is rounded at the
+        // guard precision, so a million roundings stay below the last digit
+        PrecisionScope scope(working);
+        result = reduceTerms<ComplexNumber>(first, last, [&](long long a, long long b) {
+            CompiledProgram program(series.body);
+            SlotTable own = table;
+            bool tryExact = true;
+            ComplexNumber value = guardedTerm(series, program, own, a, tryExact);
+            for (long long k = a + 1; k <= b; k++) {
+                value = combine(value, guardedTerm(series, program, own, k, tryExact));
+            }
+            return value;
+        }, combine);
+    }
+    return roundedFraction(result, precision);
+}
+
+static Rational evaluateTermsExact(const Series& series, long long first, long long last, const SlotTable& table) {
+    if (last - first + 1 > MAX_EXACT_TERMS) throw InexactError("too many terms for an exact series");
+    auto combine = [&series](const Rational& a, const Rational& b) {
+        return series.product ? multiplyTerms(a, b) : addTerms(a, b);
+    };
+    return reduceTerms<Rational>(first, last, [&](long long a, long long b) {
+        SlotTable own = table;
+        Rational value = exactTerm(series, own, a);
+        for (long long k = a + 1; k <= b; k++) value = combine(value, exactTerm(series, own, k));
+        return value;
+    }, combine);
+}
+
+// Σ of a polynomial of at most the given degree from its values at
+// first..first+degree: Newton's forward differences, Σ Δ^j t(first) C(count, j+1)
+template <typename Value, typename Term>
+static Value polynomialSum(int degree, long long first, long long count, const Term& term) {
+    vector<Value> differences;
+    for (int i = 0; i <= degree; i++) differences.push_back(term(first + i));
+    Value sum = multiplyTerms(differences[0], BigInt(count));
+    for (int j = 1; j <= degree; j++) {
+        for (int i = 0; i + j <= degree; i++) differences[i] = subtractTerms(differences[i + 1], differences[i]);
+        sum = addTerms(sum, multiplyTerms(differences[0], combinations(BigInt(count), BigInt(j + 1))));
+    }
+    return sum;
+}
+
+// ---- Binary splitting --------------------------------------------------------
+
+// Polynomial with integer coefficients evaluated exactly at integers, in
+// machine words while the value is small enough
+struct IntegerPolynomial {
+    vector<BigInt> coefficients;    // Lowest power first
+    vector<double> approximate;
+    vector<long long> small;        // Empty unless every coefficient fits
+
+    explicit IntegerPolynomial(const vector<BigInt>& c) : coefficients(c) {
+        bool fits = true;
+        for (const BigInt& coefficient : c) {
+            approximate.push_back(stod(coefficient.toString()));
+            fits = fits && coefficient.limbs.size() <= 1;
+        }
+        if (fits) {
+            for (const BigInt& coefficient : c) small.push_back(stoll(coefficient.toString()));
+        }
+    }
+
+    double estimate(long long x) const {
+        double value = 0;
+        for (size_t i = approximate.size(); i-- > 0;) value = value * (double)x + approximate[i];
+        return value;
+    }
+
+    BigInt at(long long x) const {
+        if (!small.empty()) {
+            // Every partial Horner sum is bounded by the sum of |c_i| |x|^i
+            double bound = 0;
+            for (size_t i = approximate.size(); i-- > 0;) bound = bound * fabs((double)x) + fabs(approximate[i]);
+            if (bound < 4e18) {
+                __int128 value = 0;
+                for (size_t i = small.size(); i-- > 0;) value = value * x + small[i];
+                return BigInt((long long)value);
+            }
+        }
+        BigInt value, point(x);
+        for (size_t i = coefficients.size(); i-- > 0;) value = value * point + coefficients[i];
+        return value;
+    }
+
+    int degree() const { return (int)coefficients.size() - 1; }
+};
+
+// A ratio turned out to be zero or undefined at an integer of the range
+struct RatioUndefined {};
+
+// up/down scaled to integer coefficients
+static void integerRatio(const Shape& shape, vector<BigInt>& up, vector<BigInt>& down) {
+    BigInt scale(1);
+    for (const Rational& c : shape.up) scale = lcm(scale, c.denominator);
+    for (const Rational& c : shape.down) scale = lcm(scale, c.denominator);
+    for (const Rational& c : shape.up) up.push_back(c.numerator * (scale / c.denominator));
+    for (const Rational& c : shape.down) down.push_back(c.numerator * (scale / c.denominator));
+}
+
+// Products of r(j) = up(j)/down(j) over ratios [a, b): p = Π up(j),
+// q = Π down(j), and t/q = r(a) + r(a) r(a+1) + ... + r(a) ... r(b-1)
+struct Splitting {
+    BigInt p, q, t;
+};
+
+static Splitting split(const IntegerPolynomial& up, const IntegerPolynomial& down, long long a, long long b,
+                       bool needP) {
+    if (b - a == 1) {
+        Splitting leaf;
+        leaf.p = up.at(a);
+        leaf.q = down.at(a);
+        if (leaf.p.isZero() || leaf.q.isZero()) throw RatioUndefined();
+        leaf.t = leaf.p;
+        return leaf;
+    }
+    long long middle = a + (b - a) / 2;
+    Splitting left, right;
+    if (b - a >= PARALLEL_SPLIT_TERMS && workStealingPool().workerCount() > 0) {
+        size_t precision = workingPrecision();
+        CancellationToken* token = currentCancellationToken();
+        TaskGroup group(workStealingPool());
+        group.spawn([&, precision, token] {
+            PrecisionScope precisionScope(precision);
+            CancellationScope cancellationScope(token);
+            left = split(up, down, a, middle, true);
+        });
+        right = split(up, down, middle, b, needP);
+        group.wait();
+    } else {
+        checkCancelled();
+        left = split(up, down, a, middle, true);
+        right = split(up, down, middle, b, needP);
+    }
+    // t/q of [a, b) = t1/q1 + (p1/q1) (t2/q2)
+    Splitting merged;
+    merged.t = left.t * right.q + left.p * right.t;
+    merged.q = left.q * right.q;
+    if (needP) merged.p = left.p * right.p;
+    return merged;
+}
+
+// Ratios [first, end) that binary splitting has to multiply out, from a scan
+// in doubles. With `digits` > 0 a series whose ratio tends to a limit L < 1
+// is cut where its terms fall that many digits below the largest one, once
+// the ratio is at most (1 + L)/2: the rest is then a geometric tail of at
+// most `tail` times the last term kept. False when a ratio in the range is
+// zero or undefined or the products would need more than maxDigits digits.
+// `largest` is log10 of the largest term over the first
+static bool planSplitting(const IntegerPolynomial& up, const IntegerPolynomial& down, long long first,
+                          long long last, double digits, double maxDigits, long long& end, double& largest) {
+    bool convergent = false;
+    double bound = 0, tail = 0;
+    if (digits > 0) {
+        double limit = up.degree() < down.degree() ? 0
+                     : up.degree() == down.degree() ? fabs(up.approximate.back() / down.approximate.back()) : 2;
+        convergent = limit < 1;
+        bound = (1 + limit) / 2;
+        tail = log10(bound / (1 - bound));
+    }
+    double logTerm = 0, used = 0;
+    largest = 0;
+    end = last;
+    for (long long j = first; j < last; j++) {
+        if (((j - first) & 0xFFFF) == 0) checkCancelled();
+        double p = up.estimate(j), q = down.estimate(j);
+        if (p == 0 || q == 0 || !isfinite(p) || !isfinite(q)) return false;
+        used += log10(fabs(p)) + log10(fabs(q));
+        if (used > maxDigits) return false;
+        double ratio = fabs(p / q);
+        logTerm += log10(ratio);
+        largest = max(largest, logTerm);
+        if (convergent && ratio <= bound && logTerm + tail < largest - digits) {
+            end = j + 1;
+            break;
+        }
+    }
+    return true;
+}
+
+// (1 + Σ of the ratio products over [first, end)) as numerator/denominator
+static void ratioSum(const IntegerPolynomial& up, const IntegerPolynomial& down, long long first, long long end,
+                     BigInt& numerator, BigInt& denominator) {
+    if (end <= first) {
+        numerator = denominator = BigInt(1);
+        return;
+    }
+    Splitting s = split(up, down, first, end, false);
+    numerator = s.q + s.t;
+    denominator = s.q;
+}
+
+// Σ t(k) = t(first) (1 + r(first) + r(first) r(first+1) + ...), with the
+// ratio products summed as one fraction. False if the series does not
+// qualify after all; the caller then evaluates it term by term
+static bool splitSum(const Series& series, const Shape& shape, long long first, long long last,
+                     const SlotTable& table, ComplexNumber& sum) {
+    CompiledProgram program(series.body);
+    SlotTable own = table;
+    ComplexNumber leading = decimalTerm(series, program, own, first);
+    for (int skipped = 0; isZero(leading) && first < last; skipped++) {
+        if (skipped == MAX_LEADING_ZEROS) return false;
+        leading = decimalTerm(series, program, own, ++first);
+    }
+    if (isZero(leading)) {
+        sum = leading;
+        return true;
+    }
+
+    vector<BigInt> upCoefficients, downCoefficients;
+    integerRatio(shape, upCoefficients, downCoefficients);
+    IntegerPolynomial up(upCoefficients), down(downCoefficients);
+    size_t precision = workingPrecision();
+    double digits = (double)(precision + GUARD_DIGITS);
+    try {
+        for (int attempt = 0;; attempt++) {
+            long long end;
+            double largest;
+            if (!planSplitting(up, down, first, last, digits, MAX_SPLIT_DIGITS, end, largest)) return false;
+            BigInt numerator, denominator;
+            ratioSum(up, down, first, end, numerator, denominator);
+            if (end == last) {
+                // Sums of integer terms stay exact, as integer arithmetic does
+                BigInt whole, remainder;
+                divMod(numerator, denominator, whole, remainder);
+                if (remainder.isZero()) {
+                    sum = multiplyComplex(leading, ComplexNumber(whole.toString()));
+                    return true;
+                }
+            }
+            BigFloat quotient = divide(BigFloat(numerator), BigFloat(denominator), precision + GUARD_DIGITS);
+            // Terms that cancel leave fewer significant digits than were kept:
+            // cut off that much later once more
+            double lost = quotient.isZero() ? digits : largest - (double)decimalMagnitude(quotient);
+            if (end == last || lost < 1 || attempt == 1) {
+                LOGD("%s by binary splitting of %lld of %lld terms", seriesName(series), end - first + 1,
+                     last - first + 1);
+                sum = toComplexNumber(multiply(toComplexFloat(leading), ComplexFloat(quotient)), precision);
+                return true;
+            }
+            digits += lost;
+        }
+    } catch (const RatioUndefined&) {
+        return false;
+    }
+}
+
+static bool splitSumExact(const Series& series, const Shape& shape, long long first, long long last,
+                          const SlotTable& table, Rational& sum) {
+    SlotTable own = table;
+    Rational leading = exactTerm(series, own, first);
+    for (int skipped = 0; leading.isZero() && first < last; skipped++) {
+        if (skipped == MAX_LEADING_ZEROS) return false;
+        leading = exactTerm(series, own, ++first);
+    }
+    if (leading.isZero()) {
+        sum = leading;
+        return true;
+    }
+
+    vector<BigInt> upCoefficients, downCoefficients;
+    integerRatio(shape, upCoefficients, downCoefficients);
+    IntegerPolynomial up(upCoefficients), down(downCoefficients);
+    long long end;
+    double largest;
+    if (!planSplitting(up, down, first, last, 0, MAX_EXACT_SPLIT_DIGITS, end, largest)) return false;
+    try {
+        BigInt numerator, denominator;
+        ratioSum(up, down, first, end, numerator, denominator);
+        sum = multiply(leading, Rational(numerator, denominator));
+        return true;
+    } catch (const RatioUndefined&) {
+        return false;
+    }
+}
+
+// ---- Entry points --------------------------------------------------------------
+
+ComplexNumber evaluateSeries(const Series& series, const ComplexNumber& firstValue, const ComplexNumber& lastValue,
+                             const SlotTable* slots) {
+    long long first = seriesBound(series, firstValue), last = seriesBound(series, lastValue);
+    if (first > last) throw domain_error(string(seriesName(series)) + " needs a lower bound at most the upper one");
+    long long count = last - first + 1;
+    SlotTable table = bindings(slots);
+    Shape shape = analyze(series, table);
+
+    if (series.product) {
+        if (!shape.varies) {
+            CompiledProgram program(series.body);
+            return powerComplex(decimalTerm(series, program, table, first), ComplexNumber(to_string(count)));
+        }
+        return evaluateTerms(series, first, last, table);
+    }
+    if (shape.polynomial && count > shape.degree + 1) {
+        LOGD("Σ of a polynomial of degree %d over %lld terms", shape.degree, count);
+        CompiledProgram program(series.body);
+        return polynomialSum<ComplexNumber>(shape.degree, first, count, [&](long long k) {
+            return decimalTerm(series, program, table, k);
+        });
+    }
+    ComplexNumber sum;
+    if (shape.hypergeometric && splitSum(series, shape, first, last, table, sum)) return sum;
+    return evaluateTerms(series, first, last, table);
+}
+
+Rational evaluateSeriesExact(const Series& series, const Rational& firstValue, const Rational& lastValue,
+                             const SlotTable* slots) {
+    long long first = seriesBound(series, firstValue), last = seriesBound(series, lastValue);
+    if (first > last) throw domain_error(string(seriesName(series)) + " needs a lower bound at most the upper one");
+    long long count = last - first + 1;
+    SlotTable table = bindings(slots);
+    Shape shape = analyze(series, table);
+
+    if (series.product) {
+        if (!shape.varies) {
+            if (count > MAX_EXACT_EXPONENT) throw InexactError("exponent too large for exact result");
+            return power(exactTerm(series, table, first), count);
+        }
+        return evaluateTermsExact(series, first, last, table);
+    }
+    if (shape.polynomial && count > shape.degree + 1) {
+        return polynomialSum<Rational>(shape.degree, first, count, [&](long long k) {
+            return exactTerm(series, table, k);
+        });
+    }
+    Rational sum;
+    if (shape.hypergeometric && splitSumExact(series, shape, first, last, table, sum)) return sum;
+    return evaluateTermsExact(series, first, last, table);
+}
@@ -0,0 +1,44 @@
+#pragma once
+#include <string>
+#include <vector>
+#include "complex_number.h"
+#include "rational.h"
+#include "session.h"
+#include "token.h"
+
+// Σ(body, X, a, b) and Π(body, X, a, b) of the fx-991ES: the body is summed or
+// multiplied over X = a, a+1, ..., b. It is parsed once into its own postfix
+// program, which a FUNCTION token carries; the bounds are the token's two
+// operands. Evaluation picks the cheapest method the body allows:
+//   - polynomial in X: closed form from d+1 values (Newton forward
+//     differences), whatever the number of terms
+//   - hypergeometric (t(X+1)/t(X) a rational function of X: X!, 2^X, x^X/X!,
+//     their products and quotients): binary splitting over exact integers,
+//     cut off where a convergent series drops below the working precision,
+//     so its cost follows the digits of the result, not the term count
+//   - anything else: terms evaluated by one compiled program per chunk,
+//     chunks spread over workStealingPool() and combined in a tree
+// Bounds must be integers with a <= b and at most ten digits, as on the
+// calculator (domain_error otherwise)
+struct Series {
+    bool product;               // Π instead of Σ
+    int variable;               // Slot of the loop variable, bound for each term
+    std::vector<Token> body;    // Postfix
+    std::string source;         // Body and variable as typed; identifies the series
+};
+
+// Terms without a closed form are evaluated one by one up to this many;
+// longer ranges throw overflow_error
+const long long MAX_SERIES_TERMS = 10000000;
+
+ComplexNumber evaluateSeries(const Series& series, const ComplexNumber& first, const ComplexNumber& last,
+                             const SlotTable* slots);
+
+// Exact sum or product; throws InexactError where evaluateSeries would be
+// needed (inexact terms, or more terms than are worth summing as fractions)
+Rational evaluateSeriesExact(const Series& series, const Rational& first, const Rational& last,
+                             const SlotTable* slots);
+
+// Marks the session slots the series reads besides its own loop variable,
+// including those of nested series
+void markSeriesInputs(const Series& series, bool reads[SLOT_COUNT]);
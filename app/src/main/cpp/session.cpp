@@ -0,0 +1,464 @@
+#include "session.h"
+#include "calc.h"
+#include "cancellation.h"
+#include "double_program.h"
+#include "evaluator.h"
+#include "history.h"
+#include "integer_functions.h"
+#include "optimizer.h"
+#include "parsing.h"
+#include "progressive.h"
+#include "snapshot.h"
+#include "trace.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <android/log.h>
+
+#define LOG_TAG "CalculatorSession"
+#define LOGD(...) __android_log_print(ANDROID_LOG_DEBUG, LOG_TAG, __VA_ARGS__)
+
+using namespace std;
+
+static const char* const slotNames[SLOT_COUNT] = {
+    "A", "B", "C", "D", "E", "F", "X", "Y", "M", "Ans"
+};
+
+int resolveVariableSlot(const string& name) {
+    for (int slot = 0; slot < SLOT_COUNT; slot++) {
+        if (name == slotNames[slot]) return slot;
+    }
+    return -1;
+}
+
+const char* variableSlotName(int slot) {
+    if (slot < 0 || slot >= SLOT_COUNT) {
+        throw out_of_range("Invalid variable slot: " + to_string(slot));
+    }
+    return slotNames[slot];
+}
+
+void SlotTable::assign(int slot, const ComplexNumber& value) {
+    values[slot] = value;
+    hasExact[slot] = false;
+    if (value.isReal()) {
+        try {
+            // Finite decimals are exactly representable
+            exact[slot] = parseRational(value.real);
+            hasExact[slot] = true;
+        } catch (const exception&) {
+            // Not a plain decimal, only the native value is kept
+        }
+    }
+}
+
+void SlotTable::assign(int slot, const ComplexNumber& value, const Rational& exactValue) {
+    values[slot] = value;
+    exact[slot] = exactValue;
+    hasExact[slot] = true;
+}
+
+CalcSession::CalcSession()
+    : exactMode(false), ansIsExact(false), unit(ANGLE_RADIANS), budget(DEFAULT_BUDGET),
+      history(new SessionHistory()) {
+    clear();
+}
+
+CalcSession::~CalcSession() = default;
+
+// Compiling does not touch session state, so only the cache lookups are
+// locked. A program found in the snapshot skips parsing; the DAG is still
+// built from its postfix form
+shared_ptr<CompiledProgram> CalcSession::compile(const string& expression) {
+    shared_ptr<const SnapshotFile> stored;
+    {
+        lock_guard<std::mutex> lock(mutex);
+        for (size_t i = 0; i < recentPrograms.size(); i++) {
+            if (recentPrograms[i].expression != expression) continue;
+            auto program = recentPrograms[i].program;
+            rotate(recentPrograms.begin(), recentPrograms.begin() + i, recentPrograms.begin() + i + 1);
+            return program;
+        }
+        stored = snapshot;
+    }
+    vector<Token> postfix;
+    if (!stored || !stored->findProgram(expression, postfix)) {
+        postfix = compileExpression(expression);
+    }
+    auto program = make_shared<CompiledProgram>(postfix);
+    
+    lock_guard<std::mutex> lock(mutex);
+    // Another call may have compiled the same expression meanwhile
+    for (auto& recent : recentPrograms) {
+        if (recent.expression == expression) return recent.program;
+    }
+    recentPrograms.insert(recentPrograms.begin(), RecentProgram{expression, program, false});
+    if (recentPrograms.size() > RECENT_PROGRAMS) recentPrograms.pop_back();
+    return program;
+}
+
+// Caller holds the session lock. An operation on the session slots: it is
+// run, committed and recorded in the history
+void CalcSession::runLocked(HistoryEntry& entry) {
+    entry.exactMode = exactMode;
+    entry.angleUnit = unit;
+    history->capture(entry);
+    runHistoryEntry(entry, slots);
+    if (entry.target == SLOT_ANS) {
+        ansIsExact = entry.exactResult;
+        progressive.reset();
+    }
+    history->append(std::move(entry));
+}
+
+// Caller holds the session lock. Evaluates at the working precision
+ComplexNumber CalcSession::evaluateLocked(const string& expression, shared_ptr<CompiledProgram> program) {
+    HistoryEntry entry;
+    entry.expression = expression;
+    entry.program = program;
+    entry.digits = workingPrecision();
+    runLocked(entry);
+    markEvaluatedLocked(program);
+    LOGD("Ans = %s%s", slots.values[SLOT_ANS].toString().c_str(), ansIsExact ? " (exact)" : "");
+    return slots.values[SLOT_ANS];
+}
+
+// Caller holds the session lock. The program ran without error, so a
+// snapshot may keep it
+void CalcSession::markEvaluatedLocked(const shared_ptr<CompiledProgram>& program) {
+    for (auto& recent : recentPrograms) {
+        if (recent.program == program) recent.evaluated = true;
+    }
+}
+
+// Fractions are shown only for results that came out of exact evaluation
+string CalcSession::displayAnswerLocked() const {
+    if (exactMode && ansIsExact) {
+        return formatExact(slots.exact[SLOT_ANS], displayFormat);
+    }
+    return formatComplex(slots.values[SLOT_ANS], displayFormat);
+}
+
+ComplexNumber CalcSession::evaluate(const string& expression) {
+    shared_ptr<CompiledProgram> program = compile(expression);
+    
+    lock_guard<std::mutex> lock(mutex);
+    GovernorScope governor(budget);
+    return evaluateLocked(expression, program);
+}
+
+// Caller holds the session lock. Records the mode and every slot the
+// program reads as they are before it runs
+void CalcSession::traceInputsLocked(const CompiledProgram& program, TraceEvent& trace) const {
+    if (!trace.active()) return;
+    trace.exactMode(exactMode);
+    trace.displayFormat(displayFormat);
+    trace.angleUnit(unit);
+    bool reads[SLOT_COUNT] = {};
+    markProgramInputs(program, reads);
+    for (int slot = 0; slot < SLOT_COUNT; slot++) {
+        if (reads[slot]) trace.input(slot, slots.values[slot], slots.hasExact[slot] ? &slots.exact[slot] : nullptr);
+    }
+}
+
+string CalcSession::evaluateForDisplay(const string& expression) {
+    TraceEvent trace(TRACE_SESSION, this, expression);
+    shared_ptr<CompiledProgram> program = compile(expression);
+    trace.phase(PHASE_COMPILE);
+    
+    lock_guard<std::mutex> lock(mutex);
+    GovernorScope governor(budget);
+    traceInputsLocked(*program, trace);
+    {
+        // Only the digits the display can show are computed
+        size_t digits = displayPrecision(displayFormat);
+        PrecisionScope precision(digits > 0 ? digits : workingPrecision());
+        evaluateLocked(expression, program);
+    }
+    trace.phase(PHASE_EVALUATE);
+    string display = displayAnswerLocked();
+    trace.finish(display);
+    return display;
+}
+
+string CalcSession::evaluateProgressive(const string& expression, size_t digits) {
+    TraceEvent trace(TRACE_PROGRESSIVE, this, expression, digits);
+    shared_ptr<CompiledProgram> program = compile(expression);
+    trace.phase(PHASE_COMPILE);
+    
+    lock_guard<std::mutex> lock(mutex);
+    GovernorScope governor(budget);
+    AngleUnitScope angles(unit);
+    traceInputsLocked(*program, trace);
+    HistoryEntry entry;
+    entry.expression = expression;
+    entry.program = program;
+    entry.exactMode = exactMode;
+    entry.digits = digits;
+    entry.angleUnit = unit;
+    history->capture(entry);
+    if (evaluateHistoryExact(entry, slots)) {
+        ansIsExact = true;
+        progressive.reset();
+        LOGD("Ans = %s (exact)", toFractionString(entry.exact).c_str());
+    } else {
+        // Slots are captured now; the result is only committed to Ans once
+        // the first precision succeeded
+        auto result = make_unique<ProgressiveResult>(program, &slots);
+        slots.assign(SLOT_ANS, result->refine(digits));
+        ansIsExact = false;
+        progressive = std::move(result);
+        entry.value = slots.values[SLOT_ANS];
+        entry.exact = slots.exact[SLOT_ANS];
+        entry.hasExact = slots.hasExact[SLOT_ANS];
+        LOGD("Ans = %s (%d digits)", slots.values[SLOT_ANS].toString().c_str(), (int)digits);
+    }
+    markEvaluatedLocked(program);
+    history->append(std::move(entry));
+    trace.phase(PHASE_EVALUATE);
+    string display = displayAnswerLocked();
+    trace.finish(display);
+    return display;
+}
+
+// Traced without inputs: a replay rebuilds the progressive Ans by replaying
+// the session's earlier evaluations in order
+string CalcSession::refineAnswer(size_t digits) {
+    TraceEvent trace(TRACE_REFINE, this, string(), digits);
+    lock_guard<std::mutex> lock(mutex);
+    GovernorScope governor(budget);
+    trace.exactMode(exactMode);
+    trace.displayFormat(displayFormat);
+    trace.angleUnit(unit);
+    // Exact and full-precision answers have nothing to refine
+    if (progressive && digits > progressive->digits()) {
+        slots.assign(SLOT_ANS, progressive->refine(digits));
+        // The answer's history entry is refined with it
+        HistoryEntry* entry = history->writer(SLOT_ANS);
+        if (entry) {
+            entry->value = slots.values[SLOT_ANS];
+            entry->exact = slots.exact[SLOT_ANS];
+            entry->hasExact = slots.hasExact[SLOT_ANS];
+            entry->digits = digits;
+        }
+        LOGD("Ans refined to %d digits", (int)digits);
+    }
+    trace.phase(PHASE_EVALUATE);
+    string display = displayAnswerLocked();
+    trace.finish(display);
+    return display;
+}
+
+void CalcSession::setExactMode(bool enabled) {
+    lock_guard<std::mutex> lock(mutex);
+    exactMode = enabled;
+}
+
+void CalcSession::setDisplayFormat(const DisplayFormat& format) {
+    lock_guard<std::mutex> lock(mutex);
+    displayFormat = format;
+}
+
+void CalcSession::setAngleUnit(AngleUnit angleUnit) {
+    lock_guard<std::mutex> lock(mutex);
+    unit = angleUnit;
+}
+
+void CalcSession::setResourceBudget(const ResourceBudget& limits) {
+    lock_guard<std::mutex> lock(mutex);
+    budget = limits;
+}
+
+ComplexNumber CalcSession::get(int slot) const {
+    variableSlotName(slot); // Range check
+    lock_guard<std::mutex> lock(mutex);
+    return slots.values[slot];
+}
+
+// Values set directly are history entries too, so edits upstream of them
+// see the value the slot had at the time
+void CalcSession::set(int slot, const ComplexNumber& value) {
+    variableSlotName(slot); // Range check
+    lock_guard<std::mutex> lock(mutex);
+    HistoryEntry entry;
+    entry.operation = HISTORY_ASSIGN;
+    entry.target = slot;
+    SlotTable parsed;
+    parsed.assign(slot, value);
+    entry.value = value;
+    entry.exact = parsed.exact[slot];
+    entry.hasExact = parsed.hasExact[slot];
+    runLocked(entry);
+}
+
+void CalcSession::set(int slot, const ComplexNumber& value, const Rational& exact) {
+    variableSlotName(slot); // Range check
+    lock_guard<std::mutex> lock(mutex);
+    HistoryEntry entry;
+    entry.operation = HISTORY_ASSIGN;
+    entry.target = slot;
+    entry.value = value;
+    entry.exact = exact;
+    entry.hasExact = true;
+    entry.exactResult = true;
+    runLocked(entry);
+}
+
+void CalcSession::store(int slot) {
+    variableSlotName(slot); // Range check
+    lock_guard<std::mutex> lock(mutex);
+    HistoryEntry entry;
+    entry.operation = HISTORY_STORE;
+    entry.target = slot;
+    runLocked(entry);
+}
+
+void CalcSession::memoryAdd() {
+    lock_guard<std::mutex> lock(mutex);
+    HistoryEntry entry;
+    entry.operation = HISTORY_MEMORY_ADD;
+    entry.target = SLOT_M;
+    runLocked(entry);
+}
+
+void CalcSession::memorySubtract() {
+    lock_guard<std::mutex> lock(mutex);
+    HistoryEntry entry;
+    entry.operation = HISTORY_MEMORY_SUBTRACT;
+    entry.target = SLOT_M;
+    runLocked(entry);
+}
+
+void CalcSession::clear() {
+    lock_guard<std::mutex> lock(mutex);
+    for (int slot = 0; slot < SLOT_COUNT; slot++) {
+        slots.assign(slot, ComplexNumber("0"), Rational());
+    }
+    progressive.reset();
+    history->reset(slots);
+}
+
+size_t CalcSession::historySize() const {
+    lock_guard<std::mutex> lock(mutex);
+    return history->size();
+}
+
+string CalcSession::historyExpression(size_t index) const {
+    lock_guard<std::mutex> lock(mutex);
+    return describeHistoryEntry(history->at(index));
+}
+
+// As the answer would be displayed now, in the current display format
+string CalcSession::historyResult(size_t index) const {
+    lock_guard<std::mutex> lock(mutex);
+    const HistoryEntry& entry = history->at(index);
+    if (exactMode && entry.exactResult) return formatExact(entry.exact, displayFormat);
+    return formatComplex(entry.value, displayFormat);
+}
+
+// The new expression is compiled before the lock is taken, like any other
+vector<size_t> CalcSession::editHistory(size_t index, const string& expression) {
+    shared_ptr<CompiledProgram> program = compile(expression);
+    
+    lock_guard<std::mutex> lock(mutex);
+    GovernorScope governor(budget);
+    vector<size_t> changed = history->edit(index, expression, program, slots);
+    const HistoryEntry* answer = history->writer(SLOT_ANS);
+    if (answer && answer->id >= history->at(index).id) {
+        size_t answerIndex = index + (size_t)(answer->id - history->at(index).id);
+        if (find(changed.begin(), changed.end(), answerIndex) != changed.end()) {
+            ansIsExact = answer->exactResult;
+            progressive.reset();
+        }
+    }
+    return changed;
+}
+
+string CalcSession::displayAnswer(AnswerForm form) const {
+    lock_guard<std::mutex> lock(mutex);
+    switch (form) {
+        case ANSWER_STANDARD: return displayAnswerLocked();
+        case ANSWER_RECURRING: return ansIsExact ? formatRecurring(slots.exact[SLOT_ANS]) : string();
+        case ANSWER_DECIMAL: break;
+    }
+    return formatComplex(slots.values[SLOT_ANS], displayFormat);
+}
+
+string CalcSession::factorAnswer() const {
+    TraceEvent trace(TRACE_FACTOR, this, string());
+    Rational answer;
+    ResourceBudget limits;
+    {
+        lock_guard<std::mutex> lock(mutex);
+        limits = budget;
+        trace.exactMode(exactMode);
+        trace.input(SLOT_ANS, slots.values[SLOT_ANS], slots.hasExact[SLOT_ANS] ? &slots.exact[SLOT_ANS] : nullptr);
+        if (!slots.hasExact[SLOT_ANS]) throw domain_error("FACT requires a positive integer");
+        answer = slots.exact[SLOT_ANS];
+    }
+    // Factoring can take a while; the session stays usable meanwhile
+    if (!answer.isInteger()) throw domain_error("FACT requires a positive integer");
+    GovernorScope governor(limits);
+    vector<PrimeFactor> factors = factorize(answer.numerator);
+    trace.phase(PHASE_EVALUATE);
+    string display = formatFactorization(factors);
+    trace.finish(display);
+    return display;
+}
+
+// Shortest decimal that reads back as x, so a step of 0.1 is 0.1
+static string shortestDecimal(double x) {
+    char text[32];
+    for (int digits = 1; digits <= 17; digits++) {
+        snprintf(text, sizeof text, "%.*g", digits, x);
+        if (strtod(text, nullptr) == x) break;
+    }
+    return text;
+}
+
+vector<double> CalcSession::tabulate(const string& expression, double start, double step, size_t count) {
+    if (count > MAX_TABLE_ROWS) {
+        throw invalid_argument("Table too long: " + to_string(count) + " rows, limit " + to_string(MAX_TABLE_ROWS));
+    }
+    if (!isfinite(start) || !isfinite(step)) throw invalid_argument("Table start and step must be finite");
+    shared_ptr<CompiledProgram> program = compile(expression);
+    
+    lock_guard<std::mutex> lock(mutex);
+    GovernorScope governor(budget);
+    MemoryCharge charge(2 * count * sizeof(double));
+    vector<double> values(count);
+    unique_ptr<DoubleProgram> lowered = DoubleProgram::lower(*program, SLOT_X, &slots, unit);
+    if (lowered) {
+        vector<double> inputs(count);
+        for (size_t i = 0; i < count; i++) inputs[i] = start + (double)i * step;
+        lowered->evaluate(inputs.data(), values.data(), count);
+        LOGD("Tabulated %zu rows of %s (%s)", count, expression.c_str(), lowered->isNative() ? "native" : "interpreted");
+        return values;
+    }
+    
+    // Rows are exact decimal steps from start, as typed
+    AngleUnitScope angles(unit);
+    SlotTable table = slots;
+    BigFloat first = parseBigFloat(shortestDecimal(start));
+    BigFloat increment = parseBigFloat(shortestDecimal(step));
+    for (size_t i = 0; i < count; i++) {
+        table.assign(SLOT_X, ComplexNumber(formatBigFloat(add(first, multiply(parseBigFloat(to_string(i)), increment)))));
+        try {
+            ComplexNumber value = program->evaluate(&table);
+            values[i] = value.isReal() ? stod(value.real) : NAN;
+        } catch (const CancelledError&) {
+            throw;
+        } catch (const BudgetExceededError&) {
+            throw;
+        } catch (const exception&) {
+            values[i] = NAN;
+        }
+        if (!isfinite(values[i])) values[i] = NAN;
+    }
+    LOGD("Tabulated %zu rows of %s decimally", count, expression.c_str());
+    return values;
+}
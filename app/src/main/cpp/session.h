@@ -0,0 +1,175 @@
+#pragma once
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+#include "calc.h"
+#include "complex_number.h"
+#include "display_format.h"
+#include "governor.h"
+#include "rational.h"
+#include "token.h"
+
+// Fixed storage slots of a calculator session (fx-991ES variables, M and Ans)
+enum VariableSlot {
+    SLOT_A, SLOT_B, SLOT_C, SLOT_D, SLOT_E, SLOT_F, SLOT_X, SLOT_Y,
+    SLOT_M, SLOT_ANS, SLOT_COUNT
+};
+
+// Resolve a variable name to its slot, or -1 if it is not a session variable
+int resolveVariableSlot(const std::string& name);
+
+// Name of a slot as typed in expressions
+const char* variableSlotName(int slot);
+
+// Slot storage read by the evaluator: the native value of every slot plus, when
+// one is known, its exact rational value for exact-mode evaluation
+struct SlotTable {
+    ComplexNumber values[SLOT_COUNT];
+    Rational exact[SLOT_COUNT];
+    bool hasExact[SLOT_COUNT];
+    
+    // Store a value, deriving the exact form from its decimal digits
+    void assign(int slot, const ComplexNumber& value);
+    void assign(int slot, const ComplexNumber& value, const Rational& exactValue);
+};
+
+class CompiledProgram;
+class ProgressiveResult;
+// Forms S⇔D switches Ans between
+enum AnswerForm {
+    ANSWER_STANDARD,    // As evaluated for display: fractions in exact mode
+    ANSWER_RECURRING,   // Recurring decimal with the period overlined
+    ANSWER_DECIMAL      // Decimal in the display format
+};
+
+class SessionHistory;
+class SnapshotFile;
+class TraceEvent;
+struct HistoryEntry;
+
+// Calculator session: holds Ans, independent memory M and variables A-F, X, Y
+// as native values. Sessions share no state, so any number of them can be
+// used concurrently; a single session serializes its own calls.
+class CalcSession {
+public:
+    CalcSession();
+    ~CalcSession();
+    
+    // Evaluate an expression against this session and store the result in Ans
+    ComplexNumber evaluate(const std::string& expression);
+    
+    // Same as evaluate(), returning Ans as displayed (fractions in exact mode)
+    std::string evaluateForDisplay(const std::string& expression);
+    
+    // Anytime evaluation: Ans is computed to the given significant digits
+    // only, and refineAnswer() adds digits later without starting over.
+    // Both return Ans as displayed
+    std::string evaluateProgressive(const std::string& expression, size_t digits);
+    std::string refineAnswer(size_t digits);
+    
+    // Exact mode evaluates with rationals wherever possible and displays
+    // fractions; anything irrational or complex falls back to decimal
+    void setExactMode(bool enabled);
+    
+    // How results are displayed (Norm1, Fix 2, ...). Under any mode but
+    // DISPLAY_ALL, evaluations for display run at displayPrecision() digits
+    // and return only the visible text
+    void setDisplayFormat(const DisplayFormat& format);
+    
+    // Unit of trigonometric arguments and inverse results (radians until
+    // set). Each evaluation keeps the unit it was made in, for history
+    // edits and refinement
+    void setAngleUnit(AngleUnit unit);
+    
+    // Digit, memory and time limits of each evaluation, FACT and history
+    // edit (DEFAULT_BUDGET until set). One that goes over stops with
+    // BudgetExceededError and leaves the session as it was
+    void setResourceBudget(const ResourceBudget& budget);
+    
+    ComplexNumber get(int slot) const;
+    void set(int slot, const ComplexNumber& value);
+    
+    // Store a value with its exact form, as exact-mode results are stored
+    void set(int slot, const ComplexNumber& value, const Rational& exact);
+    
+    // STO: copy Ans into a variable slot
+    void store(int slot);
+    
+    // M+ / M-: accumulate Ans into independent memory
+    void memoryAdd();
+    void memorySubtract();
+    
+    // Reset every slot to zero and forget the history
+    void clear();
+    
+    // History of the session's evaluations, STO, M+/M- and set() values,
+    // oldest first (at most SessionHistory::CAPACITY). Expressions are shown
+    // as typed ("Ans→A" for STO), results in the current display format
+    size_t historySize() const;
+    std::string historyExpression(size_t index) const;
+    std::string historyResult(size_t index) const;
+    
+    // Replaces the expression of an earlier evaluation and recalculates
+    // only the entries that depend on it, directly or through Ans and
+    // stored variables, with the settings each was evaluated with. Slots
+    // end up as if the history had been typed in again. Nothing changes if
+    // any of them fails. Returns the indices of the entries whose value
+    // changed
+    std::vector<size_t> editHistory(size_t index, const std::string& expression);
+    
+    // Ans in an S⇔D form; empty when Ans has none (only exact answers have
+    // a recurring form, and only if it fits on the display)
+    std::string displayAnswer(AnswerForm form) const;
+    
+    // FACT: prime factorization of Ans, which must be a positive integer.
+    // Ans itself is unchanged
+    std::string factorAnswer() const;
+    
+    // TABLE: f(X) at X = start, start + step, ... for count rows, against
+    // the current variables and angle unit, leaving every slot as it was.
+    // Expressions with a double form run as machine code (DoubleProgram);
+    // the rest are evaluated decimally row by row. Undefined rows are NaN.
+    // Throws invalid_argument for a malformed expression or more than
+    // MAX_TABLE_ROWS rows
+    std::vector<double> tabulate(const std::string& expression, double start, double step, size_t count);
+    
+    static const size_t MAX_TABLE_ROWS = 1000000;
+    
+    // Most recently compiled expressions kept for reuse
+    static const size_t RECENT_PROGRAMS = 8;
+    
+private:
+    friend bool saveSnapshot(const std::string& path, const CalcSession& session);
+    friend bool loadSnapshot(const std::string& path, CalcSession& session);
+    
+    std::shared_ptr<CompiledProgram> compile(const std::string& expression);
+    void runLocked(HistoryEntry& entry);
+    ComplexNumber evaluateLocked(const std::string& expression, std::shared_ptr<CompiledProgram> program);
+    void markEvaluatedLocked(const std::shared_ptr<CompiledProgram>& program);
+    std::string displayAnswerLocked() const;
+    void traceInputsLocked(const CompiledProgram& program, TraceEvent& trace) const;
+    
+    mutable std::mutex mutex;
+    SlotTable slots;
+    bool exactMode;
+    bool ansIsExact;
+    DisplayFormat displayFormat;
+    AngleUnit unit;
+    ResourceBudget budget;
+    std::unique_ptr<ProgressiveResult> progressive; // Refinable Ans, if any
+    std::unique_ptr<SessionHistory> history;
+    
+    // Recently compiled expressions, most recent first: re-evaluating one (a
+    // table of f(X) over X) reuses the program and its folded constants
+    struct RecentProgram {
+        std::string expression;
+        std::shared_ptr<CompiledProgram> program;
+        bool evaluated; // Ran without error at least once; only these are saved
+    };
+    std::vector<RecentProgram> recentPrograms;
+    
+    // Snapshot of an earlier run consulted before compiling, if one was loaded
+    std::shared_ptr<const SnapshotFile> snapshot;
+};
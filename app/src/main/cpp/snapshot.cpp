@@ -0,0 +1,452 @@
+#include "snapshot.h"
+#include "calc.h"
+#include "history.h"
+#include "optimizer.h"
+#include "parsing.h"
+#include "progressive.h"
+#include "session.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <functional>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <android/log.h>
+
+#define LOG_TAG "CalculatorSnapshot"
+#define LOGD(...) __android_log_print(ANDROID_LOG_DEBUG, LOG_TAG, __VA_ARGS__)
+#define LOGE(...) __android_log_print(ANDROID_LOG_ERROR, LOG_TAG, __VA_ARGS__)
+
+using namespace std;
+
+static const char SNAPSHOT_MAGIC[8] = {'F', 'X', '9', '9', '1', 'S', 'N', 'P'};
+
+// Magic, version, section count, file size, checksum, padding
+static const size_t HEADER_SIZE = 32;
+static const size_t CHECKSUM_OFFSET = 24;
+static const size_t ENTRY_SIZE = 24;
+
+// Programs carried over from the previous snapshot besides the session's own
+static const size_t MAX_STORED_PROGRAMS = 64;
+
+// CRC-32 (IEEE 802.3, as zlib computes it)
+static uint32_t crc32(const char* data, size_t length, uint32_t crc = 0) {
+    static const auto table = [] {
+        vector<uint32_t> entries(256);
+        for (uint32_t n = 0; n < 256; n++) {
+            uint32_t c = n;
+            for (int bit = 0; bit < 8; bit++) c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            entries[n] = c;
+        }
+        return entries;
+    }();
+    crc = ~crc;
+    for (size_t i = 0; i < length; i++) {
+        crc = table[(crc ^ (uint8_t)data[i]) & 0xFF] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+// Little-endian encoder into a growing buffer
+class Writer {
+public:
+    string bytes;
+
+    void u8(uint8_t value) { bytes.push_back((char)value); }
+    void u32(uint32_t value) {
+        for (int i = 0; i < 4; i++) bytes.push_back((char)(value >> (8 * i)));
+    }
+    void u64(uint64_t value) {
+        for (int i = 0; i < 8; i++) bytes.push_back((char)(value >> (8 * i)));
+    }
+    void text(const string& value) {
+        u32((uint32_t)value.size());
+        bytes += value;
+    }
+};
+
+// Bounds-checked decoder over mapped bytes. Reads past the end fail instead of
+// throwing, so a damaged payload only loses what it holds
+class Reader {
+public:
+    explicit Reader(string_view data) : data(data), position(0), failed(false) {}
+
+    bool ok() const { return !failed; }
+    bool atEnd() const { return position >= data.size(); }
+
+    uint8_t u8() { return (uint8_t)take(1)[0]; }
+    uint32_t u32() {
+        const char* p = take(4);
+        uint32_t value = 0;
+        for (int i = 0; i < 4; i++) value |= (uint32_t)(uint8_t)p[i] << (8 * i);
+        return value;
+    }
+    uint64_t u64() {
+        const char* p = take(8);
+        uint64_t value = 0;
+        for (int i = 0; i < 8; i++) value |= (uint64_t)(uint8_t)p[i] << (8 * i);
+        return value;
+    }
+    // Views into the mapping, not copies
+    string_view text() { return bytes(u32()); }
+    string_view bytes(size_t length) {
+        if (failed || length > data.size() - position) {
+            failed = true;
+            return string_view();
+        }
+        string_view value = data.substr(position, length);
+        position += length;
+        return value;
+    }
+
+private:
+    const char* take(size_t length) {
+        static const char zeros[8] = {};
+        if (failed || length > data.size() - position) {
+            failed = true;
+            return zeros;
+        }
+        const char* p = data.data() + position;
+        position += length;
+        return p;
+    }
+
+    string_view data;
+    size_t position;
+    bool failed;
+};
+
+shared_ptr<SnapshotFile> SnapshotFile::open(const string& path) {
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return nullptr;
+    struct stat info;
+    if (fstat(fd, &info) != 0 || (size_t)info.st_size < HEADER_SIZE) {
+        ::close(fd);
+        return nullptr;
+    }
+    size_t size = (size_t)info.st_size;
+    void* mapped = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (mapped == MAP_FAILED) {
+        LOGE("Cannot map snapshot %s", path.c_str());
+        return nullptr;
+    }
+    const char* data = static_cast<const char*>(mapped);
+
+    // Only the header and section table are read here; payloads stay untouched
+    // until they are needed
+    Reader header(string_view(data, size));
+    string_view magic = header.bytes(sizeof(SNAPSHOT_MAGIC));
+    uint32_t version = header.u32();
+    uint32_t sectionCount = header.u32();
+    uint64_t fileSize = header.u64();
+    uint32_t checksum = header.u32();
+    size_t tableEnd = HEADER_SIZE + (size_t)sectionCount * ENTRY_SIZE;
+
+    bool valid = magic == string_view(SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC)) &&
+                 version == SNAPSHOT_VERSION && fileSize == size && sectionCount <= 64 && tableEnd <= size;
+    if (valid) {
+        uint32_t computed = crc32(data, CHECKSUM_OFFSET);
+        computed = crc32("\0\0\0\0", 4, computed);
+        computed = crc32(data + CHECKSUM_OFFSET + 4, tableEnd - CHECKSUM_OFFSET - 4, computed);
+        valid = computed == checksum;
+    }
+
+    vector<Entry> entries;
+    Reader table(string_view(data, size).substr(valid ? HEADER_SIZE : size));
+    for (uint32_t i = 0; valid && i < sectionCount; i++) {
+        Entry entry;
+        entry.type = table.u32();
+        entry.checksum = table.u32();
+        entry.offset = table.u64();
+        entry.length = table.u64();
+        valid = entry.offset >= tableEnd && entry.offset <= size && entry.length <= size - entry.offset;
+        entries.push_back(entry);
+    }
+    if (!valid) {
+        LOGD("Ignoring snapshot %s: not a version %u snapshot or damaged", path.c_str(), SNAPSHOT_VERSION);
+        munmap(mapped, size);
+        return nullptr;
+    }
+    return shared_ptr<SnapshotFile>(new SnapshotFile(data, size, std::move(entries)));
+}
+
+SnapshotFile::SnapshotFile(const char* data, size_t size, vector<Entry> entries)
+    : data(data), size(size), entries(std::move(entries)), verified(this->entries.size(), 0) {}
+
+SnapshotFile::~SnapshotFile() {
+    munmap(const_cast<char*>(data), size);
+}
+
+string_view SnapshotFile::section(SnapshotSection type) const {
+    for (size_t i = 0; i < entries.size(); i++) {
+        const Entry& entry = entries[i];
+        if (entry.type != (uint32_t)type) continue;
+        string_view payload(data + entry.offset, (size_t)entry.length);
+        lock_guard<mutex> guard(lock);
+        if (verified[i] == 0) {
+            verified[i] = crc32(payload.data(), payload.size()) == entry.checksum ? 1 : -1;
+            if (verified[i] < 0) LOGE("Snapshot section %u fails its checksum, ignored", entry.type);
+        }
+        return verified[i] > 0 ? payload : string_view();
+    }
+    return string_view();
+}
+
+// Program records after the parser version and count: expression, then the
+// byte length and contents of its tokens so a lookup skips other programs
+// without decoding them. Programs of another parser version are not visited
+static void forEachProgram(string_view section, const function<bool(string_view, string_view)>& visit) {
+    Reader reader(section);
+    if (reader.u32() != PARSER_VERSION) return;
+    uint32_t count = reader.u32();
+    for (uint32_t i = 0; i < count && reader.ok(); i++) {
+        string_view expression = reader.text();
+        string_view tokens = reader.text();
+        if (!reader.ok() || !visit(expression, tokens)) return;
+    }
+}
+
+static bool decodeTokens(string_view encoded, vector<Token>& postfix) {
+    Reader reader(encoded);
+    uint32_t count = reader.u32();
+    vector<Token> tokens;
+    for (uint32_t i = 0; i < count && reader.ok(); i++) {
+        uint8_t type = reader.u8();
+        bool rightAssociative = reader.u8() != 0;
+        int precedence = (int32_t)reader.u32();
+        int slot = (int32_t)reader.u32();
+        string_view value = reader.text();
+        if (type > VARIABLE || slot < -1 || slot >= SLOT_COUNT) return false;
+        tokens.emplace_back((TokenType)type, string(value), precedence, rightAssociative);
+        tokens.back().slot = slot;
+    }
+    if (!reader.ok() || !reader.atEnd()) return false;
+    postfix = std::move(tokens);
+    return true;
+}
+
+static string encodeTokens(const vector<Token>& postfix) {
+    Writer writer;
+    writer.u32((uint32_t)postfix.size());
+    for (const Token& token : postfix) {
+        writer.u8((uint8_t)token.type);
+        writer.u8(token.rightAssociative ? 1 : 0);
+        writer.u32((uint32_t)token.precedence);
+        writer.u32((uint32_t)token.slot);
+        writer.text(token.value);
+    }
+    return writer.bytes;
+}
+
+bool SnapshotFile::findProgram(const string& expression, vector<Token>& postfix) const {
+    bool found = false;
+    forEachProgram(section(SNAPSHOT_PROGRAMS), [&](string_view stored, string_view tokens) {
+        if (stored != expression) return true;
+        found = decodeTokens(tokens, postfix);
+        return false;
+    });
+    return found;
+}
+
+// Constant records: name, digits, mantissa digits and exponent
+static bool findConstant(string_view section, const string& name, CachedConstant& constant) {
+    Reader reader(section);
+    uint32_t count = reader.u32();
+    for (uint32_t i = 0; i < count && reader.ok(); i++) {
+        string_view stored = reader.text();
+        uint64_t digits = reader.u64();
+        string_view mantissa = reader.text();
+        int64_t exponent = (int64_t)reader.u64();
+        if (!reader.ok() || stored != name) continue;
+        try {
+            constant.name = name;
+            constant.digits = (size_t)digits;
+            constant.value = BigFloat(BigInt(string(mantissa)), exponent);
+            return true;
+        } catch (const exception&) {
+            return false;
+        }
+    }
+    return false;
+}
+
+static string encodeConstants() {
+    vector<CachedConstant> constants = cachedConstants();
+    Writer writer;
+    writer.u32((uint32_t)constants.size());
+    for (const CachedConstant& constant : constants) {
+        writer.text(constant.name);
+        writer.u64(constant.digits);
+        writer.text(constant.value.mantissa.toString());
+        writer.u64((uint64_t)constant.value.exponent);
+    }
+    return writer.bytes;
+}
+
+// Session records: modes, then per slot the native value and, if known, the
+// exact value as numerator and denominator
+static bool restoreSession(string_view section, SlotTable& slots, bool& exactMode, bool& ansIsExact) {
+    Reader reader(section);
+    bool storedExactMode = reader.u8() != 0;
+    bool storedAnsIsExact = reader.u8() != 0;
+    if (reader.u32() != SLOT_COUNT) return false;
+    SlotTable restored;
+    try {
+        for (int slot = 0; slot < SLOT_COUNT && reader.ok(); slot++) {
+            string real(reader.text());
+            string imaginary(reader.text());
+            restored.values[slot] = ComplexNumber(real, imaginary);
+            restored.hasExact[slot] = reader.u8() != 0;
+            string numerator(reader.text());
+            string denominator(reader.text());
+            restored.exact[slot] = restored.hasExact[slot] ? Rational(BigInt(numerator), BigInt(denominator)) : Rational();
+        }
+    } catch (const exception&) {
+        return false;
+    }
+    if (!reader.ok()) return false;
+    slots = restored;
+    exactMode = storedExactMode;
+    ansIsExact = storedAnsIsExact;
+    return true;
+}
+
+static string encodeSession(const SlotTable& slots, bool exactMode, bool ansIsExact) {
+    Writer writer;
+    writer.u8(exactMode ? 1 : 0);
+    writer.u8(ansIsExact ? 1 : 0);
+    writer.u32(SLOT_COUNT);
+    for (int slot = 0; slot < SLOT_COUNT; slot++) {
+        writer.text(slots.values[slot].real);
+        writer.text(slots.values[slot].imaginary);
+        writer.u8(slots.hasExact[slot] ? 1 : 0);
+        writer.text(slots.exact[slot].numerator.toString());
+        writer.text(slots.exact[slot].denominator.toString());
+    }
+    return writer.bytes;
+}
+
+static bool writeFile(const string& path, const string& bytes) {
+    // Written beside the target and renamed over it, so readers see either
+    // the old snapshot or the complete new one
+    string temporary = path + ".tmp";
+    FILE* file = fopen(temporary.c_str(), "wb");
+    if (file == nullptr) return false;
+    bool written = fwrite(bytes.data(), 1, bytes.size(), file) == bytes.size() &&
+                   fflush(file) == 0 && fsync(fileno(file)) == 0;
+    written = fclose(file) == 0 && written;
+    if (!written || rename(temporary.c_str(), path.c_str()) != 0) {
+        remove(temporary.c_str());
+        return false;
+    }
+    return true;
+}
+
+bool saveSnapshot(const string& path, const CalcSession& session) {
+    SlotTable slots;
+    bool exactMode;
+    bool ansIsExact;
+    vector<pair<string, vector<Token>>> programs;
+    shared_ptr<const SnapshotFile> previous;
+    {
+        lock_guard<std::mutex> lock(session.mutex);
+        slots = session.slots;
+        exactMode = session.exactMode;
+        ansIsExact = session.ansIsExact;
+        // Only programs that evaluated without error are worth keeping
+        for (const auto& recent : session.recentPrograms) {
+            if (recent.evaluated) programs.emplace_back(recent.expression, recent.program->postfix());
+        }
+        previous = session.snapshot;
+    }
+
+    vector<string> expressions;
+    for (const auto& program : programs) expressions.push_back(program.first);
+    uint32_t programCount = 0;
+    Writer records;
+    for (const auto& program : programs) {
+        // Series bodies live outside the token list; such programs are parsed again
+        bool hasSeries = any_of(program.second.begin(), program.second.end(),
+                                [](const Token& token) { return (bool)token.series; });
+        if (hasSeries) continue;
+        records.text(program.first);
+        records.text(encodeTokens(program.second));
+        programCount++;
+    }
+    // Programs of earlier runs are carried over, already encoded
+    if (previous) {
+        forEachProgram(previous->section(SNAPSHOT_PROGRAMS), [&](string_view expression, string_view tokens) {
+            if (programCount >= CalcSession::RECENT_PROGRAMS + MAX_STORED_PROGRAMS) return false;
+            for (const string& known : expressions) {
+                if (known == expression) return true;
+            }
+            records.text(string(expression));
+            records.text(string(tokens));
+            programCount++;
+            return true;
+        });
+    }
+    Writer programSection;
+    programSection.u32(PARSER_VERSION);
+    programSection.u32(programCount);
+    programSection.bytes += records.bytes;
+
+    const pair<SnapshotSection, string> sections[] = {
+        {SNAPSHOT_CONSTANTS, encodeConstants()},
+        {SNAPSHOT_PROGRAMS, programSection.bytes},
+        {SNAPSHOT_SESSION, encodeSession(slots, exactMode, ansIsExact)},
+    };
+    const uint32_t sectionCount = sizeof(sections) / sizeof(sections[0]);
+
+    size_t offset = HEADER_SIZE + sectionCount * ENTRY_SIZE;
+    size_t fileSize = offset;
+    for (const auto& section : sections) fileSize += section.second.size();
+
+    Writer file;
+    file.bytes.append(SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC));
+    file.u32(SNAPSHOT_VERSION);
+    file.u32(sectionCount);
+    file.u64(fileSize);
+    file.u32(0); // Checksum, filled in below
+    file.u32(0);
+    for (const auto& section : sections) {
+        file.u32(section.first);
+        file.u32(crc32(section.second.data(), section.second.size()));
+        file.u64(offset);
+        file.u64(section.second.size());
+        offset += section.second.size();
+    }
+    uint32_t checksum = crc32(file.bytes.data(), file.bytes.size());
+    for (int i = 0; i < 4; i++) file.bytes[CHECKSUM_OFFSET + i] = (char)(checksum >> (8 * i));
+    for (const auto& section : sections) file.bytes += section.second;
+
+    if (!writeFile(path, file.bytes)) {
+        LOGE("Cannot write snapshot %s", path.c_str());
+        return false;
+    }
+    LOGD("Snapshot saved: %d bytes, %u programs", (int)file.bytes.size(), programCount);
+    return true;
+}
+
+bool loadSnapshot(const string& path, CalcSession& session) {
+    shared_ptr<SnapshotFile> file = SnapshotFile::open(path);
+    if (!file) return false;
+
+    // Constants stay in the mapping until first used; the source keeps it alive
+    setConstantSource([file](const string& name, CachedConstant& constant) {
+        return findConstant(file->section(SNAPSHOT_CONSTANTS), name, constant);
+    });
+
+    lock_guard<std::mutex> lock(session.mutex);
+    if (!restoreSession(file->section(SNAPSHOT_SESSION), session.slots, session.exactMode, session.ansIsExact)) {
+        LOGD("Snapshot has no usable session values");
+    }
+    session.progressive.reset();
+    session.history->reset(session.slots);
+    session.recentPrograms.clear();
+    session.snapshot = file;
+    return true;
+}
@@ -0,0 +1,73 @@
+#pragma once
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "token.h"
+
+class CalcSession;
+
+// Snapshot file layout, all integers little-endian:
+//   header    magic "FX991SNP", version, section count, file size, CRC-32 of
+//             the header and section table
+//   sections  type, CRC-32, offset and length of each payload
+//   payloads  constants, compiled programs, session slots
+// A file with another version is ignored rather than converted. The programs
+// payload starts with the PARSER_VERSION that compiled it and is dropped as
+// a whole when the parser has changed since.
+const uint32_t SNAPSHOT_VERSION = 2;
+
+enum SnapshotSection {
+    SNAPSHOT_CONSTANTS = 1,
+    SNAPSHOT_PROGRAMS = 2,
+    SNAPSHOT_SESSION = 3
+};
+
+// Snapshot mapped read-only into memory. Opening checks only the header, so
+// it costs the same however much the file holds; a section's checksum is
+// verified the first time it is read, and values are parsed out of the
+// mapping only when they are asked for
+class SnapshotFile {
+public:
+    // nullptr when the file is missing, truncated, of another version or
+    // fails its header checksum
+    static std::shared_ptr<SnapshotFile> open(const std::string& path);
+    ~SnapshotFile();
+
+    SnapshotFile(const SnapshotFile&) = delete;
+    SnapshotFile& operator=(const SnapshotFile&) = delete;
+
+    // Payload of a section; empty when absent or corrupt
+    std::string_view section(SnapshotSection type) const;
+
+    // Postfix program stored for the expression text, if any
+    bool findProgram(const std::string& expression, std::vector<Token>& postfix) const;
+
+private:
+    struct Entry {
+        uint32_t type;
+        uint32_t checksum;
+        uint64_t offset;
+        uint64_t length;
+    };
+
+    SnapshotFile(const char* data, size_t size, std::vector<Entry> entries);
+
+    const char* const data;
+    const size_t size;
+    const std::vector<Entry> entries;
+    mutable std::mutex lock;
+    mutable std::vector<int> verified; // Per entry: 0 unchecked, 1 valid, -1 corrupt
+};
+
+// Write the process's cached constants and the session's slots and recent
+// programs. The file is replaced atomically, so a crash mid-write leaves the
+// previous snapshot intact. False on I/O errors
+bool saveSnapshot(const std::string& path, const CalcSession& session);
+
+// Map a snapshot and restore the session from it: slot values and modes now,
+// constants and programs lazily as they are first needed. False when there is
+// no usable snapshot, leaving the session untouched
+bool loadSnapshot(const std::string& path, CalcSession& session);
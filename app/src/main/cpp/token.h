@@ -0,0 +1,24 @@
+#pragma once
+#include <memory>
+#include <string>
+
+struct Series;
+
+// Token types shared by the parser and the evaluator
+enum TokenType {
+    NUMBER, OPERATOR, FUNCTION, LEFT_PAREN, RIGHT_PAREN, VARIABLE,
+    COMMA // Separates function arguments; never part of a postfix program
+};
+
+// Token structure
+struct Token {
+    TokenType type;
+    std::string value;
+    int precedence;
+    bool rightAssociative;
+    int slot; // Session variable slot resolved at compile time (-1 for constants)
+    std::shared_ptr<const Series> series; // Body of a Σ or Π function token (see series.h)
+    
+    Token(TokenType t, const std::string& v, int p = 0, bool ra = false) 
+        : type(t), value(v), precedence(p), rightAssociative(ra), slot(-1) {}
+};
@@ -0,0 +1,339 @@
+#include "trace.h"
+#include "calc.h"
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <unordered_map>
+#include <android/log.h>
+
+#define LOG_TAG "CalculatorTrace"
+#define LOGD(...) __android_log_print(ANDROID_LOG_DEBUG, LOG_TAG, __VA_ARGS__)
+#define LOGE(...) __android_log_print(ANDROID_LOG_ERROR, LOG_TAG, __VA_ARGS__)
+
+using namespace std;
+
+static const char TRACE_MAGIC[8] = {'F', 'X', '9', '9', '1', 'T', 'R', 'C'};
+
+static const uint8_t RECORD_EVALUATION = 1;
+
+static const uint8_t FLAG_EXACT_MODE = 1;
+static const uint8_t FLAG_FAILED = 2;
+
+// Checked by every TraceEvent; everything else is behind traceLock
+static atomic<bool> traceEnabled(false);
+static mutex traceLock;
+static FILE* traceFile = nullptr;
+static unordered_map<const void*, uint32_t> sessionNumbers;
+
+// Varint (LEB128) encoder into a growing buffer
+class Writer {
+public:
+    string bytes;
+
+    void u8(uint8_t value) { bytes.push_back((char)value); }
+    void u64(uint64_t value) {
+        for (int i = 0; i < 8; i++) bytes.push_back((char)(value >> (8 * i)));
+    }
+    void varint(uint64_t value) {
+        while (value >= 0x80) {
+            bytes.push_back((char)(value | 0x80));
+            value >>= 7;
+        }
+        bytes.push_back((char)value);
+    }
+    void text(const string& value) {
+        varint(value.size());
+        bytes += value;
+    }
+};
+
+// Bounds-checked decoder; reads past the end fail instead of throwing
+class Reader {
+public:
+    Reader(const char* data, size_t size) : data(data), size(size), position(0), failed(false) {}
+
+    bool ok() const { return !failed; }
+    bool atEnd() const { return position >= size; }
+
+    uint8_t u8() {
+        if (failed || position >= size) {
+            failed = true;
+            return 0;
+        }
+        return (uint8_t)data[position++];
+    }
+    uint64_t u64() {
+        uint64_t value = 0;
+        for (int i = 0; i < 8; i++) value |= (uint64_t)u8() << (8 * i);
+        return value;
+    }
+    uint64_t varint() {
+        uint64_t value = 0;
+        for (int shift = 0; shift < 64; shift += 7) {
+            uint8_t byte = u8();
+            value |= (uint64_t)(byte & 0x7F) << shift;
+            if (!(byte & 0x80)) return value;
+        }
+        failed = true;
+        return 0;
+    }
+    string text() {
+        uint64_t length = varint();
+        const char* p = bytes(length);
+        return p != nullptr ? string(p, (size_t)length) : string();
+    }
+    // The next length bytes in place, nullptr if there are fewer
+    const char* bytes(uint64_t length) {
+        if (failed || length > size - position) {
+            failed = true;
+            return nullptr;
+        }
+        const char* p = data + position;
+        position += (size_t)length;
+        return p;
+    }
+
+private:
+    const char* data;
+    size_t size;
+    size_t position;
+    bool failed;
+};
+
+bool startTrace(const string& path) {
+    lock_guard<mutex> guard(traceLock);
+    if (traceFile != nullptr) {
+        fclose(traceFile);
+        traceFile = nullptr;
+        traceEnabled.store(false);
+    }
+
+    // An existing trace is appended to only if it has our header
+    FILE* file = fopen(path.c_str(), "a+b");
+    if (file == nullptr) {
+        LOGE("Cannot open trace %s", path.c_str());
+        return false;
+    }
+    fseek(file, 0, SEEK_END);
+    if (ftell(file) == 0) {
+        Writer header;
+        header.bytes.assign(TRACE_MAGIC, sizeof(TRACE_MAGIC));
+        header.varint(TRACE_VERSION);
+        fwrite(header.bytes.data(), 1, header.bytes.size(), file);
+        fflush(file);
+    } else {
+        char magic[sizeof(TRACE_MAGIC)];
+        fseek(file, 0, SEEK_SET);
+        bool valid = fread(magic, 1, sizeof(magic), file) == sizeof(magic) &&
+                     memcmp(magic, TRACE_MAGIC, sizeof(magic)) == 0 && fgetc(file) == (int)TRACE_VERSION;
+        if (!valid) {
+            LOGE("%s is not a version %u trace", path.c_str(), TRACE_VERSION);
+            fclose(file);
+            return false;
+        }
+        fseek(file, 0, SEEK_END);
+    }
+
+    traceFile = file;
+    sessionNumbers.clear();
+    traceEnabled.store(true);
+    LOGD("Tracing evaluations to %s", path.c_str());
+    return true;
+}
+
+void stopTrace() {
+    lock_guard<mutex> guard(traceLock);
+    traceEnabled.store(false);
+    if (traceFile != nullptr) {
+        fclose(traceFile);
+        traceFile = nullptr;
+    }
+}
+
+bool tracing() {
+    return traceEnabled.load(memory_order_relaxed);
+}
+
+uint64_t traceDigest(const string& result) {
+    uint64_t hash = 14695981039346656037ull;
+    for (char c : result) {
+        hash ^= (uint8_t)c;
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+TraceEvent::TraceEvent(TraceEntry entry, const void* session, const string& expression, size_t digits)
+    : recording(tracing()), entry(entry), session(session), digits(digits), precision(0), exact(false),
+      angle(ANGLE_RADIANS), phaseNanos{} {
+    if (!recording) return;
+    this->expression = expression;
+    precision = workingPrecision();
+    angle = ::angleUnit();
+    mark = chrono::steady_clock::now();
+}
+
+TraceEvent::~TraceEvent() {
+    if (recording) write(true, 0);
+}
+
+void TraceEvent::exactMode(bool enabled) {
+    exact = enabled;
+}
+
+void TraceEvent::displayFormat(const DisplayFormat& format) {
+    display = format;
+}
+
+void TraceEvent::angleUnit(AngleUnit unit) {
+    angle = unit;
+}
+
+void TraceEvent::input(int slot, const ComplexNumber& value, const Rational* exactValue) {
+    if (!recording) return;
+    inputs.push_back(Input{slot, value.real, value.isReal() ? string() : value.imaginary,
+                           exactValue != nullptr ? toFractionString(*exactValue) : string()});
+}
+
+void TraceEvent::phase(TracePhase phase) {
+    if (!recording) return;
+    auto now = chrono::steady_clock::now();
+    phaseNanos[phase] += (uint64_t)chrono::duration_cast<chrono::nanoseconds>(now - mark).count();
+    mark = now;
+}
+
+void TraceEvent::finish(const string& result) {
+    if (!recording) return;
+    phase(PHASE_FORMAT);
+    write(false, traceDigest(result));
+}
+
+void TraceEvent::write(bool failed, uint64_t digest) {
+    recording = false;
+
+    Writer record;
+    record.u8(RECORD_EVALUATION);
+    record.u8((uint8_t)entry);
+    record.u8((uint8_t)((exact ? FLAG_EXACT_MODE : 0) | (failed ? FLAG_FAILED : 0)));
+    size_t sessionField = record.bytes.size();
+    record.varint(precision);
+    record.varint(digits);
+    record.text(expression);
+    record.varint(inputs.size());
+    for (const Input& value : inputs) {
+        record.u8((uint8_t)value.slot);
+        record.text(value.real);
+        record.text(value.imaginary);
+        record.text(value.exact);
+    }
+    record.u64(digest);
+    record.varint(PHASE_COUNT);
+    for (uint64_t nanos : phaseNanos) record.varint(nanos);
+    record.u8((uint8_t)display.mode);
+    record.u8((uint8_t)display.digits);
+    record.u8((uint8_t)angle);
+
+    lock_guard<mutex> guard(traceLock);
+    if (traceFile == nullptr) return; // Stopped meanwhile
+
+    // Sessions are numbered as the trace first sees them
+    uint32_t number = 0;
+    if (session != nullptr) {
+        auto found = sessionNumbers.find(session);
+        if (found == sessionNumbers.end()) {
+            found = sessionNumbers.emplace(session, (uint32_t)sessionNumbers.size() + 1).first;
+        }
+        number = found->second;
+    }
+    Writer sessionNumber;
+    sessionNumber.varint(number);
+    record.bytes.insert(sessionField, sessionNumber.bytes);
+
+    Writer length;
+    length.varint(record.bytes.size());
+    fwrite(length.bytes.data(), 1, length.bytes.size(), traceFile);
+    fwrite(record.bytes.data(), 1, record.bytes.size(), traceFile);
+    fflush(traceFile);
+}
+
+uint64_t TraceRecord::totalNanos() const {
+    uint64_t total = 0;
+    for (uint64_t nanos : phaseNanos) total += nanos;
+    return total;
+}
+
+// "p/q" or "p" as written by toFractionString
+static Rational parseFraction(const string& text) {
+    size_t slash = text.find('/');
+    if (slash == string::npos) return Rational(BigInt(text));
+    return Rational(BigInt(text.substr(0, slash)), BigInt(text.substr(slash + 1)));
+}
+
+static bool readRecord(Reader& in, TraceRecord& record) {
+    if (in.u8() != RECORD_EVALUATION) return false;
+    record.entry = (TraceEntry)in.u8();
+    uint8_t flags = in.u8();
+    record.exactMode = (flags & FLAG_EXACT_MODE) != 0;
+    record.failed = (flags & FLAG_FAILED) != 0;
+    record.session = (uint32_t)in.varint();
+    record.precision = (size_t)in.varint();
+    record.digits = (size_t)in.varint();
+    record.expression = in.text();
+    uint64_t inputCount = in.varint();
+    for (uint64_t i = 0; i < inputCount && in.ok(); i++) {
+        TraceRecord::Input value;
+        value.slot = in.u8();
+        string real = in.text(), imaginary = in.text(), exact = in.text();
+        value.value = imaginary.empty() ? ComplexNumber(real) : ComplexNumber(real, imaginary);
+        value.hasExact = !exact.empty();
+        if (value.hasExact) value.exact = parseFraction(exact);
+        record.inputs.push_back(std::move(value));
+    }
+    record.digest = in.u64();
+    uint64_t phases = in.varint();
+    for (uint64_t i = 0; i < phases && in.ok(); i++) {
+        uint64_t nanos = in.varint();
+        if (i < PHASE_COUNT) record.phaseNanos[i] = nanos;
+    }
+    if (in.ok() && !in.atEnd()) {
+        uint8_t mode = in.u8();
+        uint8_t digits = in.u8();
+        if (mode <= DISPLAY_ENG) record.display = DisplayFormat((DisplayMode)mode, digits);
+    }
+    if (in.ok() && !in.atEnd()) {
+        uint8_t unit = in.u8();
+        if (unit <= ANGLE_GRADIANS) record.angleUnit = (AngleUnit)unit;
+    }
+    return in.ok();
+}
+
+bool readTrace(const string& path, vector<TraceRecord>& records) {
+    FILE* file = fopen(path.c_str(), "rb");
+    if (file == nullptr) return false;
+    string data;
+    char buffer[1 << 16];
+    for (size_t n; (n = fread(buffer, 1, sizeof(buffer), file)) > 0;) data.append(buffer, n);
+    fclose(file);
+
+    Reader in(data.data(), data.size());
+    for (char c : TRACE_MAGIC) {
+        if (in.u8() != (uint8_t)c) return false;
+    }
+    if (in.varint() != TRACE_VERSION || !in.ok()) return false;
+
+    while (!in.atEnd()) {
+        // Length, then exactly that many bytes of record
+        uint64_t length = in.varint();
+        const char* payload = in.bytes(length);
+        if (payload == nullptr) {
+            LOGD("Trace %s ends in a partial record", path.c_str());
+            break;
+        }
+        Reader body(payload, (size_t)length);
+        TraceRecord record{};
+        // Kinds this version does not know are skipped
+        if (readRecord(body, record)) records.push_back(std::move(record));
+    }
+    return true;
+}
@@ -0,0 +1,135 @@
+#pragma once
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "calc.h"
+#include "complex_number.h"
+#include "display_format.h"
+#include "rational.h"
+
+// Opt-in workload capture. While a trace is open, every evaluation through
+// parseExpression and the session entry points is appended to it with its
+// settings, the session slots it read, a digest of its result and the time
+// spent in each phase, so a real workload can be replayed against another
+// build (tools/replay) as a regression benchmark.
+//
+// File layout: magic "FX991TRC" and a varint version, then records, each a
+// varint length followed by that many bytes:
+//   kind u8, entry u8, flags u8 (exact mode, failed), session varint,
+//   precision varint, digits varint, expression text,
+//   input count varint, then per input: slot u8, real, imaginary and exact
+//   fraction texts (empty when absent),
+//   result digest u64, phase count varint, nanoseconds per phase varint,
+//   display mode u8, display digits u8, angle unit u8
+// Texts are a varint length and the bytes, fixed-width integers little-endian.
+// Readers ignore bytes after the fields they know and default missing
+// trailing fields, so fields can be appended without a new version.
+// Records are appended and flushed one at a time, so a crash loses at most
+// the record being written; readers stop at a record cut short.
+const uint32_t TRACE_VERSION = 1;
+
+// Entry point an evaluation came through
+enum TraceEntry {
+    TRACE_EXPRESSION = 1,   // parseExpression, no session
+    TRACE_SESSION = 2,      // CalcSession::evaluateForDisplay
+    TRACE_PROGRESSIVE = 3,  // CalcSession::evaluateProgressive to digits
+    TRACE_REFINE = 4,       // CalcSession::refineAnswer to digits
+    TRACE_FACTOR = 5        // CalcSession::factorAnswer
+};
+
+enum TracePhase {
+    PHASE_COMPILE,      // Tokenizing and compiling, or finding a compiled program
+    PHASE_EVALUATE,
+    PHASE_FORMAT,       // Turning the value into its display text
+    PHASE_COUNT
+};
+
+// Start appending to the trace at path, creating it if needed. False when it
+// cannot be opened or is not a trace of this version
+bool startTrace(const std::string& path);
+void stopTrace();
+bool tracing();
+
+// FNV-1a of a result as displayed
+uint64_t traceDigest(const std::string& result);
+
+// One evaluation being captured. Does nothing when no trace is open, so the
+// entry points create one unconditionally; the record is written by
+// finish(), or as failed when the evaluation throws before it
+class TraceEvent {
+public:
+    TraceEvent(TraceEntry entry, const void* session, const std::string& expression, size_t digits = 0);
+    ~TraceEvent();
+
+    TraceEvent(const TraceEvent&) = delete;
+    TraceEvent& operator=(const TraceEvent&) = delete;
+
+    bool active() const { return recording; }
+
+    void exactMode(bool enabled);
+    void displayFormat(const DisplayFormat& format);
+    void angleUnit(AngleUnit unit);  // The thread's unit unless set
+
+    // A slot the expression reads, as it was before evaluation
+    void input(int slot, const ComplexNumber& value, const Rational* exact);
+
+    // End of a phase: the time since the previous mark is charged to it
+    void phase(TracePhase phase);
+
+    // The result as returned to the caller; the time since the last mark is
+    // charged to PHASE_FORMAT
+    void finish(const std::string& result);
+
+private:
+    struct Input {
+        int slot;
+        std::string real;
+        std::string imaginary;
+        std::string exact;
+    };
+
+    void write(bool failed, uint64_t digest);
+
+    bool recording;
+    TraceEntry entry;
+    const void* session;
+    std::string expression;
+    size_t digits;
+    size_t precision;
+    bool exact;
+    DisplayFormat display;
+    AngleUnit angle;
+    std::vector<Input> inputs;
+    std::chrono::steady_clock::time_point mark;
+    uint64_t phaseNanos[PHASE_COUNT];
+};
+
+// A record read back from a trace
+struct TraceRecord {
+    struct Input {
+        int slot;
+        ComplexNumber value;
+        bool hasExact;
+        Rational exact;
+    };
+
+    TraceEntry entry;
+    uint32_t session;       // 0 for TRACE_EXPRESSION, otherwise numbered in order of appearance
+    bool exactMode;
+    bool failed;
+    size_t precision;
+    size_t digits;
+    std::string expression;
+    std::vector<Input> inputs;
+    uint64_t digest;
+    uint64_t phaseNanos[PHASE_COUNT];
+    DisplayFormat display;  // DISPLAY_ALL in records written before it was traced
+    AngleUnit angleUnit = ANGLE_RADIANS;  // Likewise radians
+
+    uint64_t totalNanos() const;
+};
+
+// Every complete record of the trace at path. False when the file is missing
+// or not a trace of this version
+bool readTrace(const std::string& path, std::vector<TraceRecord>& records);
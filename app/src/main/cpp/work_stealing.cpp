@@ -0,0 +1,144 @@
+#include "work_stealing.h"
+#include <algorithm>
+#include <chrono>
+#include <android/log.h>
+
+#define LOG_TAG "CalculatorWorkStealing"
+#define LOGD(...) __android_log_print(ANDROID_LOG_DEBUG, LOG_TAG, __VA_ARGS__)
+
+using namespace std;
+
+// Beyond this, big-number kernels are limited by memory bandwidth rather
+// than cores
+static const size_t MAX_WORKERS = 7;
+
+// How long a waiting thread sleeps before looking for new work to help with
+static const chrono::microseconds HELP_INTERVAL(500);
+
+// Pool and deque of the calling thread when it is a pool worker
+static thread_local WorkStealingPool* currentPool = nullptr;
+static thread_local size_t currentWorker = 0;
+
+WorkStealingPool::WorkStealingPool(size_t workerCount) : queued(0), stopping(false) {
+    for (size_t i = 0; i < workerCount; i++) deques.push_back(make_unique<Deque>());
+    for (size_t i = 0; i < workerCount; i++) threads.emplace_back(&WorkStealingPool::workerLoop, this, i);
+    LOGD("Work-stealing pool started with %d workers", (int)workerCount);
+}
+
+WorkStealingPool::~WorkStealingPool() {
+    {
+        lock_guard<mutex> guard(sleepLock);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (thread& worker : threads) worker.join();
+}
+
+void WorkStealingPool::spawn(function<void()> task) {
+    Deque& target = currentPool == this ? *deques[currentWorker] : shared;
+    {
+        lock_guard<mutex> guard(target.lock);
+        target.tasks.push_back(std::move(task));
+    }
+    queued.fetch_add(1, memory_order_release);
+    {
+        // Pairs with the predicate check of sleeping workers
+        lock_guard<mutex> guard(sleepLock);
+    }
+    wake.notify_one();
+}
+
+// Own deque newest first, then the oldest task of anyone else
+bool WorkStealingPool::take(function<void()>& task) {
+    if (queued.load(memory_order_acquire) == 0) return false;
+    bool isWorker = currentPool == this;
+    size_t count = deques.size();
+    Deque* own = isWorker ? deques[currentWorker].get() : &shared;
+    {
+        lock_guard<mutex> guard(own->lock);
+        if (!own->tasks.empty()) {
+            task = std::move(own->tasks.back());
+            own->tasks.pop_back();
+            queued.fetch_sub(1, memory_order_relaxed);
+            return true;
+        }
+    }
+    size_t start = isWorker ? currentWorker + 1 : 0;
+    for (size_t k = 0; k <= count; k++) {
+        Deque* victim = k == count ? &shared : deques[(start + k) % count].get();
+        if (victim == own) continue;
+        lock_guard<mutex> guard(victim->lock);
+        if (!victim->tasks.empty()) {
+            task = std::move(victim->tasks.front());
+            victim->tasks.pop_front();
+            queued.fetch_sub(1, memory_order_relaxed);
+            return true;
+        }
+    }
+    return false;
+}
+
+bool WorkStealingPool::runPending() {
+    function<void()> task;
+    if (!take(task)) return false;
+    task();
+    return true;
+}
+
+void WorkStealingPool::workerLoop(size_t index) {
+    currentPool = this;
+    currentWorker = index;
+    for (;;) {
+        if (runPending()) continue;
+        unique_lock<mutex> guard(sleepLock);
+        wake.wait(guard, [this] { return stopping || queued.load(memory_order_acquire) > 0; });
+        if (stopping) return;
+    }
+}
+
+TaskGroup::~TaskGroup() {
+    waitForPending();
+}
+
+void TaskGroup::spawn(function<void()> task) {
+    pending.fetch_add(1, memory_order_relaxed);
+    pool.spawn([this, task = std::move(task)] {
+        try {
+            task();
+        } catch (...) {
+            lock_guard<mutex> guard(lock);
+            if (!error) error = current_exception();
+        }
+        // The group may be destroyed as soon as pending reaches zero, so the
+        // last task notifies under the lock the waiter checks it with
+        lock_guard<mutex> guard(lock);
+        if (pending.fetch_sub(1, memory_order_acq_rel) == 1) done.notify_all();
+    });
+}
+
+void TaskGroup::waitForPending() {
+    while (pending.load(memory_order_acquire) > 0) {
+        // Help with queued work, ours or anyone's, rather than block a core
+        if (pool.runPending()) continue;
+        unique_lock<mutex> guard(lock);
+        done.wait_for(guard, HELP_INTERVAL, [this] { return pending.load(memory_order_acquire) == 0; });
+    }
+    // Let the last task leave its critical section before the group goes away
+    lock_guard<mutex> guard(lock);
+}
+
+void TaskGroup::wait() {
+    waitForPending();
+    exception_ptr failure;
+    {
+        lock_guard<mutex> guard(lock);
+        swap(failure, error);
+    }
+    if (failure) rethrow_exception(failure);
+}
+
+WorkStealingPool& workStealingPool() {
+    // The thread that forks the work runs part of it too
+    static WorkStealingPool pool(min<size_t>(MAX_WORKERS, max(thread::hardware_concurrency(), 1u) - 1));
+    return pool;
+}
@@ -0,0 +1,83 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fork-join pool that splits one computation across cores. Each worker owns a
+// deque: it pushes and pops its own tasks at the back (newest first, while
+// their operands are still in cache) and idle workers steal from the front
+// of the others (oldest first, usually the largest pieces of work). Threads
+// outside the pool queue onto a shared deque that every worker steals from.
+// Unlike EvaluationPool, tasks are pieces of one evaluation, not whole ones
+class WorkStealingPool {
+public:
+    explicit WorkStealingPool(size_t workerCount);
+    ~WorkStealingPool();
+
+    WorkStealingPool(const WorkStealingPool&) = delete;
+    WorkStealingPool& operator=(const WorkStealingPool&) = delete;
+
+    size_t workerCount() const { return threads.size(); }
+
+    void spawn(std::function<void()> task);
+
+    // Run one queued task on the calling thread, if there is any; waiting
+    // threads call this to help instead of blocking
+    bool runPending();
+
+private:
+    struct Deque {
+        std::mutex lock;
+        std::deque<std::function<void()>> tasks;
+    };
+
+    void workerLoop(size_t index);
+    bool take(std::function<void()>& task);
+
+    std::vector<std::unique_ptr<Deque>> deques; // One per worker
+    Deque shared;                               // Spawned from outside the pool
+    std::vector<std::thread> threads;
+
+    std::mutex sleepLock;
+    std::condition_variable wake;
+    std::atomic<size_t> queued;
+    bool stopping;
+};
+
+// Tasks spawned together and waited for together. A task that throws cancels
+// nothing by itself; the first exception is rethrown by wait()
+class TaskGroup {
+public:
+    explicit TaskGroup(WorkStealingPool& pool) : pool(pool), pending(0) {}
+
+    // Waits for the tasks still running, ignoring their exceptions
+    ~TaskGroup();
+
+    TaskGroup(const TaskGroup&) = delete;
+    TaskGroup& operator=(const TaskGroup&) = delete;
+
+    void spawn(std::function<void()> task);
+
+    // Runs queued tasks on the calling thread until every task of the group
+    // has finished, then rethrows the first exception one of them threw
+    void wait();
+
+private:
+    void waitForPending();
+
+    WorkStealingPool& pool;
+    std::atomic<size_t> pending;
+    std::mutex lock;
+    std::condition_variable done;
+    std::exception_ptr error;
+};
+
+// Process-wide pool with a worker per core besides the calling thread, created
+// on first use. Has no workers on single-core devices
+WorkStealingPool& workStealingPool();
@@ -1,6 +1,9 @@
 package com.example.calculator
 
+import android.content.ComponentCallbacks2
 import android.os.Bundle
+import android.os.Handler
+import android.os.Looper
 import android.util.Log
 import android.view.View
 import android.widget.Button
@@ -8,6 +11,14 @@ import android.widget.LinearLayout
 import android.widget.TextView
 import android.widget.Toast
 import androidx.appcompat.app.AppCompatActivity
+import java.io.File
+
+// Receives progress and the final "Result: ..."/"Error: ..." text of an
+// asynchronous evaluation. Called on a native worker thread
+interface EvaluationListener {
+    fun onProgress(task: Long, percent: Int)
+    fun onComplete(task: Long, state: Int, result: String)
+}
 
 object Native {
     private var isLibraryLoaded = false
@@ -25,16 +36,160 @@ object Native {
     
     external fun calc(a: Double, op: Char, b: Double): Double
     external fun parseExpression(expression: String): String
+
+    // Native calculator sessions: Ans, M and A-F/X/Y live in C++ between calls
+    external fun createSession(): Long
+    external fun destroySession(session: Long)
+    external fun evaluateInSession(session: Long, expression: String): String
+    external fun setExactMode(session: Long, enabled: Boolean)
+    // SETUP display format (display_format.h): session results come back as
+    // the display shows them, computed to DISPLAY_INTERNAL_DIGITS only
+    external fun setDisplayFormat(session: Long, mode: Int, digits: Int)
+    // SETUP Deg/Rad/Gra for the session's trigonometric functions (ANGLE_*)
+    external fun setAngleUnit(session: Long, unit: Int)
+    // Per-evaluation limits (governor.h); 0 leaves one unlimited. Going over
+    // gives "Error: ... budget exceeded" and EVALUATION_OVER_BUDGET
+    external fun setResourceBudget(session: Long, digits: Long, bytes: Long, milliseconds: Long)
+    external fun storeVariable(session: Long, name: String)
+    external fun recallVariable(session: Long, name: String): String
+    external fun memoryAdd(session: Long, subtract: Boolean)
+    external fun clearSession(session: Long)
+
+    // S⇔D: Ans as displayed, as a recurring decimal (period overlined) or as
+    // a decimal (ANSWER_*); "" when Ans has no such form
+    external fun displayAnswer(session: Long, form: Int): String
+
+    // FACT: "Result: 2^3*3*5" for a positive integer Ans; Ans is unchanged
+    external fun factorAnswer(session: Long): String
+
+    // TABLE: f(X) for count rows from start in steps of step, NaN where
+    // undefined; the session's slots are unchanged. Throws
+    // IllegalArgumentException for a malformed expression or too many rows
+    external fun tabulate(session: Long, expression: String, start: Double, step: Double, count: Int): DoubleArray
+
+    // Session history, oldest first: expressions as typed ("Ans→A" for STO)
+    // and results in the current display format. editHistory replaces an
+    // earlier calculation and recalculates only what depends on it, returning
+    // the indices whose result changed
+    external fun historySize(session: Long): Int
+    external fun historyExpression(session: Long, index: Int): String
+    external fun historyResult(session: Long, index: Int): String
+    external fun editHistory(session: Long, index: Int, expression: String): IntArray
+
+    // Asynchronous evaluation on the native worker pool. Submitting cancels the
+    // session's older tasks; every returned task must be released once
+    external fun submitEvaluation(session: Long, expression: String, listener: EvaluationListener?): Long
+    external fun cancelEvaluation(task: Long)
+    external fun evaluationState(task: Long): Int
+    external fun evaluationProgress(task: Long): Int
+    external fun awaitEvaluation(task: Long, timeoutMs: Long): String?
+    external fun releaseEvaluation(task: Long)
+
+    // Anytime evaluation: a fast low-precision answer first, refined to more
+    // significant digits on request without starting over
+    external fun submitProgressiveEvaluation(session: Long, expression: String, digits: Int,
+                                             listener: EvaluationListener?): Long
+    external fun submitRefinement(session: Long, digits: Int, listener: EvaluationListener?): Long
+
+    // Process-wide cache of divisions, roots, powers and transcendentals shared
+    // by all sessions: [hits, misses, evictions, entries, bytes]
+    external fun cacheStatistics(): LongArray
+    external fun clearCache()
+
+    // Evaluations so far that split independent subtrees across cores
+    external fun parallelEvaluations(): Long
+
+    // Session values, recent programs and computed constants persisted across
+    // launches. Loading maps the file and reads values only as they are used
+    external fun saveSnapshot(session: Long, path: String): Boolean
+    external fun loadSnapshot(session: Long, path: String): Boolean
+
+    // Appends every evaluation to a trace for tools/replay; see trace.h
+    external fun startTrace(path: String): Boolean
+    external fun stopTrace()
+
+    // DISPLAY_INTERNAL_DIGITS and DEFAULT_PRECISION in display_format.h / calc.h
+    const val DISPLAY_INTERNAL_DIGITS = 15
+    const val DEFAULT_DIGITS = 30
+    const val MAX_DIGITS = 1000
+
+    // S⇔D forms, as AnswerForm in session.h
+    const val ANSWER_STANDARD = 0
+    const val ANSWER_RECURRING = 1
+    const val ANSWER_DECIMAL = 2
+
+    // Display modes, as in display_format.h
+    const val DISPLAY_ALL = 0
+    const val DISPLAY_NORM1 = 1
+    const val DISPLAY_NORM2 = 2
+    const val DISPLAY_FIX = 3
+    const val DISPLAY_SCI = 4
+    const val DISPLAY_ENG = 5
+
+    // Angle units, as in calc.h
+    const val ANGLE_DEGREES = 0
+    const val ANGLE_RADIANS = 1
+    const val ANGLE_GRADIANS = 2
+
+    // Task states, as in async_eval.h
+    const val EVALUATION_PENDING = 0
+    const val EVALUATION_RUNNING = 1
+    const val EVALUATION_DONE = 2
+    const val EVALUATION_FAILED = 3
+    const val EVALUATION_CANCELLED = 4
+    const val EVALUATION_OVER_BUDGET = 5
     
     fun isAvailable(): Boolean = isLibraryLoaded
 }
 
 class MainActivity : AppCompatActivity() {
+    companion object {
+        // MODE cycles through these: native mode, digits, name shown
+        private val DISPLAY_FORMATS = listOf(
+            Triple(Native.DISPLAY_NORM1, 0, "Norm1"),
+            Triple(Native.DISPLAY_NORM2, 0, "Norm2"),
+            Triple(Native.DISPLAY_FIX, 2, "Fix 2"),
+            Triple(Native.DISPLAY_SCI, 5, "Sci 5"),
+            Triple(Native.DISPLAY_ENG, 0, "Eng")
+        )
+
+        // Long-pressing MODE cycles through these: native unit, name shown
+        private val ANGLE_UNITS = listOf(
+            Pair(Native.ANGLE_RADIANS, "Rad"),
+            Pair(Native.ANGLE_DEGREES, "Deg"),
+            Pair(Native.ANGLE_GRADIANS, "Gra")
+        )
+    }
+
     private lateinit var display: TextView
     private lateinit var result: TextView
     private val expression = StringBuilder()
-    private var lastResult: String? = null
+    private var session = 0L
+    private var hasAnswer = false
     private var isNewCalculation = false
+    private var pendingTask = 0L
+    private var pendingIsRefinement = false
+    private var answerDigits = 0
+    private var displayFormat = 0          // Index into DISPLAY_FORMATS
+    private var angleUnit = 0              // Index into ANGLE_UNITS
+    private var showingAllDigits = false   // Long-pressed out of the display format
+    private var answerForm = Native.ANSWER_STANDARD  // Switched by S⇔D
+    private val mainHandler = Handler(Looper.getMainLooper())
+
+    // Native callbacks arrive on a worker thread; results are applied on the
+    // UI thread and only if no newer evaluation replaced the task meanwhile
+    private val evaluationListener = object : EvaluationListener {
+        override fun onProgress(task: Long, percent: Int) {
+            mainHandler.post {
+                // A refinement keeps showing the answer it is refining
+                if (task == pendingTask && !pendingIsRefinement) result.text = "Calculating… $percent%"
+            }
+        }
+
+        override fun onComplete(task: Long, state: Int, result: String) {
+            mainHandler.post { showEvaluationResult(task, state, result) }
+        }
+    }
 
     override fun onCreate(savedInstanceState: Bundle?) {
         try {
@@ -44,8 +199,30 @@ class MainActivity : AppCompatActivity() {
             setContentView(R.layout.activity_main)
             Log.d("Calculator", "Layout loaded successfully")
 
+            if (Native.isAvailable()) {
+                session = Native.createSession()
+                // Like the fx-991ES MathIO default: exact fractions where possible
+                Native.setExactMode(session, true)
+                applyDisplayFormat()
+                Native.loadSnapshot(session, snapshotPath())
+                // Capture is opt-in: it runs only if the trace file was created
+                // beforehand (adb shell run-as <package> touch files/calc.trace)
+                if (File(tracePath()).exists()) Native.startTrace(tracePath())
+            }
+
             display = findViewById(R.id.txtDisplay)
             result = findViewById(R.id.txtResult)
+            // Long-press the result for every digit, then for more digits
+            result.setOnLongClickListener {
+                if (!showingAllDigits && session != 0L && hasAnswer && pendingTask == 0L) {
+                    showingAllDigits = true
+                    Native.setDisplayFormat(session, Native.DISPLAY_ALL, 0)
+                    requestMoreDigits(Native.DEFAULT_DIGITS)
+                } else {
+                    requestMoreDigits(minOf(answerDigits * 3, Native.MAX_DIGITS))
+                }
+                true
+            }
             Log.d("Calculator", "Display elements found")
 
             clearAll()
@@ -71,6 +248,37 @@ class MainActivity : AppCompatActivity() {
         }
     }
 
+    override fun onStop() {
+        // A running evaluation holds the session; onDestroy saves after it
+        if (session != 0L && pendingTask == 0L) {
+            Native.saveSnapshot(session, snapshotPath())
+        }
+        super.onStop()
+    }
+
+    override fun onDestroy() {
+        cancelPendingEvaluation()
+        if (session != 0L) {
+            Native.saveSnapshot(session, snapshotPath())
+            Native.destroySession(session)
+            session = 0L
+            Native.stopTrace()
+        }
+        super.onDestroy()
+    }
+
+    override fun onTrimMemory(level: Int) {
+        super.onTrimMemory(level)
+        // Cached results are only a speed-up; give the memory back when asked
+        if (level >= ComponentCallbacks2.TRIM_MEMORY_RUNNING_LOW && Native.isAvailable()) {
+            Native.clearCache()
+        }
+    }
+
+    private fun snapshotPath() = "${filesDir.absolutePath}/calc.snapshot"
+
+    private fun tracePath() = "${filesDir.absolutePath}/calc.trace"
+
     private fun setupButtons() {
         // Setup digit buttons (0-9)
         val digitButtons = listOf(
@@ -129,8 +337,8 @@ class MainActivity : AppCompatActivity() {
         }
         findViewById<View>(R.id.btnSquare)?.setOnClickListener { 
             // If expression is empty or just calculated, use last result
-            if (expression.isEmpty() && lastResult != null) {
-                expression.append(lastResult)
+            if (expression.isEmpty() && hasAnswer) {
+                expression.append("Ans")
             }
             appendToExpression("^2") 
         }
@@ -154,14 +362,20 @@ class MainActivity : AppCompatActivity() {
         }
         findViewById<View>(R.id.btnSquareNew)?.setOnClickListener { 
             // If expression is empty or just calculated, use last result
-            if (expression.isEmpty() && lastResult != null) {
-                expression.append(lastResult)
+            if (expression.isEmpty() && hasAnswer) {
+                expression.append("Ans")
             }
             appendToExpression("^2") 
         }
         findViewById<View>(R.id.btnAbs)?.setOnClickListener { 
             appendToExpression("abs(") 
         }
+        findViewById<View>(R.id.btnNpr)?.setOnClickListener { 
+            appendToExpression("nPr") 
+        }
+        findViewById<View>(R.id.btnNcr)?.setOnClickListener { 
+            appendToExpression("nCr") 
+        }
 
         // Setup special buttons
         findViewById<View>(R.id.btnAbsNew)?.setOnClickListener { 
@@ -175,8 +389,33 @@ class MainActivity : AppCompatActivity() {
 
         // Setup answer button (use last result)
         findViewById<View>(R.id.btnAns)?.setOnClickListener { 
-            if (lastResult != null) {
-                appendToExpression(lastResult!!)
+            appendToExpression("Ans")
+        }
+
+        // MODE steps through the display formats
+        findViewById<View>(R.id.btnMode)?.setOnClickListener {
+            displayFormat = (displayFormat + 1) % DISPLAY_FORMATS.size
+            if (pendingTask == 0L) applyDisplayFormat()
+            Toast.makeText(this, "Display: ${DISPLAY_FORMATS[displayFormat].third}", Toast.LENGTH_SHORT).show()
+        }
+        // Long-press for the angle unit; evaluations already made keep theirs
+        findViewById<View>(R.id.btnMode)?.setOnLongClickListener {
+            angleUnit = (angleUnit + 1) % ANGLE_UNITS.size
+            if (session != 0L) Native.setAngleUnit(session, ANGLE_UNITS[angleUnit].first)
+            Toast.makeText(this, "Angle: ${ANGLE_UNITS[angleUnit].second}", Toast.LENGTH_SHORT).show()
+            true
+        }
+
+        // S⇔D steps Ans through the forms it has: fraction, recurring decimal, decimal
+        findViewById<View>(R.id.btnStoD)?.setOnClickListener {
+            if (session == 0L || !hasAnswer || pendingTask != 0L) return@setOnClickListener
+            for (step in 1..3) {
+                answerForm = (answerForm + 1) % 3
+                val text = Native.displayAnswer(session, answerForm)
+                if (text.isNotEmpty()) {
+                    result.text = text
+                    break
+                }
             }
         }
 
@@ -191,7 +430,7 @@ class MainActivity : AppCompatActivity() {
 
     private fun setupStaticButtons() {
         val staticButtons = listOf(
-            R.id.btnShift, R.id.btnAlpha, R.id.btnMode, R.id.btnOn,
+            R.id.btnShift, R.id.btnAlpha, R.id.btnOn,
             R.id.btnCalc
         )
         
@@ -217,6 +456,7 @@ class MainActivity : AppCompatActivity() {
 
     // HELPER FUNCTIONS - These work with just the display elements
     fun appendToExpression(text: String) {
+        cancelPendingEvaluation()
         // If we just calculated and user starts typing a new number, clear the expression
         if (isNewCalculation && text.matches(Regex("[0-9.]"))) {
             expression.clear()
@@ -224,10 +464,10 @@ class MainActivity : AppCompatActivity() {
             isNewCalculation = false
         }
         // If user starts with an operator after a calculation, use the last result
-        else if (isNewCalculation && text.trim().matches(Regex("[+\\-*/^]"))) {
+        else if (isNewCalculation && text.trim().matches(Regex("[+\\-*/^]|nPr|nCr"))) {
             expression.clear()
-            if (lastResult != null) {
-                expression.append(lastResult)
+            if (hasAnswer) {
+                expression.append("Ans")
             }
             result.text = ""
             isNewCalculation = false
@@ -253,21 +493,17 @@ class MainActivity : AppCompatActivity() {
                 return
             }
             
-            // Send the expression to C++ parsing and evaluation system
-            val parseResult = Native.parseExpression(expressionText)
-            
-            Log.d("Calculator", "C++ returned: $parseResult")
-            
-            // Keep expression visible in display, show result below
+            // Evaluate on the native worker pool so long inputs never block the
+            // UI thread; Ans is kept natively in the session
+            cancelPendingEvaluation()
             display.text = expressionText  // Keep original expression visible
-            result.text = parseResult
-            
-            // Store result for potential further calculations
-            val resultValue = extractResultValue(parseResult)
-            if (resultValue != null) {
-                lastResult = resultValue
-                isNewCalculation = true  // Flag that we just completed a calculation
-            }
+            result.text = "Calculating…"
+            applyDisplayFormat()
+            // The display rounds to 10 digits; nothing beyond the 15 it is
+            // rounded from is computed
+            answerDigits = Native.DISPLAY_INTERNAL_DIGITS
+            pendingIsRefinement = false
+            pendingTask = Native.submitProgressiveEvaluation(session, expressionText, answerDigits, evaluationListener)
             
         } catch (e: Exception) {
             val errorMsg = "Error: ${e.message}"
@@ -276,18 +512,51 @@ class MainActivity : AppCompatActivity() {
         }
     }
 
-    private fun extractResultValue(fullResult: String): String? {
-        // Extract the actual result from "Result: 42" format
-        return if (fullResult.startsWith("Result: ")) {
-            fullResult.substring(8).trim()
-        } else if (fullResult.startsWith("Error: ")) {
-            null // Don't chain on errors
-        } else {
-            fullResult.trim() // Fallback
+    private fun showEvaluationResult(task: Long, state: Int, text: String) {
+        Native.releaseEvaluation(task)
+        if (task != pendingTask) return  // Preempted by a newer keystroke
+        pendingTask = 0L
+        if (state == Native.EVALUATION_CANCELLED) return
+
+        Log.d("Calculator", "C++ returned: $text")
+        result.text = text
+        
+        // The session already stored the result in Ans for further calculations
+        if (text.startsWith("Result: ")) {
+            hasAnswer = true
+            answerForm = Native.ANSWER_STANDARD
+            isNewCalculation = true  // Flag that we just completed a calculation
+        }
+    }
+
+    // Also leaves the all-digits view of a long-pressed answer
+    private fun applyDisplayFormat() {
+        if (session == 0L) return
+        val (mode, digits, _) = DISPLAY_FORMATS[displayFormat]
+        Native.setDisplayFormat(session, mode, digits)
+        showingAllDigits = false
+    }
+
+    // Refines Ans in place; earlier digits are reused, not recomputed
+    private fun requestMoreDigits(digits: Int) {
+        if (session == 0L || !hasAnswer || pendingTask != 0L || digits <= answerDigits) return
+        answerDigits = digits
+        pendingIsRefinement = true
+        pendingTask = Native.submitRefinement(session, digits, evaluationListener)
+    }
+
+    // A new keystroke makes a running evaluation stale
+    private fun cancelPendingEvaluation() {
+        if (pendingTask != 0L) {
+            Native.cancelEvaluation(pendingTask)
+            pendingTask = 0L
+            // A cancelled refinement leaves its answer valid at the old precision
+            if (!pendingIsRefinement) result.text = ""
         }
     }
 
     fun deleteLast() {
+        cancelPendingEvaluation()
         if (expression.isNotEmpty()) {
             expression.deleteCharAt(expression.length - 1)
             updateDisplay()
@@ -295,10 +564,11 @@ class MainActivity : AppCompatActivity() {
     }
 
     fun clearAll() {
+        cancelPendingEvaluation()
         expression.clear()
         display.text = "0"
         result.text = ""
-        lastResult = null
+        hasAnswer = false
         isNewCalculation = false
     }
 
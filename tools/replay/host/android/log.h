@@ -0,0 +1,24 @@
+#pragma once
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+
+// Host stand-in for the NDK logging call the engine uses. Silent unless
+// CALC_HOST_LOG is set in the environment, so replay timings are not spent
+// formatting debug output
+#define ANDROID_LOG_DEBUG 3
+#define ANDROID_LOG_INFO 4
+#define ANDROID_LOG_WARN 5
+#define ANDROID_LOG_ERROR 6
+
+static inline int __android_log_print(int priority, const char* tag, const char* format, ...) {
+    static const bool enabled = std::getenv("CALC_HOST_LOG") != nullptr;
+    if (!enabled) return 0;
+    std::fprintf(stderr, "%c/%s: ", priority >= ANDROID_LOG_ERROR ? 'E' : 'D', tag);
+    va_list arguments;
+    va_start(arguments, format);
+    int written = std::vfprintf(stderr, format, arguments);
+    va_end(arguments);
+    std::fputc('\n', stderr);
+    return written;
+}
@@ -0,0 +1,207 @@
+// calc-replay: replays a trace captured by the app (see trace.h) against this
+// build of the engine, checks every result against the recorded digest and
+// compares the time each evaluation took.
+//
+//   calc-replay [--repeat N] [--threshold PCT] [--record out.trace] trace
+//
+// Recorded and replayed times usually come from different machines, so each
+// record's time ratio is also shown normalized by the median ratio of the
+// whole trace: a record at +40% normalized got 40% slower relative to the
+// rest of the workload. --repeat runs the trace N times from a cold start
+// (fresh sessions, empty memo cache) and keeps each record's fastest run.
+// --threshold fails the run if any record is that much slower normalized.
+// --record writes the replay as a new trace, a baseline for another build.
+//
+// Exit status: 0 all results match, 1 a result differs or a record is over
+// the threshold, 2 usage error or unreadable trace
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+#include "calc.h"
+#include "memo_cache.h"
+#include "parsing.h"
+#include "session.h"
+#include "trace.h"
+
+using namespace std;
+
+// Records faster than this are too noisy to rank as regressions
+static const double MIN_RANKED_MS = 0.05;
+static const size_t WORST_SHOWN = 10;
+
+static const char* entryName(TraceEntry entry) {
+    switch (entry) {
+        case TRACE_EXPRESSION: return "expr";
+        case TRACE_SESSION: return "session";
+        case TRACE_PROGRESSIVE: return "progressive";
+        case TRACE_REFINE: return "refine";
+        case TRACE_FACTOR: return "factor";
+    }
+    return "?";
+}
+
+struct Replayed {
+    bool failed;
+    uint64_t digest;
+    double milliseconds;
+};
+
+// One evaluation through the entry point it was recorded from, on the
+// session with the same number
+static Replayed replay(const TraceRecord& record, map<uint32_t, unique_ptr<CalcSession>>& sessions) {
+    PrecisionScope precision(record.precision);
+    AngleUnitScope angles(record.angleUnit);
+    CalcSession* session = nullptr;
+    if (record.entry != TRACE_EXPRESSION) {
+        auto& slot = sessions[record.session];
+        if (!slot) slot.reset(new CalcSession());
+        session = slot.get();
+        session->setExactMode(record.exactMode);
+        session->setDisplayFormat(record.display);
+        session->setAngleUnit(record.angleUnit);
+        for (const TraceRecord::Input& input : record.inputs) {
+            if (input.hasExact) {
+                session->set(input.slot, input.value, input.exact);
+            } else {
+                session->set(input.slot, input.value);
+            }
+        }
+    }
+
+    Replayed result{false, 0, 0};
+    string output;
+    auto start = chrono::steady_clock::now();
+    try {
+        switch (record.entry) {
+            case TRACE_EXPRESSION: output = parseExpression(record.expression); break;
+            case TRACE_SESSION: output = session->evaluateForDisplay(record.expression); break;
+            case TRACE_PROGRESSIVE: output = session->evaluateProgressive(record.expression, record.digits); break;
+            case TRACE_REFINE: output = session->refineAnswer(record.digits); break;
+            case TRACE_FACTOR: output = session->factorAnswer(); break;
+        }
+    } catch (const exception&) {
+        result.failed = true;
+    }
+    result.milliseconds = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+    if (!result.failed) result.digest = traceDigest(output);
+    return result;
+}
+
+static double median(vector<double> values) {
+    if (values.empty()) return 1;
+    size_t middle = values.size() / 2;
+    nth_element(values.begin(), values.begin() + middle, values.end());
+    return values[middle];
+}
+
+static string shorten(const string& text, size_t length) {
+    return text.size() <= length ? text : text.substr(0, length - 3) + "...";
+}
+
+static int usage() {
+    fprintf(stderr, "usage: calc-replay [--repeat N] [--threshold PCT] [--record out.trace] trace\n");
+    return 2;
+}
+
+int main(int argc, char** argv) {
+    int repeat = 1;
+    double threshold = -1;
+    string recordPath, tracePath;
+    for (int i = 1; i < argc; i++) {
+        string option = argv[i];
+        if (option == "--repeat" && i + 1 < argc) {
+            repeat = max(1, atoi(argv[++i]));
+        } else if (option == "--threshold" && i + 1 < argc) {
+            threshold = atof(argv[++i]);
+        } else if (option == "--record" && i + 1 < argc) {
+            recordPath = argv[++i];
+        } else if (option.empty() || option[0] == '-' || !tracePath.empty()) {
+            return usage();
+        } else {
+            tracePath = option;
+        }
+    }
+    if (tracePath.empty()) return usage();
+
+    vector<TraceRecord> records;
+    if (!readTrace(tracePath, records)) {
+        fprintf(stderr, "%s: not a version %u trace\n", tracePath.c_str(), TRACE_VERSION);
+        return 2;
+    }
+    if (!recordPath.empty()) {
+        // Only the first pass is recorded, so the new trace matches the old
+        remove(recordPath.c_str());
+        if (!startTrace(recordPath)) {
+            fprintf(stderr, "%s: cannot write trace\n", recordPath.c_str());
+            return 2;
+        }
+    }
+
+    vector<Replayed> best(records.size());
+    for (int pass = 0; pass < repeat; pass++) {
+        map<uint32_t, unique_ptr<CalcSession>> sessions;
+        memoCache().clear();
+        for (size_t i = 0; i < records.size(); i++) {
+            Replayed result = replay(records[i], sessions);
+            if (pass == 0 || result.milliseconds < best[i].milliseconds) best[i] = result;
+        }
+        if (pass == 0 && !recordPath.empty()) stopTrace();
+    }
+
+    // Machine speed cancels out of the normalized ratios
+    vector<double> ratios;
+    for (size_t i = 0; i < records.size(); i++) {
+        double recorded = records[i].totalNanos() / 1e6;
+        if (recorded >= MIN_RANKED_MS) ratios.push_back(best[i].milliseconds / recorded);
+    }
+    double scale = median(ratios);
+
+    size_t mismatches = 0, overThreshold = 0;
+    vector<pair<double, size_t>> ranked;
+    printf("%6s  %-11s  %10s  %10s  %8s  %s\n", "#", "entry", "recorded", "replay", "norm", "expression");
+    for (size_t i = 0; i < records.size(); i++) {
+        const TraceRecord& record = records[i];
+        double recorded = record.totalNanos() / 1e6;
+        bool matches = best[i].failed == record.failed && (record.failed || best[i].digest == record.digest);
+        if (!matches) mismatches++;
+
+        string change = "-";
+        if (recorded >= MIN_RANKED_MS) {
+            double normalized = best[i].milliseconds / recorded / scale;
+            ranked.push_back(make_pair(normalized, i));
+            if (threshold >= 0 && (normalized - 1) * 100 > threshold) overThreshold++;
+            char text[32];
+            snprintf(text, sizeof(text), "%+.0f%%", (normalized - 1) * 100);
+            change = text;
+        }
+        string expression = record.expression.empty() ? "(Ans)" : shorten(record.expression, 48);
+        printf("%6zu  %-11s  %8.3fms  %8.3fms  %8s  %s%s\n", i + 1, entryName(record.entry), recorded,
+               best[i].milliseconds, change.c_str(), expression.c_str(), matches ? "" : "  MISMATCH");
+    }
+
+    double recordedTotal = 0, replayTotal = 0;
+    for (size_t i = 0; i < records.size(); i++) {
+        recordedTotal += records[i].totalNanos() / 1e6;
+        replayTotal += best[i].milliseconds;
+    }
+    printf("\n%zu records, %zu mismatched; recorded %.1fms, replayed %.1fms (best of %d), median ratio %.3f\n",
+           records.size(), mismatches, recordedTotal, replayTotal, repeat, scale);
+
+    sort(ranked.rbegin(), ranked.rend());
+    if (!ranked.empty() && ranked[0].first > 1) {
+        printf("Largest regressions, normalized:\n");
+        for (size_t k = 0; k < ranked.size() && k < WORST_SHOWN && ranked[k].first > 1; k++) {
+            const TraceRecord& record = records[ranked[k].second];
+            printf("  #%zu %+.0f%% %s\n", ranked[k].second + 1, (ranked[k].first - 1) * 100,
+                   shorten(record.expression.empty() ? "(Ans)" : record.expression, 60).c_str());
+        }
+    }
+    if (threshold >= 0) printf("%zu records over the %.0f%% threshold\n", overThreshold, threshold);
+    return mismatches > 0 || overThreshold > 0 ? 1 : 0;
+}